@@ -12,6 +12,7 @@
 #include <stdio.h>
 #include <sys/stat.h>
 #include <string>
+#include <unordered_map>
 
 #include "tier1/utlbuffer.h"
 #include "vstdlib/strtools.h"
@@ -340,6 +341,26 @@ static void SetQDirFromFilename( const char *pFilename )
     Q_AppendSlash( qdir, sizeof( qdir ) );
 }
 
+// The game dir found by walking up from each source dir.  A process that
+// compiles many models (studiomdl -server) only walks each dir once.
+static std::unordered_map< std::string, std::string > g_GameDirFromQDir;
+
+static void FindGameDirFromQDir( const char *pFilename, char *out, int outLen )
+{
+    auto it = g_GameDirFromQDir.find( qdir );
+    if ( it == g_GameDirFromQDir.end() )
+    {
+        char found[MAX_PATH];
+        if ( !FindGameDirFromFile( pFilename, found, sizeof( found ) ) )
+        {
+            // Default to the directory containing the source file if nothing else.
+            Q_strncpy( found, qdir, sizeof( found ) );
+        }
+        it = g_GameDirFromQDir.emplace( qdir, found ).first;
+    }
+    Q_strncpy( out, it->second.c_str(), outLen );
+}
+
 bool FileSystem_Init( const char *pFilename, int maxMemoryUsage, FSInitType_t initType, bool bOnlyUseFilename )
 {
     (void)maxMemoryUsage;
@@ -357,10 +378,9 @@ bool FileSystem_Init( const char *pFilename, int maxMemoryUsage, FSInitType_t in
     {
         Q_MakeAbsolutePath( gamedir, sizeof( gamedir ), vproj );
     }
-    else if ( !FindGameDirFromFile( pFilename, gamedir, sizeof( gamedir ) ) )
+    else
     {
-        // Default to the directory containing the source file if nothing else.
-        Q_strncpy( gamedir, qdir, sizeof( gamedir ) );
+        FindGameDirFromQDir( pFilename, gamedir, sizeof( gamedir ) );
     }
 
     Q_FixSlashes( gamedir );
@@ -67,11 +67,7 @@ void AddScriptToStack (char *filename, ScriptPathMode_t pathMode = SCRIPT_USE_AB
 
 	// printf ("entering %s\n", script->filename);
 #ifdef STUDIOMDL
-	extern bool g_bCreateMakefile;
-	if( g_bCreateMakefile )
-	{
-		CreateMakefile_AddDependency( script->filename );
-	}
+	CreateMakefile_AddDependency( script->filename );
 #endif
 
 	script->line = 1;
@@ -13,13 +13,18 @@
 
 #define	USED
 
-#include <windows.h>
 #include "cmdlib.h"
 #define NO_THREAD_NAMES
 #include "threads.h"
 #include "pacifier.h"
 
-#define	MAX_THREADS	16
+#include <mutex>
+#include <thread>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define	MAX_THREADS	MAX_TOOL_THREADS
 
 
 class CRunThreadsData
@@ -40,7 +45,12 @@ qboolean		pacifier;
 qboolean	threaded;
 bool g_bLowPriorityThreads = false;
 
-HANDLE g_ThreadHandles[MAX_THREADS];
+// Heap allocated so exit() never runs a joinable std::thread's destructor
+// (which calls std::terminate) while a pool is up.
+static std::thread *g_pThreadHandles[MAX_THREADS];
+
+static thread_local bool s_bWorkerThread = false;
+static std::mutex s_ErrorMutex;
 
 
 
@@ -62,7 +72,8 @@ int	GetThreadWork (void)
 		return -1;
 	}
 
-	UpdatePacifier( (float)dispatch / workcount );
+	if (pacifier)
+		UpdatePacifier( (float)dispatch / workcount );
 
 	r = dispatch;
 	dispatch++;
@@ -101,46 +112,37 @@ void RunThreadsOnIndividual (int workcnt, qboolean showpacifier, ThreadWorkerFn
 /*
 ===================================================================
 
-WIN32
+std::thread (all platforms)
 
 ===================================================================
 */
 
 int		numthreads = -1;
-CRITICAL_SECTION		crit;
+static std::mutex		crit;
 static int enter;
 
 
-class CCritInit
-{
-public:
-	CCritInit()
-	{
-		InitializeCriticalSection (&crit);
-	}
-} g_CritInit;
-
-
-
 void SetLowPriority()
 {
+#ifdef _WIN32
 	SetPriorityClass( GetCurrentProcess(), IDLE_PRIORITY_CLASS );
+#endif
 }
 
 
 void ThreadSetDefault (void)
 {
-	SYSTEM_INFO info;
-
 	if (numthreads == -1)	// not set manually
 	{
-		GetSystemInfo (&info);
-		numthreads = info.dwNumberOfProcessors;
-		if (numthreads < 1 || numthreads > 32)
-			numthreads = 1;
+		numthreads = (int)std::thread::hardware_concurrency();
+		if (numthreads < 1 || numthreads > MAX_TOOL_THREADS)
+			numthreads = ( numthreads > MAX_TOOL_THREADS ) ? MAX_TOOL_THREADS : 1;
 	}
 
-	Msg ("%i threads\n", numthreads);
+	if (verbose)
+	{
+		Msg ("%i threads\n", numthreads);
+	}
 }
 
 
@@ -148,7 +150,7 @@ void ThreadLock (void)
 {
 	if (!threaded)
 		return;
-	EnterCriticalSection (&crit);
+	crit.lock ();
 	if (enter)
 		Error ("Recursive ThreadLock\n");
 	enter = 1;
@@ -161,16 +163,14 @@ void ThreadUnlock (void)
 	if (!enter)
 		Error ("ThreadUnlock without lock\n");
 	enter = 0;
-	LeaveCriticalSection (&crit);
+	crit.unlock ();
 }
 
 
-// This runs in the thread and dispatches a RunThreadsFn call.
-DWORD WINAPI InternalRunThreadsFn( LPVOID pParameter )
+static void RunThreadsWorker( int iThread, void *pUserData )
 {
-	CRunThreadsData *pData = (CRunThreadsData*)pParameter;
-	pData->m_Fn( pData->m_iThread, pData->m_pUserData );
-	return 0;
+	s_bWorkerThread = true;
+	g_RunThreadsData[iThread].m_Fn( iThread, pUserData );
 }
 
 
@@ -188,30 +188,48 @@ void RunThreads_Start( RunThreadsFn fn, void *pUserData )
 		g_RunThreadsData[i].m_pUserData = pUserData;
 		g_RunThreadsData[i].m_Fn = fn;
 
-		DWORD dwDummy;
-		g_ThreadHandles[i] = CreateThread(
-		   NULL,	// LPSECURITY_ATTRIBUTES lpsa,
-		   0,		// DWORD cbStack,
-		   InternalRunThreadsFn,	// LPTHREAD_START_ROUTINE lpStartAddr,
-		   &g_RunThreadsData[i],	// LPVOID lpvThreadParm,
-		   0,			// DWORD fdwCreate,
-		   &dwDummy );
+		g_pThreadHandles[i] = new std::thread( RunThreadsWorker, i, pUserData );
 
+#ifdef _WIN32
 		if( g_bLowPriorityThreads )
-			SetThreadPriority( g_ThreadHandles[i], THREAD_PRIORITY_LOWEST );
+			SetThreadPriority( g_pThreadHandles[i]->native_handle(), THREAD_PRIORITY_LOWEST );
+#endif
 	}
 }
 
 
 void RunThreads_End()
 {
-	WaitForMultipleObjects( numthreads, g_ThreadHandles, TRUE, INFINITE );
 	for ( int i=0; i < numthreads; i++ )
-		CloseHandle( g_ThreadHandles[i] );
+	{
+		g_pThreadHandles[i]->join();
+		delete g_pThreadHandles[i];
+		g_pThreadHandles[i] = NULL;
+	}
 
 	threaded = false;
 }
-	
+
+
+void RunThreads_ErrorLock()
+{
+	// never released, the holder is on its way to RunThreads_Exit
+	if ( s_bWorkerThread )
+		s_ErrorMutex.lock();
+}
+
+
+void RunThreads_Exit( int exitCode )
+{
+	if ( s_bWorkerThread )
+	{
+		fflush( NULL );
+		_Exit( exitCode );
+	}
+
+	exit( exitCode );
+}
+
 
 /*
 =============
@@ -220,31 +238,45 @@ RunThreadsOn
 */
 void RunThreadsOn( int workcnt, qboolean showpacifier, RunThreadsFn fn, void *pUserData )
 {
-	int		start, end;
+	double	start, end;
+
+	if (numthreads == -1)
+		ThreadSetDefault ();
 
 	start = Plat_FloatTime();
 	dispatch = 0;
 	workcount = workcnt;
-	StartPacifier("");
 	pacifier = showpacifier;
+	if (pacifier)
+		StartPacifier("");
 
 #ifdef _PROFILE
 	threaded = false;
-	(*func)( 0 );
+	fn( 0, pUserData );
 	return;
 #endif
 
-	
-	RunThreads_Start( fn, pUserData );
-	RunThreads_End();
+	// don't spin up more workers than there is work for
+	int nSaveThreads = numthreads;
+	if ( workcnt > 0 && workcnt < numthreads )
+		numthreads = workcnt;
 
+	if ( numthreads <= 1 )
+	{
+		fn( 0, pUserData );
+	}
+	else
+	{
+		RunThreads_Start( fn, pUserData );
+		RunThreads_End();
+	}
+
+	numthreads = nSaveThreads;
 
 	end = Plat_FloatTime();
 	if (pacifier)
 	{
 		EndPacifier(false);
-		printf (" (%i)\n", end-start);
+		printf (" (%i)\n", (int)(end-start));
 	}
 }
-
-
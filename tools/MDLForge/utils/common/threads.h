@@ -18,8 +18,8 @@
 
 // Arrays that are indexed by thread should always be MAX_TOOL_THREADS+1
 // large so THREADINDEX_MAIN can be used from the main thread.
-#define MAX_TOOL_THREADS	4
-#define THREADINDEX_MAIN	4
+#define MAX_TOOL_THREADS	32
+#define THREADINDEX_MAIN	32
 
 
 extern	int		numthreads;
@@ -44,6 +44,12 @@ void RunThreadsOn ( int workcnt, qboolean showpacifier, RunThreadsFn fn, void *p
 void RunThreads_Start( RunThreadsFn fn, void *pUserData );
 void RunThreads_End();
 
+// Error handlers call these instead of exit(). On a worker thread only the first
+// error is reported, and the process leaves with _Exit() because exit() would run
+// the static destructors while the other workers are still using them.
+void RunThreads_ErrorLock();
+void RunThreads_Exit( int exitCode );
+
 void ThreadLock (void);
 void ThreadUnlock (void);
 
@@ -19,10 +19,11 @@ static inline unsigned short AsUShort( unsigned int nValue )
 
 ////////////////////////////////////////////////////////////////////////////////////////
 //private data
-static unsigned int cacheSize    = CACHESIZE_GEFORCE1_2;
-static bool bStitchStrips        = true;
-static unsigned int minStripSize = 0;
-static bool bListsOnly           = false;
+// per-thread so callers stripifying on several threads can each use their own settings
+static thread_local unsigned int cacheSize    = CACHESIZE_GEFORCE1_2;
+static thread_local bool bStitchStrips        = true;
+static thread_local unsigned int minStripSize = 0;
+static thread_local bool bListsOnly           = false;
 
 ////////////////////////////////////////////////////////////////////////////////////////
 // SetListsOnly()
@@ -0,0 +1,117 @@
+//=======================================================================
+// Case-insensitive hashed bone name lookups
+//=======================================================================
+
+#ifndef BONENAMES_H
+#define BONENAMES_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include <ctype.h>
+#include <string.h>
+#include <mutex>
+#include <unordered_map>
+#include "tier0/platform.h"
+
+// Hashes the names of a list of bones so a name finds its bone in O(1).
+// The index catches up by itself when bones are appended to the list, and
+// every hit is checked against the list's current name, so a stale entry
+// never returns the wrong bone.  Code that moves, removes or renames bones
+// in place has to call Invalidate() so the next lookup re-indexes the list.
+// Like the linear searches it replaces, the first bone with a name wins.
+class CBoneNameIndex
+{
+public:
+	// bDotSuffixes indexes the part of each name after every '.', for
+	// finding XSI style "model.bone" names by their bone name
+	CBoneNameIndex( bool bDotSuffixes = false ) : m_nIndexed( 0 ), m_bDotSuffixes( bDotSuffixes ) {}
+
+	// Finds pName among bones [0,nCount), GetName( i ) returning bone i's name
+	template< class NameFn >
+	int Find( const char *pName, int nCount, NameFn GetName )
+	{
+		std::lock_guard<std::mutex> lock( m_Mutex );
+
+		if ( nCount < m_nIndexed )
+		{
+			m_Names.clear();
+			m_nIndexed = 0;
+		}
+
+		for ( ; m_nIndexed < nCount; m_nIndexed++ )
+		{
+			const char *pBoneName = GetName( m_nIndexed );
+			if ( !m_bDotSuffixes )
+			{
+				AddName( pBoneName, m_nIndexed, GetName );
+				continue;
+			}
+
+			for ( const char *pDot = strchr( pBoneName, '.' ); pDot; pDot = strchr( pDot + 1, '.' ) )
+			{
+				AddName( pDot + 1, m_nIndexed, GetName );
+			}
+		}
+
+		return Lookup( pName, GetName );
+	}
+
+	void Invalidate()
+	{
+		std::lock_guard<std::mutex> lock( m_Mutex );
+		m_Names.clear();
+		m_nIndexed = 0;
+	}
+
+private:
+	static unsigned int HashName( const char *pName )
+	{
+		// FNV-1a over the lower case name
+		unsigned int hash = 2166136261u;
+		for ( ; *pName; pName++ )
+		{
+			hash = ( hash ^ (unsigned char)tolower( (unsigned char)*pName ) ) * 16777619u;
+		}
+		return hash;
+	}
+
+	bool Matches( const char *pName, const char *pBoneName ) const
+	{
+		if ( !m_bDotSuffixes )
+			return !stricmp( pName, pBoneName );
+
+		// same test as IsGlobalBoneXSI()
+		int len = strlen( pName );
+		int len2 = strlen( pBoneName );
+		return len2 > len && pBoneName[len2-len-1] == '.' && !stricmp( &pBoneName[len2-len], pName );
+	}
+
+	template< class NameFn >
+	int Lookup( const char *pName, NameFn GetName ) const
+	{
+		auto range = m_Names.equal_range( HashName( pName ) );
+		for ( auto it = range.first; it != range.second; ++it )
+		{
+			if ( Matches( pName, GetName( it->second ) ) )
+				return it->second;
+		}
+		return -1;
+	}
+
+	template< class NameFn >
+	void AddName( const char *pName, int index, NameFn GetName )
+	{
+		if ( Lookup( pName, GetName ) == -1 )
+		{
+			m_Names.emplace( HashName( pName ), index );
+		}
+	}
+
+	std::unordered_multimap<unsigned int, int> m_Names;
+	int m_nIndexed;
+	bool m_bDotSuffixes;
+	std::mutex m_Mutex;
+};
+
+#endif // BONENAMES_H
@@ -0,0 +1,1365 @@
+//=======================================================================
+// Built-in collision model builder for standalone studiomdl.  Builds the
+// convex hulls itself (quickhull) and writes them as the IVP compact
+// surfaces vphysics loads from .phy files, so collision models compile
+// without a game's vphysics module.
+//=======================================================================
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+#include "mathlib/mathlib.h"
+#include "vphysics_interface.h"
+#include "keyvalues.h"
+#include "tier1/strtools.h"
+#include "utlvector.h"
+#include "builtinphysics.h"
+
+// IVP works in meters with the Y and Z axes swapped (and Y flipped)
+static inline void ConvertPositionToIVP( const Vector &in, float *out )
+{
+	out[0] = in.x * METERS_PER_INCH;
+	out[1] = -in.z * METERS_PER_INCH;
+	out[2] = in.y * METERS_PER_INCH;
+}
+
+//-----------------------------------------------------------------------------
+// Quickhull
+//-----------------------------------------------------------------------------
+struct hullvec_t
+{
+	double x, y, z;
+
+	hullvec_t() {}
+	hullvec_t( double _x, double _y, double _z ) : x( _x ), y( _y ), z( _z ) {}
+	hullvec_t operator-( const hullvec_t &v ) const { return hullvec_t( x - v.x, y - v.y, z - v.z ); }
+	hullvec_t operator+( const hullvec_t &v ) const { return hullvec_t( x + v.x, y + v.y, z + v.z ); }
+	hullvec_t operator*( double s ) const { return hullvec_t( x * s, y * s, z * s ); }
+	double Dot( const hullvec_t &v ) const { return x * v.x + y * v.y + z * v.z; }
+	hullvec_t Cross( const hullvec_t &v ) const { return hullvec_t( y * v.z - z * v.y, z * v.x - x * v.z, x * v.y - y * v.x ); }
+	double Length( void ) const { return sqrt( Dot( *this ) ); }
+};
+
+struct hullface_t
+{
+	int					v[3];		// counter-clockwise seen from outside
+	hullvec_t			normal;
+	double				dist;
+	std::vector< int >	outside;	// points in front of this face not yet on the hull
+	bool				dead;
+};
+
+class CQuickHull
+{
+public:
+	// false if the points don't span a volume
+	bool Build( const hullvec_t *pPoints, int pointCount );
+
+	// three point indices per hull triangle
+	std::vector< int >		m_triangles;
+
+private:
+	static long long EdgeKey( int a, int b ) { return ( (long long)a << 32 ) | (unsigned int)b; }
+
+	double Distance( int face, int point ) const
+	{
+		return m_faces[face].normal.Dot( m_pPoints[point] ) - m_faces[face].dist;
+	}
+
+	int AddFace( int a, int b, int c );
+	void RemoveFace( int face );
+
+	const hullvec_t							*m_pPoints;
+	double									m_epsilon;
+	std::vector< hullface_t >				m_faces;
+	std::unordered_map< long long, int >	m_edges;	// directed edge -> face
+};
+
+int CQuickHull::AddFace( int a, int b, int c )
+{
+	hullface_t face;
+	face.v[0] = a;
+	face.v[1] = b;
+	face.v[2] = c;
+	face.normal = ( m_pPoints[b] - m_pPoints[a] ).Cross( m_pPoints[c] - m_pPoints[a] );
+	double len = face.normal.Length();
+	face.normal = len > 0 ? face.normal * ( 1.0 / len ) : hullvec_t( 0, 0, 0 );
+	face.dist = face.normal.Dot( m_pPoints[a] );
+	face.dead = false;
+
+	int index = (int)m_faces.size();
+	m_faces.push_back( face );
+	m_edges[EdgeKey( a, b )] = index;
+	m_edges[EdgeKey( b, c )] = index;
+	m_edges[EdgeKey( c, a )] = index;
+	return index;
+}
+
+void CQuickHull::RemoveFace( int face )
+{
+	hullface_t &f = m_faces[face];
+	for ( int k = 0; k < 3; k++ )
+	{
+		m_edges.erase( EdgeKey( f.v[k], f.v[( k + 1 ) % 3] ) );
+	}
+	f.dead = true;
+	f.outside.clear();
+}
+
+bool CQuickHull::Build( const hullvec_t *pPoints, int pointCount )
+{
+	m_pPoints = pPoints;
+	m_faces.clear();
+	m_edges.clear();
+	m_triangles.clear();
+
+	if ( pointCount < 4 )
+		return false;
+
+	// extreme points along each axis
+	int extremes[6] = { 0, 0, 0, 0, 0, 0 };
+	double maxAbs[3] = { 0, 0, 0 };
+	for ( int i = 0; i < pointCount; i++ )
+	{
+		const double *p = &pPoints[i].x;
+		for ( int axis = 0; axis < 3; axis++ )
+		{
+			if ( p[axis] < ( &pPoints[extremes[axis * 2]].x )[axis] )
+				extremes[axis * 2] = i;
+			if ( p[axis] > ( &pPoints[extremes[axis * 2 + 1]].x )[axis] )
+				extremes[axis * 2 + 1] = i;
+			maxAbs[axis] = MAX( maxAbs[axis], fabs( p[axis] ) );
+		}
+	}
+
+	// the input is float, so anything closer than float precision is on the plane
+	m_epsilon = 3 * FLT_EPSILON * ( maxAbs[0] + maxAbs[1] + maxAbs[2] );
+
+	// initial simplex: the farthest pair of extremes, the point farthest from
+	// their line and the point farthest from that plane
+	int i0 = 0, i1 = 0;
+	double best = -1;
+	for ( int a = 0; a < 6; a++ )
+	{
+		for ( int b = a + 1; b < 6; b++ )
+		{
+			hullvec_t delta = pPoints[extremes[b]] - pPoints[extremes[a]];
+			double d = delta.Dot( delta );
+			if ( d > best )
+			{
+				best = d;
+				i0 = extremes[a];
+				i1 = extremes[b];
+			}
+		}
+	}
+
+	hullvec_t dir = pPoints[i1] - pPoints[i0];
+	if ( dir.Length() <= m_epsilon )
+		return false;
+	dir = dir * ( 1.0 / dir.Length() );
+
+	int i2 = -1;
+	best = m_epsilon;
+	for ( int i = 0; i < pointCount; i++ )
+	{
+		double d = ( pPoints[i] - pPoints[i0] ).Cross( dir ).Length();
+		if ( d > best )
+		{
+			best = d;
+			i2 = i;
+		}
+	}
+	if ( i2 < 0 )
+		return false;
+
+	hullvec_t planeNormal = ( pPoints[i1] - pPoints[i0] ).Cross( pPoints[i2] - pPoints[i0] );
+	planeNormal = planeNormal * ( 1.0 / planeNormal.Length() );
+	int i3 = -1;
+	best = m_epsilon;
+	for ( int i = 0; i < pointCount; i++ )
+	{
+		double d = fabs( planeNormal.Dot( pPoints[i] - pPoints[i0] ) );
+		if ( d > best )
+		{
+			best = d;
+			i3 = i;
+		}
+	}
+	if ( i3 < 0 )
+		return false;
+
+	int simplex[4] = { i0, i1, i2, i3 };
+	for ( int k = 0; k < 4; k++ )
+	{
+		int a = simplex[k], b = simplex[( k + 1 ) % 4], c = simplex[( k + 2 ) % 4], opposite = simplex[( k + 3 ) % 4];
+		hullvec_t normal = ( pPoints[b] - pPoints[a] ).Cross( pPoints[c] - pPoints[a] );
+		if ( normal.Dot( pPoints[opposite] - pPoints[a] ) > 0 )
+		{
+			AddFace( a, c, b );
+		}
+		else
+		{
+			AddFace( a, b, c );
+		}
+	}
+
+	for ( int i = 0; i < pointCount; i++ )
+	{
+		if ( i == i0 || i == i1 || i == i2 || i == i3 )
+			continue;
+
+		for ( int f = 0; f < 4; f++ )
+		{
+			if ( Distance( f, i ) > m_epsilon )
+			{
+				m_faces[f].outside.push_back( i );
+				break;
+			}
+		}
+	}
+
+	std::vector< char > visible;
+	std::vector< int > stack;
+	std::vector< int > horizon;
+	std::vector< int > orphans;
+	std::vector< int > newFaces;
+	for ( size_t face = 0; face < m_faces.size(); face++ )
+	{
+		if ( m_faces[face].dead || m_faces[face].outside.empty() )
+			continue;
+
+		// the farthest point in front of this face goes on the hull next
+		int eye = m_faces[face].outside[0];
+		double eyeDist = Distance( face, eye );
+		for ( size_t i = 1; i < m_faces[face].outside.size(); i++ )
+		{
+			double d = Distance( face, m_faces[face].outside[i] );
+			if ( d > eyeDist )
+			{
+				eyeDist = d;
+				eye = m_faces[face].outside[i];
+			}
+		}
+
+		// flood out to every face it can see; the edges to the faces it can't
+		// see are the horizon
+		visible.assign( m_faces.size(), 0 );	// 0 unknown, 1 visible, 2 hidden
+		horizon.clear();
+		stack.clear();
+		stack.push_back( face );
+		visible[face] = 1;
+		while ( stack.size() )
+		{
+			int f = stack.back();
+			stack.pop_back();
+			for ( int k = 0; k < 3; k++ )
+			{
+				int a = m_faces[f].v[k], b = m_faces[f].v[( k + 1 ) % 3];
+				int neighbor = m_edges[EdgeKey( b, a )];
+				if ( visible[neighbor] == 0 )
+				{
+					visible[neighbor] = Distance( neighbor, eye ) > m_epsilon ? 1 : 2;
+					if ( visible[neighbor] == 1 )
+					{
+						stack.push_back( neighbor );
+						continue;
+					}
+				}
+				if ( visible[neighbor] == 2 )
+				{
+					horizon.push_back( a );
+					horizon.push_back( b );
+				}
+			}
+		}
+
+		orphans.clear();
+		for ( size_t f = 0; f < visible.size(); f++ )
+		{
+			if ( visible[f] != 1 )
+				continue;
+
+			for ( size_t i = 0; i < m_faces[f].outside.size(); i++ )
+			{
+				if ( m_faces[f].outside[i] != eye )
+				{
+					orphans.push_back( m_faces[f].outside[i] );
+				}
+			}
+			RemoveFace( f );
+		}
+
+		newFaces.clear();
+		for ( size_t i = 0; i < horizon.size(); i += 2 )
+		{
+			newFaces.push_back( AddFace( horizon[i], horizon[i + 1], eye ) );
+		}
+
+		for ( size_t i = 0; i < orphans.size(); i++ )
+		{
+			for ( size_t f = 0; f < newFaces.size(); f++ )
+			{
+				if ( Distance( newFaces[f], orphans[i] ) > m_epsilon )
+				{
+					m_faces[newFaces[f]].outside.push_back( orphans[i] );
+					break;
+				}
+			}
+		}
+	}
+
+	for ( size_t f = 0; f < m_faces.size(); f++ )
+	{
+		if ( m_faces[f].dead )
+			continue;
+
+		m_triangles.push_back( m_faces[f].v[0] );
+		m_triangles.push_back( m_faces[f].v[1] );
+		m_triangles.push_back( m_faces[f].v[2] );
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Hull reduction
+//-----------------------------------------------------------------------------
+static double HullVolume( const hullvec_t *pPoints, const std::vector< int > &triangles )
+{
+	if ( triangles.empty() )
+		return 0;
+
+	const hullvec_t &o = pPoints[triangles[0]];
+	double volume = 0;
+	for ( size_t i = 0; i < triangles.size(); i += 3 )
+	{
+		const hullvec_t &a = pPoints[triangles[i]];
+		const hullvec_t &b = pPoints[triangles[i + 1]];
+		const hullvec_t &c = pPoints[triangles[i + 2]];
+		volume += ( a - o ).Dot( ( b - o ).Cross( c - o ) ) / 6.0;
+	}
+	return volume;
+}
+
+// The volume the hull loses when point is removed: the hull of the point and
+// its ring of neighbors minus the hull of the ring alone
+static double RemovalCost( const hullvec_t *pPoints, int point, const std::vector< int > &ring )
+{
+	std::vector< hullvec_t > local;
+	local.reserve( ring.size() + 1 );
+	for ( size_t i = 0; i < ring.size(); i++ )
+	{
+		local.push_back( pPoints[ring[i]] );
+	}
+
+	CQuickHull hull;
+	double without = hull.Build( local.data(), (int)local.size() ) ? HullVolume( local.data(), hull.m_triangles ) : 0;
+	local.push_back( pPoints[point] );
+	double with = hull.Build( local.data(), (int)local.size() ) ? HullVolume( local.data(), hull.m_triangles ) : 0;
+	return with - without;
+}
+
+int ReduceHullVerts( Vector **pVerts, int vertCount, int maxVerts, int *pHullVertCount )
+{
+	std::vector< hullvec_t > points( vertCount );
+	for ( int i = 0; i < vertCount; i++ )
+	{
+		points[i] = hullvec_t( pVerts[i]->x, pVerts[i]->y, pVerts[i]->z );
+	}
+
+	// flat or degenerate input has no interior to drop
+	CQuickHull hull;
+	if ( !hull.Build( points.data(), vertCount ) )
+	{
+		if ( pHullVertCount )
+		{
+			*pHullVertCount = 0;
+		}
+		return MIN( vertCount, maxVerts );
+	}
+
+	std::vector< int > keep;			// hull points, indices into pVerts
+	std::vector< hullvec_t > subset;	// their positions
+	std::vector< int > triangles;		// hull of subset
+	std::vector< int > slot( vertCount, -1 );
+	for ( size_t i = 0; i < hull.m_triangles.size(); i++ )
+	{
+		int index = hull.m_triangles[i];
+		if ( slot[index] < 0 )
+		{
+			slot[index] = (int)keep.size();
+			keep.push_back( index );
+			subset.push_back( points[index] );
+		}
+		triangles.push_back( slot[index] );
+	}
+	if ( pHullVertCount )
+	{
+		*pHullVertCount = (int)keep.size();
+	}
+
+	// a point's cost only changes when its ring does, so both are kept by
+	// original index across passes
+	std::vector< std::vector< int > > lastRing( vertCount );
+	std::vector< double > lastCost( vertCount, 0 );
+	std::vector< std::vector< int > > rings;
+	std::vector< int > ring;
+	std::vector< std::pair< double, int > > costs;
+	std::vector< char > locked;
+	std::vector< char > removed;
+	while ( (int)keep.size() > maxVerts )
+	{
+		int count = (int)keep.size();
+		rings.assign( count, std::vector< int >() );
+		for ( size_t i = 0; i < triangles.size(); i += 3 )
+		{
+			for ( int k = 0; k < 3; k++ )
+			{
+				int a = triangles[i + k], b = triangles[i + ( k + 1 ) % 3];
+				rings[a].push_back( b );
+			}
+		}
+
+		costs.clear();
+		for ( int i = 0; i < count; i++ )
+		{
+			ring.clear();
+			for ( size_t k = 0; k < rings[i].size(); k++ )
+			{
+				ring.push_back( keep[rings[i][k]] );
+			}
+			std::sort( ring.begin(), ring.end() );
+			if ( ring != lastRing[keep[i]] )
+			{
+				lastRing[keep[i]] = ring;
+				lastCost[keep[i]] = RemovalCost( subset.data(), i, rings[i] );
+			}
+			costs.push_back( std::make_pair( lastCost[keep[i]], i ) );
+		}
+		std::sort( costs.begin(), costs.end() );
+
+		// remove the cheapest points a batch at a time; no two neighbors go in the
+		// same batch so each cost is still exact when its point is removed
+		int batch = MAX( 1, ( count - maxVerts ) / 4 );
+		locked.assign( count, 0 );
+		removed.assign( count, 0 );
+		for ( int i = 0; i < count && batch > 0; i++ )
+		{
+			int point = costs[i].second;
+			if ( locked[point] )
+				continue;
+
+			removed[point] = 1;
+			for ( size_t k = 0; k < rings[point].size(); k++ )
+			{
+				locked[rings[point][k]] = 1;
+			}
+			batch--;
+		}
+
+		std::vector< int > nextKeep;
+		std::vector< hullvec_t > nextSubset;
+		for ( int i = 0; i < count; i++ )
+		{
+			if ( !removed[i] )
+			{
+				nextKeep.push_back( keep[i] );
+				nextSubset.push_back( subset[i] );
+			}
+		}
+
+		// points that end up on a face of the smaller hull drop out as well
+		if ( !hull.Build( nextSubset.data(), (int)nextSubset.size() ) )
+		{
+			keep.swap( nextKeep );
+			break;
+		}
+
+		keep.clear();
+		subset.clear();
+		triangles.clear();
+		slot.assign( nextSubset.size(), -1 );
+		for ( size_t i = 0; i < hull.m_triangles.size(); i++ )
+		{
+			int index = hull.m_triangles[i];
+			if ( slot[index] < 0 )
+			{
+				slot[index] = (int)keep.size();
+				keep.push_back( nextKeep[index] );
+				subset.push_back( nextSubset[index] );
+			}
+			triangles.push_back( slot[index] );
+		}
+	}
+
+	// kept points first, in their original order
+	std::sort( keep.begin(), keep.end() );
+	std::vector< Vector * > reordered;
+	reordered.reserve( vertCount );
+	std::vector< char > used( vertCount, 0 );
+	for ( size_t i = 0; i < keep.size(); i++ )
+	{
+		reordered.push_back( pVerts[keep[i]] );
+		used[keep[i]] = 1;
+	}
+	for ( int i = 0; i < vertCount; i++ )
+	{
+		if ( !used[i] )
+		{
+			reordered.push_back( pVerts[i] );
+		}
+	}
+	memcpy( pVerts, reordered.data(), vertCount * sizeof( Vector * ) );
+	return MIN( (int)keep.size(), maxVerts );
+}
+
+
+//-----------------------------------------------------------------------------
+// Convex pieces and collision models
+//-----------------------------------------------------------------------------
+struct builtinconvex_t
+{
+	CUtlVector< Vector >	points;		// inches
+	CUtlVector< int >		triangles;	// three points per triangle, counter-clockwise seen from outside
+	unsigned int			gameData;
+};
+
+struct builtincollide_t
+{
+	CUtlVector< builtinconvex_t * >	convexes;
+	Vector		massCenter;			// inches
+	Vector		rotationInertia;	// IVP axes, m^2 (per kg of mass), about the mass center
+	Vector		orthoAreas;			// fraction of the bounding box each axis sees covered
+	float		volume;
+	float		surfaceArea;
+};
+
+static builtinconvex_t *ConvexFromPoints( const hullvec_t *pPoints, int pointCount )
+{
+	CQuickHull hull;
+	if ( !hull.Build( pPoints, pointCount ) )
+		return NULL;
+
+	builtinconvex_t *pConvex = new builtinconvex_t;
+	pConvex->gameData = 0;
+
+	// only keep the points that ended up on the hull
+	std::vector< int > remap( pointCount, -1 );
+	for ( size_t i = 0; i < hull.m_triangles.size(); i++ )
+	{
+		int index = hull.m_triangles[i];
+		if ( remap[index] < 0 )
+		{
+			remap[index] = pConvex->points.AddToTail( Vector( pPoints[index].x, pPoints[index].y, pPoints[index].z ) );
+		}
+		pConvex->triangles.AddToTail( remap[index] );
+	}
+	return pConvex;
+}
+
+static double ConvexVolumeAndCenter( const builtinconvex_t *pConvex, hullvec_t *pCenter )
+{
+	// sum of the tetrahedrons from the first point to each triangle
+	const Vector &origin = pConvex->points[0];
+	hullvec_t o( origin.x, origin.y, origin.z );
+	double volume = 0;
+	hullvec_t center( 0, 0, 0 );
+	for ( int i = 0; i < pConvex->triangles.Count(); i += 3 )
+	{
+		const Vector &a = pConvex->points[pConvex->triangles[i]];
+		const Vector &b = pConvex->points[pConvex->triangles[i + 1]];
+		const Vector &c = pConvex->points[pConvex->triangles[i + 2]];
+		hullvec_t pa( a.x, a.y, a.z ), pb( b.x, b.y, b.z ), pc( c.x, c.y, c.z );
+		double v = ( pa - o ).Dot( ( pb - o ).Cross( pc - o ) ) / 6.0;
+		volume += v;
+		center = center + ( o + pa + pb + pc ) * ( v * 0.25 );
+	}
+	if ( pCenter )
+	{
+		*pCenter = volume > 0 ? center * ( 1.0 / volume ) : o;
+	}
+	return volume;
+}
+
+static double ConvexArea( const builtinconvex_t *pConvex )
+{
+	double area = 0;
+	for ( int i = 0; i < pConvex->triangles.Count(); i += 3 )
+	{
+		const Vector &a = pConvex->points[pConvex->triangles[i]];
+		const Vector &b = pConvex->points[pConvex->triangles[i + 1]];
+		const Vector &c = pConvex->points[pConvex->triangles[i + 2]];
+		hullvec_t pa( a.x, a.y, a.z ), pb( b.x, b.y, b.z ), pc( c.x, c.y, c.z );
+		area += 0.5 * ( pb - pa ).Cross( pc - pa ).Length();
+	}
+	return area;
+}
+
+//-----------------------------------------------------------------------------
+// Second moments of the convex about center, for the inertia tensor
+//-----------------------------------------------------------------------------
+static void ConvexSecondMoments( const builtinconvex_t *pConvex, const hullvec_t &center, double moments[3][3] )
+{
+	const Vector &origin = pConvex->points[0];
+	hullvec_t o = hullvec_t( origin.x, origin.y, origin.z ) - center;
+	for ( int i = 0; i < pConvex->triangles.Count(); i += 3 )
+	{
+		hullvec_t p[4];
+		p[0] = o;
+		for ( int k = 0; k < 3; k++ )
+		{
+			const Vector &v = pConvex->points[pConvex->triangles[i + k]];
+			p[k + 1] = hullvec_t( v.x, v.y, v.z ) - center;
+		}
+		double volume = ( p[1] - p[0] ).Dot( ( p[2] - p[0] ).Cross( p[3] - p[0] ) ) / 6.0;
+		hullvec_t sum = p[0] + p[1] + p[2] + p[3];
+
+		// integral of x_i x_j over a tetrahedron
+		for ( int r = 0; r < 3; r++ )
+		{
+			for ( int c = 0; c < 3; c++ )
+			{
+				double s = ( &sum.x )[r] * ( &sum.x )[c];
+				for ( int k = 0; k < 4; k++ )
+				{
+					s += ( &p[k].x )[r] * ( &p[k].x )[c];
+				}
+				moments[r][c] += volume * s / 20.0;
+			}
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Does the line through point along axis pass through the convex?
+//-----------------------------------------------------------------------------
+static bool ConvexHitsAxisLine( const builtinconvex_t *pConvex, const Vector &point, int axis )
+{
+	double tMin = -FLT_MAX, tMax = FLT_MAX;
+	for ( int i = 0; i < pConvex->triangles.Count(); i += 3 )
+	{
+		const Vector &a = pConvex->points[pConvex->triangles[i]];
+		const Vector &b = pConvex->points[pConvex->triangles[i + 1]];
+		const Vector &c = pConvex->points[pConvex->triangles[i + 2]];
+		hullvec_t pa( a.x, a.y, a.z ), pb( b.x, b.y, b.z ), pc( c.x, c.y, c.z );
+		hullvec_t normal = ( pb - pa ).Cross( pc - pa );
+
+		// point + t * axis is inside this plane while denom * t <= dist
+		hullvec_t p( point.x, point.y, point.z );
+		double dist = normal.Dot( pa - p );
+		double denom = ( &normal.x )[axis];
+		if ( fabs( denom ) < 1e-12 )
+		{
+			if ( dist < 0 )
+				return false;
+			continue;
+		}
+
+		double t = dist / denom;
+		if ( denom > 0 )
+			tMax = MIN( tMax, t );
+		else
+			tMin = MAX( tMin, t );
+		if ( tMin > tMax )
+			return false;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Fraction of the bounding box's projection along each axis the model covers,
+// sampled on a grid no finer than epsilon
+//-----------------------------------------------------------------------------
+static Vector ComputeOrthographicAreas( const builtincollide_t *pCollide, float epsilon )
+{
+	Vector mins, maxs;
+	ClearBounds( mins, maxs );
+	for ( int i = 0; i < pCollide->convexes.Count(); i++ )
+	{
+		for ( int j = 0; j < pCollide->convexes[i]->points.Count(); j++ )
+		{
+			AddPointToBounds( pCollide->convexes[i]->points[j], mins, maxs );
+		}
+	}
+
+	const int MAX_SAMPLES = 64;
+	Vector areas( 1, 1, 1 );
+	for ( int axis = 0; axis < 3; axis++ )
+	{
+		int u = ( axis + 1 ) % 3, v = ( axis + 2 ) % 3;
+		int countU = clamp( (int)ceil( ( maxs[u] - mins[u] ) / MAX( epsilon, 1e-3f ) ), 1, MAX_SAMPLES );
+		int countV = clamp( (int)ceil( ( maxs[v] - mins[v] ) / MAX( epsilon, 1e-3f ) ), 1, MAX_SAMPLES );
+
+		int hits = 0;
+		for ( int i = 0; i < countU; i++ )
+		{
+			for ( int j = 0; j < countV; j++ )
+			{
+				Vector point = mins;
+				point[u] = mins[u] + ( maxs[u] - mins[u] ) * ( i + 0.5f ) / countU;
+				point[v] = mins[v] + ( maxs[v] - mins[v] ) * ( j + 0.5f ) / countV;
+				for ( int c = 0; c < pCollide->convexes.Count(); c++ )
+				{
+					if ( ConvexHitsAxisLine( pCollide->convexes[c], point, axis ) )
+					{
+						hits++;
+						break;
+					}
+				}
+			}
+		}
+		areas[axis] = (float)hits / (float)( countU * countV );
+	}
+	return areas;
+}
+
+
+//-----------------------------------------------------------------------------
+// IVP compact surface serialization
+//
+//	collideheader_t			"VPHY", version, model type
+//	compactsurfaceheader_t	surface size, drag axis areas, axis map size
+//	IVP_Compact_Surface		48 bytes, ends in "IVPS"
+//	IVP_Compact_Ledge[]		one per convex, each followed by its triangles
+//	IVP_Compact_Poly_Point[]	every ledge's points, shared array
+//	IVP_Compact_Ledgetree_Node[]	binary tree over the ledges, left child follows its parent
+//-----------------------------------------------------------------------------
+#define COLLIDE_HEADER_SIZE		28
+#define COMPACT_SURFACE_SIZE	48
+#define COMPACT_LEDGE_SIZE		16
+#define COMPACT_TRIANGLE_SIZE	16
+#define COMPACT_POINT_SIZE		16
+#define LEDGETREE_NODE_SIZE		28
+
+class CCompactSurfaceWriter
+{
+public:
+	CCompactSurfaceWriter( const builtincollide_t *pCollide );
+
+	int Size( void ) const { return COLLIDE_HEADER_SIZE + m_surfaceSize; }
+	void Write( char *pDest );
+
+private:
+	void PutInt( int offset, int value ) { memcpy( m_pDest + offset, &value, 4 ); }
+	void PutFloat( int offset, float value ) { memcpy( m_pDest + offset, &value, 4 ); }
+
+	void WriteLedge( int convex );
+	int WriteNode( int *pLedges, int ledgeCount, int offset );
+	void ComputeSphere( const int *pLedges, int ledgeCount, float *center, float *radius, unsigned char *boxSizes );
+
+	const builtincollide_t	*m_pCollide;
+	std::vector< int >		m_ledgeOffsets;	// from the start of the surface
+	std::vector< int >		m_firstPoint;
+	std::vector< float >	m_points;		// IVP space, xyz per point
+	int						m_pointsOffset;
+	int						m_treeOffset;
+	int						m_surfaceSize;
+	char					*m_pDest;		// start of the surface
+};
+
+CCompactSurfaceWriter::CCompactSurfaceWriter( const builtincollide_t *pCollide )
+{
+	m_pCollide = pCollide;
+	m_pDest = NULL;
+
+	int offset = COMPACT_SURFACE_SIZE;
+	int pointCount = 0;
+	for ( int i = 0; i < pCollide->convexes.Count(); i++ )
+	{
+		const builtinconvex_t *pConvex = pCollide->convexes[i];
+		m_ledgeOffsets.push_back( offset );
+		m_firstPoint.push_back( pointCount );
+		offset += COMPACT_LEDGE_SIZE + COMPACT_TRIANGLE_SIZE * ( pConvex->triangles.Count() / 3 );
+
+		for ( int j = 0; j < pConvex->points.Count(); j++ )
+		{
+			float p[3];
+			ConvertPositionToIVP( pConvex->points[j], p );
+			m_points.insert( m_points.end(), p, p + 3 );
+		}
+		pointCount += pConvex->points.Count();
+	}
+
+	m_pointsOffset = offset;
+	m_treeOffset = m_pointsOffset + pointCount * COMPACT_POINT_SIZE;
+	int nodeCount = pCollide->convexes.Count() * 2 - 1;
+	m_surfaceSize = ( m_treeOffset + nodeCount * LEDGETREE_NODE_SIZE + 15 ) & ~15;
+}
+
+void CCompactSurfaceWriter::Write( char *pDest )
+{
+	memset( pDest, 0, Size() );
+
+	// collideheader_t
+	memcpy( pDest, "VPHY", 4 );
+	short version = 0x100, modelType = 0;	// COLLIDE_POLY
+	memcpy( pDest + 4, &version, 2 );
+	memcpy( pDest + 6, &modelType, 2 );
+
+	// compactsurfaceheader_t
+	m_pDest = pDest + 8;
+	PutInt( 0, m_surfaceSize );
+	PutFloat( 4, m_pCollide->orthoAreas.x );
+	PutFloat( 8, m_pCollide->orthoAreas.y );
+	PutFloat( 12, m_pCollide->orthoAreas.z );
+	PutInt( 16, 0 );	// no trace tables
+
+	// IVP_Compact_Surface
+	m_pDest = pDest + COLLIDE_HEADER_SIZE;
+	float massCenter[3];
+	ConvertPositionToIVP( m_pCollide->massCenter, massCenter );
+	float radius = 0;
+	for ( size_t i = 0; i < m_points.size(); i += 3 )
+	{
+		float dx = m_points[i] - massCenter[0], dy = m_points[i + 1] - massCenter[1], dz = m_points[i + 2] - massCenter[2];
+		radius = MAX( radius, sqrtf( dx * dx + dy * dy + dz * dz ) );
+	}
+	for ( int k = 0; k < 3; k++ )
+	{
+		PutFloat( k * 4, massCenter[k] );
+		PutFloat( 12 + k * 4, m_pCollide->rotationInertia[k] );
+	}
+	PutFloat( 24, radius );
+	// no surface point is farther than upper_limit_radius from the mass center
+	const int maxFactorSurfaceDeviation = 251;
+	PutInt( 28, maxFactorSurfaceDeviation | ( m_surfaceSize << 8 ) );
+	PutInt( 32, m_treeOffset );
+	memcpy( m_pDest + 44, "IVPS", 4 );
+
+	for ( int i = 0; i < m_pCollide->convexes.Count(); i++ )
+	{
+		WriteLedge( i );
+	}
+
+	for ( size_t i = 0; i < m_points.size(); i += 3 )
+	{
+		int offset = m_pointsOffset + (int)i / 3 * COMPACT_POINT_SIZE;
+		PutFloat( offset, m_points[i] );
+		PutFloat( offset + 4, m_points[i + 1] );
+		PutFloat( offset + 8, m_points[i + 2] );
+	}
+
+	std::vector< int > ledges;
+	for ( int i = 0; i < m_pCollide->convexes.Count(); i++ )
+	{
+		ledges.push_back( i );
+	}
+	WriteNode( ledges.data(), (int)ledges.size(), m_treeOffset );
+}
+
+void CCompactSurfaceWriter::WriteLedge( int convex )
+{
+	const builtinconvex_t *pConvex = m_pCollide->convexes[convex];
+	int ledgeOffset = m_ledgeOffsets[convex];
+	int triangleCount = pConvex->triangles.Count() / 3;
+	const int *tris = pConvex->triangles.Base();
+
+	// IVP_Compact_Ledge
+	int sizeDiv16 = ( COMPACT_LEDGE_SIZE + triangleCount * COMPACT_TRIANGLE_SIZE + pConvex->points.Count() * COMPACT_POINT_SIZE ) / 16;
+	PutInt( ledgeOffset, m_pointsOffset - ledgeOffset );
+	PutInt( ledgeOffset + 4, pConvex->gameData );
+	PutInt( ledgeOffset + 8, ( 1 << 2 ) | ( sizeDiv16 << 8 ) );	// is_compact_flag
+	PutInt( ledgeOffset + 12, triangleCount );
+
+	// each edge's twin runs the other way in the neighboring triangle
+	std::unordered_map< long long, int > edges;
+	for ( int t = 0; t < triangleCount; t++ )
+	{
+		for ( int k = 0; k < 3; k++ )
+		{
+			long long key = ( (long long)tris[t * 3 + k] << 32 ) | (unsigned int)tris[t * 3 + ( k + 1 ) % 3];
+			edges[key] = t * 4 + 1 + k;	// edges are counted in 4 byte units, after the triangle's own word
+		}
+	}
+
+	for ( int t = 0; t < triangleCount; t++ )
+	{
+		const Vector &a = pConvex->points[tris[t * 3]];
+		const Vector &b = pConvex->points[tris[t * 3 + 1]];
+		const Vector &c = pConvex->points[tris[t * 3 + 2]];
+		Vector normal = CrossProduct( b - a, c - a );
+		VectorNormalize( normal );
+		Vector centroid = ( a + b + c ) * ( 1.0f / 3.0f );
+
+		// the triangle the inverted normal comes out through
+		int pierce = t;
+		float bestT = FLT_MAX;
+		bool bestInside = false;
+		for ( int s = 0; s < triangleCount; s++ )
+		{
+			if ( s == t )
+				continue;
+
+			const Vector &sa = pConvex->points[tris[s * 3]];
+			const Vector &sb = pConvex->points[tris[s * 3 + 1]];
+			const Vector &sc = pConvex->points[tris[s * 3 + 2]];
+			Vector sNormal = CrossProduct( sb - sa, sc - sa );
+			float denom = -DotProduct( sNormal, normal );
+			if ( denom <= 0 )
+				continue;
+
+			float hitT = DotProduct( sNormal, sa - centroid ) / denom;
+			Vector hit = centroid - normal * hitT;
+			bool inside = DotProduct( CrossProduct( sb - sa, hit - sa ), sNormal ) >= 0 &&
+				DotProduct( CrossProduct( sc - sb, hit - sb ), sNormal ) >= 0 &&
+				DotProduct( CrossProduct( sa - sc, hit - sc ), sNormal ) >= 0;
+			if ( ( inside && !bestInside ) || ( inside == bestInside && hitT < bestT ) )
+			{
+				pierce = s;
+				bestT = hitT;
+				bestInside = inside;
+			}
+		}
+
+		// IVP_Compact_Triangle
+		int triangleOffset = ledgeOffset + COMPACT_LEDGE_SIZE + t * COMPACT_TRIANGLE_SIZE;
+		PutInt( triangleOffset, t | ( pierce << 12 ) );
+		for ( int k = 0; k < 3; k++ )
+		{
+			int start = tris[t * 3 + k], end = tris[t * 3 + ( k + 1 ) % 3];
+			std::unordered_map< long long, int >::const_iterator twin = edges.find( ( (long long)end << 32 ) | (unsigned int)start );
+			int opposite = twin != edges.end() ? twin->second - ( t * 4 + 1 + k ) : 0;
+
+			// IVP_Compact_Edge
+			PutInt( triangleOffset + 4 + k * 4, ( m_firstPoint[convex] + start ) | ( ( opposite & 0x7fff ) << 16 ) );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Bounding sphere of the ledges' points, and the box around its center in
+// 1/250ths of the radius
+//-----------------------------------------------------------------------------
+void CCompactSurfaceWriter::ComputeSphere( const int *pLedges, int ledgeCount, float *center, float *radius, unsigned char *boxSizes )
+{
+	float mins[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, maxs[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for ( int i = 0; i < ledgeCount; i++ )
+	{
+		int first = m_firstPoint[pLedges[i]];
+		int count = m_pCollide->convexes[pLedges[i]]->points.Count();
+		for ( int j = first; j < first + count; j++ )
+		{
+			for ( int k = 0; k < 3; k++ )
+			{
+				mins[k] = MIN( mins[k], m_points[j * 3 + k] );
+				maxs[k] = MAX( maxs[k], m_points[j * 3 + k] );
+			}
+		}
+	}
+
+	float r2 = 0;
+	for ( int k = 0; k < 3; k++ )
+	{
+		center[k] = ( mins[k] + maxs[k] ) * 0.5f;
+	}
+	for ( int i = 0; i < ledgeCount; i++ )
+	{
+		int first = m_firstPoint[pLedges[i]];
+		int count = m_pCollide->convexes[pLedges[i]]->points.Count();
+		for ( int j = first; j < first + count; j++ )
+		{
+			float dx = m_points[j * 3] - center[0], dy = m_points[j * 3 + 1] - center[1], dz = m_points[j * 3 + 2] - center[2];
+			r2 = MAX( r2, dx * dx + dy * dy + dz * dz );
+		}
+	}
+	*radius = sqrtf( r2 );
+
+	for ( int k = 0; k < 3; k++ )
+	{
+		float size = *radius > 0 ? ( maxs[k] - mins[k] ) * 0.5f / *radius * 250.0f : 250.0f;
+		boxSizes[k] = (unsigned char)clamp( (int)ceilf( size ), 1, 255 );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Writes the subtree over pLedges at offset, returns the offset after it
+//-----------------------------------------------------------------------------
+int CCompactSurfaceWriter::WriteNode( int *pLedges, int ledgeCount, int offset )
+{
+	float center[3], radius;
+	unsigned char boxSizes[3];
+	ComputeSphere( pLedges, ledgeCount, center, &radius, boxSizes );
+
+	// IVP_Compact_Ledgetree_Node
+	PutFloat( offset + 8, center[0] );
+	PutFloat( offset + 12, center[1] );
+	PutFloat( offset + 16, center[2] );
+	PutFloat( offset + 20, radius );
+	memcpy( m_pDest + offset + 24, boxSizes, 3 );
+
+	if ( ledgeCount == 1 )
+	{
+		PutInt( offset, 0 );
+		PutInt( offset + 4, m_ledgeOffsets[pLedges[0]] - offset );
+		return offset + LEDGETREE_NODE_SIZE;
+	}
+
+	// split at the median along the longest axis of the ledge centers
+	std::vector< float > centers( ledgeCount * 3 );
+	float mins[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, maxs[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for ( int i = 0; i < ledgeCount; i++ )
+	{
+		float ledgeRadius;
+		unsigned char ledgeBox[3];
+		ComputeSphere( &pLedges[i], 1, &centers[i * 3], &ledgeRadius, ledgeBox );
+		for ( int k = 0; k < 3; k++ )
+		{
+			mins[k] = MIN( mins[k], centers[i * 3 + k] );
+			maxs[k] = MAX( maxs[k], centers[i * 3 + k] );
+		}
+	}
+	int axis = 0;
+	for ( int k = 1; k < 3; k++ )
+	{
+		if ( maxs[k] - mins[k] > maxs[axis] - mins[axis] )
+			axis = k;
+	}
+
+	std::vector< int > order( ledgeCount );
+	for ( int i = 0; i < ledgeCount; i++ )
+	{
+		order[i] = i;
+	}
+	std::stable_sort( order.begin(), order.end(), [&]( int a, int b ) { return centers[a * 3 + axis] < centers[b * 3 + axis]; } );
+	std::vector< int > sorted( ledgeCount );
+	for ( int i = 0; i < ledgeCount; i++ )
+	{
+		sorted[i] = pLedges[order[i]];
+	}
+	memcpy( pLedges, sorted.data(), ledgeCount * sizeof( int ) );
+
+	int half = ledgeCount / 2;
+	int right = WriteNode( pLedges, half, offset + LEDGETREE_NODE_SIZE );
+	PutInt( offset, right - offset );
+	PutInt( offset + 4, 0 );
+	return WriteNode( pLedges + half, ledgeCount - half, right );
+}
+
+
+//-----------------------------------------------------------------------------
+// IPhysicsCollision
+//-----------------------------------------------------------------------------
+class CBuiltinPhysicsCollision : public IPhysicsCollision
+{
+public:
+	virtual CPhysConvex *ConvexFromVerts( Vector **pVerts, int vertCount )
+	{
+		std::vector< hullvec_t > points( vertCount );
+		for ( int i = 0; i < vertCount; i++ )
+		{
+			points[i] = hullvec_t( pVerts[i]->x, pVerts[i]->y, pVerts[i]->z );
+		}
+		return (CPhysConvex *)ConvexFromPoints( points.data(), vertCount );
+	}
+	virtual CPhysConvex *ConvexFromPlanes( float *pPlanes, int planeCount, float mergeDistance ) { return NULL; }
+	virtual float ConvexVolume( CPhysConvex *pConvex ) { return (float)ConvexVolumeAndCenter( (builtinconvex_t *)pConvex, NULL ); }
+	virtual CPhysCollide *ConvertConvexToCollide( CPhysConvex **pConvex, int convexCount )
+	{
+		convertconvexparams_t params;
+		params.Defaults();
+		return ConvertConvexToCollideParams( pConvex, convexCount, params );
+	}
+	virtual float ConvexSurfaceArea( CPhysConvex *pConvex ) { return (float)ConvexArea( (builtinconvex_t *)pConvex ); }
+	virtual void SetConvexGameData( CPhysConvex *pConvex, unsigned int gameData ) { ( (builtinconvex_t *)pConvex )->gameData = gameData; }
+	virtual void ConvexFree( CPhysConvex *pConvex ) { delete (builtinconvex_t *)pConvex; }
+
+	virtual CPhysPolysoup *PolysoupCreate( void ) { return NULL; }
+	virtual void PolysoupDestroy( CPhysPolysoup *pSoup ) {}
+	virtual void PolysoupAddTriangle( CPhysPolysoup *pSoup, const Vector &a, const Vector &b, const Vector &c, int materialIndex7bits ) {}
+	virtual CPhysCollide *ConvertPolysoupToCollide( CPhysPolysoup *pSoup, bool useMOPP ) { return NULL; }
+
+	virtual int CollideSize( CPhysCollide *pCollide )
+	{
+		CCompactSurfaceWriter writer( (builtincollide_t *)pCollide );
+		return writer.Size();
+	}
+	virtual int CollideWrite( char *pDest, CPhysCollide *pCollide )
+	{
+		CCompactSurfaceWriter writer( (builtincollide_t *)pCollide );
+		writer.Write( pDest );
+		return writer.Size();
+	}
+	virtual void DestroyCollide( CPhysCollide *pCollide )
+	{
+		builtincollide_t *pBuiltin = (builtincollide_t *)pCollide;
+		if ( !pBuiltin )
+			return;
+		pBuiltin->convexes.PurgeAndDeleteElements();
+		delete pBuiltin;
+	}
+	virtual float CollideVolume( CPhysCollide *pCollide ) { return ( (builtincollide_t *)pCollide )->volume; }
+	virtual float CollideSurfaceArea( CPhysCollide *pCollide ) { return ( (builtincollide_t *)pCollide )->surfaceArea; }
+
+	virtual Vector CollideGetExtent( const CPhysCollide *pCollide, const Vector &collideOrigin, const QAngle &collideAngles, const Vector &direction )
+	{
+		matrix3x4_t xform;
+		AngleMatrix( collideAngles, collideOrigin, xform );
+		const builtincollide_t *pBuiltin = (const builtincollide_t *)pCollide;
+		Vector best = collideOrigin;
+		float bestDot = -FLT_MAX;
+		for ( int i = 0; i < pBuiltin->convexes.Count(); i++ )
+		{
+			for ( int j = 0; j < pBuiltin->convexes[i]->points.Count(); j++ )
+			{
+				Vector point;
+				VectorTransform( pBuiltin->convexes[i]->points[j], xform, point );
+				if ( DotProduct( point, direction ) > bestDot )
+				{
+					bestDot = DotProduct( point, direction );
+					best = point;
+				}
+			}
+		}
+		return best;
+	}
+	virtual void CollideGetAABB( Vector &mins, Vector &maxs, const CPhysCollide *pCollide, const Vector &collideOrigin, const QAngle &collideAngles )
+	{
+		matrix3x4_t xform;
+		AngleMatrix( collideAngles, collideOrigin, xform );
+		const builtincollide_t *pBuiltin = (const builtincollide_t *)pCollide;
+		ClearBounds( mins, maxs );
+		for ( int i = 0; i < pBuiltin->convexes.Count(); i++ )
+		{
+			for ( int j = 0; j < pBuiltin->convexes[i]->points.Count(); j++ )
+			{
+				Vector point;
+				VectorTransform( pBuiltin->convexes[i]->points[j], xform, point );
+				AddPointToBounds( point, mins, maxs );
+			}
+		}
+	}
+	virtual CPhysCollide *BBoxToCollide( const Vector &mins, const Vector &maxs )
+	{
+		CPhysConvex *pConvex = BBoxToConvex( mins, maxs );
+		return pConvex ? ConvertConvexToCollide( &pConvex, 1 ) : NULL;
+	}
+
+	virtual void TraceBox( const Vector &start, const Vector &end, const Vector &mins, const Vector &maxs, const CPhysCollide *pCollide, const Vector &collideOrigin, const QAngle &collideAngles, trace_t *ptr ) {}
+	virtual void TraceBox( const Ray_t &ray, const CPhysCollide *pCollide, const Vector &collideOrigin, const QAngle &collideAngles, trace_t *ptr ) {}
+	virtual void TraceCollide( const Vector &start, const Vector &end, const CPhysCollide *pSweepCollide, const QAngle &sweepAngles, const CPhysCollide *pCollide, const Vector &collideOrigin, const QAngle &collideAngles, trace_t *ptr ) {}
+	virtual void VCollideLoad( vcollide_t *pOutput, int solidCount, const char *pBuffer, int size ) {}
+	virtual void VCollideUnload( vcollide_t *pVCollide ) {}
+	virtual IVPhysicsKeyParser *VPhysicsKeyParserCreate( const char *pKeyData ) { return NULL; }
+	virtual void VPhysicsKeyParserDestroy( IVPhysicsKeyParser *pParser ) {}
+	virtual int CreateDebugMesh( CPhysCollide const *pCollisionModel, Vector **outVerts ) { *outVerts = NULL; return 0; }
+	virtual void DestroyDebugMesh( int vertCount, Vector *outVerts ) {}
+	virtual ICollisionQuery *CreateQueryModel( CPhysCollide *pCollide ) { return NULL; }
+	virtual void DestroyQueryModel( ICollisionQuery *pQuery ) {}
+	virtual IPhysicsCollision *ThreadContextCreate( void ) { return this; }
+	virtual void ThreadContextDestroy( IPhysicsCollision *pThreadContex ) {}
+	virtual unsigned int ReadStat( int statID ) { return 0; }
+	virtual void TraceBox( const Ray_t &ray, unsigned int contentsMask, IConvexInfo *pConvexInfo, const CPhysCollide *pCollide, const Vector &collideOrigin, const QAngle &collideAngles, trace_t *ptr ) {}
+
+	virtual void CollideGetMassCenter( CPhysCollide *pCollide, Vector *pOutMassCenter ) { *pOutMassCenter = ( (builtincollide_t *)pCollide )->massCenter; }
+	virtual void CollideSetMassCenter( CPhysCollide *pCollide, const Vector &massCenter ) { ( (builtincollide_t *)pCollide )->massCenter = massCenter; }
+	virtual int CollideIndex( const CPhysCollide *pCollide ) { return 0; }
+
+	virtual CPhysCollide *ConvertConvexToCollideParams( CPhysConvex **pConvex, int convexCount, const convertconvexparams_t &convertParams );
+	virtual CPhysConvex *BBoxToConvex( const Vector &mins, const Vector &maxs )
+	{
+		hullvec_t corners[8];
+		for ( int i = 0; i < 8; i++ )
+		{
+			corners[i] = hullvec_t( ( i & 1 ) ? maxs.x : mins.x, ( i & 2 ) ? maxs.y : mins.y, ( i & 4 ) ? maxs.z : mins.z );
+		}
+		return (CPhysConvex *)ConvexFromPoints( corners, 8 );
+	}
+	virtual Vector CollideGetOrthographicAreas( const CPhysCollide *pCollide ) { return ( (const builtincollide_t *)pCollide )->orthoAreas; }
+	virtual void OutputDebugInfo( const CPhysCollide *pCollide ) {}
+	virtual bool IsBoxIntersectingCone( const Vector &boxAbsMins, const Vector &boxAbsMaxs, const truncatedcone_t &cone ) { return false; }
+	virtual CPhysCollide *CreateVirtualMesh( const virtualmeshparams_t &params ) { return NULL; }
+	virtual void DumpVirtualCollideStats() {}
+	virtual CPhysConvex *ConvexFromConvexPolyhedron( const CPolyhedron &ConvexPolyhedron ) { return NULL; }
+	virtual bool SupportsVirtualMesh() { return false; }
+	virtual CPhysCollide *UnserializeCollide( char *pBuffer, int size, int index ) { return NULL; }
+	virtual void CollideSetOrthographicAreas( CPhysCollide *pCollide, const Vector &areas ) { ( (builtincollide_t *)pCollide )->orthoAreas = areas; }
+	virtual bool GetBBoxCacheSize( int *pCachedSize, int *pCachedCount ) { *pCachedSize = 0; *pCachedCount = 0; return false; }
+	virtual const char *PackVCollideText( const char *pTextIn, int *pSizeOut, bool storeSolidNames, bool storeSurfacepropsAsNames ) { return NULL; }
+	virtual void DestroyVCollideText( const char *pText ) {}
+	virtual CPackedPhysicsDescription *CreatePackedDesc( const char *pPackedBuffer, int packedSize ) { return NULL; }
+	virtual void DestroyPackedDesc( CPackedPhysicsDescription *pPhysics ) {}
+};
+
+//-----------------------------------------------------------------------------
+// Takes ownership of the convexes, like vphysics does
+//-----------------------------------------------------------------------------
+CPhysCollide *CBuiltinPhysicsCollision::ConvertConvexToCollideParams( CPhysConvex **pConvex, int convexCount, const convertconvexparams_t &convertParams )
+{
+	if ( convexCount <= 0 )
+		return NULL;
+
+	builtincollide_t *pCollide = new builtincollide_t;
+	double volume = 0, area = 0;
+	hullvec_t center( 0, 0, 0 );
+	for ( int i = 0; i < convexCount; i++ )
+	{
+		builtinconvex_t *pBuiltin = (builtinconvex_t *)pConvex[i];
+		pCollide->convexes.AddToTail( pBuiltin );
+
+		hullvec_t convexCenter;
+		double convexVolume = ConvexVolumeAndCenter( pBuiltin, &convexCenter );
+		volume += convexVolume;
+		center = center + convexCenter * convexVolume;
+		area += ConvexArea( pBuiltin );
+	}
+	if ( volume > 0 )
+	{
+		center = center * ( 1.0 / volume );
+	}
+	pCollide->massCenter.Init( center.x, center.y, center.z );
+	pCollide->volume = (float)volume;
+	pCollide->surfaceArea = (float)area;
+
+	// unit mass inertia about the mass center, swizzled into IVP's axes
+	double moments[3][3] = {};
+	for ( int i = 0; i < convexCount; i++ )
+	{
+		ConvexSecondMoments( pCollide->convexes[i], center, moments );
+	}
+	double scale = volume > 0 ? METERS_PER_INCH * METERS_PER_INCH / volume : 0;
+	double ixx = ( moments[1][1] + moments[2][2] ) * scale;
+	double iyy = ( moments[0][0] + moments[2][2] ) * scale;
+	double izz = ( moments[0][0] + moments[1][1] ) * scale;
+	pCollide->rotationInertia.Init( ixx, izz, iyy );
+
+	pCollide->orthoAreas.Init( 1, 1, 1 );
+	if ( convertParams.buildDragAxisAreas )
+	{
+		pCollide->orthoAreas = ComputeOrthographicAreas( pCollide, convertParams.dragAreaEpsilon );
+	}
+
+	return (CPhysCollide *)pCollide;
+}
+
+
+//-----------------------------------------------------------------------------
+// IPhysicsSurfaceProps, just the physics parameters studiomdl needs for mass
+//-----------------------------------------------------------------------------
+class CBuiltinPhysicsSurfaceProps : public IPhysicsSurfaceProps
+{
+public:
+	virtual int ParseSurfaceData( const char *pFilename, const char *pTextfile );
+	virtual int SurfacePropCount( void ) { return m_names.Count(); }
+	virtual int GetSurfaceIndex( const char *pSurfacePropName )
+	{
+		for ( int i = 0; i < m_names.Count(); i++ )
+		{
+			if ( !Q_stricmp( m_names[i], pSurfacePropName ) )
+				return i;
+		}
+		return -1;
+	}
+	virtual void GetPhysicsProperties( int surfaceDataIndex, float *density, float *thickness, float *friction, float *elasticity )
+	{
+		surfacephysicsparams_t params;
+		GetPhysicsParameters( surfaceDataIndex, &params );
+		if ( density )
+			*density = params.density;
+		if ( thickness )
+			*thickness = params.thickness;
+		if ( friction )
+			*friction = params.friction;
+		if ( elasticity )
+			*elasticity = params.elasticity;
+	}
+	virtual surfacedata_t *GetSurfaceData( int surfaceDataIndex ) { return NULL; }
+	virtual const char *GetString( unsigned short stringTableIndex ) { return NULL; }
+	virtual const char *GetPropName( int surfaceDataIndex )
+	{
+		return surfaceDataIndex >= 0 && surfaceDataIndex < m_names.Count() ? m_names[surfaceDataIndex] : NULL;
+	}
+	virtual void SetWorldMaterialIndexTable( int *pMapArray, int mapSize ) {}
+	virtual void GetPhysicsParameters( int surfaceDataIndex, surfacephysicsparams_t *pParamsOut )
+	{
+		// unknown props fall back to "default", like vphysics
+		if ( surfaceDataIndex < 0 || surfaceDataIndex >= m_params.Count() )
+		{
+			surfaceDataIndex = GetSurfaceIndex( "default" );
+		}
+		if ( surfaceDataIndex < 0 )
+		{
+			DefaultParams( pParamsOut );
+			return;
+		}
+		*pParamsOut = m_params[surfaceDataIndex];
+	}
+
+private:
+	static void DefaultParams( surfacephysicsparams_t *pParams )
+	{
+		pParams->friction = 0.8f;
+		pParams->elasticity = 0.25f;
+		pParams->density = 2000.0f;
+		pParams->thickness = 0.0f;
+		pParams->dampening = 0.0f;
+	}
+
+	CUtlVector< char * >					m_names;
+	CUtlVector< surfacephysicsparams_t >	m_params;
+};
+
+int CBuiltinPhysicsSurfaceProps::ParseSurfaceData( const char *pFilename, const char *pTextfile )
+{
+	KeyValues *pKeys = new KeyValues( pFilename );
+	if ( !pKeys->LoadFromBuffer( pFilename, pTextfile ) )
+	{
+		pKeys->deleteThis();
+		return 0;
+	}
+
+	for ( KeyValues *pSurface = pKeys; pSurface; pSurface = pSurface->GetNextKey() )
+	{
+		// the first definition of a name wins
+		if ( GetSurfaceIndex( pSurface->GetName() ) >= 0 )
+			continue;
+
+		surfacephysicsparams_t params;
+		DefaultParams( &params );
+		for ( KeyValues *pKey = pSurface->GetFirstSubKey(); pKey; pKey = pKey->GetNextKey() )
+		{
+			const char *pName = pKey->GetName();
+			if ( !Q_stricmp( pName, "base" ) )
+			{
+				int base = GetSurfaceIndex( pKey->GetString() );
+				if ( base >= 0 )
+				{
+					params = m_params[base];
+				}
+			}
+			else if ( !Q_stricmp( pName, "density" ) )
+				params.density = pKey->GetFloat();
+			else if ( !Q_stricmp( pName, "thickness" ) )
+				params.thickness = pKey->GetFloat();
+			else if ( !Q_stricmp( pName, "friction" ) )
+				params.friction = pKey->GetFloat();
+			else if ( !Q_stricmp( pName, "elasticity" ) )
+				params.elasticity = pKey->GetFloat();
+			else if ( !Q_stricmp( pName, "dampening" ) )
+				params.dampening = pKey->GetFloat();
+		}
+
+		char *pName = new char[strlen( pSurface->GetName() ) + 1];
+		strcpy( pName, pSurface->GetName() );
+		m_names.AddToTail( pName );
+		m_params.AddToTail( params );
+	}
+
+	pKeys->deleteThis();
+	return m_names.Count();
+}
+
+
+static CBuiltinPhysicsCollision s_BuiltinPhysicsCollision;
+static CBuiltinPhysicsSurfaceProps s_BuiltinPhysicsSurfaceProps;
+
+IPhysicsCollision *BuiltinPhysicsCollision( void )
+{
+	return &s_BuiltinPhysicsCollision;
+}
+
+IPhysicsSurfaceProps *BuiltinPhysicsSurfaceProps( void )
+{
+	return &s_BuiltinPhysicsSurfaceProps;
+}
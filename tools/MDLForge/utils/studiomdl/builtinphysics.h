@@ -0,0 +1,24 @@
+//=======================================================================
+// Built-in collision model builder for standalone studiomdl
+//=======================================================================
+
+#ifndef BUILTINPHYSICS_H
+#define BUILTINPHYSICS_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "vphysics_interface.h"
+
+// Convex hulls and .phy (IVP compact surface) serialization without a game's
+// vphysics module.  Only the calls studiomdl makes are implemented.
+IPhysicsCollision *BuiltinPhysicsCollision( void );
+IPhysicsSurfaceProps *BuiltinPhysicsSurfaceProps( void );
+
+// Moves the vertices of the convex hull of pVerts to the front and drops the
+// ones whose removal loses the least volume until at most maxVerts are left.
+// Returns how many to keep; pHullVertCount gets the unreduced hull's count,
+// or 0 when the points are flat and the first maxVerts are kept as they are.
+int ReduceHullVerts( Vector **pVerts, int vertCount, int maxVerts, int *pHullVertCount );
+
+#endif // BUILTINPHYSICS_H
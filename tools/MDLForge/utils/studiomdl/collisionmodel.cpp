@@ -19,6 +19,7 @@
 #include <sys/stat.h>
 #include <algorithm>
 #include <math.h>
+#include <unordered_map>
 #include <vector>
 
 #include "tier0/platform.h"
@@ -30,6 +31,8 @@
 #include "studio.h"
 #include "studiomdl.h"
 #include "physdll.h"
+#include "builtinphysics.h"
+#include "bonenames.h"
 #include "phyfile.h"
 #include "utlvector.h"
 #include "vcollide_parse.h"
@@ -43,6 +46,9 @@ static int Safe_atoi( const char *pString );
 IPhysicsCollision *physcollision = NULL;
 IPhysicsSurfaceProps *physprops = NULL;
 
+// -builtinphysics: never load the game's vphysics
+bool g_bBuiltinPhysics = false;
+
 static bool g_hasCollisionModelBounds = false;
 static Vector g_collisionModelMins;
 static Vector g_collisionModelMaxs;
@@ -77,7 +83,7 @@ static bool VectorPtrEqualXYZ( const Vector *a, const Vector *b )
 	return a->x == b->x && a->y == b->y && a->z == b->z;
 }
 
-static CPhysConvex *ConvexFromVertsStable( Vector **verts, int vertCount )
+static CPhysConvex *ConvexFromVertsStable( Vector **verts, int vertCount, int maxConvexVerts )
 {
 	if ( !verts || vertCount <= 0 )
 		return NULL;
@@ -105,23 +111,35 @@ static CPhysConvex *ConvexFromVertsStable( Vector **verts, int vertCount )
 			[]( const Vector *a, const Vector *b ) { return VectorPtrEqualXYZ( a, b ); } ),
 		uniqueVerts.end() );
 
-	const int maxVerts = GetMaxConvexHullVertexCount();
+	// $maxconvexverts can only lower the limit
+	int maxVerts = GetMaxConvexHullVertexCount();
+	if ( maxConvexVerts > 0 && maxConvexVerts < maxVerts )
+	{
+		maxVerts = maxConvexVerts;
+	}
+
 	if ( (int)uniqueVerts.size() > maxVerts )
 	{
-		if ( !g_quiet )
+		// keep the hull vertices that hold the most volume
+		int hullVertCount = 0;
+		int count = ReduceHullVerts( uniqueVerts.data(), (int)uniqueVerts.size(), maxVerts, &hullVertCount );
+		if ( hullVertCount == 0 )
 		{
-			printf( "WARNING: collision hull has %d unique verts; truncating to %d\n", (int)uniqueVerts.size(), maxVerts );
+			MdlWarning( "collision hull of %d verts is flat, keeping the first %d\n", (int)uniqueVerts.size(), count );
 		}
+		else if ( hullVertCount > GetMaxConvexHullVertexCount() )
+		{
+			MdlWarning( "collision hull of %d verts reduced to %d\n", hullVertCount, count );
+		}
+		int originalCount = (int)uniqueVerts.size();
+		uniqueVerts.resize( count );
 
-		std::vector<Vector *> sampled;
-		sampled.reserve( (size_t)maxVerts );
-		const size_t n = uniqueVerts.size();
-		for ( int i = 0; i < maxVerts; i++ )
+		CPhysConvex *pConvex = physcollision->ConvexFromVerts( uniqueVerts.data(), count );
+		if ( !pConvex )
 		{
-			const size_t index = (size_t)i * n / (size_t)maxVerts;
-			sampled.push_back( uniqueVerts[index] );
+			MdlWarning( "collision hull of %d verts reduced to %d isn't a solid, dropping it\n", originalCount, count );
 		}
-		uniqueVerts.swap( sampled );
+		return pConvex;
 	}
 
 	return physcollision->ConvexFromVerts( uniqueVerts.data(), (int)uniqueVerts.size() );
@@ -217,20 +235,26 @@ int FindLocalBoneNamed( const s_source_t *pSource, const char *pName )
 {
 	if ( pName )
 	{
-		int i;
-		for ( i = 0; i < pSource->numbones; i++ )
+		static std::mutex s_AllocMutex;
+		CBoneNameIndex *pBoneNames;
 		{
-			if ( !stricmp( pName, pSource->localBone[i].name ) )
-				return i;
+			std::lock_guard<std::mutex> lock( s_AllocMutex );
+			if ( !pSource->pBoneNames )
+			{
+				pSource->pBoneNames = new CBoneNameIndex;
+			}
+			pBoneNames = pSource->pBoneNames;
 		}
 
+		auto LocalBoneName = [pSource]( int i ) { return pSource->localBone[i].name; };
+
+		int i = pBoneNames->Find( pName, pSource->numbones, LocalBoneName );
+		if ( i != -1 )
+			return i;
+
 		pName = RenameBone( pName );
 
-		for ( i = 0; i < pSource->numbones; i++ )
-		{
-			if ( !stricmp( pName, pSource->localBone[i].name ) )
-				return i;
-		}
+		return pBoneNames->Find( pName, pSource->numbones, LocalBoneName );
 	}
 
 	return -1;
@@ -323,6 +347,7 @@ public:
 	int						m_iMinAnimatedFriction;
 	int						m_iMaxAnimatedFriction;
 	bool					m_bHasAnimatedFriction;
+	int						m_maxConvexVerts;	// 0 = vphysics limit
 };
 
 
@@ -359,6 +384,7 @@ CJointedModel::CJointedModel( void )
 	m_iMinAnimatedFriction = 1.0f;
 	m_iMaxAnimatedFriction = 1.0f;
 	m_bHasAnimatedFriction = false;
+	m_maxConvexVerts = 0;
 }
 
 
@@ -826,17 +852,15 @@ void ConvertToWorldSpace( CJointedModel &joints, s_source_t *psource, Vector *wo
 
 
 //-----------------------------------------------------------------------------
-// Purpose: Transforms the set of verts into the space of a particular bone
+// Purpose: Gets the transform that takes the source's verts into the space of
+//			a particular bone
 // Input  : *psource - 
 //			boneIndex - 
-//			*boneVerts - 
+//			&boneToPose - 
 //-----------------------------------------------------------------------------
-void ConvertToBoneSpace( s_source_t *psource, int boneIndex, Vector *boneVerts )
+void GetPhysicsBoneToPose( s_source_t *psource, int boneIndex, matrix3x4_t &boneToPose )
 {
-	int i;
-
 	int remapIndex = psource->boneLocalToGlobal[boneIndex];
-	matrix3x4_t boneToPose;
 	if ( remapIndex < 0 )
 	{
 		MdlWarning("Error! physics for unused bone %s\n", psource->localBone[boneIndex].name );
@@ -846,70 +870,9 @@ void ConvertToBoneSpace( s_source_t *psource, int boneIndex, Vector *boneVerts )
 	{
 		ConcatTransforms( psource->boneToPose[boneIndex], g_bonetable[remapIndex].srcRealign, boneToPose );
 	}
-
-	for (i = 0; i < psource->numvertices; i++)
-	{
-		VectorITransform(psource->vertex[i].position, boneToPose, boneVerts[i] );
-	}
 }
 
 
-//-----------------------------------------------------------------------------
-// Purpose: Test this face to see if any of its verts are assigned to a particular bone
-// Input  : &joints - 
-//			*pmodel - 
-//			*face - 
-//			boneIndex - 
-// Output : Returns true if this face has a vert assigned to boneIndex
-//-----------------------------------------------------------------------------
-bool FaceHasVertOnBone( const CJointedModel &joints, s_source_t *pmodel, s_face_t *face, int boneIndex )
-{
-	int j;
-	s_boneweight_t *pweight;
-
-	pweight = &pmodel->vertex[ face->a ].globalBoneweight;
-	for ( j = 0; j < pweight->numbones; j++ )
-	{
-		// Discover the local bone index for this bone
-		int localBone = pmodel->boneGlobalToLocal[ pweight->bone[j] ];
-		
-		// assigned to boneIndex?
-		if ( joints.RemapBone( localBone ) == boneIndex )
-		{
-			return true;
-		}
-	}
-
-	pweight = &pmodel->vertex[ face->b ].globalBoneweight;
-	for ( j = 0; j < pweight->numbones; j++ )
-	{
-		// Discover the local bone index for this bone
-		int localBone = pmodel->boneGlobalToLocal[ pweight->bone[j] ];
-
-		// assigned to boneIndex?
-		if ( joints.RemapBone( localBone ) == boneIndex )
-		{
-			return true;
-		}
-	}
-
-	pweight = &pmodel->vertex[ face->c ].globalBoneweight;
-	for ( j = 0; j < pweight->numbones; j++ )
-	{
-		// Discover the local bone index for this bone
-		int localBone = pmodel->boneGlobalToLocal[ pweight->bone[j] ];
-
-		// assigned to boneIndex?
-		if ( joints.RemapBone( localBone ) == boneIndex )
-		{
-			return true;
-		}
-	}
-
-	return false;
-
-}
-
 //-----------------------------------------------------------------------------
 // Purpose: Fixup the pointers in this face to reference the mesh globally (source relative)
 //			(faces are mesh relative, each source has several meshes)
@@ -964,64 +927,85 @@ int CopyVertsByBone( Vector **verts, Vector *worldVerts, const CJointedModel &jo
 
 
 //-----------------------------------------------------------------------------
-// Purpose: Copy all verts that are referenced by a face which has a vert assigned
-//			to this bone.
+// Purpose: Sort the faces by the bones their verts are assigned to, in one pass
+//			over the model.  A face lands in the list of every bone any of its
+//			verts is assigned to, in model order.
 //			NOTE: convex hulls of each bone will overlap at the joints
-// Input  : **verts - 
-//			*worldVerts - 
-//			&joints - 
-//			boneIndex - 
-// Output : int
+// Input  : &joints - 
+//			*pBoneFaces - numbones lists of faces, with global vert indices
 //-----------------------------------------------------------------------------
-int CopyFaceVertsByBone( Vector **verts, Vector *worldVerts, const CJointedModel &joints, int boneIndex )
+void BucketFacesByBone( const CJointedModel &joints, CUtlVector< s_face_t > *pBoneFaces )
 {
-	int vertCount = 0;
 	s_source_t *pmodel = joints.m_pModel;
 
-	int *vertChecked = new int[pmodel->numvertices];
-	for ( int b = 0; b < pmodel->numvertices; b++ )
-	{
-		vertChecked[b] = 0;
-	}
-
 	for ( int i = 0; i < pmodel->nummeshes; i++ )
 	{
 		s_mesh_t *pmesh = pmodel->mesh + pmodel->meshindex[i];
 		for ( int j = 0; j < pmesh->numfaces; j++ )
 		{
-			s_face_t *face = pmodel->face + pmesh->faceoffset + j;
 			s_face_t globalFace;
-			GlobalFace( &globalFace, pmesh, face );
-			if ( FaceHasVertOnBone( joints, pmodel, &globalFace, boneIndex ) )
+			GlobalFace( &globalFace, pmesh, pmodel->face + pmesh->faceoffset + j );
+
+			unsigned long faceVerts[3] = { globalFace.a, globalFace.b, globalFace.c };
+			int faceBones[3 * MAXSTUDIOBONEWEIGHTS];
+			int faceBoneCount = 0;
+			for ( int k = 0; k < 3; k++ )
 			{
-				if ( !vertChecked[globalFace.a] )
-				{
-					// add this vert to model
-					verts[vertCount++] = &worldVerts[globalFace.a];
-				}
-				if ( !vertChecked[globalFace.b] )
-				{
-					// add this vert to model
-					verts[vertCount++] = &worldVerts[globalFace.b];
-				}
-				if ( !vertChecked[globalFace.c] )
+				s_boneweight_t *pweight = &pmodel->vertex[ faceVerts[k] ].globalBoneweight;
+				for ( int n = 0; n < pweight->numbones; n++ )
 				{
-					// add this vert to model
-					verts[vertCount++] = &worldVerts[globalFace.c];
+					// Discover the local bone index for this bone
+					int boneIndex = joints.RemapBone( pmodel->boneGlobalToLocal[ pweight->bone[n] ] );
+					if ( boneIndex < 0 )
+						continue;
+
+					int m;
+					for ( m = 0; m < faceBoneCount; m++ )
+					{
+						if ( faceBones[m] == boneIndex )
+							break;
+					}
+					if ( m == faceBoneCount )
+					{
+						faceBones[faceBoneCount++] = boneIndex;
+						pBoneFaces[boneIndex].AddToTail( globalFace );
+					}
 				}
-				// mark these verts so you only add them once
-				vertChecked[globalFace.a] = 1;
-				vertChecked[globalFace.b] = 1;
-				vertChecked[globalFace.c] = 1;
 			}
 		}
 	}
-
-	delete[] vertChecked;
-	return vertCount;
 }
 
 
+// exact position key for welding; -0 and 0 compare equal so they must hash equal
+struct weldkey_t
+{
+	unsigned int bits[3];
+
+	bool operator==( const weldkey_t &other ) const
+	{
+		return bits[0] == other.bits[0] && bits[1] == other.bits[1] && bits[2] == other.bits[2];
+	}
+};
+
+struct WeldKeyHash
+{
+	size_t operator()( const weldkey_t &key ) const
+	{
+		return ( (size_t)key.bits[0] * 73856093u ) ^ ( (size_t)key.bits[1] * 19349663u ) ^ ( (size_t)key.bits[2] * 83492791u );
+	}
+};
+
+static weldkey_t WeldKey( const Vector &position )
+{
+	weldkey_t key;
+	for ( int i = 0; i < 3; i++ )
+	{
+		float value = position[i] + 0.0f;
+		memcpy( &key.bits[i], &value, sizeof( value ) );
+	}
+	return key;
+}
 
 //-----------------------------------------------------------------------------
 // Purpose: Find all verts that differ only by texture coordinates - this allows
@@ -1031,31 +1015,68 @@ int CopyFaceVertsByBone( Vector **verts, Vector *worldVerts, const CJointedModel
 //-----------------------------------------------------------------------------
 void BuildVertWeldTable( int *weldTable, s_source_t *pmodel )
 {
+	// verts sharing a position are chained in index order, so the first one
+	// with a close enough normal is the lowest match
+	std::unordered_map< weldkey_t, int, WeldKeyHash > firstAtPosition;
+	std::vector< int > nextAtPosition( pmodel->numvertices, -1 );
+	std::vector< int > lastAtPosition( pmodel->numvertices, -1 );
+	firstAtPosition.reserve( pmodel->numvertices );
+
 	for ( int i = 0; i < pmodel->numvertices; i++ )
 	{
-		bool found = false;
-		for ( int j = 0; j < i; j++ )
+		weldTable[i] = i;
+
+		std::pair< std::unordered_map< weldkey_t, int, WeldKeyHash >::iterator, bool > insert =
+			firstAtPosition.insert( std::make_pair( WeldKey( pmodel->vertex[i].position ), i ) );
+		if ( insert.second )
 		{
-			if ( VectorCompare( pmodel->vertex[j].position, pmodel->vertex[i].position ) &&
-				 DotProduct( pmodel->vertex[j].normal, pmodel->vertex[i].normal ) > normal_blend )
+			lastAtPosition[i] = i;
+			continue;
+		}
+
+		int first = insert.first->second;
+		for ( int j = first; j >= 0; j = nextAtPosition[j] )
+		{
+			if ( DotProduct( pmodel->vertex[j].normal, pmodel->vertex[i].normal ) > normal_blend )
 			{
-				found = true;
 				weldTable[i] = j;
 				break;
 			}
 		}
+		nextAtPosition[lastAtPosition[first]] = i;
+		lastAtPosition[first] = i;
+	}
+}
 
-		if ( !found )
-		{
-			weldTable[i] = i;
-		}
+static int FindSet( std::vector< int > &parent, int i )
+{
+	while ( parent[i] != i )
+	{
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+	return i;
+}
+
+static void UnionSets( std::vector< int > &parent, int a, int b )
+{
+	a = FindSet( parent, a );
+	b = FindSet( parent, b );
+	if ( a < b )
+	{
+		parent[b] = a;
+	}
+	else if ( b < a )
+	{
+		parent[a] = b;
 	}
 }
 
 //-----------------------------------------------------------------------------
 // Purpose: marks all verts with a unique ID.  Each set of connected verts has
 //			the same ID.  IDs are the index of the lowest numbered face on the 
-//			mesh
+//			mesh.  A set that reaches a vert welded away to another one is
+//			marked -1 along with it.
 // Input  : *vertID - array that holds IDs
 //			*pmodel - model to process
 //-----------------------------------------------------------------------------
@@ -1078,55 +1099,65 @@ void MarkConnectedMeshes( int *vertID, s_source_t *pmodel, int *vertMap )
 		}
 	}
 
-	int marked = 0;
-	int faceid = 0;
-	// iterate the face list, minimizing the vertID at each vert
-	// until we have an iteration where no vertIDs are changed
-	do 
+	// join the verts of each face into sets
+	std::vector< int > parent( pmodel->numvertices );
+	std::vector< char > onFace( pmodel->numvertices, 0 );
+	for ( i = 0; i < pmodel->numvertices; i++ )
 	{
-		marked = 0;
-		faceid = 0;
+		parent[i] = i;
+	}
 
-		for ( i = 0; i < pmodel->nummeshes; i++ )
+	for ( i = 0; i < pmodel->nummeshes; i++ )
+	{
+		s_mesh_t *pmesh = pmodel->mesh + pmodel->meshindex[i];
+		for ( int j = 0; j < pmesh->numfaces; j++ )
 		{
-			s_mesh_t *pmesh = pmodel->mesh + pmodel->meshindex[i];
-			for ( int j = 0; j < pmesh->numfaces; j++ )
-			{
-				s_face_t *face = pmodel->face + pmesh->faceoffset + j;
-				s_face_t globalFace;
-				GlobalFace( &globalFace, pmesh, face );
+			s_face_t globalFace;
+			GlobalFace( &globalFace, pmesh, pmodel->face + pmesh->faceoffset + j );
 
-				// account for welding
-				globalFace.a = vertMap[globalFace.a];
-				globalFace.b = vertMap[globalFace.b];
-				globalFace.c = vertMap[globalFace.c];
+			// account for welding
+			int a = vertMap[globalFace.a];
+			int b = vertMap[globalFace.b];
+			int c = vertMap[globalFace.c];
+			UnionSets( parent, a, b );
+			UnionSets( parent, a, c );
+			onFace[a] = onFace[b] = onFace[c] = 1;
+		}
+	}
 
+	// each set gets the lowest of its faces' ids and its verts' ids
+	std::vector< int > setID( pmodel->numvertices, pmodel->numfaces+1 );
+	int faceid = 0;
+	for ( i = 0; i < pmodel->nummeshes; i++ )
+	{
+		s_mesh_t *pmesh = pmodel->mesh + pmodel->meshindex[i];
+		for ( int j = 0; j < pmesh->numfaces; j++ )
+		{
+			s_face_t globalFace;
+			GlobalFace( &globalFace, pmesh, pmodel->face + pmesh->faceoffset + j );
 
-				// find min(faceid, vertID[a], vertID[b], vertID[c]);
-				int newid = min(faceid, vertID[globalFace.a]);
-				newid = min( newid, vertID[globalFace.b]);
-				newid = min( newid, vertID[globalFace.c]);
-				
-				// mark all verts with the minimum, count the number we had to mark
-				if ( vertID[globalFace.a] != newid )
-				{
-					vertID[globalFace.a] = newid;
-					marked++;
-				}
-				if ( vertID[globalFace.b] != newid )
-				{
-					vertID[globalFace.b] = newid;
-					marked++;
-				}
-				if ( vertID[globalFace.c] != newid )
-				{
-					vertID[globalFace.c] = newid;
-					marked++;
-				}
-				faceid++;
-			}
+			int set = FindSet( parent, vertMap[globalFace.a] );
+			setID[set] = min( setID[set], faceid );
+			faceid++;
 		}
-	} while ( marked != 0 );
+	}
+
+	for ( i = 0; i < pmodel->numvertices; i++ )
+	{
+		if ( onFace[i] )
+		{
+			int set = FindSet( parent, i );
+			setID[set] = min( setID[set], vertID[i] );
+		}
+	}
+
+	for ( i = 0; i < pmodel->numvertices; i++ )
+	{
+		if ( onFace[i] )
+		{
+			vertID[i] = setID[FindSet( parent, i )];
+		}
+	}
 }
 
 
@@ -1313,29 +1344,64 @@ void CreateCollide( CPhysCollisionModel *pBase, CPhysConvex **pElements, int ele
 //-----------------------------------------------------------------------------
 int ProcessJointedModel( CJointedModel &joints )
 {
-	Vector *boneVerts = new Vector[joints.m_pModel->numvertices];
-	Vector **verts = new Vector *[joints.m_pModel->numvertices];
+	s_source_t *pmodel = joints.m_pModel;
+	Vector *boneVerts = new Vector[pmodel->numvertices];
+	Vector **verts = new Vector *[pmodel->numvertices];
+	int *vertBone = new int[pmodel->numvertices];
 	int vertCount;
 
+	for ( int i = 0; i < pmodel->numvertices; i++ )
+	{
+		vertBone[i] = -1;
+	}
+
 	if( !g_quiet )
 	{
 		printf("Processing jointed collision model\n" );
 	}
+
+	CUtlVector< s_face_t > boneFaces[MAXSTUDIOSRCBONES];
+	BucketFacesByBone( joints, boneFaces );
+
 	// loop through each bone and form a convex element
-	for ( int boneIndex = 0; boneIndex < joints.m_pModel->numbones; boneIndex++ )
+	for ( int boneIndex = 0; boneIndex < pmodel->numbones; boneIndex++ )
 	{
 		if ( !joints.ShouldProcessBone( boneIndex ) )
 			continue;
 
-		CPhysCollisionModel *pPhys = InitCollisionModel( joints, joints.m_pModel->localBone[boneIndex].name );
-		ConvertToBoneSpace( joints.m_pModel, boneIndex, boneVerts );
-		vertCount = CopyFaceVertsByBone( verts, boneVerts, joints, boneIndex );
+		CPhysCollisionModel *pPhys = InitCollisionModel( joints, pmodel->localBone[boneIndex].name );
+
+		// copy the verts of this bone's faces, transformed into the bone's space
+		matrix3x4_t boneToPose;
+		GetPhysicsBoneToPose( pmodel, boneIndex, boneToPose );
+		vertCount = 0;
+		for ( int i = 0; i < boneFaces[boneIndex].Count(); i++ )
+		{
+			const s_face_t &face = boneFaces[boneIndex][i];
+			unsigned long faceVerts[3] = { face.a, face.b, face.c };
+			bool faceAdds[3];
+			int k;
+			for ( k = 0; k < 3; k++ )
+			{
+				faceAdds[k] = vertBone[ faceVerts[k] ] != boneIndex;
+			}
+			for ( k = 0; k < 3; k++ )
+			{
+				if ( faceAdds[k] )
+				{
+					VectorITransform( pmodel->vertex[ faceVerts[k] ].position, boneToPose, boneVerts[ faceVerts[k] ] );
+					verts[vertCount++] = &boneVerts[ faceVerts[k] ];
+				}
+				// mark these verts so you only add them once
+				vertBone[ faceVerts[k] ] = boneIndex;
+			}
+		}
 		//vertCount = CopyVertsByBone( verts, boneVerts, joints, boneIndex );
 //		printf("Bone %s has %d verts\n", joints.m_pModel->localBone[boneIndex].name, vertCount );
 		// if verts were attached to this bone, build a convex element from those verts
 		if ( vertCount )
 		{
-			CPhysConvex *pConvex = ConvexFromVertsStable( verts, vertCount );
+			CPhysConvex *pConvex = ConvexFromVertsStable( verts, vertCount, joints.m_maxConvexVerts );
 			
 			// If this was a valid volume, add it to the list
 			if ( pConvex )
@@ -1392,6 +1458,7 @@ int ProcessJointedModel( CJointedModel &joints )
 	// free index buffer
 	delete[] boneVerts;
 	delete[] verts;
+	delete[] vertBone;
 
 	return 1;
 }
@@ -1560,7 +1627,7 @@ int ProcessSingleBody( CJointedModel &joints )
 
 	if ( forceSingleHull )
 	{
-		boundingVolume.pHull = ConvexFromVertsStable( verts, pmodel->numvertices );
+		boundingVolume.pHull = ConvexFromVertsStable( verts, pmodel->numvertices, joints.m_maxConvexVerts );
 		if ( boundingVolume.pHull )
 		{
 			physcollision->SetConvexGameData( boundingVolume.pHull, 0 );
@@ -1611,7 +1678,7 @@ int ProcessSingleBody( CJointedModel &joints )
 					{
 						verts[k] = &worldVerts[k];
 					}
-					boundingVolume.pHull = ConvexFromVertsStable( verts, pmodel->numvertices );
+					boundingVolume.pHull = ConvexFromVertsStable( verts, pmodel->numvertices, joints.m_maxConvexVerts );
 					if ( boundingVolume.pHull )
 					{
 						physcollision->SetConvexGameData( boundingVolume.pHull, 0 );
@@ -1626,7 +1693,7 @@ int ProcessSingleBody( CJointedModel &joints )
 				break;
 			}
 
-			CPhysConvex *pConvex = ConvexFromVertsStable( verts, vertCount );
+			CPhysConvex *pConvex = ConvexFromVertsStable( verts, vertCount, joints.m_maxConvexVerts );
 			
 			// If this was a valid volume, add it to the list
 			if ( pConvex )
@@ -1655,7 +1722,7 @@ int ProcessSingleBody( CJointedModel &joints )
 					{
 						verts[k] = &worldVerts[k];
 					}
-					boundingVolume.pHull = ConvexFromVertsStable( verts, pmodel->numvertices );
+					boundingVolume.pHull = ConvexFromVertsStable( verts, pmodel->numvertices, joints.m_maxConvexVerts );
 					if ( boundingVolume.pHull )
 					{
 						physcollision->SetConvexGameData( boundingVolume.pHull, 0 );
@@ -1959,6 +2026,18 @@ void ParseCollisionCommands( CJointedModel &joints )
 		{
 			joints.AllowConcave();
 		}
+		else if ( !stricmp( command, "$maxconvexverts" ) )
+		{
+			argCount = ReadArgs( args, 1 );
+			joints.m_maxConvexVerts = Safe_atoi( args[0] );
+
+			// a tetrahedron is the least that holds any volume
+			if ( joints.m_maxConvexVerts < 4 )
+			{
+				MdlWarning( "$maxconvexverts %d is less than the 4 a hull needs, using 4\n", joints.m_maxConvexVerts );
+				joints.m_maxConvexVerts = 4;
+			}
+		}
 		else if ( !stricmp( command, "$masscenter" ) )
 		{
 			argCount = ReadArgs( args, 3 );
@@ -2082,11 +2161,39 @@ void Cmd_CollisionText( void )
 	}
 }
 
+// Every surface property script a compile depends on, found or not, so
+// -cache can tell when one changes.  Kept across compiles in one process
+// since the props themselves are.
+static CUtlVector<CUtlSymbol> s_SurfacePropFiles;
+
+static void AddSurfacePropFile( const char *pFileName )
+{
+	// where the file system looks for a "GAME" file
+	char fullPath[MAX_PATH];
+	if ( Q_IsAbsolutePath( pFileName ) )
+	{
+		Q_strncpy( fullPath, pFileName, sizeof( fullPath ) );
+	}
+	else
+	{
+		Q_snprintf( fullPath, sizeof( fullPath ), "%s%s", gamedir, pFileName );
+	}
+	Q_FixSlashes( fullPath );
+
+	CUtlSymbol sym( fullPath );
+	if ( s_SurfacePropFiles.Find( sym ) < 0 )
+	{
+		s_SurfacePropFiles.AddToTail( sym );
+	}
+}
+
 static bool LoadSurfaceProps( const char *pMaterialFilename )
 {
 	if ( !physprops )
 		return false;
 
+	AddSurfacePropFile( pMaterialFilename );
+
 	FileHandle_t fp = g_pFileSystem->Open( pMaterialFilename, "rb", TOOLS_READ_PATH_ID );
 	if ( fp == FILESYSTEM_INVALID_HANDLE )
 		return false;
@@ -2108,25 +2215,124 @@ static bool LoadSurfaceProps( const char *pMaterialFilename )
 void LoadSurfacePropsAll()
 {
 	// already loaded
-	if ( physprops->SurfacePropCount() )
-		return;
-
-	const char *SURFACEPROP_MANIFEST_FILE = "scripts/surfaceproperties_manifest.txt";
-	KeyValues *manifest = new KeyValues( SURFACEPROP_MANIFEST_FILE );
-	if ( manifest->LoadFromFile( g_pFileSystem, SURFACEPROP_MANIFEST_FILE, "GAME" ) )
+	if ( !physprops->SurfacePropCount() )
 	{
-		for ( KeyValues *sub = manifest->GetFirstSubKey(); sub != NULL; sub = sub->GetNextKey() )
+		const char *SURFACEPROP_MANIFEST_FILE = "scripts/surfaceproperties_manifest.txt";
+		AddSurfacePropFile( SURFACEPROP_MANIFEST_FILE );
+
+		KeyValues *manifest = new KeyValues( SURFACEPROP_MANIFEST_FILE );
+		if ( manifest->LoadFromFile( g_pFileSystem, SURFACEPROP_MANIFEST_FILE, "GAME" ) )
 		{
-			if ( !Q_stricmp( sub->GetName(), "file" ) )
+			for ( KeyValues *sub = manifest->GetFirstSubKey(); sub != NULL; sub = sub->GetNextKey() )
 			{
-				// Add
-				LoadSurfaceProps( sub->GetString() );
-				continue;
+				if ( !Q_stricmp( sub->GetName(), "file" ) )
+				{
+					// Add
+					LoadSurfaceProps( sub->GetString() );
+					continue;
+				}
 			}
 		}
+
+		manifest->deleteThis();
+	}
+
+	for ( int i = 0; i < s_SurfacePropFiles.Count(); i++ )
+	{
+		CompileCache_AddInput( s_SurfacePropFiles[i].String() );
+	}
+}
+
+#if defined( _LINUX ) || defined( OSX )
+static bool NativeCollisionAllowed( void )
+{
+	const char *allow = getenv( "MDLFORGE_ALLOW_NATIVE_COLLISION" );
+	return allow && allow[0] && allow[0] != '0';
+}
+#endif
+
+static bool VPhysicsAllowed( void )
+{
+#if defined( _LINUX ) || defined( OSX )
+	// Shipped vphysics builds on Linux/macOS are optimized for runtime and are not reliable for
+	// collision model serialization (CollideSize/CollideWrite) needed to generate .phy.
+	return NativeCollisionAllowed();
+#else
+	return true;
+#endif
+}
+
+static IPhysicsCollision *s_pVPhysicsCollision = NULL;
+static IPhysicsSurfaceProps *s_pVPhysicsProps = NULL;
+static bool s_bVPhysicsLoaded = false;
+
+static void LoadVPhysics( void )
+{
+	if ( s_bVPhysicsLoaded )
+		return;
+	s_bVPhysicsLoaded = true;
+
+	PhysicsDLLPath( "VPHYSICS.DLL" );
+
+	CreateInterfaceFn physicsFactory = GetPhysicsFactory();
+	if ( !physicsFactory )
+	{
+		Msg( "WARNING: Could not load vphysics; using the built-in collision model builder.\n" );
+		return;
+	}
+
+	s_pVPhysicsCollision = (IPhysicsCollision *)physicsFactory( VPHYSICS_COLLISION_INTERFACE_VERSION, NULL );
+	s_pVPhysicsProps = (IPhysicsSurfaceProps *)physicsFactory( VPHYSICS_SURFACEPROPS_INTERFACE_VERSION, NULL );
+	if ( !s_pVPhysicsCollision || !s_pVPhysicsProps )
+	{
+		Msg( "WARNING: Could not acquire required vphysics interfaces; using the built-in collision model builder.\n" );
+		s_pVPhysicsCollision = NULL;
+		s_pVPhysicsProps = NULL;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Use the game's vphysics for the collision interfaces, or the
+//			built-in hull builder when it can't (or shouldn't) be loaded
+//-----------------------------------------------------------------------------
+static void CollisionModel_InitInterfaces( void )
+{
+	physcollision = BuiltinPhysicsCollision();
+	physprops = BuiltinPhysicsSurfaceProps();
+
+	if ( g_bBuiltinPhysics || !VPhysicsAllowed() )
+		return;
+
+	LoadVPhysics();
+	if ( s_pVPhysicsCollision )
+	{
+		physcollision = s_pVPhysicsCollision;
+		physprops = s_pVPhysicsProps;
 	}
+}
 
-	manifest->deleteThis();
+//-----------------------------------------------------------------------------
+// Purpose: Load vphysics up front so a long running studiomdl (-server) only
+//			pays for it once.  Surface props still load with the first
+//			$collisionmodel since they depend on the game directory.
+//-----------------------------------------------------------------------------
+void CollisionModel_Preload( void )
+{
+	if ( VPhysicsAllowed() )
+	{
+		LoadVPhysics();
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Forget the previous model's collision data.  The vphysics
+//			interfaces and loaded surface props are kept.
+//-----------------------------------------------------------------------------
+void CollisionModel_Clear( void )
+{
+	g_JointedModel = CJointedModel();
+	g_bJointed = false;
+	g_hasCollisionModelBounds = false;
 }
 
 //-----------------------------------------------------------------------------
@@ -2145,35 +2351,7 @@ int DoCollisionModel( bool separateJoints )
 
 	strcpyn( name, token );
 
-#if defined( _LINUX ) || defined( OSX )
-	const char *allow = getenv( "MDLFORGE_ALLOW_NATIVE_COLLISION" );
-	if ( !allow || !allow[0] || allow[0] == '0' )
-	{
-		// Shipped vphysics builds on Linux/macOS are optimized for runtime and are not reliable for
-		// collision model serialization (CollideSize/CollideWrite) needed to generate .phy.
-		// Prefer running the Windows toolchain (studiomdl.exe) under Wine/Proton for $collisionmodel.
-		Msg( "WARNING: Native $collisionmodel/$collisionjoints compilation is not supported on this platform. Use studiomdl.exe via Wine/Proton to generate .phy.\n" );
-		Msg( "WARNING: Set MDLFORGE_ALLOW_NATIVE_COLLISION=1 to force-enable (experimental).\n" );
-		return 0;
-	}
-#endif
-
-	PhysicsDLLPath( "VPHYSICS.DLL" );
-
-	CreateInterfaceFn physicsFactory = GetPhysicsFactory();
-	if ( !physicsFactory )
-	{
-		Msg( "WARNING: Could not load vphysics; $collisionmodel/$collisionjoints compilation will be skipped.\n" );
-		return 0;
-	}
-
-	physcollision = (IPhysicsCollision *)physicsFactory( VPHYSICS_COLLISION_INTERFACE_VERSION, NULL );
-	physprops = (IPhysicsSurfaceProps *)physicsFactory( VPHYSICS_SURFACEPROPS_INTERFACE_VERSION, NULL );
-	if ( !physcollision || !physprops )
-	{
-		Msg( "WARNING: Could not acquire required vphysics interfaces; $collisionmodel/$collisionjoints compilation will be skipped.\n" );
-		return 0;
-	}
+	CollisionModel_InitInterfaces();
 
 	LoadSurfacePropsAll();
 
@@ -2705,6 +2883,7 @@ void CollisionModel_Write( int checkSum )
 			}
 			fwrite( &terminator, sizeof(terminator), 1, fp );
 			fclose( fp );
+			CompileCache_AddOutput( filename );
 		}
 		else
 		{
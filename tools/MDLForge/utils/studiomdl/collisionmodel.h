@@ -25,4 +25,12 @@ extern void CollisionModel_Write( int checkSum );
 
 void CollisionModel_ExpandBBox( Vector &mins, Vector &maxs );
 
+// load vphysics before the first model
+extern void CollisionModel_Preload( void );
+// forget the previous model (ClearModel)
+extern void CollisionModel_Clear( void );
+
+// -builtinphysics: build collision models without the game's vphysics
+extern bool g_bBuiltinPhysics;
+
 #endif // COLLISIONMODEL_H
@@ -88,13 +88,14 @@ int CHardwareMatrixState::FindLocalLRUIndex( void )
 	return oldestID;
 }
 
-void CHardwareMatrixState::DeallocateLRU( void )
+int CHardwareMatrixState::DeallocateLRU( void )
 {
 	int id;
 
 	id = FindLocalLRUIndex();
 	m_matrixState[id].allocated = false;
 	--m_AllocatedMatrices;
+	return m_matrixState[id].globalMatrixID;
 }
 
 void CHardwareMatrixState::DeallocateLRU( int n )
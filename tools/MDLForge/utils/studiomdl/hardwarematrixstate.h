@@ -21,8 +21,8 @@ public:
 	// return false if there is no slot for this matrix.
 	bool AllocateMatrix( int globalMatrixID );
 
-	// deallocate the least recently used matrix
-	void DeallocateLRU( void );
+	// deallocate the least recently used matrix, returns its global ID
+	int DeallocateLRU( void );
 	void DeallocateLRU( int n );
 
 	// return true if a matrix is allocate.
@@ -0,0 +1,330 @@
+//=======================================================================
+// Memory mapped line reader and sscanf-free value scanner.  The numbers
+// are converted with std::from_chars, which rounds exactly like strtod, so
+// whitespace separated values read bit for bit what sscanf() read.
+//=======================================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <ctype.h>
+#include <charconv>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "linereader.h"
+
+//-----------------------------------------------------------------------------
+// Purpose: read only mapping of a whole file
+//-----------------------------------------------------------------------------
+bool MapFile( const char *pFileName, s_mappedfile_t &map )
+{
+	memset( &map, 0, sizeof( map ) );
+#ifdef _WIN32
+	map.hFile = CreateFileA( pFileName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if ( map.hFile == INVALID_HANDLE_VALUE )
+		return false;
+	LARGE_INTEGER size;
+	if ( !GetFileSizeEx( map.hFile, &size ) || size.QuadPart == 0 )
+	{
+		CloseHandle( map.hFile );
+		return false;
+	}
+	map.size = size.QuadPart;
+	map.hMapping = CreateFileMappingA( map.hFile, NULL, PAGE_READONLY, 0, 0, NULL );
+	if ( map.hMapping )
+	{
+		map.pBase = (const unsigned char *)MapViewOfFile( map.hMapping, FILE_MAP_READ, 0, 0, 0 );
+	}
+	if ( !map.pBase )
+	{
+		if ( map.hMapping )
+			CloseHandle( map.hMapping );
+		CloseHandle( map.hFile );
+		return false;
+	}
+#else
+	int fd = open( pFileName, O_RDONLY );
+	if ( fd < 0 )
+		return false;
+	struct stat st;
+	if ( fstat( fd, &st ) != 0 || st.st_size == 0 )
+	{
+		close( fd );
+		return false;
+	}
+	map.size = st.st_size;
+	void *pBase = mmap( NULL, map.size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if ( pBase == MAP_FAILED )
+		return false;
+	map.pBase = (const unsigned char *)pBase;
+#endif
+	return true;
+}
+
+void UnmapFile( s_mappedfile_t &map )
+{
+	if ( !map.pBase )
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile( map.pBase );
+	CloseHandle( map.hMapping );
+	CloseHandle( map.hFile );
+#else
+	munmap( (void *)map.pBase, map.size );
+#endif
+	map.pBase = NULL;
+}
+
+//-----------------------------------------------------------------------------
+// CLineReader
+//-----------------------------------------------------------------------------
+CLineReader::CLineReader()
+{
+	memset( &m_Map, 0, sizeof( m_Map ) );
+	m_pNext = m_pEnd = m_pLine = m_pLineEnd = NULL;
+}
+
+CLineReader::~CLineReader()
+{
+	Close();
+}
+
+bool CLineReader::Open( const char *pFileName )
+{
+	Close();
+
+	if ( !MapFile( pFileName, m_Map ) )
+	{
+		// MapFile() turns down empty files, which just have no lines
+		FILE *fp = fopen( pFileName, "rb" );
+		if ( !fp )
+			return false;
+		bool bEmpty = fseek( fp, 0, SEEK_END ) == 0 && ftell( fp ) == 0;
+		fclose( fp );
+		if ( !bEmpty )
+			return false;
+	}
+
+	m_pNext = (const char *)m_Map.pBase;
+	m_pEnd = m_pNext + m_Map.size;
+	m_pLine = m_pLineEnd = m_pNext;
+	return true;
+}
+
+void CLineReader::Close()
+{
+	UnmapFile( m_Map );
+	memset( &m_Map, 0, sizeof( m_Map ) );
+	m_pNext = m_pEnd = m_pLine = m_pLineEnd = NULL;
+}
+
+bool CLineReader::NextLine()
+{
+	if ( m_pNext >= m_pEnd )
+		return false;
+
+	m_pLine = m_pNext;
+	m_pLineEnd = FindLineEnd( m_pNext, m_pEnd );
+	m_pNext = m_pLineEnd;
+	return true;
+}
+
+const char *CLineReader::FindLineEnd( const char *pLine, const char *pEnd )
+{
+	const char *pNewline = (const char *)memchr( pLine, '\n', pEnd - pLine );
+	return pNewline ? pNewline + 1 : pEnd;
+}
+
+void CLineReader::CopyLine( char *pBuf, int nSize ) const
+{
+	CopyLine( m_pLine, m_pLineEnd, pBuf, nSize );
+}
+
+void CLineReader::CopyLine( const char *pLine, const char *pLineEnd, char *pBuf, int nSize )
+{
+	int64 nLength = pLineEnd - pLine;
+	bool bCRLF = nLength >= 2 && pLineEnd[-2] == '\r' && pLineEnd[-1] == '\n';
+	if ( bCRLF )
+	{
+		nLength--;
+	}
+
+	int nCopy = ( nLength < nSize - 1 ) ? (int)nLength : nSize - 1;
+	memcpy( pBuf, pLine, nCopy );
+	if ( bCRLF && nCopy == nLength )
+	{
+		pBuf[nCopy - 1] = '\n';
+	}
+	pBuf[nCopy] = '\0';
+}
+
+bool CLineReader::GetLine( char *pBuf, int nSize )
+{
+	if ( !NextLine() )
+		return false;
+
+	CopyLine( pBuf, nSize );
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// CLineScanner
+//-----------------------------------------------------------------------------
+static inline bool IsSpace( char c )
+{
+	return c == ' ' || ( c >= '\t' && c <= '\r' );
+}
+
+static inline bool IsDigit( char c )
+{
+	return c >= '0' && c <= '9';
+}
+
+void CLineScanner::SkipSpace()
+{
+	while ( m_p < m_pEnd && IsSpace( *m_p ) )
+	{
+		m_p++;
+	}
+}
+
+bool CLineScanner::Skip( char c )
+{
+	if ( m_p >= m_pEnd || *m_p != c )
+		return false;
+
+	m_p++;
+	return true;
+}
+
+bool CLineScanner::Read( int &value )
+{
+	SkipSpace();
+
+	const char *p = m_p;
+	bool bNegative = false;
+	if ( p < m_pEnd && ( *p == '+' || *p == '-' ) )
+	{
+		bNegative = ( *p == '-' );
+		p++;
+	}
+
+	if ( p >= m_pEnd || !IsDigit( *p ) )
+		return false;
+
+	// scanf converts with strtol and truncates the long, which saturates
+	unsigned long long nLimit = bNegative ? 0ull - (unsigned long long)LONG_MIN : (unsigned long long)LONG_MAX;
+	unsigned long long n = 0;
+	for ( ; p < m_pEnd && IsDigit( *p ); p++ )
+	{
+		n = ( n > ( nLimit - ( *p - '0' ) ) / 10 ) ? nLimit : n * 10 + ( *p - '0' );
+	}
+
+	value = (int)(long)( bNegative ? 0ull - n : n );
+	m_p = p;
+	return true;
+}
+
+static inline void StrToFloat( const char *pString, char **ppStop, float &value )
+{
+	value = strtof( pString, ppStop );
+}
+
+static inline void StrToFloat( const char *pString, char **ppStop, double &value )
+{
+	value = strtod( pString, ppStop );
+}
+
+// strtof/strtod on a copy of the token, for what from_chars doesn't read the
+// same way: hex floats and values out of the type's range
+template< class T >
+static const char *ParseFloatToken( const char *p, const char *pEnd, T &value )
+{
+	char buf[256];
+	int n = 0;
+	for ( ; p + n < pEnd && n < (int)sizeof( buf ) - 1 && !IsSpace( p[n] ); n++ )
+	{
+		buf[n] = p[n];
+	}
+	buf[n] = '\0';
+
+	char *pStop;
+	StrToFloat( buf, &pStop, value );
+	return ( pStop == buf ) ? NULL : p + ( pStop - buf );
+}
+
+template< class T >
+static const char *ParseFloat( const char *p, const char *pEnd, T &value )
+{
+#if defined( __cpp_lib_to_chars )
+	// from_chars takes no '+', and stops at the 'x' of "0x"
+	const char *pDigits = p;
+	if ( pDigits < pEnd && *pDigits == '+' )
+	{
+		pDigits++;
+		if ( pDigits < pEnd && *pDigits == '-' )
+			return NULL;
+	}
+
+	const char *pMantissa = ( pDigits < pEnd && *pDigits == '-' ) ? pDigits + 1 : pDigits;
+	bool bHex = pEnd - pMantissa >= 2 && pMantissa[0] == '0' && ( pMantissa[1] == 'x' || pMantissa[1] == 'X' );
+	if ( !bHex )
+	{
+		T result;
+		std::from_chars_result r = std::from_chars( pDigits, pEnd, result );
+		if ( r.ec == std::errc() )
+		{
+			// scanf also swallows an exponent that has no digits
+			const char *pStop = r.ptr;
+			if ( pStop < pEnd && ( *pStop == 'e' || *pStop == 'E' ) )
+			{
+				pStop++;
+				if ( pStop < pEnd && ( *pStop == '+' || *pStop == '-' ) )
+					pStop++;
+			}
+			value = result;
+			return pStop;
+		}
+		if ( r.ec == std::errc::invalid_argument )
+			return NULL;
+	}
+	else if ( pEnd - pMantissa < 3 || !isxdigit( (unsigned char)pMantissa[2] ) )
+	{
+		// scanf won't read "0x" without hex digits as 0
+		return NULL;
+	}
+#endif
+
+	return ParseFloatToken( p, pEnd, value );
+}
+
+bool CLineScanner::Read( float &value )
+{
+	SkipSpace();
+
+	const char *p = ParseFloat( m_p, m_pEnd, value );
+	if ( !p )
+		return false;
+
+	m_p = p;
+	return true;
+}
+
+bool CLineScanner::Read( double &value )
+{
+	SkipSpace();
+
+	const char *p = ParseFloat( m_p, m_pEnd, value );
+	if ( !p )
+		return false;
+
+	m_p = p;
+	return true;
+}
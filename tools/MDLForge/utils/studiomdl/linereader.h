@@ -0,0 +1,114 @@
+//=======================================================================
+// Memory mapped line reader and sscanf-free value scanner for the text
+// source formats (.smd, .vta, .vrm, .obj, .vrd)
+//=======================================================================
+
+#ifndef LINEREADER_H
+#define LINEREADER_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include <string.h>
+#include "tier0/platform.h"
+
+//-----------------------------------------------------------------------------
+// Read only mapping of a whole file
+//-----------------------------------------------------------------------------
+struct s_mappedfile_t
+{
+	const unsigned char	*pBase;
+	int64				size;
+#ifdef _WIN32
+	void				*hFile;
+	void				*hMapping;
+#endif
+};
+
+bool MapFile( const char *pFileName, s_mappedfile_t &map );
+void UnmapFile( s_mappedfile_t &map );
+
+//-----------------------------------------------------------------------------
+// Steps through the lines of a mapped text file.  The current line stays in
+// the mapping: [Line(), LineEnd()) includes its '\n' like fgets() would
+// return it, but isn't NUL terminated.  Code that wants a C string, for
+// sscanf() or an error message, copies it out with CopyLine() or GetLine().
+//-----------------------------------------------------------------------------
+class CLineReader
+{
+public:
+	CLineReader();
+	~CLineReader();
+
+	bool Open( const char *pFileName );
+	void Close();
+
+	// false at the end of the file
+	bool NextLine();
+
+	const char *Line() const { return m_pLine; }
+	const char *LineEnd() const { return m_pLineEnd; }
+
+	// the current line as a C string, truncated to nSize - 1 characters,
+	// with a "\r\n" ending read as "\n" the way text mode reads it
+	void CopyLine( char *pBuf, int nSize ) const;
+
+	// NextLine() then CopyLine(), where fgets() used to be
+	bool GetLine( char *pBuf, int nSize );
+
+	// Where NextLine() reads from next, for parsers that look ahead through
+	// the mapping themselves and then Seek() past what they used
+	const char *Tell() const { return m_pNext; }
+	const char *End() const { return m_pEnd; }
+	void Seek( const char *p ) { m_pNext = p; }
+
+	// the end of the line at pLine, past its '\n'
+	static const char *FindLineEnd( const char *pLine, const char *pEnd );
+
+	static void CopyLine( const char *pLine, const char *pLineEnd, char *pBuf, int nSize );
+
+private:
+	s_mappedfile_t	m_Map;
+	const char		*m_pNext;
+	const char		*m_pEnd;
+	const char		*m_pLine;
+	const char		*m_pLineEnd;
+};
+
+//-----------------------------------------------------------------------------
+// Reads whitespace separated values off one line with the results sscanf()
+// gives for "%d", "%f" and "%lf", but without parsing a format string or
+// needing the line NUL terminated.
+//-----------------------------------------------------------------------------
+class CLineScanner
+{
+public:
+	CLineScanner( const char *pLine, const char *pEnd ) : m_p( pLine ), m_pEnd( pEnd ) {}
+	explicit CLineScanner( const CLineReader &reader ) : m_p( reader.Line() ), m_pEnd( reader.LineEnd() ) {}
+	explicit CLineScanner( const char *pLine ) : m_p( pLine ), m_pEnd( pLine + strlen( pLine ) ) {}
+
+	bool Read( int &value );
+	bool Read( float &value );
+	bool Read( double &value );
+
+	// a character that has to come next, like one in a scanf() format
+	bool Skip( char c );
+
+	// Reads the values in order, stopping at the first one that isn't
+	// there, and returns how many were read
+	template< class... T >
+	int Scan( T &... values )
+	{
+		int n = 0;
+		(void)( ( Read( values ) && ++n ) && ... );
+		return n;
+	}
+
+private:
+	void SkipSpace();
+
+	const char *m_p;
+	const char *m_pEnd;
+};
+
+#endif // LINEREADER_H
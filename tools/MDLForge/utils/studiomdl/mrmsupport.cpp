@@ -28,6 +28,7 @@
 #include "mathlib.h"
 #include "studio.h"
 #include "studiomdl.h"
+#include "linereader.h"
 //#include "..\..\dlls\activity.h"
 
 bool IsEnd( char const* pLine )
@@ -120,7 +121,7 @@ void Grab_Vertexlist( s_source_t *psource )
 {
 	while (1) 
 	{
-		if (fgets( g_szLine, sizeof( g_szLine ), g_fpInput ) != NULL) 
+		if (g_InputFile.GetLine( g_szLine, sizeof( g_szLine ) )) 
 		{
 			int j;
 			int bone;
@@ -135,12 +136,11 @@ void Grab_Vertexlist( s_source_t *psource )
 				return;
 
 
-			int i = sscanf( g_szLine, "%d %d %f %f %f %d %d %f %d %f %d %f %d %f",
-				&j, 
-				&bone, 
-				&p[0], &p[1], &p[2],
-				&iCount,
-				&bones[0], &weights[0], &bones[1], &weights[1], &bones[2], &weights[2], &bones[3], &weights[3] );
+			int i = CLineScanner( g_szLine ).Scan( j, 
+				bone, 
+				p[0], p[1], p[2],
+				iCount,
+				bones[0], weights[0], bones[1], weights[1], bones[2], weights[2], bones[3], weights[3] );
 			
 			if (i == 5)
 			{
@@ -182,7 +182,7 @@ void Grab_Facelist( s_source_t *psource )
 {
 	while (1) 
 	{
-		if (fgets( g_szLine, sizeof( g_szLine ), g_fpInput ) != NULL) 
+		if (g_InputFile.GetLine( g_szLine, sizeof( g_szLine ) )) 
 		{
 			int j;
 			s_tmpface_t f;
@@ -213,7 +213,7 @@ void Grab_Materiallist( s_source_t *psource )
 {
 	while (1) 
 	{
-		if (fgets( g_szLine, sizeof( g_szLine ), g_fpInput ) != NULL) 
+		if (g_InputFile.GetLine( g_szLine, sizeof( g_szLine ) )) 
 		{
 			// char name[256];
 			char path[256];
@@ -251,7 +251,7 @@ void Grab_Texcoordlist( s_source_t *psource )
 {
 	while (1) 
 	{
-		if (fgets( g_szLine, sizeof( g_szLine ), g_fpInput ) != NULL) 
+		if (g_InputFile.GetLine( g_szLine, sizeof( g_szLine ) )) 
 		{
 			int j;
 			Vector2D t;
@@ -262,9 +262,8 @@ void Grab_Texcoordlist( s_source_t *psource )
 			if (IsEnd(g_szLine)) 
 				return;
 
-			if (sscanf( g_szLine, "%d %f %f",
-				&j, 
-				&t[0], &t[1]) == 3)
+			if (CLineScanner( g_szLine ).Scan( j, 
+				t[0], t[1] ) == 3)
 			{
 				t[1] = 1.0 - t[1];
 				g_texcoord[j][0] = t[0];
@@ -286,7 +285,7 @@ void Grab_Normallist( s_source_t *psource )
 {
 	while (1) 
 	{
-		if (fgets( g_szLine, sizeof( g_szLine ), g_fpInput ) != NULL) 
+		if (g_InputFile.GetLine( g_szLine, sizeof( g_szLine ) )) 
 		{
 			int j;
 			int bone;
@@ -299,10 +298,9 @@ void Grab_Normallist( s_source_t *psource )
 				return;
 
 
-			if (sscanf( g_szLine, "%d %d %f %f %f",
-				&j, 
-				&bone, 
-				&n[0], &n[1], &n[2]) == 5)
+			if (CLineScanner( g_szLine ).Scan( j, 
+				bone, 
+				n[0], n[1], n[2] ) == 5)
 			{
 				if (bone < 0 || bone >= psource->numbones) 
 				{
@@ -327,7 +325,7 @@ void Grab_Faceattriblist( s_source_t *psource )
 {
 	while (1) 
 	{
-		if (fgets( g_szLine, sizeof( g_szLine ), g_fpInput ) != NULL) 
+		if (g_InputFile.GetLine( g_szLine, sizeof( g_szLine ) )) 
 		{
 			int j;
 			int smooth;
@@ -665,7 +663,7 @@ void Grab_MRMFaceupdates( s_source_t *psource )
 {
 	while (1) 
 	{
-		if (fgets( g_szLine, sizeof( g_szLine ), g_fpInput ) != NULL) 
+		if (g_InputFile.GetLine( g_szLine, sizeof( g_szLine ) )) 
 		{
 			g_iLinecount++;
 
@@ -693,7 +691,7 @@ int Load_VRM ( s_source_t *psource )
 
 	g_iLinecount = 0;
 
-	while (fgets( g_szLine, sizeof( g_szLine ), g_fpInput ) != NULL) {
+	while (g_InputFile.GetLine( g_szLine, sizeof( g_szLine ) )) {
 		g_iLinecount++;
 		sscanf( g_szLine, "%1023s %d", cmd, &option );
 		if (stricmp( cmd, "version" ) == 0) {
@@ -774,7 +772,7 @@ int Load_VRM ( s_source_t *psource )
 	UnifyIndices( psource );
 	BuildIndividualMeshes( psource );
 
-	fclose( g_fpInput );
+	g_InputFile.Close();
 
 	return 1;
 }
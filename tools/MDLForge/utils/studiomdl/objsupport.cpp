@@ -28,6 +28,7 @@
 #include "mathlib.h"
 #include "studio.h"
 #include "studiomdl.h"
+#include "linereader.h"
 //#include "..\..\dlls\activity.h"
 
 bool IsEnd( char const* pLine );
@@ -42,6 +43,27 @@ void UnifyIndices( s_source_t *psource );
 void BuildIndividualMeshes( s_source_t *psource );
 
 
+//-----------------------------------------------------------------------------
+// Purpose: sscanf( pLine, "%d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d", ... )
+//-----------------------------------------------------------------------------
+static int ScanFaceIndices( const char *pLine, int &v0, int &t0, int &n0, int &v1, int &t1, int &n1, 
+	int &v2, int &t2, int &n2, int &v3, int &t3, int &n3 )
+{
+	int *pIndices[12] = { &v0, &t0, &n0, &v1, &t1, &n1, &v2, &t2, &n2, &v3, &t3, &n3 };
+
+	CLineScanner scan( pLine );
+	int i;
+	for (i = 0; i < 12; i++)
+	{
+		if ((i % 3) != 0 && !scan.Skip( '/' ))
+			break;
+		if (!scan.Read( *pIndices[i] ))
+			break;
+	}
+	return i;
+}
+
+
 int Load_OBJ( s_source_t *psource )
 {
 	char	cmd[1024];
@@ -72,7 +94,7 @@ int Load_OBJ( s_source_t *psource )
 	psource->rawanim[0][0].rot.Init();
 	Build_Reference( psource );
 
-	while (fgets( g_szLine, sizeof( g_szLine ), g_fpInput ) != NULL) {
+	while (g_InputFile.GetLine( g_szLine, sizeof( g_szLine ) )) {
 		g_iLinecount++;
 		Vector tmp;
 
@@ -80,7 +102,7 @@ int Load_OBJ( s_source_t *psource )
 		{
 			i = g_numverts++;
 
-			sscanf( g_szLine, "v %f %f %f", &g_vertex[i].x, &g_vertex[i].y, &g_vertex[i].z );
+			CLineScanner( g_szLine + 2 ).Scan( g_vertex[i].x, g_vertex[i].y, g_vertex[i].z );
 			g_bone[i].numbones = 1;
 			g_bone[i].bone[0] = 0;
 			g_bone[i].weight[0] = 1.0;
@@ -88,12 +110,12 @@ int Load_OBJ( s_source_t *psource )
 		else if (strncmp( g_szLine, "vn ", 3 ) == 0)
 		{
 			i = g_numnormals++;
-			sscanf( g_szLine, "vn %f %f %f", &g_normal[i].x, &g_normal[i].y, &g_normal[i].z );
+			CLineScanner( g_szLine + 3 ).Scan( g_normal[i].x, g_normal[i].y, g_normal[i].z );
 		}
 		else if (strncmp( g_szLine, "vt ", 3 ) == 0)
 		{
 			i = g_numtexcoords++;
-			sscanf( g_szLine, "vt %f %f", &g_texcoord[i].x, &g_texcoord[i].y );
+			CLineScanner( g_szLine + 3 ).Scan( g_texcoord[i].x, g_texcoord[i].y );
 			g_texcoord[i].y = 1.0 - g_texcoord[i].y;
 
 		}
@@ -116,7 +138,7 @@ int Load_OBJ( s_source_t *psource )
 
 			i = g_numfaces++;
 
-			j = sscanf( g_szLine, "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d", &v0, &t0, &n0, &v1, &t1, &n1, &v2, &t2, &n2, &v3, &t3, &n3 );
+			j = ScanFaceIndices( g_szLine + 2, v0, t0, n0, v1, t1, n1, v2, t2, n2, v3, t3, n3 );
 
 			f.material = material;
 			f.a = v0 - 1; f.na = n0 - 1, f.ta = t0 - 1;
@@ -144,7 +166,7 @@ int Load_OBJ( s_source_t *psource )
 
 	BuildIndividualMeshes( psource );
 
-	fclose( g_fpInput );
+	g_InputFile.Close();
 
 	return 1;
 }
@@ -176,7 +198,7 @@ int AppendVTAtoOBJ( s_source_t *psource, char *filename, int frame )
 
 	g_numverts = g_numnormals = g_numtexcoords = g_numfaces = 0;
 
-	while (fgets( g_szLine, sizeof( g_szLine ), g_fpInput ) != NULL) {
+	while (g_InputFile.GetLine( g_szLine, sizeof( g_szLine ) )) {
 		g_iLinecount++;
 		Vector tmp;
 
@@ -184,7 +206,7 @@ int AppendVTAtoOBJ( s_source_t *psource, char *filename, int frame )
 		{
 			i = g_numverts++;
 
-			sscanf( g_szLine, "v %f %f %f", &tmp.x, &tmp.y, &tmp.z );
+			CLineScanner( g_szLine + 2 ).Scan( tmp.x, tmp.y, tmp.z );
 			VectorTransform( tmp, m, g_vertex[i] );
 
 			// printf("%f %f %f\n", g_vertex[i].x, g_vertex[i].y, g_vertex[i].z );
@@ -196,13 +218,13 @@ int AppendVTAtoOBJ( s_source_t *psource, char *filename, int frame )
 		else if (strncmp( g_szLine, "vn ", 3 ) == 0)
 		{
 			i = g_numnormals++;
-			sscanf( g_szLine, "vn %f %f %f", &tmp.x, &tmp.y, &tmp.z );
+			CLineScanner( g_szLine + 3 ).Scan( tmp.x, tmp.y, tmp.z );
 			VectorTransform( tmp, m, g_normal[i] );
 		}
 		else if (strncmp( g_szLine, "vt ", 3 ) == 0)
 		{
 			i = g_numtexcoords++;
-			sscanf( g_szLine, "vt %f %f", &g_texcoord[i].x, &g_texcoord[i].y );
+			CLineScanner( g_szLine + 3 ).Scan( g_texcoord[i].x, g_texcoord[i].y );
 		}
 		else if (strncmp( g_szLine, "usemtl ", 7 ) == 0)
 		{
@@ -223,7 +245,7 @@ int AppendVTAtoOBJ( s_source_t *psource, char *filename, int frame )
 
 			i = g_numfaces++;
 
-			j = sscanf( g_szLine, "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d", &v0, &t0, &n0, &v1, &t1, &n1, &v2, &t2, &n2, &v3, &t3, &n3 );
+			j = ScanFaceIndices( g_szLine + 2, v0, t0, n0, v1, t1, n1, v2, t2, n2, v3, t3, n3 );
 
 			f.material = material;
 			f.a = v0 - 1; f.na = n0 - 1, f.ta = 0;
@@ -280,7 +302,7 @@ int AppendVTAtoOBJ( s_source_t *psource, char *filename, int frame )
 		psource->vanim[t][i].normal = g_normal[v_listdata[i].n];
 	}
 
-	fclose( g_fpInput );
+	g_InputFile.Close();
 
 	return 1;
 }
@@ -23,6 +23,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <float.h>
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <vector>
 #include <mathlib.h>
 #include "cmdlib.h"
 #include "studio.h"
@@ -34,6 +38,7 @@
 #include "mstristrip.h"
 #endif
 #include "optimize.h"
+#include "perfstats.h"
 #if defined(OSX)
 #include <malloc/malloc.h>
 #elif defined(_WIN32) || defined(_LINUX)
@@ -41,6 +46,7 @@
 #endif
 #include <nvtristrip.h>
 #include "filebuffer.h"
+#include "threads.h"
 #include "tier1/utlvector.h"
 #include "materialsystem/imaterial.h"
 
@@ -113,9 +119,8 @@ struct BoneStateChange_t
 
 struct Strip_t
 {
-	// these are the verts and indices that are used while building.
-	// (there may be verts in here that aren't use in the stripGroup.)
-	CUtlVector<Vertex_t> verts;
+	// these are the indices that are used while building; they index
+	// the strip group's sourceVerts, which all of its strips share.
 	int numIndices;
 	unsigned short *pIndices;
 
@@ -144,6 +149,122 @@ typedef CUtlVector<unsigned short>	VertexIndexList_t;
 typedef CUtlVector<Strip_t>		StripList_t;
 typedef CUtlVector<bool>		TriangleProcessedList_t;
 
+//-----------------------------------------------------------------------------
+// The untouched triangles of a HW skinned strip group, bucketed by how many
+// of their bones the hardware matrix state doesn't have.  The counts are
+// updated as bones are allocated and freed, so picking the next triangle
+// doesn't rescan the list.  Each bucket is a min-heap of triangle indices,
+// so it gives the first triangle in list order, as the scans it replaces
+// did.  Entries a count change or touching a triangle leaves behind are
+// dropped when they come to the top.
+//-----------------------------------------------------------------------------
+
+class CUntouchedTriangles
+{
+public:
+	void Init( TriangleList_t& triangles, int numBones );
+
+	void BoneAllocated( int bone ) { UpdateBone( bone, -1 ); }
+	void BoneFreed( int bone ) { UpdateBone( bone, 1 ); }
+
+	int NewBonesNeeded( int tri ) const { return m_NewBones[tri]; }
+
+	// first untouched triangle needing numNewBones new bones, -1 if none
+	int First( int numNewBones );
+
+	// first untouched triangle, -1 if none
+	int First();
+
+private:
+	typedef std::priority_queue< int, std::vector<int>, std::greater<int> > Bucket_t;
+
+	void UpdateBone( int bone, int delta );
+
+	TriangleList_t *m_pTriangles;
+	std::vector<int> m_NewBones;
+	std::vector<int> m_BoneTriStart;	// m_BoneTris[m_BoneTriStart[bone]...] use the bone
+	std::vector<int> m_BoneTris;
+	Bucket_t m_Buckets[MAX_NUM_BONES_PER_TRI + 1];
+	int m_FirstUntouched;
+};
+
+void CUntouchedTriangles::Init( TriangleList_t& triangles, int numBones )
+{
+	m_pTriangles = &triangles;
+	m_FirstUntouched = 0;
+	m_NewBones.resize( triangles.Size() );
+	for( int i = 0; i <= MAX_NUM_BONES_PER_TRI; i++ )
+	{
+		m_Buckets[i] = Bucket_t();
+	}
+
+	m_BoneTriStart.assign( numBones + 1, 0 );
+	for( int i = 0; i < triangles.Size(); i++ )
+	{
+		for( int j = 0; j < triangles[i].numBones; j++ )
+		{
+			++m_BoneTriStart[triangles[i].boneID[j] + 1];
+		}
+	}
+	for( int bone = 0; bone < numBones; bone++ )
+	{
+		m_BoneTriStart[bone + 1] += m_BoneTriStart[bone];
+	}
+
+	// nothing is allocated yet, every triangle needs all of its bones
+	std::vector<int> next( m_BoneTriStart.begin(), m_BoneTriStart.end() - 1 );
+	m_BoneTris.resize( m_BoneTriStart[numBones] );
+	for( int i = 0; i < triangles.Size(); i++ )
+	{
+		for( int j = 0; j < triangles[i].numBones; j++ )
+		{
+			m_BoneTris[next[triangles[i].boneID[j]]++] = i;
+		}
+		m_NewBones[i] = triangles[i].numBones;
+		if( !triangles[i].touched )
+		{
+			m_Buckets[m_NewBones[i]].push( i );
+		}
+	}
+}
+
+void CUntouchedTriangles::UpdateBone( int bone, int delta )
+{
+	TriangleList_t& triangles = *m_pTriangles;
+	for( int i = m_BoneTriStart[bone]; i < m_BoneTriStart[bone + 1]; i++ )
+	{
+		int tri = m_BoneTris[i];
+		if( triangles[tri].touched )
+			continue;
+
+		m_NewBones[tri] += delta;
+		m_Buckets[m_NewBones[tri]].push( tri );
+	}
+}
+
+int CUntouchedTriangles::First( int numNewBones )
+{
+	Bucket_t& bucket = m_Buckets[numNewBones];
+	while( !bucket.empty() )
+	{
+		int tri = bucket.top();
+		if( !(*m_pTriangles)[tri].touched && m_NewBones[tri] == numNewBones )
+			return tri;
+		bucket.pop();
+	}
+	return -1;
+}
+
+int CUntouchedTriangles::First()
+{
+	TriangleList_t& triangles = *m_pTriangles;
+	while( m_FirstUntouched < triangles.Size() && triangles[m_FirstUntouched].touched )
+	{
+		++m_FirstUntouched;
+	}
+	return ( m_FirstUntouched < triangles.Size() ) ? m_FirstUntouched : -1;
+}
+
 //-----------------------------------------------------------------------------
 // String table
 //-----------------------------------------------------------------------------
@@ -219,9 +340,6 @@ private:
 	CUtlVector<CharVector_t> m_Strings;
 };
 
-// global string table for the whole vtx file.
-static CStringTable s_StringTable;
-
 //-----------------------------------------------------------------------------
 // This is all the indices, vertices, and strips that make up this group
 // a group can be rendered all in one call to the material system
@@ -232,6 +350,10 @@ struct StripGroup_t
 	VertexIndexList_t	indices;
 	VertexList_t		verts;
 	StripList_t			strips;
+
+	// the vertices the strips index while building, before
+	// PostProcessStripGroup() sorts the ones they use into verts
+	VertexList_t		sourceVerts;
 	unsigned int flags;
 };
 
@@ -263,6 +385,13 @@ public:
 		bool usesFixedFunction, bool bForceSoftwareSkin, bool bHWFlex, int maxBonesPerVert, int maxBonesPerTri, 
 		int maxBonesPerStrip, const char *fileName, const char *glViewFileName );
 
+	// Prints what OptimizeFromStudioHdr built; kept separate so concurrent
+	// passes can report in a stable order once they're all done.
+	void OutputReport( void );
+
+	// Hands over the finished vtx image (malloc'd), NULL if none was built
+	void *DetachFileData( int *pSize );
+
 private:
 	void CleanupEverything();
 
@@ -369,6 +498,7 @@ private:
 	void WriteGLViewFiles( studiohdr_t *pHdr, const char *glViewFileName );
 
 	void OutputMemoryUsage( void );
+	void AddMaterialReplacementsToStringTable( void );
 	bool IsVertexFlexed( mstudiomesh_t *pStudioMesh, int vertID ) const;
 	void BuildNeighborInfo( TriangleList_t& list );
 	void ClearTouched( void );
@@ -445,8 +575,17 @@ private:
 
 	CHardwareMatrixState m_HardwareMatrixState;
 
+	// the triangles of the HW skinned strip group being built
+	CUntouchedTriangles m_UntouchedTriangles;
+
 	// a place to stick file output.
 	CFileBuffer *m_FileBuffer;
+	char m_FileName[MAX_PATH];
+	void *m_pFileData;
+	int m_FileDataSize;
+
+	// string table for the whole vtx file.
+	CStringTable m_StringTable;
 
 	// offset for different items in the output file.
 	int m_BodyPartsOffset;
@@ -464,13 +603,6 @@ private:
 	int m_EndOfFileOffset;
 };
 
-//-----------------------------------------------------------------------------
-// Singleton instance
-//-----------------------------------------------------------------------------
-
-static COptimizedModel s_OptimizedModel;
-
-
 //-----------------------------------------------------------------------------
 // Cleanup method
 //-----------------------------------------------------------------------------
@@ -538,22 +670,6 @@ void COptimizedModel::SanityCheckAgainstStudioHDR( studiohdr_t *phdr )
 
 
 
-//-----------------------------------------------------------------------------
-// pick any triangle that hasn't been used yet to start with.
-//-----------------------------------------------------------------------------
-
-static Triangle_t *GetNextUntouched( TriangleList_t& triangles )
-{
-	int i;
-	for( i = 0; i < triangles.Size(); i++ )
-	{
-		if( !triangles[i].touched )
-			return &triangles[i];
-	}
-	return 0;
-}
-
-
 //-----------------------------------------------------------------------------
 // Returns the number of bones that are not represented in the current hardware state
 //-----------------------------------------------------------------------------
@@ -578,32 +694,18 @@ inline int COptimizedModel::ComputeNewBonesNeeded( Triangle_t const& triangle )
 
 Triangle_t* COptimizedModel::GetNextUntouchedWithoutBoneStateChange( TriangleList_t& triangles )
 {
-	Triangle_t *bestTriangle = 0;
-	int bestNumNewBones = MAX_NUM_BONES_PER_TRI + 1;
-	
-	int i;
-	for( i = 0; i < triangles.Size(); i++ )
+	// The first triangle needing the fewest new bones, if they fit
+	int maxNumNewBones = min( m_HardwareMatrixState.FreeMatrixCount(), MAX_NUM_BONES_PER_TRI );
+	for( int numNewBones = 0; numNewBones <= maxNumNewBones; numNewBones++ )
 	{
-		// We haven't processed this one, so let's try it
-		if( !triangles[i].touched )
+		int tri = m_UntouchedTriangles.First( numNewBones );
+		if( tri >= 0 )
 		{
-			// How many bones are not represented in the current state?
-			int numNewBones = ComputeNewBonesNeeded( triangles[i] );
-
-			// if this triangle fit and if it's the best so far, save it.
-			if ( (numNewBones <= m_HardwareMatrixState.FreeMatrixCount()) && 
-				 (numNewBones < bestNumNewBones ) )
-			{
-				bestNumNewBones = numNewBones;
-				bestTriangle = &triangles[i];
-
-				// Can't get any better than this!
-				if (bestNumNewBones == 0)
-					break;
-			}
+			Assert( ComputeNewBonesNeeded( triangles[tri] ) == numNewBones );
+			return &triangles[tri];
 		}
 	}
-	return bestTriangle;
+	return 0;
 }
 
 
@@ -615,22 +717,17 @@ Triangle_t* COptimizedModel::GetNextUntouchedWithoutBoneStateChange( TriangleLis
 Triangle_t *COptimizedModel::GetNextUntouchedWithLeastBoneStateChanges( TriangleList_t& triangles )
 {
 	Triangle_t *bestTriangle = 0;
-	int bestNumNewBones = MAX_NUM_BONES_PER_TRI + 1;
-	int i;
+	int bestNumNewBones;
 	
 	// For this one, just find the triangle that needs the least number
 	// of new bones. That way, we'll not have to change too many states
-	for( i = 0; i < triangles.Size(); i++ )
+	for( bestNumNewBones = 0; bestNumNewBones <= MAX_NUM_BONES_PER_TRI; bestNumNewBones++ )
 	{
-		if( !triangles[i].touched )
+		int tri = m_UntouchedTriangles.First( bestNumNewBones );
+		if( tri >= 0 )
 		{
-			int numNewBones = ComputeNewBonesNeeded( triangles[i] );
-
-			if( numNewBones < bestNumNewBones )
-			{
-				bestNumNewBones = numNewBones;
-				bestTriangle = &triangles[i];
-			}
+			bestTriangle = &triangles[tri];
+			break;
 		}
 	}
 	
@@ -639,12 +736,19 @@ Triangle_t *COptimizedModel::GetNextUntouchedWithLeastBoneStateChanges( Triangle
 		return 0;
 
 #ifdef USE_FLUSH
+	for( int i = 0; i < m_HardwareMatrixState.AllocatedMatrixCount(); i++ )
+	{
+		m_UntouchedTriangles.BoneFreed( m_HardwareMatrixState.GetNthBoneGlobalID( i ) );
+	}
 	m_HardwareMatrixState.DeallocateAll();
 #else
 	// Remove bones until we have enough space...
 	int numToRemove = bestNumNewBones - m_HardwareMatrixState.FreeMatrixCount();
 	assert( numToRemove > 0 );
-	m_HardwareMatrixState.DeallocateLRU(numToRemove);
+	for( int i = 0; i < numToRemove; i++ )
+	{
+		m_UntouchedTriangles.BoneFreed( m_HardwareMatrixState.DeallocateLRU() );
+	}
 #endif
 
 	return bestTriangle;
@@ -664,6 +768,7 @@ bool COptimizedModel::AllocateHardwareBonesForTriangle( Triangle_t *tri )
 		{
 			if( !m_HardwareMatrixState.AllocateMatrix( bone ) )
 				return false;
+			m_UntouchedTriangles.BoneAllocated( bone );
 		}
 	}
 	return true;
@@ -785,7 +890,8 @@ void COptimizedModel::BuildStripsRecursive( VertexIndexList_t& indices,
 		return;
 
 	// Only suck in triangles that need no state change
-	if (ComputeNewBonesNeeded( *triangle ))
+	Assert( m_UntouchedTriangles.NewBonesNeeded( triangle - tris.Base() ) == ComputeNewBonesNeeded( *triangle ) );
+	if (m_UntouchedTriangles.NewBonesNeeded( triangle - tris.Base() ))
 		return;
 
 	// We've got enough hardware bones. Lets add this triangle's vertices, and 
@@ -825,8 +931,12 @@ void COptimizedModel::BuildHWSkinnedStrips( TriangleList_t& triangles,
 	VertexIndexList_t trianglesToStrip;
 	trianglesToStrip.EnsureCapacity( triangles.Size() * 3 );
 
+	// Bucket the triangles by the bones they need
+	m_UntouchedTriangles.Init( triangles, m_NumBones );
+
 	// pick any old unused triangle to start with.
-	Triangle_t *pSeedTri = GetNextUntouched( triangles );
+	int seedTri = m_UntouchedTriangles.First();
+	Triangle_t *pSeedTri = ( seedTri >= 0 ) ? &triangles[seedTri] : 0;
 	while( pSeedTri )
 	{
 		// Make sure we've got out transforms allocated
@@ -863,18 +973,12 @@ void COptimizedModel::BuildHWSkinnedStrips( TriangleList_t& triangles,
 		// NOTE: This allocates space for stripIndices.pIndices.
 		Stripify( trianglesToStrip, &newStrip.numIndices, &newStrip.pIndices );
 
-		// hack - should just build directly into newStrip.verts instead of using a global.
-		int i;
-		for( i = 0; i < vertices.Size(); i++ )
-		{
-			newStrip.verts.AddToTail( vertices[i] );
-		}
-
 		// Compute the number of bones in this strip
 		newStrip.numBoneStateChanges = m_HardwareMatrixState.AllocatedMatrixCount();
 		assert( newStrip.numBoneStateChanges <= maxBonesPerStrip );
 
 		// Save off the bones used for this strip.
+		int i;
 		for( i = 0; i < m_HardwareMatrixState.AllocatedMatrixCount(); i++ )
 		{
 			newStrip.boneStateChanges[i].hardwareID = IsChar( i );
@@ -924,12 +1028,6 @@ void COptimizedModel::BuildSWSkinnedStrips( TriangleList_t& triangles,
 	
 	Stripify( indices, &newStrip.numIndices, &newStrip.pIndices );
 
-	// hack - should just build directly into newStrip.verts instead of using a global.
-	for( i = 0; i < vertices.Size(); i++ )
-	{
-		newStrip.verts.AddToTail( vertices[i] );
-	}
-
 	newStrip.numBoneStateChanges = 0;
 	for( i = 0; i < MAX_NUM_BONES_PER_STRIP; i++ )
 	{
@@ -1163,20 +1261,20 @@ int COptimizedModel::CountMaxVertBones( int count, Vertex_t *pVertex ) const
 // Adds a vertex to the list of vertices to be added to the strip group
 //-----------------------------------------------------------------------------
 
-static int FindOrCreateVertex( VertexList_t& list, Vertex_t const& vert )
+static int FindOrCreateVertex( VertexList_t& list, CUtlVector<int>& vertexMap, Vertex_t const& vert )
 {
-	int i;
-	for( i = 0; i < list.Size(); i++ )
+	// vertexMap maps origMeshVertID to the index in list, -1 if it isn't there yet
+	Assert( vert.origMeshVertID < vertexMap.Size() );
+	int i = vertexMap[vert.origMeshVertID];
+	if( i >= 0 )
 	{
-		if (list[i].origMeshVertID == vert.origMeshVertID)
-		{
-			// If this is the case, then everything else should be too!
-			assert( !memcmp( &list[i], &vert, sizeof( vert )) );
-			return i;
-		}
+		// If this is the case, then everything else should be too!
+		assert( !memcmp( &list[i], &vert, sizeof( vert )) );
+		return i;
 	}
 
-	list.AddToTail( vert );
+	i = list.AddToTail( vert );
+	vertexMap[vert.origMeshVertID] = i;
 	return i;
 }
 
@@ -1225,10 +1323,23 @@ void COptimizedModel::BuildTriangleBoneData( VertexList_t& list, Triangle_t& tri
 // Computes neighboring triangles along each face of a triangle
 //-----------------------------------------------------------------------------
 
-void COptimizedModel::BuildNeighborInfo( TriangleList_t& list )
+struct NeighborEdge_t
+{
+	int v1, v2;		// sorted so v1 <= v2
+	int triID;
+	int edgeNum;
+};
+
+struct NeighborCandidate_t
 {
 	int triID1, triID2;
 	int edgeNum1, edgeNum2;
+};
+
+void COptimizedModel::BuildNeighborInfo( TriangleList_t& list )
+{
+	int triID1;
+	int edgeNum1;
 
 	// Reset all edge information for all triangles
 	for( triID1 = 0; triID1 < list.Size(); triID1++ )
@@ -1239,39 +1350,99 @@ void COptimizedModel::BuildNeighborInfo( TriangleList_t& list )
 		}
 	}
 
-	// For each edge in each triangle, find another triangle that has 
-	// an edge that shares both vertices
+	// Sort every edge by its (undirected) vertex pair so edges
+	// that share both vertices end up next to each other
+	std::vector<NeighborEdge_t> edges;
+	edges.reserve( (size_t)list.Size() * 3 );
 	for( triID1 = 0; triID1 < list.Size(); triID1++ )
 	{
-		for( triID2 = triID1 + 1; triID2 < list.Size(); triID2++ )
+		for( edgeNum1 = 0; edgeNum1 < 3; edgeNum1++ )
 		{
-			for( edgeNum1 = 0; edgeNum1 < 3; ++edgeNum1 )
+			NeighborEdge_t edge;
+			edge.v1 = list[triID1].vertID[edgeNum1];
+			edge.v2 = list[triID1].vertID[(edgeNum1+1)%3];
+			if( edge.v1 > edge.v2 )
 			{
-				int t1v1 = list[triID1].vertID[edgeNum1];
-				int t1v2 = list[triID1].vertID[(edgeNum1+1)%3];
+				std::swap( edge.v1, edge.v2 );
+			}
+			edge.triID = triID1;
+			edge.edgeNum = edgeNum1;
+			edges.push_back( edge );
+		}
+	}
 
-				for( edgeNum2 = 0; edgeNum2 < 3; ++edgeNum2 )
-				{
-					int t2v1 = list[triID2].vertID[edgeNum2];
-					int t2v2 = list[triID2].vertID[(edgeNum2+1)%3];
+	std::sort(
+		edges.begin(),
+		edges.end(),
+		[]( const NeighborEdge_t &a, const NeighborEdge_t &b )
+		{
+			if( a.v1 != b.v1 )
+				return a.v1 < b.v1;
+			if( a.v2 != b.v2 )
+				return a.v2 < b.v2;
+			if( a.triID != b.triID )
+				return a.triID < b.triID;
+			return a.edgeNum < b.edgeNum;
+		} );
+
+	// Every pair of distinct triangles that share an edge is a candidate
+	std::vector<NeighborCandidate_t> candidates;
+	size_t runStart, runEnd;
+	for( runStart = 0; runStart < edges.size(); runStart = runEnd )
+	{
+		for( runEnd = runStart + 1; runEnd < edges.size(); runEnd++ )
+		{
+			if( edges[runEnd].v1 != edges[runStart].v1 || edges[runEnd].v2 != edges[runStart].v2 )
+				break;
+		}
 
-					if ( (( t1v1 == t2v1 ) && (t1v2 == t2v2)) ||
-						 (( t1v2 == t2v1 ) && (t1v1 == t2v2)) ) 
-					{
-						// Check for T-junctions
-						// This actually does happen; hmm... for now, I'll
-						// just not mark this as a neighbor if a T-junction is found
-						if( (list[triID1].neighborTriID[edgeNum1] == -1 ) &&
-							( list[triID2].neighborTriID[edgeNum2] == -1 ) )
-						{
-							list[triID1].neighborTriID[edgeNum1] = triID2;
-							list[triID2].neighborTriID[edgeNum2] = triID1;
-						}
-					}
-				}
+		for( size_t i = runStart; i < runEnd; i++ )
+		{
+			for( size_t j = i + 1; j < runEnd; j++ )
+			{
+				if( edges[i].triID == edges[j].triID )
+					continue;
+
+				NeighborCandidate_t candidate;
+				candidate.triID1 = edges[i].triID;
+				candidate.edgeNum1 = edges[i].edgeNum;
+				candidate.triID2 = edges[j].triID;
+				candidate.edgeNum2 = edges[j].edgeNum;
+				candidates.push_back( candidate );
 			}
 		}
 	}
+
+	// Hand out neighbors in the order a triangle-by-triangle scan would find
+	// them, so the first match still wins when an edge is shared more than once
+	std::sort(
+		candidates.begin(),
+		candidates.end(),
+		[]( const NeighborCandidate_t &a, const NeighborCandidate_t &b )
+		{
+			if( a.triID1 != b.triID1 )
+				return a.triID1 < b.triID1;
+			if( a.triID2 != b.triID2 )
+				return a.triID2 < b.triID2;
+			if( a.edgeNum1 != b.edgeNum1 )
+				return a.edgeNum1 < b.edgeNum1;
+			return a.edgeNum2 < b.edgeNum2;
+		} );
+
+	for( size_t i = 0; i < candidates.size(); i++ )
+	{
+		const NeighborCandidate_t &candidate = candidates[i];
+
+		// Check for T-junctions
+		// This actually does happen; hmm... for now, I'll
+		// just not mark this as a neighbor if a T-junction is found
+		if( (list[candidate.triID1].neighborTriID[candidate.edgeNum1] == -1 ) &&
+			( list[candidate.triID2].neighborTriID[candidate.edgeNum2] == -1 ) )
+		{
+			list[candidate.triID1].neighborTriID[candidate.edgeNum1] = candidate.triID2;
+			list[candidate.triID2].neighborTriID[candidate.edgeNum2] = candidate.triID1;
+		}
+	}
 }
 
 
@@ -1290,7 +1461,15 @@ void COptimizedModel::ProcessStripGroup( StripGroup_t *pStripGroup, bool isHWSki
 
 	// all of the triangles before stripping for the current stripgroup.
 	TriangleList_t	stripGroupSourceTriangles;
-	VertexList_t	stripGroupVertices;
+	VertexList_t&	stripGroupVertices = pStripGroup->sourceVerts;
+
+	// where each mesh vertex landed in stripGroupVertices
+	CUtlVector<int>	stripGroupVertexMap;
+	stripGroupVertexMap.SetSize( pStudioMesh->numvertices );
+	for( int i = 0; i < stripGroupVertexMap.Size(); i++ )
+	{
+		stripGroupVertexMap[i] = -1;
+	}
 
 	// FIXME: Flexed/HWSkinned state of faces don't change with each pass.
 	// We could precompute those flags just once (instead of doing it 4 times)
@@ -1345,9 +1524,9 @@ void COptimizedModel::ProcessStripGroup( StripGroup_t *pStripGroup, bool isHWSki
 
 		Triangle_t& newTri = stripGroupSourceTriangles[triIndex];
 		newTri.touched = false;
-		newTri.vertID[0] = FindOrCreateVertex( stripGroupVertices, stripGroupVert[0] );
-		newTri.vertID[1] = FindOrCreateVertex( stripGroupVertices, stripGroupVert[1] );
-		newTri.vertID[2] = FindOrCreateVertex( stripGroupVertices, stripGroupVert[2] );
+		newTri.vertID[0] = FindOrCreateVertex( stripGroupVertices, stripGroupVertexMap, stripGroupVert[0] );
+		newTri.vertID[1] = FindOrCreateVertex( stripGroupVertices, stripGroupVertexMap, stripGroupVert[1] );
+		newTri.vertID[2] = FindOrCreateVertex( stripGroupVertices, stripGroupVertexMap, stripGroupVert[2] );
 		BuildTriangleBoneData( stripGroupVertices, newTri );
 
 		// By default, this processes a triangle
@@ -1424,6 +1603,15 @@ int COptimizedModel::CountUniqueBonesInStrip( StripGroup_t *pStripGroup, Strip_t
 void COptimizedModel::PostProcessStripGroup( mstudiomodel_t *pStudioModel, mstudiomesh_t *pStudioMesh, StripGroup_t *pStripGroup )
 {
 	int i;
+
+	// where each source vertex landed in the strip group's vertex list;
+	// anything below the current strip's vertOffset belongs to an earlier strip
+	CUtlVector<int> sourceVertMap;
+	sourceVertMap.SetSize( pStripGroup->sourceVerts.Size() );
+	for( i = 0; i < sourceVertMap.Size(); i++ )
+	{
+		sourceVertMap[i] = -1;
+	}
 	
 	// We're gonna compile all of the vertices in the current strip into
 	// the current strip group's vertex list
@@ -1443,25 +1631,17 @@ void COptimizedModel::PostProcessStripGroup( mstudiomodel_t *pStudioModel, mstud
 		int j;
 		for( j = 0; j < pStrip->numIndices; j++ )
 		{
-			int newIndex = -1;
 			int index = pStrip->pIndices[j];
-			Vertex_t *pVert = &pStrip->verts[index];
+			Vertex_t *pVert = &pStripGroup->sourceVerts[index];
 
-			// Does this vertex exist in the strip group?
-			int k;
-			for( k = vertOffset; k < pStripGroup->verts.Size(); k++ )
-			{
-				if( pVert->origMeshVertID == pStripGroup->verts[k].origMeshVertID )
-				{
-					newIndex = k;
-					break;
-				}
-			}
+			// Does this vertex exist in the strip?
+			int newIndex = sourceVertMap[index];
 
 			// Didn't find it? Add the vertex to the list
-			if( newIndex == -1 )
+			if( newIndex < vertOffset )
 			{
 				newIndex = pStripGroup->verts.AddToTail( *pVert );
+				sourceVertMap[index] = newIndex;
 			}
 			pStripGroup->indices.AddToTail( newIndex );
 
@@ -1490,6 +1670,9 @@ void COptimizedModel::PostProcessStripGroup( mstudiomodel_t *pStudioModel, mstud
 		else
 			pStrip->numBones = CountUniqueBonesInStrip(pStripGroup, pStrip);
 	}
+
+	// Nothing indexes the source vertices anymore
+	pStripGroup->sourceVerts.Purge();
 }
 
 
@@ -1618,17 +1801,7 @@ void COptimizedModel::SetupMeshProcessing( studiohdr_t *pHdr, int vertexCacheSiz
 #	endif
 #endif // NVTRISTRIP
 	
-	if( !g_quiet )
-	{
-		printf( "---------------------\n" );
-		printf( "Generating optimized mesh \"%s\":\n", fileName );
-#ifdef _DEBUG
-		printf( "\tvertex cache size: %d\n", vertexCacheSize );
-		printf( "\tmax bones/tri:     %d\n", maxBonesPerTri );
-		printf( "\tmax bones/vert:    %d\n", maxBonesPerVert );
-		printf( "\tmax bones/strip:   %d\n", maxBonesPerStrip );
-#endif
-	}
+	Q_strncpy( m_FileName, fileName, sizeof( m_FileName ) );
 
 	CleanupEverything();
 
@@ -2414,13 +2587,13 @@ void COptimizedModel::ZeroNumBones( void )
 
 void COptimizedModel::WriteStringTable( int stringTableOffset )
 {
-	int stringTableSize = s_StringTable.CalcSize();
+	int stringTableSize = m_StringTable.CalcSize();
 	if( stringTableSize == 0 )
 	{
 		return;
 	}
 	char *pTmp = new char[stringTableSize];
-	s_StringTable.WriteToMem( pTmp );
+	m_StringTable.WriteToMem( pTmp );
 	m_FileBuffer->WriteAt( stringTableOffset, pTmp, stringTableSize, "string table" );
 	char *pDebug = ( char * )m_FileBuffer->GetPointer( stringTableOffset );
 	delete [] pTmp;
@@ -2440,7 +2613,7 @@ void COptimizedModel::WriteMaterialReplacements( int materialReplacementsOffset
 			MaterialReplacementHeader_t tmpHeader;
 			tmpHeader.materialID = FindMaterialByName( materialReplacement.GetSrcName() );
 			tmpHeader.replacementMaterialNameOffset = m_StringTableOffset + 
-				s_StringTable.StringTableOffset( materialReplacement.GetDstName() ) - offset;
+				m_StringTable.StringTableOffset( materialReplacement.GetDstName() ) - offset;
 			m_FileBuffer->WriteAt( offset, &tmpHeader, sizeof( tmpHeader ), "material replacements" );
 			offset += sizeof( MaterialReplacementHeader_t );
 		}
@@ -2539,7 +2712,7 @@ void COptimizedModel::WriteVTXFile( studiohdr_t *pHdr, const char *pFileName,
 	m_IndicesOffset = m_VertsOffset + sizeof( Vertex_t ) * stats.m_TotalVerts;
 	m_BoneStageChangesOffset = m_IndicesOffset + sizeof( unsigned short ) * stats.m_TotalIndices;
 	m_StringTableOffset = m_BoneStageChangesOffset + sizeof( BoneStateChangeHeader_t ) * stats.m_TotalBoneStateChanges;
-	m_MaterialReplacementsOffset = m_StringTableOffset + s_StringTable.CalcSize();
+	m_MaterialReplacementsOffset = m_StringTableOffset + m_StringTable.CalcSize();
 	m_MaterialReplacementsListOffset = m_MaterialReplacementsOffset + stats.m_TotalMaterialReplacements * sizeof( MaterialReplacementHeader_t );
 	m_EndOfFileOffset = m_MaterialReplacementsListOffset + g_ScriptLODs.Size() * sizeof( MaterialReplacementListHeader_t );
 	
@@ -2637,11 +2810,6 @@ void COptimizedModel::WriteVTXFile( studiohdr_t *pHdr, const char *pFileName,
 //	DebugCompareVerts( phdr );
 	SanityCheckAgainstStudioHDR( pHdr );
 
-	if ( !g_quiet )
-	{
-		OutputMemoryUsage();
-	}
-		
 	RemoveRedundantBoneStateChanges();
 	if( g_staticprop )
 	{
@@ -2653,7 +2821,9 @@ void COptimizedModel::WriteVTXFile( studiohdr_t *pHdr, const char *pFileName,
 //	ShowStats();
 #endif
 		
-	m_FileBuffer->WriteToFile( pFileName, m_EndOfFileOffset );
+	m_pFileData = malloc( m_EndOfFileOffset );
+	memcpy( m_pFileData, m_FileBuffer->GetPointer( 0 ), m_EndOfFileOffset );
+	m_FileDataSize = m_EndOfFileOffset;
 
 	FileHeader_t *pVtxHeader = ( FileHeader_t * )m_FileBuffer->GetPointer( 0 );
 	SanityCheckVertexBoneLODFlags( pHdr, pVtxHeader );
@@ -2661,33 +2831,24 @@ void COptimizedModel::WriteVTXFile( studiohdr_t *pHdr, const char *pFileName,
 	
 
 
+//-----------------------------------------------------------------------------
+// Sums the weights of a vert's duplicate bones into the first one and drops
+// the rest.  Zero weights are moved behind the others first, so a zero weight
+// duplicate ahead of its bone's real weight gets dropped too, and running it
+// again finds nothing more to do.
+//-----------------------------------------------------------------------------
 static void MergeLikeBoneIndicesWithinVert( mstudioboneweight_t *pBoneWeight )
 {
-	if( pBoneWeight->numbones == 1 )
+	if( pBoneWeight->numbones <= 1 )
 	{
 		return;
 	}
 	
-	int i, j;
-	int realNumBones = pBoneWeight->numbones;
-	for( i = 0; i < pBoneWeight->numbones; i++ )
-	{
-		for( j = i+1; j < pBoneWeight->numbones; j++ )
-		{
-			if( ( pBoneWeight->bone[i] == pBoneWeight->bone[j] ) && ( pBoneWeight->weight[i] != 0.0f ) )
-			{
-				pBoneWeight->weight[i] += pBoneWeight->weight[j];
-				pBoneWeight->weight[j] = 0.0f;
-				realNumBones--;
-			}
-		}
-	}
-
-	// force all of the -1's at the end with a bubble sort
-	
 	float tmpWeight;
 	int tmpIndex;
-	// bubble sort the bones.
+	int i, j;
+
+	// force all of the zero weights to the end with a bubble sort
 	for( j = pBoneWeight->numbones; j > 1; j-- )
 	{
 		int k;
@@ -2705,7 +2866,35 @@ static void MergeLikeBoneIndicesWithinVert( mstudioboneweight_t *pBoneWeight )
 			}
 		}
 	}
-	pBoneWeight->numbones = realNumBones;
+
+	int numBones = pBoneWeight->numbones;
+	for( i = 0; i < numBones && pBoneWeight->weight[i] != 0.0f; i++ )
+	{
+		for( j = i+1; j < numBones; )
+		{
+			if( pBoneWeight->bone[i] != pBoneWeight->bone[j] )
+			{
+				j++;
+				continue;
+			}
+
+			pBoneWeight->weight[i] += pBoneWeight->weight[j];
+
+			// close up the gap, keeping the order of what's left, and park
+			// the merged bone past the end with no weight
+			tmpIndex = pBoneWeight->bone[j];
+			int k;
+			for( k = j; k < numBones - 1; k++ )
+			{
+				pBoneWeight->bone[k] = pBoneWeight->bone[k+1];
+				pBoneWeight->weight[k] = pBoneWeight->weight[k+1];
+			}
+			numBones--;
+			pBoneWeight->bone[numBones] = tmpIndex;
+			pBoneWeight->weight[numBones] = 0.0f;
+		}
+	}
+	pBoneWeight->numbones = numBones;
 }
 
 static void MergeLikeBoneIndicesWithinVerts( studiohdr_t *pHdr )
@@ -2829,12 +3018,14 @@ bool COptimizedModel::OptimizeFromStudioHdr( studiohdr_t *pHdr, s_bodypart_t *pS
 	Assert( maxBonesPerTri <= MAX_NUM_BONES_PER_TRI );
 	Assert( maxBonesPerStrip <= MAX_NUM_BONES_PER_STRIP );
 	
-	MergeLikeBoneIndicesWithinVerts( pHdr );
-	
 	// Some initialization shite
 	SetupMeshProcessing( pHdr, vertCacheSize, usesFixedFunction, maxBonesPerVert,
 		maxBonesPerTri, maxBonesPerStrip, pFileName );
 
+	// hack!  This should really go in the mdl file since it's common to all LODs.
+	m_StringTable.Purge();
+	AddMaterialReplacementsToStringTable();
+
 	// The dude that does it all
 	TotalMeshStats_t stats;
 	ProcessModel( pHdr, pSrcBodyParts, stats, bForceSoftwareSkin, bHWFlex );
@@ -2854,14 +3045,41 @@ bool COptimizedModel::OptimizeFromStudioHdr( studiohdr_t *pHdr, s_bodypart_t *pS
 	delete m_FileBuffer;
 	m_FileBuffer = NULL;
 
+	m_StringTable.Purge();
+
+	CleanupEverything();
+
+	return true;
+}
+
+void *COptimizedModel::DetachFileData( int *pSize )
+{
+	void *pData = m_pFileData;
+	*pSize = m_FileDataSize;
+	m_pFileData = NULL;
+	m_FileDataSize = 0;
+	return pData;
+}
+
+void COptimizedModel::OutputReport( void )
+{
+	if( !g_quiet )
+	{
+		printf( "---------------------\n" );
+		printf( "Generating optimized mesh \"%s\":\n", m_FileName );
+#ifdef _DEBUG
+		printf( "\tvertex cache size: %d\n", m_VertexCacheSize );
+		printf( "\tmax bones/tri:     %d\n", m_MaxBonesPerTri );
+		printf( "\tmax bones/vert:    %d\n", m_MaxBonesPerVert );
+		printf( "\tmax bones/strip:   %d\n", m_MaxBonesPerStrip );
+#endif
+		OutputMemoryUsage();
+	}
+
 	if( m_NumSkinnedAndFlexedVerts != 0 )
 	{
 		MdlWarning( "!!!!WARNING!!!!: %d flexed verts had more than one bone influence. . will use SLOW path in engine\n", m_NumSkinnedAndFlexedVerts );
 	}
-	
-	CleanupEverything();
-
-	return true;
 }
 
 
@@ -3847,7 +4065,7 @@ void COptimizedModel::RemoveRedundantBoneStateChanges( void )
 	}
 }
 
-static void AddMaterialReplacementsToStringTable( void )
+void COptimizedModel::AddMaterialReplacementsToStringTable( void )
 {
  	int i, j;
 	int numLODs = g_ScriptLODs.Size();
@@ -3857,7 +4075,7 @@ static void AddMaterialReplacementsToStringTable( void )
 		for( j = 0; j < scriptLOD.materialReplacements.Size(); j++ )
 		{
 			CLodScriptReplacement_t &materialReplacement = scriptLOD.materialReplacements[j];
-			s_StringTable.AddString( materialReplacement.GetDstName() );
+			m_StringTable.AddString( materialReplacement.GetDstName() );
 		}
 	}
 }
@@ -3904,19 +4122,89 @@ got_one:
 	}
 }
 
+//-----------------------------------------------------------------------------
+// The vtx targets only differ by hardware limits, so each one is built by its
+// own COptimizedModel and the passes run on the tool thread pool.
+//-----------------------------------------------------------------------------
+
+struct OptimizePass_t
+{
+	const char	*pExtension;
+	int			vertCacheSize;
+	bool		bForceSoftwareSkin;
+	bool		bHWFlex;
+	int			maxBonesPerVert;
+	int			maxBonesPerTri;
+	int			maxBonesPerStrip;
+
+	char		fileName[260];
+	char		glViewFileName[260];
+	COptimizedModel *pOptimizedModel;
+
+	// private copies; GetVertexData writes into the studiohdr and the
+	// bone weights in the vvd get merged in place
+	studiohdr_t	*pStudioHdr;
+	vertexFileHeader_t *pVertexHdr;
+};
+
+enum
+{
+	OPTIMIZE_PASS_SW = 0,
+	OPTIMIZE_PASS_DX80,
+	OPTIMIZE_PASS_DX90,
+	OPTIMIZE_PASS_XBOX,
+
+	OPTIMIZE_PASS_COUNT
+};
+
+// vert cache sizes are the real size, not effective!
+static OptimizePass_t s_OptimizePasses[OPTIMIZE_PASS_COUNT] =
+{
+	// ext		cache	force sw skin	hw flex	bones/vert	bones/tri	bones/strip
+	{ ".sw",	512,	true,			false,	3,			3*3,		512 },	// FIXME: figure out the correct cache size for L1
+	{ ".dx80",	24,		false,			false,	3,			9,			16 },
+	{ ".dx90",	24,		false,			true,	3,			9,			53 },	// Hardware flex on DX9 parts
+	{ ".xbox",	24,		false,			true,	3,			9,			47 },
+};
+
+static const char *s_OptimizePassStages[OPTIMIZE_PASS_COUNT] =
+{
+	"OptimizeFromStudioHdr sw",
+	"OptimizeFromStudioHdr dx80",
+	"OptimizeFromStudioHdr dx90",
+	"OptimizeFromStudioHdr xbox",
+};
+
+static s_bodypart_t	*s_pOptimizeSrcBodyParts;
+
+static void OptimizePassThread( int iThread, int iPass )
+{
+	OptimizePass_t &pass = s_OptimizePasses[iPass];
+	Timings_Begin( s_OptimizePassStages[iPass] );
+	SetThreadVertexFileHeader( pass.pVertexHdr );
+
+	MergeLikeBoneIndicesWithinVerts( pass.pStudioHdr );
+
+	pass.pOptimizedModel->OptimizeFromStudioHdr( pass.pStudioHdr, s_pOptimizeSrcBodyParts,
+		pass.vertCacheSize,
+		false, /* doesn't use fixed function */
+		pass.bForceSoftwareSkin,
+		pass.bHWFlex,
+		pass.maxBonesPerVert,
+		pass.maxBonesPerTri,
+		pass.maxBonesPerStrip,
+		pass.fileName, pass.glViewFileName );
+
+	SetThreadVertexFileHeader( NULL );
+	Timings_End();
+}
+
 void WriteOptimizedFiles( studiohdr_t *phdr, s_bodypart_t *pSrcBodyParts )
 {
 	char		filename[260];
-	char		tmpFileName[260];
-	char		glViewFilename[260];
 	
 	ValidateLODReplacements( phdr );
 	
-	s_StringTable.Purge();
-	
-	// hack!  This should really go in the mdl file since it's common to all LODs.
-	AddMaterialReplacementsToStringTable();
-	
 	strcpy( filename, gamedir );
 //	if( *g_pPlatformName )
 //	{
@@ -3928,69 +4216,56 @@ void WriteOptimizedFiles( studiohdr_t *phdr, s_bodypart_t *pSrcBodyParts )
 	strcat( filename, outname );
 	Q_StripExtension( filename, filename, sizeof( filename ) );
 
-	// if ( !g_bXbox )
-	{
-		strcpy( tmpFileName, filename );
-		strcat( tmpFileName, ".sw.vtx" );
-		strcpy( glViewFilename, filename );
-		strcat( glViewFilename, ".sw.glview" );
-		bool bForceSoftwareSkinning = phdr->numbones > 0 && !g_staticprop;
-		s_OptimizedModel.OptimizeFromStudioHdr( phdr, pSrcBodyParts,
-												512,	//vert cache size FIXME: figure out the correct size for L1
-												false, /* doesn't use fixed function */
-												bForceSoftwareSkinning,	// force software skinning if not static prop
-												false, // No hardware flex
-												3,		// bones/vert
-												3*3,		// bones/tri
-												512,	// bones/strip
-												tmpFileName, glViewFilename );
-
-		strcpy( tmpFileName, filename );
-		strcat( tmpFileName, ".dx80.vtx" );
-		strcpy( glViewFilename, filename );
-		strcat( glViewFilename, ".dx80.glview" );
-		s_OptimizedModel.OptimizeFromStudioHdr( phdr, pSrcBodyParts,
-												24 /* vert cache size (real size, not effective!)*/, 
-												false, /* doesn't use fixed function */
-												false, // don't force software skinning
-												false, // No hardware flex
-												3  /* bones/vert */, 
-												9  /* bones/tri */, 
-												16  /* bones/strip */,
-												tmpFileName, glViewFilename );
-
-		strcpy( tmpFileName, filename );
-		strcat( tmpFileName, ".dx90.vtx" );
-		strcpy( glViewFilename, filename );
-		strcat( glViewFilename, ".dx90.glview" );
-		s_OptimizedModel.OptimizeFromStudioHdr( phdr, pSrcBodyParts,
-												24 /* vert cache size (real size, not effective!)*/, 
-												false, /* doesn't use fixed function */
-												false, // don't force software skinning
-												true, // Hardware flex on DX9 parts
-												3  /* bones/vert */, 
-												9  /* bones/tri */, 
-												53  /* bones/strip */,
-												tmpFileName, glViewFilename );
-	}
-	// else
-	{
-		strcpy( tmpFileName, filename );
-		strcat( tmpFileName, ".xbox.vtx" );
-		strcpy( glViewFilename, filename );
-		strcat( glViewFilename, ".xbox.glview" );
-		s_OptimizedModel.OptimizeFromStudioHdr( phdr, pSrcBodyParts,
-												24 /* vert cache size (real size, not effective!)*/, 
-												false, /* doesn't use fixed function */
-												false, // don't force software skinning
-												true, // Allow hardware flex
-												3  /* bones/vert */, 
-												9  /* bones/tri */, 
-												47  /* bones/strip */,
-												tmpFileName, glViewFilename );
-	}
-
-	s_StringTable.Purge();
+	s_OptimizePasses[OPTIMIZE_PASS_SW].bForceSoftwareSkin = phdr->numbones > 0 && !g_staticprop;
+
+	int iPass;
+	for( iPass = 0; iPass < OPTIMIZE_PASS_COUNT; iPass++ )
+	{
+		OptimizePass_t &pass = s_OptimizePasses[iPass];
+		Q_snprintf( pass.fileName, sizeof( pass.fileName ), "%s%s.vtx", filename, pass.pExtension );
+		Q_snprintf( pass.glViewFileName, sizeof( pass.glViewFileName ), "%s%s.glview", filename, pass.pExtension );
+		pass.pOptimizedModel = new COptimizedModel();
+		pass.pStudioHdr = ( studiohdr_t * )malloc( phdr->length );
+		memcpy( pass.pStudioHdr, phdr, phdr->length );
+		pass.pVertexHdr = CopyVertexFileHeader();
+	}
+
+	s_pOptimizeSrcBodyParts = pSrcBodyParts;
+
+	if( g_bDumpGLViewFiles )
+	{
+		// the glview writer keeps its drawing state in statics
+		for( iPass = 0; iPass < OPTIMIZE_PASS_COUNT; iPass++ )
+		{
+			OptimizePassThread( 0, iPass );
+		}
+	}
+	else
+	{
+		RunThreadsOnIndividual( OPTIMIZE_PASS_COUNT, false, OptimizePassThread );
+	}
+
+	for( iPass = 0; iPass < OPTIMIZE_PASS_COUNT; iPass++ )
+	{
+		OptimizePass_t &pass = s_OptimizePasses[iPass];
+		pass.pOptimizedModel->OutputReport();
+
+		int fileSize;
+		void *pFileData = pass.pOptimizedModel->DetachFileData( &fileSize );
+		if( pFileData )
+		{
+			AddOutputFile( pass.fileName, pFileData, fileSize );
+		}
+
+		delete pass.pOptimizedModel;
+		pass.pOptimizedModel = NULL;
+		free( pass.pStudioHdr );
+		pass.pStudioHdr = NULL;
+		free( pass.pVertexHdr );
+		pass.pVertexHdr = NULL;
+	}
+
+	s_pOptimizeSrcBodyParts = NULL;
 }
 
 }; // namespace OptimizedModel
@@ -1,7 +1,19 @@
 //=======================================================================
-// Perf stats stubs for standalone studiomdl
+// Perf stats stubs and -timings for standalone studiomdl
 //=======================================================================
+#include <stdio.h>
+#include <mutex>
+#include <thread>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
 #include "studio.h"
+#include "perfstats.h"
+#include "tier0/platform.h"
+#include "tier1/utlvector.h"
 
 void InitStudioRender( void )
 {
@@ -16,3 +28,200 @@ void SpewPerfStats( studiohdr_t *pStudioHdr, const char *pFilename )
         (void)pStudioHdr;
         (void)pFilename;
 }
+
+
+//-----------------------------------------------------------------------------
+// -timings
+//-----------------------------------------------------------------------------
+bool g_bTimings = false;
+
+struct s_timing_t
+{
+	const char	*pName;
+	int			depth;
+	int			thread;
+	double		start;		// seconds
+	double		wall;
+	double		cpu;
+	double		peakRSS;	// MB, high water mark of the process when the stage ended
+};
+
+static std::mutex					s_TimingsMutex;
+static CUtlVector< s_timing_t >		s_Timings;
+static std::thread::id				s_TimingsMainThread;
+static int							s_nTimingsMainDepth;
+static int							s_nTimingsThreads;
+static double						s_flTimingsStart;
+
+// open stages of the calling thread, indexes into s_Timings
+static thread_local CUtlVector< int >	s_TimingStack;
+static thread_local int					s_nTimingThread = -1;
+
+//-----------------------------------------------------------------------------
+// CPU seconds used; the whole process on the main thread, just the calling
+// thread on the workers so concurrent passes aren't charged for each other
+//-----------------------------------------------------------------------------
+static double TimingsCPUTime( bool bMainThread )
+{
+#ifdef _WIN32
+	FILETIME creation, exitTime, kernel, user;
+	BOOL bOk = bMainThread ? GetProcessTimes( GetCurrentProcess(), &creation, &exitTime, &kernel, &user )
+		: GetThreadTimes( GetCurrentThread(), &creation, &exitTime, &kernel, &user );
+	if ( !bOk )
+		return 0;
+	ULARGE_INTEGER k, u;
+	k.LowPart = kernel.dwLowDateTime;
+	k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime;
+	u.HighPart = user.dwHighDateTime;
+	return ( k.QuadPart + u.QuadPart ) * 1e-7;
+#else
+	struct rusage usage;
+#ifdef RUSAGE_THREAD
+	if ( getrusage( bMainThread ? RUSAGE_SELF : RUSAGE_THREAD, &usage ) != 0 )
+#else
+	if ( getrusage( RUSAGE_SELF, &usage ) != 0 )
+#endif
+		return 0;
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 +
+		usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+#endif
+}
+
+static double TimingsPeakRSS( void )
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if ( !K32GetProcessMemoryInfo( GetCurrentProcess(), &counters, sizeof( counters ) ) )
+		return 0;
+	return counters.PeakWorkingSetSize / ( 1024.0 * 1024.0 );
+#else
+	struct rusage usage;
+	if ( getrusage( RUSAGE_SELF, &usage ) != 0 )
+		return 0;
+#ifdef OSX
+	return usage.ru_maxrss / ( 1024.0 * 1024.0 );	// bytes
+#else
+	return usage.ru_maxrss / 1024.0;				// kilobytes
+#endif
+#endif
+}
+
+void Timings_Clear( void )
+{
+	std::lock_guard< std::mutex > lock( s_TimingsMutex );
+	s_Timings.Purge();
+	s_TimingStack.Purge();
+	s_TimingsMainThread = std::this_thread::get_id();
+	s_nTimingsMainDepth = 0;
+	s_nTimingsThreads = 1;
+	s_nTimingThread = 0;
+	s_flTimingsStart = Plat_FloatTime();
+}
+
+void Timings_Begin( const char *pStage )
+{
+	if ( !g_bTimings )
+		return;
+
+	bool bMainThread = std::this_thread::get_id() == s_TimingsMainThread;
+	double cpu = TimingsCPUTime( bMainThread );
+
+	std::lock_guard< std::mutex > lock( s_TimingsMutex );
+	if ( s_nTimingThread < 0 )
+	{
+		s_nTimingThread = s_nTimingsThreads++;
+	}
+
+	int i = s_Timings.AddToTail();
+	s_timing_t &timing = s_Timings[i];
+	timing.pName = pStage;
+	// worker stages nest under whatever the main thread is waiting in
+	timing.depth = bMainThread ? s_TimingStack.Count() : s_nTimingsMainDepth + s_TimingStack.Count();
+	timing.thread = s_nTimingThread;
+	timing.start = Plat_FloatTime() - s_flTimingsStart;
+	timing.wall = 0;
+	timing.cpu = cpu;
+	timing.peakRSS = 0;
+
+	s_TimingStack.AddToTail( i );
+	if ( bMainThread )
+	{
+		s_nTimingsMainDepth = s_TimingStack.Count();
+	}
+}
+
+void Timings_End( void )
+{
+	if ( !g_bTimings || s_TimingStack.Count() == 0 )
+		return;
+
+	bool bMainThread = std::this_thread::get_id() == s_TimingsMainThread;
+	double cpu = TimingsCPUTime( bMainThread );
+	double peakRSS = TimingsPeakRSS();
+
+	std::lock_guard< std::mutex > lock( s_TimingsMutex );
+	int i = s_TimingStack[s_TimingStack.Count() - 1];
+	s_TimingStack.Remove( s_TimingStack.Count() - 1 );
+	if ( bMainThread )
+	{
+		s_nTimingsMainDepth = s_TimingStack.Count();
+	}
+
+	s_timing_t &timing = s_Timings[i];
+	timing.wall = Plat_FloatTime() - s_flTimingsStart - timing.start;
+	timing.cpu = cpu - timing.cpu;
+	timing.peakRSS = peakRSS;
+}
+
+void Timings_Stage( const char *pStage, void (*pfnStage)( void ) )
+{
+	Timings_Begin( pStage );
+	pfnStage();
+	Timings_End();
+}
+
+//-----------------------------------------------------------------------------
+// Prints the stages and writes them to pTraceFile in the Chrome trace event
+// format (chrome://tracing, Perfetto) when it's given
+//-----------------------------------------------------------------------------
+void Timings_Report( const char *pTraceFile )
+{
+	if ( !g_bTimings )
+		return;
+
+	std::lock_guard< std::mutex > lock( s_TimingsMutex );
+
+	printf( "---------------------\n" );
+	printf( "%-40s %10s %10s %10s\n", "stage", "wall (s)", "cpu (s)", "peak (MB)" );
+	for ( int i = 0; i < s_Timings.Count(); i++ )
+	{
+		const s_timing_t &timing = s_Timings[i];
+		printf( "%*s%-*s %10.3f %10.3f %10.1f\n", timing.depth * 2, "", 40 - timing.depth * 2, timing.pName,
+			timing.wall, timing.cpu, timing.peakRSS );
+	}
+
+	if ( !pTraceFile )
+		return;
+
+	FILE *fp = fopen( pTraceFile, "w" );
+	if ( !fp )
+	{
+		printf( "can't write timings to \"%s\"\n", pTraceFile );
+		return;
+	}
+
+	fprintf( fp, "{\"traceEvents\":[\n" );
+	for ( int i = 0; i < s_Timings.Count(); i++ )
+	{
+		const s_timing_t &timing = s_Timings[i];
+		fprintf( fp, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.0f,\"dur\":%.0f,"
+			"\"args\":{\"cpu_ms\":%.3f,\"peak_rss_mb\":%.1f}}",
+			i ? ",\n" : "", timing.pName, timing.thread, timing.start * 1e6, timing.wall * 1e6,
+			timing.cpu * 1e3, timing.peakRSS );
+	}
+	fprintf( fp, "\n],\"displayTimeUnit\":\"ms\"}\n" );
+	fclose( fp );
+
+	printf( "timings: \"%s\"\n", pTraceFile );
+}
@@ -15,4 +15,13 @@
 
 void SpewPerfStats( studiohdr_t *pStudioHdr, const char *pFilename );
 
+// -timings: wall time, cpu time and peak memory of each compile stage
+extern bool g_bTimings;
+
+void Timings_Clear( void );
+void Timings_Begin( const char *pStage );
+void Timings_End( void );
+void Timings_Stage( const char *pStage, void (*pfnStage)( void ) );
+void Timings_Report( const char *pTraceFile );
+
 #endif // PERFSTATS_H
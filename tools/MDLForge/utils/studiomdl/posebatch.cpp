@@ -0,0 +1,194 @@
+//=======================================================================
+// Bone transforms for four animation frames at a time.  Each lane holds
+// one frame, so the matrix math runs on whole SSE registers instead of one
+// float at a time.  The operations are done in the same order as the
+// scalar mathlib routines so the results are identical.
+//=======================================================================
+#include "cmdlib.h"
+#include "mathlib.h"
+#include "studio.h"
+#include "studiomdl.h"
+#include "posebatch.h"
+
+// flip or clear the sign bit, like the unary minus and fabs in the scalar code
+static inline fltx4 NegateBatch( const fltx4 &a )
+{
+	return XorSIMD( a, ReplicateX4( -0.0f ) );
+}
+
+static inline fltx4 AbsBatch( const fltx4 &a )
+{
+	return AndNotSIMD( ReplicateX4( -0.0f ), a );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: AngleMatrix( RadianEuler, Vector ) for four frames
+//-----------------------------------------------------------------------------
+void AngleMatrixBatch( const FourVectors &angles, const FourVectors &position, matrix3x4x4_t &out )
+{
+	// AngleMatrix( RadianEuler ) goes through a QAngle in degrees
+	fltx4 toDegrees = ReplicateX4( (float)(180.f / M_PI_F) );
+	fltx4 toRadians = ReplicateX4( (float)(M_PI_F / 180.f) );
+
+	fltx4 sp, cp, sy, cy, sr, cr;
+	SinCosSIMD( sy, cy, MulSIMD( MulSIMD( angles.z, toDegrees ), toRadians ) );
+	SinCosSIMD( sp, cp, MulSIMD( MulSIMD( angles.y, toDegrees ), toRadians ) );
+	SinCosSIMD( sr, cr, MulSIMD( MulSIMD( angles.x, toDegrees ), toRadians ) );
+
+	// matrix = (YAW * PITCH) * ROLL
+	out.m[0][0] = MulSIMD( cp, cy );
+	out.m[1][0] = MulSIMD( cp, sy );
+	out.m[2][0] = NegateBatch( sp );
+
+	fltx4 crcy = MulSIMD( cr, cy );
+	fltx4 crsy = MulSIMD( cr, sy );
+	fltx4 srcy = MulSIMD( sr, cy );
+	fltx4 srsy = MulSIMD( sr, sy );
+	out.m[0][1] = SubSIMD( MulSIMD( sp, srcy ), crsy );
+	out.m[1][1] = AddSIMD( MulSIMD( sp, srsy ), crcy );
+	out.m[2][1] = MulSIMD( sr, cp );
+
+	out.m[0][2] = AddSIMD( MulSIMD( sp, crcy ), srsy );
+	out.m[1][2] = SubSIMD( MulSIMD( sp, crsy ), srcy );
+	out.m[2][2] = MulSIMD( cr, cp );
+
+	out.m[0][3] = position.x;
+	out.m[1][3] = position.y;
+	out.m[2][3] = position.z;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: ConcatTransforms for four frames
+//-----------------------------------------------------------------------------
+void ConcatTransformsBatch( const matrix3x4x4_t &in1, const matrix3x4x4_t &in2, matrix3x4x4_t &out )
+{
+	matrix3x4x4_t result;
+	for ( int i = 0; i < 3; i++ )
+	{
+		for ( int j = 0; j < 4; j++ )
+		{
+			fltx4 sum = AddSIMD( MulSIMD( in1.m[i][0], in2.m[0][j] ),
+				AddSIMD( MulSIMD( in1.m[i][1], in2.m[1][j] ), MulSIMD( in1.m[i][2], in2.m[2][j] ) ) );
+
+			// ConcatTransforms adds the masked translation to every column
+			result.m[i][j] = AddSIMD( sum, ( j == 3 ) ? in1.m[i][3] : Four_Zeros );
+		}
+	}
+	out = result;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: ConcatTransforms for four frames with the same right hand matrix
+//-----------------------------------------------------------------------------
+void ConcatTransformsBatch( const matrix3x4x4_t &in1, const matrix3x4_t &in2, matrix3x4x4_t &out )
+{
+	matrix3x4x4_t result;
+	for ( int i = 0; i < 3; i++ )
+	{
+		for ( int j = 0; j < 4; j++ )
+		{
+			fltx4 sum = AddSIMD( MulSIMD( in1.m[i][0], ReplicateX4( in2[0][j] ) ),
+				AddSIMD( MulSIMD( in1.m[i][1], ReplicateX4( in2[1][j] ) ), MulSIMD( in1.m[i][2], ReplicateX4( in2[2][j] ) ) ) );
+
+			result.m[i][j] = AddSIMD( sum, ( j == 3 ) ? in1.m[i][3] : Four_Zeros );
+		}
+	}
+	out = result;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: VectorTransform of one point by four frames' transforms
+//-----------------------------------------------------------------------------
+void VectorTransformBatch( const Vector &in, const matrix3x4x4_t &transform, FourVectors &out )
+{
+	fltx4 x = ReplicateX4( in.x );
+	fltx4 y = ReplicateX4( in.y );
+	fltx4 z = ReplicateX4( in.z );
+
+	for ( int i = 0; i < 3; i++ )
+	{
+		fltx4 dot = AddSIMD( AddSIMD( MulSIMD( x, transform.m[i][0] ), MulSIMD( y, transform.m[i][1] ) ), MulSIMD( z, transform.m[i][2] ) );
+		out[i] = AddSIMD( dot, transform.m[i][3] );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: TransformAABB of one box by four frames' transforms
+//-----------------------------------------------------------------------------
+void TransformAABBBatch( const matrix3x4x4_t &transform, const Vector &vecMinsIn, const Vector &vecMaxsIn, FourVectors &vecMinsOut, FourVectors &vecMaxsOut )
+{
+	Vector localCenter;
+	VectorAdd( vecMinsIn, vecMaxsIn, localCenter );
+	localCenter *= 0.5f;
+
+	Vector localExtents;
+	VectorSubtract( vecMaxsIn, localCenter, localExtents );
+
+	FourVectors worldCenter;
+	VectorTransformBatch( localCenter, transform, worldCenter );
+
+	fltx4 x = ReplicateX4( localExtents.x );
+	fltx4 y = ReplicateX4( localExtents.y );
+	fltx4 z = ReplicateX4( localExtents.z );
+
+	for ( int i = 0; i < 3; i++ )
+	{
+		fltx4 worldExtent = AddSIMD( AddSIMD( AbsBatch( MulSIMD( x, transform.m[i][0] ) ), AbsBatch( MulSIMD( y, transform.m[i][1] ) ) ),
+			AbsBatch( MulSIMD( z, transform.m[i][2] ) ) );
+		vecMinsOut[i] = SubSIMD( worldCenter[i], worldExtent );
+		vecMaxsOut[i] = AddSIMD( worldCenter[i], worldExtent );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// CPoseBatch
+//-----------------------------------------------------------------------------
+CPoseBatch::CPoseBatch()
+{
+	m_PoseToBone.resize( g_numbones );
+	m_BoneToWorld.resize( g_numbones );
+	m_PoseToWorld.resize( g_numbones );
+
+	for ( int k = 0; k < g_numbones; k++ )
+	{
+		MatrixInvert( g_bonetable[k].boneToPose, m_PoseToBone[k] );
+	}
+}
+
+void CPoseBatch::Build( const s_animation_t *panim, int frame )
+{
+	int lanes[4];
+	for ( int i = 0; i < 4; i++ )
+	{
+		lanes[i] = min( frame + i, panim->numframes - 1 );
+	}
+
+	for ( int k = 0; k < g_numbones; k++ )
+	{
+		FourVectors rot, pos;
+		for ( int i = 0; i < 4; i++ )
+		{
+			const s_bone_t &bone = panim->sanim[lanes[i]][k];
+			SubFloat( rot.x, i ) = bone.rot.x;
+			SubFloat( rot.y, i ) = bone.rot.y;
+			SubFloat( rot.z, i ) = bone.rot.z;
+			SubFloat( pos.x, i ) = bone.pos.x;
+			SubFloat( pos.y, i ) = bone.pos.y;
+			SubFloat( pos.z, i ) = bone.pos.z;
+		}
+
+		matrix3x4x4_t bonematrix;
+		AngleMatrixBatch( rot, pos, bonematrix );
+
+		if ( g_bonetable[k].parent == -1 )
+		{
+			m_BoneToWorld[k] = bonematrix;
+		}
+		else
+		{
+			ConcatTransformsBatch( m_BoneToWorld[g_bonetable[k].parent], bonematrix, m_BoneToWorld[k] );
+		}
+
+		ConcatTransformsBatch( m_BoneToWorld[k], m_PoseToBone[k], m_PoseToWorld[k] );
+	}
+}
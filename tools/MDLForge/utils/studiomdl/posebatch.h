@@ -0,0 +1,51 @@
+//=======================================================================
+// Bone transforms for four animation frames at a time, one per SIMD lane
+//=======================================================================
+
+#ifndef POSEBATCH_H
+#define POSEBATCH_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include <vector>
+#include "mathlib/ssemath.h"
+
+struct s_animation_t;
+
+// A matrix3x4_t for each of four frames, element [i][j] of all four in m[i][j]
+struct matrix3x4x4_t
+{
+	fltx4 m[3][4];
+};
+
+// These match AngleMatrix/ConcatTransforms/VectorTransform/TransformAABB
+// lane for lane, bit for bit.
+void AngleMatrixBatch( const FourVectors &angles, const FourVectors &position, matrix3x4x4_t &out );
+void ConcatTransformsBatch( const matrix3x4x4_t &in1, const matrix3x4x4_t &in2, matrix3x4x4_t &out );
+void ConcatTransformsBatch( const matrix3x4x4_t &in1, const matrix3x4_t &in2, matrix3x4x4_t &out );
+void VectorTransformBatch( const Vector &in, const matrix3x4x4_t &transform, FourVectors &out );
+void TransformAABBBatch( const matrix3x4x4_t &transform, const Vector &vecMinsIn, const Vector &vecMaxsIn, FourVectors &vecMinsOut, FourVectors &vecMaxsOut );
+
+// Builds the global bone transforms of an animation's frames four at a time,
+// for passes that sweep every frame of every animation.
+class CPoseBatch
+{
+public:
+	CPoseBatch();
+
+	// Frames [frame, frame + 4) of panim; lanes past its last frame repeat it
+	void Build( const s_animation_t *panim, int frame );
+
+	const matrix3x4x4_t &BoneToWorld( int bone ) const { return m_BoneToWorld[bone]; }
+
+	// reference pose space to world, for skinning vertices
+	const matrix3x4x4_t &PoseToWorld( int bone ) const { return m_PoseToWorld[bone]; }
+
+private:
+	std::vector<matrix3x4_t> m_PoseToBone;
+	std::vector<matrix3x4x4_t> m_BoneToWorld;
+	std::vector<matrix3x4x4_t> m_PoseToWorld;
+};
+
+#endif // POSEBATCH_H
@@ -29,9 +29,14 @@
 #include "mathlib.h"
 #include "studio.h"
 #include "studiomdl.h"
+#include "collisionmodel.h"
+#include "perfstats.h"
 #include "bone_setup.h"
 #include "vstdlib/strtools.h"
 #include "vmatrix.h"
+#include "threads.h"
+#include "posebatch.h"
+#include "bonenames.h"
 
 class CBoneRenderBounds
 {
@@ -43,9 +48,185 @@ public:
 // this is computed once so render models and their physics hulls get translated by the same amount
 static Vector g_PropCenterOffset(0,0,0);
 
+extern int g_rootIndex;
+extern int nummacros;
+
+//-----------------------------------------------------------------------------
+// Purpose: return all the model globals to their startup state so that one
+//			process (studiomdl -server) can compile any number of .qc files.
+//			Sources, animations and meshes from the previous model are leaked,
+//			just like they are when the process exits.
+//-----------------------------------------------------------------------------
 void ClearModel (void)
 {
+	// the globals are already zero for the first model, don't touch all those pages
+	static bool bModelCleared = false;
+	if ( !bModelCleared )
+	{
+		bModelCleared = true;
+		return;
+	}
 
+	outname[0] = '\0';
+	cdset = false;
+	numdirs = 0;
+	memset( cddir, 0, sizeof( cddir ) );
+	numcdtextures = 0;
+	memset( cdtextures, 0, sizeof( cdtextures ) );
+	fullpath[0] = '\0';
+
+	rootname[0] = '\0';
+	g_defaultscale = 0;
+	g_currentscale = 0;
+	g_defaultrotation.Init();
+
+	memset( defaulttexture, 0, sizeof( defaulttexture ) );
+	memset( sourcetexture, 0, sizeof( sourcetexture ) );
+	numrep = 0;
+
+	tag_reversed = 0;
+	tag_normals = 0;
+	flip_triangles = 0;
+	normal_blend = 0;
+	dump_hboxes = 0;
+	ignore_warnings = 0;
+
+	eyeposition.Init();
+	illumposition.Init();
+	illumpositionset = 0;
+	gflags = 0;
+	bbox[0].Init();
+	bbox[1].Init();
+	cbox[0].Init();
+	cbox[1].Init();
+	g_wrotebbox = false;
+	g_wrotecbox = false;
+
+	clip_texcoords = 0;
+	g_staticprop = false;
+	g_centerstaticprop = false;
+
+	g_realignbones = false;
+	g_definebones = false;
+
+	g_constdirectionalightdot = 0;
+
+	g_numbones = 0;
+	memset( g_bonetable, 0, sizeof( g_bonetable ) );
+	g_numrenamedbones = 0;
+	memset( g_renamedbone, 0, sizeof( g_renamedbone ) );
+	InvalidateGlobalBoneNames();
+	g_numimportbones = 0;
+	memset( g_importbone, 0, sizeof( g_importbone ) );
+	g_numincludemodels = 0;
+	memset( g_includemodel, 0, sizeof( g_includemodel ) );
+	g_hitboxsets.Purge();
+	g_numhitgroups = 0;
+	memset( g_hitgroup, 0, sizeof( g_hitgroup ) );
+	g_numbonecontrollers = 0;
+	memset( g_bonecontroller, 0, sizeof( g_bonecontroller ) );
+	g_numscreenalignedbones = 0;
+	memset( g_screenalignedbone, 0, sizeof( g_screenalignedbone ) );
+	g_numattachments = 0;
+	memset( g_attachment, 0, sizeof( g_attachment ) );
+	g_BoneMerge.Purge();
+	g_nummouths = 0;
+	memset( g_mouth, 0, sizeof( g_mouth ) );
+
+	g_numani = 0;
+	memset( g_panimation, 0, sizeof( g_panimation ) );
+	g_numcmdlists = 0;
+	memset( g_cmdlist, 0, sizeof( g_cmdlist ) );
+	g_numikautoplaylocks = 0;
+	memset( g_ikautoplaylock, 0, sizeof( g_ikautoplaylock ) );
+	g_sequence.Purge();
+	g_numanimblocks = 0;
+	memset( g_animblock, 0, sizeof( g_animblock ) );
+	g_animblocksize = 0;
+	g_animblockname[0] = '\0';
+	g_numposeparameters = 0;
+	memset( g_pose, 0, sizeof( g_pose ) );
+
+	g_numxnodes = 0;
+	memset( g_xnodename, 0, sizeof( g_xnodename ) );
+	memset( g_xnode, 0, sizeof( g_xnode ) );
+	g_numxnodeskips = 0;
+	memset( g_xnodeskip, 0, sizeof( g_xnodeskip ) );
+
+	g_numtextures = 0;
+	memset( g_texture, 0, sizeof( g_texture ) );
+	g_nummaterials = 0;
+	memset( g_material, 0, sizeof( g_material ) );
+	g_gamma = 0;
+	g_numskinref = 0;
+	g_numskinfamilies = 0;
+	memset( g_skinref, 0, sizeof( g_skinref ) );
+	g_numtexturegroups = 0;
+	memset( g_numtexturelayers, 0, sizeof( g_numtexturelayers ) );
+	memset( g_numtexturereps, 0, sizeof( g_numtexturereps ) );
+	memset( g_texturegroup, 0, sizeof( g_texturegroup ) );
+
+	g_numsources = 0;
+	memset( g_source, 0, sizeof( g_source ) );
+	g_nummodels = 0;
+	g_nummodelsbeforeLOD = 0;
+	memset( g_model, 0, sizeof( g_model ) );
+
+	g_numflexdesc = 0;
+	memset( g_flexdesc, 0, sizeof( g_flexdesc ) );
+	g_numflexcontrollers = 0;
+	memset( g_flexcontroller, 0, sizeof( g_flexcontroller ) );
+	g_numflexkeys = 0;
+	memset( g_flexkey, 0, sizeof( g_flexkey ) );
+	g_defaultflexkey = NULL;
+	g_numflexrules = 0;
+	memset( g_flexrule, 0, sizeof( g_flexrule ) );
+	g_defaultadjust.Init();
+
+	g_numbodyparts = 0;
+	memset( g_bodypart, 0, sizeof( g_bodypart ) );
+	g_numweightlist = 0;
+	memset( g_weightlist, 0, sizeof( g_weightlist ) );
+	g_numikchains = 0;
+	memset( g_ikchain, 0, sizeof( g_ikchain ) );
+
+	g_numaxisinterpbones = 0;
+	memset( g_axisinterpbones, 0, sizeof( g_axisinterpbones ) );
+	memset( g_axisinterpbonemap, 0, sizeof( g_axisinterpbonemap ) );
+	g_numquatinterpbones = 0;
+	memset( g_quatinterpbones, 0, sizeof( g_quatinterpbones ) );
+	memset( g_quatinterpbonemap, 0, sizeof( g_quatinterpbonemap ) );
+	g_numaimatbones = 0;
+	memset( g_aimatbones, 0, sizeof( g_aimatbones ) );
+	memset( g_aimatbonemap, 0, sizeof( g_aimatbonemap ) );
+	g_numforcedhierarchy = 0;
+	memset( g_forcedhierarchy, 0, sizeof( g_forcedhierarchy ) );
+	g_numforcedrealign = 0;
+	memset( g_forcedrealign, 0, sizeof( g_forcedrealign ) );
+	g_numlimitrotation = 0;
+	memset( g_limitrotation, 0, sizeof( g_limitrotation ) );
+	g_bonesaveframe.Purge();
+
+	is_v1support = 0;
+
+	g_numverts = 0;
+	g_numnormals = 0;
+	g_numtexcoords = 0;
+	g_numfaces = 0;
+	numvlist = 0;
+
+	g_ScriptLODs.Purge();
+
+	g_numcollapse = 0;
+	memset( g_collapse, 0, sizeof( g_collapse ) );
+
+	g_KeyValueText.Purge();
+
+	g_PropCenterOffset.Init();
+	g_rootIndex = 0;
+	nummacros = 0;
+
+	CollisionModel_Clear();
 }
 
 
@@ -122,181 +303,295 @@ void forceAnimationLoop( s_animation_t *panim );
 void solveBone( s_animation_t *panim, int iFrame, int iBone, matrix3x4_t* pBoneToWorld );
 
 
-void processAnimations()
-{ 
-	int i, j;
-
-	// find global root bone.
-	if ( strlen( rootname ) )
-	{
-		g_rootIndex = findGlobalBone( rootname );
-		if (g_rootIndex == -1)
-			g_rootIndex = 0;
-	}
-
-	buildAnimationWeights( );
+//-----------------------------------------------------------------------------
+// Purpose: run an animation's commands, motion extraction and loop fixups
+//-----------------------------------------------------------------------------
+static void processAnimation( s_animation_t *panim )
+{
+	int j;
 
-	for (i = 0; i < g_numani; i++)
-	{
-		s_animation_t *panim = g_panimation[i];
+	extractUnusedMotion( panim ); // FIXME: this should be part of LinearMotion()
 
-		extractUnusedMotion( panim ); // FIXME: this should be part of LinearMotion()
+	setAnimationWeight( panim, 0 );
 
-		setAnimationWeight( panim, 0 );
+	int startframe = 0;
 
-		int startframe = 0;
+	if (panim->fudgeloop)
+	{
+		fixupMissingFrame( panim );
+	}
 
-		if (panim->fudgeloop)
-		{
-			fixupMissingFrame( panim );
-		}
+	for (j = 0; j < panim->numcmds; j++)
+	{
+		s_animcmd_t *pcmd = &panim->cmds[j];
 
-		for (j = 0; j < panim->numcmds; j++)
+		switch( pcmd->cmd )
 		{
-			s_animcmd_t *pcmd = &panim->cmds[j];
-
-			switch( pcmd->cmd )
+		case CMD_WEIGHTS:
+			setAnimationWeight( panim, pcmd->u.weightlist.index );
+			break;
+		case CMD_SUBTRACT:
+			panim->flags |= STUDIO_DELTA;
+			subtractBaseAnimations( pcmd->u.subtract.ref, panim, pcmd->u.subtract.frame, pcmd->u.subtract.flags );
+			break;
+		case CMD_AO:
 			{
-			case CMD_WEIGHTS:
-				setAnimationWeight( panim, pcmd->u.weightlist.index );
-				break;
-			case CMD_SUBTRACT:
-				panim->flags |= STUDIO_DELTA;
-				subtractBaseAnimations( pcmd->u.subtract.ref, panim, pcmd->u.subtract.frame, pcmd->u.subtract.flags );
-				break;
-			case CMD_AO:
+				int bone = g_rootIndex;
+				if (pcmd->u.ao.pBonename != NULL)
 				{
-					int bone = g_rootIndex;
-					if (pcmd->u.ao.pBonename != NULL)
+					bone = findGlobalBone( pcmd->u.ao.pBonename );
+					if (bone == -1)
 					{
-						bone = findGlobalBone( pcmd->u.ao.pBonename );
-						if (bone == -1)
-						{
-							MdlError("unable to find bone %s to alignbone\n", pcmd->u.ao.pBonename );
-						}
+						MdlError("unable to find bone %s to alignbone\n", pcmd->u.ao.pBonename );
 					}
-					processAutoorigin( pcmd->u.ao.ref, panim, pcmd->u.ao.motiontype, pcmd->u.ao.srcframe, pcmd->u.ao.destframe, bone );
-				}
-				break;
-			case CMD_MATCH:
-				processMatch( pcmd->u.match.ref, panim, false );
-				break;
-			case CMD_FIXUP:
-				fixupLoopingDiscontinuities( panim, pcmd->u.fixuploop.start, pcmd->u.fixuploop.end );
-				break;
-			case CMD_ANGLE:
-				makeAngle( panim, pcmd->u.angle.angle );
-				break;
-			case CMD_IKFIXUP:
-				{
-					s_ikrule_t ikrule = *(pcmd->u.ikfixup.pRule);
-					fixupIKErrors( panim, &ikrule );
-				}
-				break;
-			case CMD_IKRULE:
-				// processed later
-				break;
-			case CMD_MOTION:
-				{
-					extractLinearMotion( 
-						panim, 
-						pcmd->u.motion.motiontype, 
-						startframe, 
-						pcmd->u.motion.iEndFrame, 
-						pcmd->u.motion.iEndFrame, 
-						panim, 
-						startframe );
-					startframe = pcmd->u.motion.iEndFrame;
-				}
-				break;
-			case CMD_REFMOTION:
-				{
-					extractLinearMotion(
-						panim, 
-						pcmd->u.motion.motiontype, 
-						startframe, 
-						pcmd->u.motion.iEndFrame, 
-						pcmd->u.motion.iSrcFrame, 
-						pcmd->u.motion.pRefAnim, 
-						pcmd->u.motion.iRefFrame );
-					startframe = pcmd->u.motion.iEndFrame;
-				}
-				break;
-			case CMD_DERIVATIVE:
-				{
-					createDerivative(
-						panim, 
-						pcmd->u.derivative.scale );
-				}
-				break;
-			case CMD_NOANIMATION:
-				{
-					clearAnimations( panim );
-				}
-				break;
-			case CMD_LINEARDELTA:
-				{
-					panim->flags |= STUDIO_DELTA;
-					linearDelta( panim, panim, panim->numframes - 1, pcmd->u.linear.flags );
 				}
-				break;
-			case CMD_COMPRESS:
-				{
-					reencodeAnimation( panim, pcmd->u.compress.frames );
-				}
-				break;
-			case CMD_NUMFRAMES:
-				{
-					forceNumframes( panim, pcmd->u.numframes.frames );
-				}
-				break;
-			case CMD_COUNTERROTATE:
+				processAutoorigin( pcmd->u.ao.ref, panim, pcmd->u.ao.motiontype, pcmd->u.ao.srcframe, pcmd->u.ao.destframe, bone );
+			}
+			break;
+		case CMD_MATCH:
+			processMatch( pcmd->u.match.ref, panim, false );
+			break;
+		case CMD_FIXUP:
+			fixupLoopingDiscontinuities( panim, pcmd->u.fixuploop.start, pcmd->u.fixuploop.end );
+			break;
+		case CMD_ANGLE:
+			makeAngle( panim, pcmd->u.angle.angle );
+			break;
+		case CMD_IKFIXUP:
+			{
+				s_ikrule_t ikrule = *(pcmd->u.ikfixup.pRule);
+				fixupIKErrors( panim, &ikrule );
+			}
+			break;
+		case CMD_IKRULE:
+			// processed later
+			break;
+		case CMD_MOTION:
+			{
+				extractLinearMotion( 
+					panim, 
+					pcmd->u.motion.motiontype, 
+					startframe, 
+					pcmd->u.motion.iEndFrame, 
+					pcmd->u.motion.iEndFrame, 
+					panim, 
+					startframe );
+				startframe = pcmd->u.motion.iEndFrame;
+			}
+			break;
+		case CMD_REFMOTION:
+			{
+				extractLinearMotion(
+					panim, 
+					pcmd->u.motion.motiontype, 
+					startframe, 
+					pcmd->u.motion.iEndFrame, 
+					pcmd->u.motion.iSrcFrame, 
+					pcmd->u.motion.pRefAnim, 
+					pcmd->u.motion.iRefFrame );
+				startframe = pcmd->u.motion.iEndFrame;
+			}
+			break;
+		case CMD_DERIVATIVE:
+			{
+				createDerivative(
+					panim, 
+					pcmd->u.derivative.scale );
+			}
+			break;
+		case CMD_NOANIMATION:
+			{
+				clearAnimations( panim );
+			}
+			break;
+		case CMD_LINEARDELTA:
+			{
+				panim->flags |= STUDIO_DELTA;
+				linearDelta( panim, panim, panim->numframes - 1, pcmd->u.linear.flags );
+			}
+			break;
+		case CMD_COMPRESS:
+			{
+				reencodeAnimation( panim, pcmd->u.compress.frames );
+			}
+			break;
+		case CMD_NUMFRAMES:
+			{
+				forceNumframes( panim, pcmd->u.numframes.frames );
+			}
+			break;
+		case CMD_COUNTERROTATE:
+			{
+				int bone = findGlobalBone( pcmd->u.counterrotate.pBonename );
+				if (bone != -1)
 				{
-					int bone = findGlobalBone( pcmd->u.counterrotate.pBonename );
-					if (bone != -1)
-					{
-						QAngle target;
+					QAngle target;
 
-						if (!pcmd->u.counterrotate.bHasTarget)
-						{
-							matrix3x4_t rootxform;
-							matrix3x4_t defaultBoneToWorld;
-							AngleMatrix( panim->rotation, rootxform );
-							ConcatTransforms( rootxform, g_bonetable[bone].boneToPose, defaultBoneToWorld );
-
-							MatrixAngles( defaultBoneToWorld, target );
-						}
-						else
-						{
-							target.Init( pcmd->u.counterrotate.targetAngle[0], pcmd->u.counterrotate.targetAngle[1], pcmd->u.counterrotate.targetAngle[2] );
-						}
+					if (!pcmd->u.counterrotate.bHasTarget)
+					{
+						matrix3x4_t rootxform;
+						matrix3x4_t defaultBoneToWorld;
+						AngleMatrix( panim->rotation, rootxform );
+						ConcatTransforms( rootxform, g_bonetable[bone].boneToPose, defaultBoneToWorld );
 
-						counterRotateBone( panim, bone, target );
+						MatrixAngles( defaultBoneToWorld, target );
 					}
 					else
 					{
-						Error("unable to find bone %s to counterrotate\n", pcmd->u.counterrotate.pBonename );
+						target.Init( pcmd->u.counterrotate.targetAngle[0], pcmd->u.counterrotate.targetAngle[1], pcmd->u.counterrotate.targetAngle[2] );
 					}
+
+					counterRotateBone( panim, bone, target );
+				}
+				else
+				{
+					Error("unable to find bone %s to counterrotate\n", pcmd->u.counterrotate.pBonename );
 				}
-				break;
-			case CMD_WORLDSPACEBLEND:
-				worldspaceBlend( pcmd->u.world.ref, panim, pcmd->u.world.startframe, pcmd->u.world.loops );
-				break;
-			case CMD_MATCHBLEND:
-				matchBlend( panim, pcmd->u.match.ref, pcmd->u.match.srcframe, pcmd->u.match.destframe, pcmd->u.match.destpre, pcmd->u.match.destpost );
-				break;
 			}
+			break;
+		case CMD_WORLDSPACEBLEND:
+			worldspaceBlend( pcmd->u.world.ref, panim, pcmd->u.world.startframe, pcmd->u.world.loops );
+			break;
+		case CMD_MATCHBLEND:
+			matchBlend( panim, pcmd->u.match.ref, pcmd->u.match.srcframe, pcmd->u.match.destframe, pcmd->u.match.destpre, pcmd->u.match.destpost );
+			break;
+		}
+	}
+
+	if (panim->motiontype)
+	{
+		extractLinearMotion( panim, panim->motiontype, startframe, panim->numframes - 1, panim->numframes - 1, panim, startframe );
+		startframe = panim->numframes - 1;
+	}
+
+	realignLooping( panim );
+
+	forceAnimationLoop( panim );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: collect the other animations an animation's commands read
+//-----------------------------------------------------------------------------
+static int AnimationCmdRefs( const s_animation_t *panim, s_animation_t **ppRefs )
+{
+	int count = 0;
+	for (int j = 0; j < panim->numcmds; j++)
+	{
+		const s_animcmd_t *pcmd = &panim->cmds[j];
+		s_animation_t *pRef = NULL;
+
+		switch( pcmd->cmd )
+		{
+		case CMD_SUBTRACT:			pRef = pcmd->u.subtract.ref; break;
+		case CMD_AO:				pRef = pcmd->u.ao.ref; break;
+		case CMD_MATCH:				pRef = pcmd->u.match.ref; break;
+		case CMD_MATCHBLEND:		pRef = pcmd->u.match.ref; break;
+		case CMD_WORLDSPACEBLEND:	pRef = pcmd->u.world.ref; break;
+		case CMD_REFMOTION:			pRef = pcmd->u.motion.pRefAnim; break;
+		}
+
+		if (pRef && pRef != panim)
+		{
+			ppRefs[count++] = pRef;
+		}
+	}
+	return count;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: split the animations into waves that can be processed in parallel.
+//			An animation whose commands read another one has to see it in the
+//			same state the serial loop would have, so of any two animations
+//			linked by a command, the later one goes in a later wave.
+//-----------------------------------------------------------------------------
+static int BuildAnimationWaves( CUtlVector< int > &wave )
+{
+	int i, j;
+
+	// links to lower numbered animations
+	CUtlVector< CUtlVector< int > > earlier;
+	earlier.SetSize( g_numani );
+
+	for (i = 0; i < g_numani; i++)
+	{
+		s_animation_t *pRefs[MAXSTUDIOCMDS];
+		int numRefs = AnimationCmdRefs( g_panimation[i], pRefs );
+		for (j = 0; j < numRefs; j++)
+		{
+			// references to animations outside the list are read-only
+			int ref = pRefs[j]->index;
+			if (ref < 0 || ref >= g_numani || g_panimation[ref] != pRefs[j])
+				continue;
+
+			earlier[max( i, ref )].AddToTail( min( i, ref ) );
 		}
+	}
 
-		if (panim->motiontype)
+	int numWaves = 0;
+	wave.SetSize( g_numani );
+	for (i = 0; i < g_numani; i++)
+	{
+		wave[i] = 0;
+		for (j = 0; j < earlier[i].Count(); j++)
 		{
-			extractLinearMotion( panim, panim->motiontype, startframe, panim->numframes - 1, panim->numframes - 1, panim, startframe );
-			startframe = panim->numframes - 1;
+			wave[i] = max( wave[i], wave[earlier[i][j]] + 1 );
 		}
+		numWaves = max( numWaves, wave[i] + 1 );
+	}
+	return numWaves;
+}
+
+
+// the animations in the wave processAnimations is running
+static CUtlVector< s_animation_t * > s_AnimationWave;
+
+static void ProcessAnimationThread( int iThread, int iAnim )
+{
+	processAnimation( s_AnimationWave[iAnim] );
+}
+
+
+void processAnimations()
+{ 
+	int i, j;
+
+	// find global root bone.
+	if ( strlen( rootname ) )
+	{
+		g_rootIndex = findGlobalBone( rootname );
+		if (g_rootIndex == -1)
+			g_rootIndex = 0;
+	}
 
-		realignLooping( panim );
+	buildAnimationWeights( );
 
-		forceAnimationLoop( panim );
+	if (g_verbose)
+	{
+		// keep the verbose motion reports in order
+		for (i = 0; i < g_numani; i++)
+		{
+			processAnimation( g_panimation[i] );
+		}
+	}
+	else
+	{
+		CUtlVector< int > wave;
+		int numWaves = BuildAnimationWaves( wave );
+		for (int w = 0; w < numWaves; w++)
+		{
+			s_AnimationWave.RemoveAll();
+			for (i = 0; i < g_numani; i++)
+			{
+				if (wave[i] == w)
+				{
+					s_AnimationWave.AddToTail( g_panimation[i] );
+				}
+			}
+			RunThreadsOnIndividual( s_AnimationWave.Count(), false, ProcessAnimationThread );
+		}
+		s_AnimationWave.Purge();
 	}
 
 	// merge weightlists
@@ -2200,98 +2495,289 @@ void fixupIKErrors( s_animation_t *panim, s_ikrule_t *pRule )
 
 
 //-----------------------------------------------------------------------------
-// Purpose: map the vertex animations to their equivalent vertex in the base animations
+// Purpose: model vertices sorted by the grid cell they fall in, so the ones
+//			near a vertex animation vertex can be found without a full scan
 //-----------------------------------------------------------------------------
-void RemapVertexAnimations(void)
+struct vanimgridvert_t
 {
-	int i, j, k;
-	int n, m;
-	s_source_t	*pvsource;					// vertex animation source
-	s_loddata_t	*pmLodSource;				// original model source
-	Vector		tmp;
-	float		dist, minDist, dot;
-	static Vector		modelpos[MAXSTUDIOVERTS];
-	// index by vertex in targets root LOD
-	static int			model_to_vanim_vert_imap[MAXSTUDIOVERTS];		// model vert to vanim vert mapping
-	static float 		imapdist[MAXSTUDIOVERTS];	// distance from src vert to vanim vert
-	static float 		imapdot[MAXSTUDIOVERTS];	// dot product of src norm to vanim normal
+	long long	cell;
+	int			vertex;
+};
 
-	// indexed by vertex anim vertex index
-	static int			*mapp[MAXSTUDIOVERTS*4];
+// a hair over sqrt( 0.15 ), the farthest a vertex animation vertex can be from
+// the model vertices it maps to
+#define VANIM_GRID_SIZE		0.3875f
 
-	static bool			doesMove[MAXSTUDIOVERTS];
-	int					numMoved;
+static int VAnimGridCell( float flCoord )
+{
+	double flCell = floor( (double)flCoord / VANIM_GRID_SIZE );
+	return (int)clamp( flCell, -1.0e9, 1.0e9 );
+}
 
-	memset( doesMove, 0, MAXSTUDIOVERTS * sizeof( bool ) );
-	numMoved = 0;
+static long long VAnimGridKey( int x, int y, int z )
+{
+	// far apart cells can share a key, which only adds candidates
+	return ( (long long)( x & 0x1FFFFF ) << 42 ) | ( (long long)( y & 0x1FFFFF ) << 21 ) | (long long)( z & 0x1FFFFF );
+}
 
-	// for all the sources of flexes, find a mapping of vertex animations to base model.
-	// There can be multiple "vertices" in the base model for each animated vertex since vertices 
-	// are duplicated along material boundaries.
-	for (i = 0; i < g_numflexkeys; i++)
-	{
-		pvsource = g_flexkey[i].source;
+static int VAnimGridCompare( const void *a, const void *b )
+{
+	const vanimgridvert_t *pA = (const vanimgridvert_t *)a;
+	const vanimgridvert_t *pB = (const vanimgridvert_t *)b;
+	if ( pA->cell != pB->cell )
+		return pA->cell < pB->cell ? -1 : 1;
+	return pA->vertex - pB->vertex;
+}
 
-		// skip if it's already been done or if has doesn't have any animations
-		if (pvsource->vanim_flag)
+static void BuildVAnimGrid( const s_loddata_t *pmLodSource, int minLod, CUtlVector<vanimgridvert_t> &grid )
+{
+	grid.RemoveAll();
+	grid.EnsureCapacity( pmLodSource->numvertices );
+	for ( int k = 0; k < pmLodSource->numvertices; k++ )
+	{
+		// go ahead and skip vertices that are just going to be stripped later
+		// TODO: take this out when the lod clamping stuff gets moved into the LOD code instead of being a post process
+		if (minLod && !(pmLodSource->vertex[k].bLoD & (0xFFFFFF << minLod)))
 			continue;
 
-		pmLodSource = g_model[g_flexkey[i].imodel]->source->pLodData;
-
-		// translate g_model into current frame 0 animation space
-		// not possible.  In the sample the bones were deleted.  Assume they are in the correct space
-		for (j = 0; j < pmLodSource->numvertices; j++)
-		{
-			// k = pmsource->boneweight[j].bone[0]; // BUG
+		const Vector &pos = pmLodSource->vertex[k].position;
+		int i = grid.AddToTail();
+		grid[i].cell = VAnimGridKey( VAnimGridCell( pos.x ), VAnimGridCell( pos.y ), VAnimGridCell( pos.z ) );
+		grid[i].vertex = k;
+	}
+	qsort( grid.Base(), grid.Count(), sizeof( vanimgridvert_t ), VAnimGridCompare );
+}
 
-			// NOTE: these bones have already been "fixed"
-			// VectorTransform( pmsource->vertex[j], pmsource->bonefixup[k].m, modelpos[j] );
-			// VectorAdd( modelpos[j], pmsource->bonefixup[k].worldorg, modelpos[j] );
-			// printf("%4d  %6.2f %6.2f %6.2f\n", j, modelpos[j][0], modelpos[j][1], modelpos[j][2] );
-			VectorCopy( pmLodSource->vertex[j].position, modelpos[j] );
-		}
+static void FindVAnimGridVerts( const CUtlVector<vanimgridvert_t> &grid, const Vector &pos, CUtlVector<int> &verts )
+{
+	verts.RemoveAll();
 
-		// flag all the vertices that animate
-		pvsource->vanim_flag = (int *)kalloc( pvsource->numvertices, sizeof( int ));
-		for (n = i; n < g_numflexkeys; n++)
+	int cx = VAnimGridCell( pos.x );
+	int cy = VAnimGridCell( pos.y );
+	int cz = VAnimGridCell( pos.z );
+	long long keys[27];
+	int numKeys = 0;
+	for ( int x = cx - 1; x <= cx + 1; x++ )
+	{
+		for ( int y = cy - 1; y <= cy + 1; y++ )
 		{
-			// make sure it's the current flex file and that it's not frame 0 (happens with eyeball stuff).
-			if (g_flexkey[n].source == pvsource && g_flexkey[n].frame != 0)
+			for ( int z = cz - 1; z <= cz + 1; z++ )
 			{
-				k = g_flexkey[n].frame;
-				for (m = 0; m < pvsource->numvanims[k]; m++)
+				long long key = VAnimGridKey( x, y, z );
+				int n;
+				for ( n = 0; n < numKeys; n++ )
 				{
-					pvsource->vanim_flag[pvsource->vanim[k][m].vertex] = 1;
+					if ( keys[n] == key )
+						break;
+				}
+				if ( n < numKeys )
+					continue;
+				keys[numKeys++] = key;
+
+				// first grid vert in this cell
+				int lo = 0, hi = grid.Count();
+				while ( lo < hi )
+				{
+					int mid = ( lo + hi ) / 2;
+					if ( grid[mid].cell < key )
+						lo = mid + 1;
+					else
+						hi = mid;
+				}
+				for ( ; lo < grid.Count() && grid[lo].cell == key; lo++ )
+				{
+					verts.AddToTail( grid[lo].vertex );
 				}
 			}
 		}
+	}
+}
 
-		// find frame 0 vertices to closest g_model vertex
-		for (j = 0; j < pmLodSource->numvertices; j++)
-		{
-			imapdist[j] = 1E30;
-			imapdot[j] = -1.0;
-			model_to_vanim_vert_imap[j] = -1;
-		}
 
-		int minLod = min( g_minLod, g_ScriptLODs.Size() - 1 );
+//-----------------------------------------------------------------------------
+// Purpose: map the vertex animations to their equivalent vertex in the base animations
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+// Purpose: whether a vertex animation delta is big enough to keep
+//-----------------------------------------------------------------------------
+bool VertexAnimMoves( const Vector &delta, const Vector &ndelta )
+{
+	// FIXME: the clamp needs to be paired with the other matching positions.
+	// currently this is set to the float16 min value.  Sucky.
+	return DotProduct( delta, delta ) > (0.001f*0.001f) /* 0.0001 */ || DotProduct( ndelta, ndelta ) > 0.001;
+}
 
-		for (j = 0; j < pvsource->numvertices; j++)
+//-----------------------------------------------------------------------------
+// Purpose: frame t of a vertex animation with every vertex, the ones it
+//			doesn't list taken from frame 0
+//-----------------------------------------------------------------------------
+static void ExpandVertexAnimationFrame( const s_source_t *pvsource, int t, CUtlVector< s_vertanim_t > &frame )
+{
+	frame.CopyArray( pvsource->vanim[0], pvsource->numvanims[0] );
+	for (int m = 0; m < pvsource->numvanims[t]; m++)
+	{
+		const s_vertanim_t &anim = pvsource->vanim[t][m];
+		if (anim.vertex >= 0 && anim.vertex < frame.Count() && frame[anim.vertex].vertex == anim.vertex)
 		{
-			// don't check if it doesn't animate
-			if (0 && !pvsource->vanim_flag[j])
-				continue;
+			frame[anim.vertex] = anim;
+		}
+		else
+		{
+			frame.AddToTail( anim );
+		}
+	}
+}
 
-			minDist = 1E30;
-			n = -1;
-			for (k = 0; k < pmLodSource->numvertices; k++)
-			{
-				// go ahead and skip vertices that are just going to be stripped later
-				// TODO: take this out when the lod clamping stuff gets moved into the LOD code instead of being a post process
-				if (minLod && !(pmLodSource->vertex[k].bLoD & (0xFFFFFF << minLod)))
-					continue;
+static int __cdecl CompareVertAnimVertex( const s_vertanim_t *a, const s_vertanim_t *b )
+{
+	return a->vertex - b->vertex;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Before frame 0 is moved to a default pose from another frame, list
+//			the vertices the pose moves in the other frames too, at their
+//			frame 0 positions, so flexes on those frames still move them back.
+//-----------------------------------------------------------------------------
+static void ListDefaultPoseVertices( s_source_t *pvsource, int defaultframe )
+{
+	if (defaultframe == 0)
+		return;
+
+	const s_vertanim_t *pdefault = pvsource->vanim[defaultframe];
+	int numdefault = pvsource->numvanims[defaultframe];
+	CUtlVector< bool > listed;
+	CUtlVector< s_vertanim_t > frame;
+	listed.SetCount( pvsource->numvanims[0] );
+
+	for (int t = 1; t < pvsource->numframes; t++)
+	{
+		if (t == defaultframe)
+			continue;
+
+		if (listed.Count())
+		{
+			memset( listed.Base(), 0, listed.Count() * sizeof( bool ) );
+		}
+		frame.CopyArray( pvsource->vanim[t], pvsource->numvanims[t] );
+		for (int m = 0; m < frame.Count(); m++)
+		{
+			if (frame[m].vertex >= 0 && frame[m].vertex < listed.Count())
+			{
+				listed[frame[m].vertex] = true;
+			}
+		}
+
+		for (int m = 0; m < numdefault; m++)
+		{
+			int v = pdefault[m].vertex;
+			if (v >= 0 && v < listed.Count() && !listed[v] && pvsource->vanim[0][v].vertex == v)
+			{
+				frame.AddToTail( pvsource->vanim[0][v] );
+				listed[v] = true;
+			}
+		}
+
+		if (frame.Count() == pvsource->numvanims[t])
+			continue;
+
+		frame.Sort( CompareVertAnimVertex );
+		pvsource->numvanims[t] = frame.Count();
+		pvsource->vanim[t] = (s_vertanim_t *)kalloc( frame.Count(), sizeof( s_vertanim_t ) );
+		memcpy( pvsource->vanim[t], frame.Base(), frame.Count() * sizeof( s_vertanim_t ) );
+	}
+}
+
+void RemapVertexAnimations(void)
+{
+	int i, j, k;
+	int n, m;
+	s_source_t	*pvsource;					// vertex animation source
+	s_loddata_t	*pmLodSource;				// original model source
+	Vector		tmp;
+	float		dist, dot;
+	CUtlVector<vanimgridvert_t>	modelgrid;	// model verts by position
+	CUtlVector<int>		nearverts;
+	// index by vertex in targets root LOD
+	CUtlVector<int>		model_to_vanim_vert_imap;	// model vert to vanim vert mapping
+	CUtlVector<float>	imapdist;	// distance from src vert to vanim vert
+	CUtlVector<float>	imapdot;	// dot product of src norm to vanim normal
+
+	// indexed by vertex anim vertex index
+	CUtlVector<int *>	mapp;
+
+	// indexed by model vertex, across all the flexed models
+	CUtlVector<bool>	doesMove;
+	int					numMoved;
+
+	int maxModelVerts = 0;
+	for (i = 0; i < g_numflexkeys; i++)
+	{
+		maxModelVerts = max( maxModelVerts, g_model[g_flexkey[i].imodel]->source->pLodData->numvertices );
+	}
+	doesMove.SetCount( maxModelVerts );
+	if ( maxModelVerts > 0 )
+	{
+		memset( doesMove.Base(), 0, maxModelVerts * sizeof( bool ) );
+	}
+	numMoved = 0;
+
+	// for all the sources of flexes, find a mapping of vertex animations to base model.
+	// There can be multiple "vertices" in the base model for each animated vertex since vertices 
+	// are duplicated along material boundaries.
+	for (i = 0; i < g_numflexkeys; i++)
+	{
+		pvsource = g_flexkey[i].source;
+
+		// skip if it's already been done or if has doesn't have any animations
+		if (pvsource->vanim_flag)
+			continue;
+
+		pmLodSource = g_model[g_flexkey[i].imodel]->source->pLodData;
+
+		// translate g_model into current frame 0 animation space
+		// not possible.  In the sample the bones were deleted.  Assume they are in the correct space
+		int minLod = min( g_minLod, g_ScriptLODs.Size() - 1 );
+		BuildVAnimGrid( pmLodSource, minLod, modelgrid );
+
+		// flag all the vertices that animate
+		pvsource->vanim_flag = (int *)kalloc( pvsource->numvertices, sizeof( int ));
+		for (n = i; n < g_numflexkeys; n++)
+		{
+			// make sure it's the current flex file and that it's not frame 0 (happens with eyeball stuff).
+			if (g_flexkey[n].source == pvsource && g_flexkey[n].frame != 0)
+			{
+				k = g_flexkey[n].frame;
+				for (m = 0; m < pvsource->numvanims[k]; m++)
+				{
+					pvsource->vanim_flag[pvsource->vanim[k][m].vertex] = 1;
+				}
+			}
+		}
+
+		// find frame 0 vertices to closest g_model vertex
+		model_to_vanim_vert_imap.SetCount( pmLodSource->numvertices );
+		imapdist.SetCount( pmLodSource->numvertices );
+		imapdot.SetCount( pmLodSource->numvertices );
+		for (j = 0; j < pmLodSource->numvertices; j++)
+		{
+			imapdist[j] = 1E30;
+			imapdot[j] = -1.0;
+			model_to_vanim_vert_imap[j] = -1;
+		}
+
+		for (j = 0; j < pvsource->numvertices; j++)
+		{
+			// don't check if it doesn't animate
+			if (0 && !pvsource->vanim_flag[j])
+				continue;
+
+			// only model verts in the neighboring grid cells can be close enough
+			FindVAnimGridVerts( modelgrid, pvsource->vanim[0][j].pos, nearverts );
+			for (int nearvert = 0; nearvert < nearverts.Count(); nearvert++)
+			{
+				k = nearverts[nearvert];
 
-				VectorSubtract( modelpos[k], pvsource->vanim[0][j].pos, tmp );
+				VectorSubtract( pmLodSource->vertex[k].position, pvsource->vanim[0][j].pos, tmp );
 				// TODO: Length() gives inconsistent results in release build
 				dist = tmp.LengthSqr();
 				dot = DotProduct( pmLodSource->vertex[k].normal, pvsource->vanim[0][j].normal );
@@ -2304,25 +2790,8 @@ void RemapVertexAnimations(void)
 						model_to_vanim_vert_imap[k] = j;
 
 					}
-					if (dist < minDist)
-					{
-						minDist = dist;
-						n = j;
-					}
 				}
 			}
-			if (minDist > 0.01)
-			{
-				// printf("vert %d dist %.4f\n", j, minDist );
-				// printf("%.4f %.4f %.4f\n", pvsource->vanim[0][j].pos[0], pvsource->vanim[0][j].pos[1], pvsource->vanim[0][j].pos[2] );
-			}
-
-			// VectorSubtract( modelpos[n], pvsource->vanim[0][j].pos, matchdelta[j] );
-
-			if (n == -1)
-			{
-				// printf("no match for animated vertex %d : %.4f %.4f %.4f\n", j, pvsource->vanim[0][j].pos[0], pvsource->vanim[0][j].pos[1], pvsource->vanim[0][j].pos[2] );
-			}
 		}
 		/*
 		for (j = 0; j < pmsource->numvertices; j++)
@@ -2371,7 +2840,7 @@ void RemapVertexAnimations(void)
 
 		pvsource->vanim_map = (int **)kalloc( pvsource->numvertices, sizeof( int * ));
 		int *vmap = (int *)kalloc( n, sizeof( int ) );
-		int *vsrcmap = vmap;
+		mapp.SetCount( pvsource->numvertices );
 
 		// build mapping arrays
 		for (j = 0; j < pvsource->numvertices; j++)
@@ -2416,8 +2885,12 @@ void RemapVertexAnimations(void)
 		pvsource = g_defaultflexkey->source;
 		pmLodSource = g_model[g_defaultflexkey->imodel]->source->pLodData;
 
-		int numsrcanims = pvsource->numvanims[g_defaultflexkey->frame];
-		s_vertanim_t *psrcanim = pvsource->vanim[g_defaultflexkey->frame];
+		CUtlVector< s_vertanim_t > defaultpose;
+		ExpandVertexAnimationFrame( pvsource, g_defaultflexkey->frame, defaultpose );
+		ListDefaultPoseVertices( pvsource, g_defaultflexkey->frame );
+
+		int numsrcanims = defaultpose.Count();
+		s_vertanim_t *psrcanim = defaultpose.Base();
 
 		for (m = 0; m < numsrcanims; m++)
 		{
@@ -2534,9 +3007,7 @@ void RemapVertexAnimations(void)
 				VectorSubtract( psrcanim->normal, pvsource->vanim[0][psrcanim->vertex].normal, ndelta );
 
 				// if the changes are too small, skip 'em
-				// FIXME: the clamp needs to be paired with the other matching positions.
-				// currently this is set to the float16 min value.  Sucky.
-				if (DotProduct( delta, delta ) > (0.001f*0.001f) /* 0.0001 */ || DotProduct( ndelta, ndelta ) > 0.001)
+				if (VertexAnimMoves( delta, ndelta ))
 				{
 					for (n = 0; n < pvsource->vanim_mapcount[psrcanim->vertex]; n++)
 					{
@@ -2617,21 +3088,33 @@ extern int FindLocalBoneNamed( const s_source_t *pSource, const char *pName );
 // Purpose: finds the bone index in the global bone table
 //-----------------------------------------------------------------------------
 
-int findGlobalBone( const char *name )
+static CBoneNameIndex s_GlobalBoneNames;
+static CBoneNameIndex s_GlobalBoneNamesXSI( true );
+
+static const char *GlobalBoneName( int k )
 {
-	int k;
+	return g_bonetable[k].name;
+}
+
+static CBoneNameIndex s_RenamedBoneNames;
+
+static const char *RenamedBoneName( int k )
+{
+	return g_renamedbone[k].from;
+}
+
+void InvalidateGlobalBoneNames()
+{
+	s_GlobalBoneNames.Invalidate();
+	s_GlobalBoneNamesXSI.Invalidate();
+	s_RenamedBoneNames.Invalidate();
+}
 
+int findGlobalBone( const char *name )
+{
 	name = RenameBone( name );
 
-	for ( k = 0; k < g_numbones; k++ )
-	{
-		if ( stricmp( g_bonetable[k].name, name ) == 0 )
-		{
-			return k;
-		}
-	}
-	
-	return -1;
+	return s_GlobalBoneNames.Find( name, g_numbones, GlobalBoneName );
 }
 
 
@@ -2660,21 +3143,9 @@ bool IsGlobalBoneXSI( const char *name, const char *bonename )
 
 int findGlobalBoneXSI( const char *name )
 {
-	int k;
-
 	name = RenameBone( name );
 
-	int len = strlen( name );
-
-	for (k = 0; k < g_numbones; k++)
-	{
-		if (IsGlobalBoneXSI( name, g_bonetable[k].name ))
-		{
-			return k;
-		}
-	}
-	
-	return -1;
+	return s_GlobalBoneNamesXSI.Find( name, g_numbones, GlobalBoneName );
 }
 
 //-----------------------------------------------------------------------------
@@ -3238,6 +3709,7 @@ void CollapseBones( void )
 		}
 
 		g_numbones--;
+		InvalidateGlobalBoneNames();
 		int m = g_bonetable[k].parent;
 
 		for (j = k; j < g_numbones; j++)
@@ -3280,6 +3752,10 @@ void MakeStaticProp()
 		s_source_t *psource = g_source[i];
 
 		strcpy( psource->localBone[0].name, "static_prop" );
+		if ( psource->pBoneNames )
+		{
+			psource->pBoneNames->Invalidate();
+		}
 		psource->localBone[0].parent = -1;
 
 		for (k = 1; k < psource->numbones; k++)
@@ -3564,6 +4040,10 @@ void RenameBones( )
 				if (!stricmp( g_source[i]->localBone[j].name, g_renamedbone[k].from))
 				{
 					strcpy( g_source[i]->localBone[j].name, g_renamedbone[k].to );
+					if ( g_source[i]->pBoneNames )
+					{
+						g_source[i]->pBoneNames->Invalidate();
+					}
 					break;
 				}
 			}
@@ -3574,13 +4054,10 @@ void RenameBones( )
 
 const char *RenameBone( const char *pName )
 {
-	int k;
-	for (k = 0; k < g_numrenamedbones; k++)
+	int k = s_RenamedBoneNames.Find( pName, g_numrenamedbones, RenamedBoneName );
+	if (k != -1)
 	{
-		if (!stricmp( pName, g_renamedbone[k].from))
-		{
-			return g_renamedbone[k].to;
-		}
+		return g_renamedbone[k].to;
 	}
 	return pName;
 }
@@ -3878,6 +4355,7 @@ void EnforceHierarchy( )
 				tmp = g_bonetable[i];
 				g_bonetable[i] = g_bonetable[j];
 				g_bonetable[j] = tmp;
+				InvalidateGlobalBoneNames();
 
 				// relink parents
 				for (k = i; k < g_numbones; k++)
@@ -6340,82 +6818,398 @@ static void ProcessIKRules( )
 // CompressAnimations
 //-----------------------------------------------------------------------------
 
-static void CompressAnimations( )
+// per bone channel range seen by one thread while finding the scales
+struct s_channelrange_t
 {
-	int i, j, k, n, m;
+	float	minv, maxv;
+	float	total_minv, total_maxv;
+};
 
-	// find scales for all bones
-	for (j = 0; j < g_numbones; j++)
+static CUtlVector< s_channelrange_t > s_ChannelRanges[MAX_TOOL_THREADS];
+
+static void InitChannelRanges( CUtlVector< s_channelrange_t > &ranges )
+{
+	ranges.SetSize( g_numbones * 6 );
+	for (int j = 0; j < g_numbones; j++)
 	{
-		// printf("%s : ", g_bonetable[j].name );
-		for (k = 0; k < 6; k++)
+		for (int k = 0; k < 6; k++)
 		{
-			float minv, maxv, scale;
-			float total_minv, total_maxv;
-
+			s_channelrange_t &range = ranges[j * 6 + k];
 			if (k < 3) 
 			{
-				minv = -128.0;
-				maxv = 128.0;
-				total_maxv = total_minv = g_bonetable[j].pos[k];
+				range.minv = -128.0;
+				range.maxv = 128.0;
+				range.total_maxv = range.total_minv = g_bonetable[j].pos[k];
 			}
 			else
 			{
-				minv = -M_PI / 8.0;
-				maxv = M_PI / 8.0;
-				total_maxv = total_minv = g_bonetable[j].rot[k-3];
+				range.minv = -M_PI / 8.0;
+				range.maxv = M_PI / 8.0;
+				range.total_maxv = range.total_minv = g_bonetable[j].rot[k-3];
 			}
+		}
+	}
+}
 
-			for (i = 0; i < g_numani; i++)
+static void FindChannelRangesThread( int iThread, int i )
+{
+	int j, k, n;
+	CUtlVector< s_channelrange_t > &ranges = s_ChannelRanges[iThread];
+
+	for (j = 0; j < g_numbones; j++)
+	{
+		for (k = 0; k < 6; k++)
+		{
+			s_channelrange_t &range = ranges[j * 6 + k];
+
+			for (n = 0; n < g_panimation[i]->numframes; n++)
+			{
+				float v;
+				switch(k)
+				{
+				case 0: 
+				case 1: 
+				case 2: 
+					if (g_panimation[i]->flags & STUDIO_DELTA)
+					{
+						v = g_panimation[i]->sanim[n][j].pos[k]; 
+					}
+					else
+					{
+						v = ( g_panimation[i]->sanim[n][j].pos[k] - g_bonetable[j].pos[k] ); 
+
+						if (g_panimation[i]->sanim[n][j].pos[k] < range.total_minv)
+							range.total_minv = g_panimation[i]->sanim[n][j].pos[k];
+						if (g_panimation[i]->sanim[n][j].pos[k] > range.total_maxv)
+							range.total_maxv = g_panimation[i]->sanim[n][j].pos[k];
+					}
+					break;
+				case 3:
+				case 4:
+				case 5:
+					if (g_panimation[i]->flags & STUDIO_DELTA)
+					{
+						v = g_panimation[i]->sanim[n][j].rot[k-3]; 
+					}
+					else
+					{
+						v = ( g_panimation[i]->sanim[n][j].rot[k-3] - g_bonetable[j].rot[k-3] ); 
+					}
+					while (v >= M_PI)
+						v -= M_PI * 2;
+					while (v < -M_PI)
+						v += M_PI * 2;
+					break;
+				}
+				if (v < range.minv)
+					range.minv = v;
+				if (v > range.maxv)
+					range.maxv = v;
+			}
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: RLE encode one channel into the fewest mstudioanimvalue_t entries
+//			ExtractAnimValue() can read.  A block stores its first frames as
+//			they are and holds its last value over the rest, so a run of
+//			frames that all lie within tolerance of one value can be held.
+//			A tolerance of 0 is lossless.  data needs room for numframes +
+//			numframes / 255 + 1 entries; returns how many were used.
+//-----------------------------------------------------------------------------
+static int EncodeAnimValues( const short *value, int numframes, int tolerance, mstudioanimvalue_t *data )
+{
+	int e, s, h;
+
+	// best[e] is the fewest entries that encode frames [0,e), the last block
+	// covering [blockstart[e],e) and holding from holdstart[e]
+	CUtlVector<int> best;
+	CUtlVector<int> blockstart;
+	CUtlVector<int> holdstart;
+	best.SetCount( numframes + 1 );
+	blockstart.SetCount( numframes + 1 );
+	holdstart.SetCount( numframes + 1 );
+	best[0] = 0;
+
+	// queues of frame indices: the smallest and largest values of the run
+	// ending at the current frame, and the block starts before that run
+	// ordered by best[s] - s
+	CUtlVector<int> runmin;
+	CUtlVector<int> runmax;
+	CUtlVector<int> starts;
+	runmin.SetCount( numframes );
+	runmax.SetCount( numframes );
+	starts.SetCount( numframes );
+	int minhead = 0, mintail = 0;
+	int maxhead = 0, maxtail = 0;
+	int starthead = 0, starttail = 0;
+
+	tolerance = min( max( tolerance, 0 ), 65535 );
+
+	int runstart = 0;
+	int nextstart = 0;
+	for (e = 1; e <= numframes; e++)
+	{
+		int f = e - 1;
+
+		// grow the run to take frame f, then drop frames off its front until
+		// its values fit inside the tolerance again
+		while (mintail > minhead && value[runmin[mintail-1]] >= value[f])
+			mintail--;
+		runmin[mintail++] = f;
+		while (maxtail > maxhead && value[runmax[maxtail-1]] <= value[f])
+			maxtail--;
+		runmax[maxtail++] = f;
+		while (value[runmax[maxhead]] - value[runmin[minhead]] > 2 * tolerance)
+		{
+			runstart++;
+			if (runmin[minhead] < runstart)
+				minhead++;
+			if (runmax[maxhead] < runstart)
+				maxhead++;
+		}
+
+		// blocks that start before the run store frames [s,runstart) and
+		// hold over the run
+		for ( ; nextstart < runstart; nextstart++)
+		{
+			while (starttail > starthead && best[starts[starttail-1]] - starts[starttail-1] >= best[nextstart] - nextstart)
+				starttail--;
+			starts[starttail++] = nextstart;
+		}
+		while (starttail > starthead && starts[starthead] < e - 255)
+			starthead++;
+
+		// a block that starts inside the run holds all of it; best[] never
+		// decreases so the earliest such start is the cheapest
+		s = max( e - 255, runstart );
+		best[e] = best[s] + 2;
+		blockstart[e] = s;
+		holdstart[e] = s;
+
+		if (starttail > starthead)
+		{
+			s = starts[starthead];
+			if (best[s] + 2 + runstart - s < best[e])
 			{
+				best[e] = best[s] + 2 + runstart - s;
+				blockstart[e] = s;
+				holdstart[e] = runstart;
+			}
+		}
+	}
+
+	// walk the blocks back to front, then write them out in order
+	CUtlVector<int> blockend;
+	for (e = numframes; e > 0; e = blockstart[e])
+	{
+		blockend.AddToHead( e );
+	}
+
+	mstudioanimvalue_t *pvalue = data;
+	for (int i = 0; i < blockend.Count(); i++)
+	{
+		e = blockend[i];
+		s = blockstart[e];
+		h = holdstart[e];
+
+		mstudioanimvalue_t *pcount = pvalue++;
+		pcount->num.valid = h - s + 1;
+		pcount->num.total = e - s;
+		for ( ; s < h; s++)
+		{
+			(pvalue++)->value = value[s];
+		}
+
+		// hold the middle of the run's values
+		int lo = value[h], hi = value[h];
+		for ( ; h < e; h++)
+		{
+			lo = min( lo, (int)value[h] );
+			hi = max( hi, (int)value[h] );
+		}
+		(pvalue++)->value = lo + (hi - lo) / 2;
+	}
+
+	return pvalue - data;
+}
+
+static void CompressAnimationThread( int iThread, int i )
+{
+	int j, k, n, m;
+
+	s_source_t *psource = g_panimation[i]->source;
+
+	if (g_bCheckLengths)
+	{
+		printf("%s\n", g_panimation[i]->name ); 
+	}
 
-				s_source_t *psource = g_panimation[i]->source;
+	for (j = 0; j < g_numbones; j++)
+	{
+		// skip bones that are always procedural
+		if (g_bonetable[j].flags & BONE_ALWAYS_PROCEDURAL)
+		{
+			// g_panimation[i]->weight[j] = 0.0;
+			continue;
+		}
 
-				for (n = 0; n < g_panimation[i]->numframes; n++)
+		// skip bones that have no influence
+		if (g_panimation[i]->weight[j] < 0.001)
+			continue;
+
+		float checkmin[6], checkmax[6];
+		for (k = 0; k < 6; k++)
+		{
+			checkmin[k] = 9999;
+			checkmax[k] = -9999;
+		}
+
+		for (k = 0; k < 6; k++)
+		{
+			float v;
+			short value[MAXSTUDIOANIMFRAMES];
+			mstudioanimvalue_t data[MAXSTUDIOANIMFRAMES + MAXSTUDIOANIMFRAMES / 255 + 1];
+			float tolerance;
+
+			// how far a stored value may be from its frame, in stored units
+			if (k < 3)
+			{
+				tolerance = g_flAnimPosTolerance / g_bonetable[j].posscale[k];
+				if (g_panimation[i]->flags & STUDIO_DELTA)
 				{
-					float v;
-					switch(k)
+					tolerance *= g_panimation[i]->posweight[j] / g_panimation[i]->weight[j];
+				}
+			}
+			else
+			{
+				tolerance = g_flAnimRotTolerance / g_bonetable[j].rotscale[k-3];
+			}
+
+			// find deltas from default pose
+			for (n = 0; n < g_panimation[i]->numframes; n++)
+			{
+				switch(k)
+				{
+				case 0: /* X Position */
+				case 1: /* Y Position */
+				case 2: /* Z Position */
+					if (g_panimation[i]->flags & STUDIO_DELTA)
 					{
-					case 0: 
-					case 1: 
-					case 2: 
-						if (g_panimation[i]->flags & STUDIO_DELTA)
-						{
-							v = g_panimation[i]->sanim[n][j].pos[k]; 
-						}
-						else
-						{
-							v = ( g_panimation[i]->sanim[n][j].pos[k] - g_bonetable[j].pos[k] ); 
+						value[n] = g_panimation[i]->sanim[n][j].pos[k] / g_bonetable[j].posscale[k]; 
+						// pre-scale pos delta since format only has room for "overall" weight
+						float r = g_panimation[i]->posweight[j] / g_panimation[i]->weight[j];
+						value[n] *= r;
+					}
+					else
+					{
+						value[n] = ( g_panimation[i]->sanim[n][j].pos[k] - g_bonetable[j].pos[k] ) / g_bonetable[j].posscale[k]; 
+					}
 
-							if (g_panimation[i]->sanim[n][j].pos[k] < total_minv)
-								total_minv = g_panimation[i]->sanim[n][j].pos[k];
-							if (g_panimation[i]->sanim[n][j].pos[k] > total_maxv)
-								total_maxv = g_panimation[i]->sanim[n][j].pos[k];
-						}
-						break;
-					case 3:
-					case 4:
-					case 5:
-						if (g_panimation[i]->flags & STUDIO_DELTA)
-						{
-							v = g_panimation[i]->sanim[n][j].rot[k-3]; 
-						}
-						else
-						{
-							v = ( g_panimation[i]->sanim[n][j].rot[k-3] - g_bonetable[j].rot[k-3] ); 
-						}
-						while (v >= M_PI)
-							v -= M_PI * 2;
-						while (v < -M_PI)
-							v += M_PI * 2;
-						break;
+					checkmin[k] = min( value[n] * g_bonetable[j].posscale[k], checkmin[k] );
+					checkmax[k] = max( value[n] * g_bonetable[j].posscale[k], checkmax[k] );
+					break;
+				case 3: /* X Rotation */
+				case 4: /* Y Rotation */
+				case 5: /* Z Rotation */
+					if (g_panimation[i]->flags & STUDIO_DELTA)
+					{
+						v = g_panimation[i]->sanim[n][j].rot[k-3]; 
 					}
-					if (v < minv)
-						minv = v;
-					if (v > maxv)
-						maxv = v;
+					else
+					{
+						v = ( g_panimation[i]->sanim[n][j].rot[k-3] - g_bonetable[j].rot[k-3] ); 
+					}
+
+					while (v >= M_PI)
+						v -= M_PI * 2;
+					while (v < -M_PI)
+						v += M_PI * 2;
+
+					checkmin[k] = min( v, checkmin[k] );
+					checkmax[k] = max( v, checkmax[k] );
+					value[n] = v / g_bonetable[j].rotscale[k-3]; 
+					break;
 				}
 			}
+			if (n == 0)
+				MdlError("no animation frames: \"%s\"\n", psource->filename );
+
+			// channels that never leave the default pose aren't stored
+			for (m = 0; m < n; m++)
+			{
+				if (abs( value[m] ) > tolerance)
+					break;
+			}
+			if (m == n)
+			{
+				g_panimation[i]->numanim[j][k] = 0;
+				continue;
+			}
+
+			// build a RLE of deltas from the default pose
+			g_panimation[i]->numanim[j][k] = EncodeAnimValues( value, n, (int)min( tolerance, 65535.0f ), data );
+			g_panimation[i]->anim[j][k] = (mstudioanimvalue_t *)kalloc( g_panimation[i]->numanim[j][k], sizeof( mstudioanimvalue_t ) );
+			memmove( g_panimation[i]->anim[j][k], data, g_panimation[i]->numanim[j][k] * sizeof( mstudioanimvalue_t ) );
+			// printf("%d(%d) ", g_source[i]->panim[q]->numanim[j][k], n );
+		}
+
+		if (g_bCheckLengths)
+		{
+			char *tmp[6] = { "X", "Y", "Z", "XR", "YR", "ZR" };
+			n = 0;
+			for (k = 0; k < 3; k++)
+			{
+				if (checkmin[k] != 0)
+				{
+					if (n == 0)
+						printf("%s :", g_bonetable[j].name );
+				
+					printf("%s(%.1f: %.1f %.1f) ", tmp[k], g_bonetable[j].pos[k], checkmin[k], checkmax[k] );
+					n = 1;
+				}
+			}
+			if (n)
+				printf("\n");
+		}
+	}
+}
+
+static void CompressAnimations( )
+{
+	int i, j, k;
+
+	// find scales for all bones; each thread gathers the ranges of the
+	// animations it gets, then the ranges are merged
+	for (i = 0; i < MAX_TOOL_THREADS; i++)
+	{
+		InitChannelRanges( s_ChannelRanges[i] );
+	}
+	RunThreadsOnIndividual( g_numani, false, FindChannelRangesThread );
+
+	for (j = 0; j < g_numbones; j++)
+	{
+		// printf("%s : ", g_bonetable[j].name );
+		for (k = 0; k < 6; k++)
+		{
+			float minv, maxv, scale;
+			float total_minv, total_maxv;
+
+			s_channelrange_t &range = s_ChannelRanges[0][j * 6 + k];
+			minv = range.minv;
+			maxv = range.maxv;
+			total_minv = range.total_minv;
+			total_maxv = range.total_maxv;
+			for (i = 1; i < MAX_TOOL_THREADS; i++)
+			{
+				s_channelrange_t &threadRange = s_ChannelRanges[i][j * 6 + k];
+				minv = min( minv, threadRange.minv );
+				maxv = max( maxv, threadRange.maxv );
+				total_minv = min( total_minv, threadRange.total_minv );
+				total_maxv = max( total_maxv, threadRange.total_maxv );
+			}
+
 			if (minv < maxv)
 			{
 				if (-minv> maxv)
@@ -6452,171 +7246,24 @@ static void CompressAnimations( )
 		// printf("\n" );
 	}
 
+	for (i = 0; i < MAX_TOOL_THREADS; i++)
+	{
+		s_ChannelRanges[i].Purge();
+	}
 
 	// reduce animations
-	for (i = 0; i < g_numani; i++)
+	if (g_bCheckLengths)
 	{
-		s_source_t *psource = g_panimation[i]->source;
-
-		if (g_bCheckLengths)
-		{
-			printf("%s\n", g_panimation[i]->name ); 
-		}
-
-		for (j = 0; j < g_numbones; j++)
+		// keep the length report in order
+		for (i = 0; i < g_numani; i++)
 		{
-			// skip bones that are always procedural
-			if (g_bonetable[j].flags & BONE_ALWAYS_PROCEDURAL)
-			{
-				// g_panimation[i]->weight[j] = 0.0;
-				continue;
-			}
-
-			// skip bones that have no influence
-			if (g_panimation[i]->weight[j] < 0.001)
-				continue;
-
-			float checkmin[6], checkmax[6];
-			for (k = 0; k < 6; k++)
-			{
-				checkmin[k] = 9999;
-				checkmax[k] = -9999;
-			}
-
-			for (k = 0; k < 6; k++)
-			{
-				mstudioanimvalue_t	*pcount, *pvalue;
-				float v;
-				short value[MAXSTUDIOANIMFRAMES];
-				mstudioanimvalue_t data[MAXSTUDIOANIMFRAMES];
-
-				// find deltas from default pose
-				for (n = 0; n < g_panimation[i]->numframes; n++)
-				{
-					switch(k)
-					{
-					case 0: /* X Position */
-					case 1: /* Y Position */
-					case 2: /* Z Position */
-						if (g_panimation[i]->flags & STUDIO_DELTA)
-						{
-							value[n] = g_panimation[i]->sanim[n][j].pos[k] / g_bonetable[j].posscale[k]; 
-							// pre-scale pos delta since format only has room for "overall" weight
-							float r = g_panimation[i]->posweight[j] / g_panimation[i]->weight[j];
-							value[n] *= r;
-						}
-						else
-						{
-							value[n] = ( g_panimation[i]->sanim[n][j].pos[k] - g_bonetable[j].pos[k] ) / g_bonetable[j].posscale[k]; 
-						}
-
-						checkmin[k] = min( value[n] * g_bonetable[j].posscale[k], checkmin[k] );
-						checkmax[k] = max( value[n] * g_bonetable[j].posscale[k], checkmax[k] );
-						break;
-					case 3: /* X Rotation */
-					case 4: /* Y Rotation */
-					case 5: /* Z Rotation */
-						if (g_panimation[i]->flags & STUDIO_DELTA)
-						{
-							v = g_panimation[i]->sanim[n][j].rot[k-3]; 
-						}
-						else
-						{
-							v = ( g_panimation[i]->sanim[n][j].rot[k-3] - g_bonetable[j].rot[k-3] ); 
-						}
-
-						while (v >= M_PI)
-							v -= M_PI * 2;
-						while (v < -M_PI)
-							v += M_PI * 2;
-
-						checkmin[k] = min( v, checkmin[k] );
-						checkmax[k] = max( v, checkmax[k] );
-						value[n] = v / g_bonetable[j].rotscale[k-3]; 
-						break;
-					}
-				}
-				if (n == 0)
-					MdlError("no animation frames: \"%s\"\n", psource->filename );
-
-				// FIXME: this compression algorithm needs work
-
-				// initialize animation RLE block
-				g_panimation[i]->numanim[j][k] = 0;
-
-				memset( data, 0, sizeof( data ) ); 
-				pcount = data; 
-				pvalue = pcount + 1;
-
-				pcount->num.valid = 1;
-				pcount->num.total = 1;
-				pvalue->value = value[0];
-				pvalue++;
-
-				// build a RLE of deltas from the default pose
-				for (m = 1; m < n; m++)
-				{
-					if (pcount->num.total == 255)
-					{
-						// chain too long, force a new entry
-						pcount = pvalue;
-						pvalue = pcount + 1;
-						pcount->num.valid++;
-						pvalue->value = value[m];
-						pvalue++;
-					} 
-					// insert value if they're not equal, 
-					// or if we're not on a run and the run is less than 3 units
-					else if ((value[m] != value[m-1]) 
-						|| ((pcount->num.total == pcount->num.valid) && ((m < n - 1) && value[m] != value[m+1])))
-					{
-						if (pcount->num.total != pcount->num.valid)
-						{
-							//if (j == 0) printf("%d:%d   ", pcount->num.valid, pcount->num.total ); 
-							pcount = pvalue;
-							pvalue = pcount + 1;
-						}
-						pcount->num.valid++;
-						pvalue->value = value[m];
-						pvalue++;
-					}
-					pcount->num.total++;
-				}
-				//if (j == 0) printf("%d:%d\n", pcount->num.valid, pcount->num.total ); 
-
-				g_panimation[i]->numanim[j][k] = pvalue - data;
-				if (g_panimation[i]->numanim[j][k] == 2 && value[0] == 0)
-				{
-					g_panimation[i]->numanim[j][k] = 0;
-				}
-				else
-				{
-					g_panimation[i]->anim[j][k] = (mstudioanimvalue_t *)kalloc( pvalue - data, sizeof( mstudioanimvalue_t ) );
-					memmove( g_panimation[i]->anim[j][k], data, (pvalue - data) * sizeof( mstudioanimvalue_t ) );
-				}
-				// printf("%d(%d) ", g_source[i]->panim[q]->numanim[j][k], n );
-			}
-
-			if (g_bCheckLengths)
-			{
-				char *tmp[6] = { "X", "Y", "Z", "XR", "YR", "ZR" };
-				n = 0;
-				for (k = 0; k < 3; k++)
-				{
-					if (checkmin[k] != 0)
-					{
-						if (n == 0)
-							printf("%s :", g_bonetable[j].name );
-					
-						printf("%s(%.1f: %.1f %.1f) ", tmp[k], g_bonetable[j].pos[k], checkmin[k], checkmax[k] );
-						n = 1;
-					}
-				}
-				if (n)
-					printf("\n");
-			}
+			CompressAnimationThread( 0, i );
 		}
 	}
+	else
+	{
+		RunThreadsOnIndividual( g_numani, false, CompressAnimationThread );
+	}
 }
 
 //-----------------------------------------------------------------------------
@@ -6701,10 +7348,9 @@ static void CompressIKErrors( )
 
 				pRule->scale[k] = scale;
 				
-				mstudioanimvalue_t	*pcount, *pvalue;
 				float v;
 				short value[MAXSTUDIOANIMFRAMES];
-				mstudioanimvalue_t data[MAXSTUDIOANIMFRAMES];
+				mstudioanimvalue_t data[MAXSTUDIOANIMFRAMES + MAXSTUDIOANIMFRAMES / 255 + 1];
 
 				// find deltas from default pose
 				for (n = 0; n < pRule->numerror; n++)
@@ -6730,52 +7376,10 @@ static void CompressIKErrors( )
 					}
 				}
 
-				// initialize animation RLE block
-				pRule->numanim[k] = 0;
-
-				memset( data, 0, sizeof( data ) ); 
-				pcount = data; 
-				pvalue = pcount + 1;
-
-				pcount->num.valid = 1;
-				pcount->num.total = 1;
-				pvalue->value = value[0];
-				pvalue++;
-
-				// build a RLE of deltas from the default pose
-				for (m = 1; m < n; m++)
-				{
-					if (pcount->num.total == 255)
-					{
-						// chain too long, force a new entry
-						pcount = pvalue;
-						pvalue = pcount + 1;
-						pcount->num.valid++;
-						pvalue->value = value[m];
-						pvalue++;
-					} 
-					// insert value if they're not equal, 
-					// or if we're not on a run and the run is less than 3 units
-					else if ((value[m] != value[m-1]) 
-						|| ((pcount->num.total == pcount->num.valid) && ((m < n - 1) && value[m] != value[m+1])))
-					{
-						if (pcount->num.total != pcount->num.valid)
-						{
-							//if (j == 0) printf("%d:%d   ", pcount->num.valid, pcount->num.total ); 
-							pcount = pvalue;
-							pvalue = pcount + 1;
-						}
-						pcount->num.valid++;
-						pvalue->value = value[m];
-						pvalue++;
-					}
-					pcount->num.total++;
-				}
-				//if (j == 0) printf("%d:%d\n", pcount->num.valid, pcount->num.total ); 
-
-				pRule->numanim[k] = pvalue - data;
-				pRule->anim[k] = (mstudioanimvalue_t *)kalloc( pvalue - data, sizeof( mstudioanimvalue_t ) );
-				memmove( pRule->anim[k], data, (pvalue - data) * sizeof( mstudioanimvalue_t ) );
+				// build a RLE of the errors
+				pRule->numanim[k] = EncodeAnimValues( value, n, 0, data );
+				pRule->anim[k] = (mstudioanimvalue_t *)kalloc( pRule->numanim[k], sizeof( mstudioanimvalue_t ) );
+				memmove( pRule->anim[k], data, pRule->numanim[k] * sizeof( mstudioanimvalue_t ) );
 				// printf("%d (%d) : %d\n", pRule->numanim[k], n, pRule->numerror );
 			}
 		}
@@ -7046,129 +7650,110 @@ void SetupFullBoneRenderBounds( CUtlVector<CBoneRenderBounds> &boneRenderBounds
 }
 
 
-void CalcSequenceBoundingBoxes()
+// the bone bounds CalcSequenceBoundingBoxes is sweeping through the animations
+static const CUtlVector<CBoneRenderBounds> *s_pBoneRenderBounds;
+
+static void CalcAnimationBoundingBoxThread( int iThread, int i )
 {
-	int i;
 	int	j;
 	int	k;
 	int	n;
 	int	m;
 
-	CUtlVector<CBoneRenderBounds> boneRenderBounds;
-	SetupFullBoneRenderBounds( boneRenderBounds );
+	s_animation_t *panim = g_panimation[i];
 
-	// find bounding box for each g_sequence
-	for (i = 0; i < g_numani; i++)
+	// one bounding box per lane, merged at the end
+	FourVectors bmin, bmax;
+	bmin.DuplicateVector( Vector( 9999.0, 9999.0, 9999.0 ) );
+	bmax.DuplicateVector( Vector( -9999.0, -9999.0, -9999.0 ) );
+
+	CPoseBatch pose;
+
+	// find intersection box volume for each bone, four frames at a time
+	for (j = 0; j < panim->numframes; j += 4)
 	{
-		Vector bmin, bmax;
-		
-		// find intersection box volume for each bone
-		for (j = 0; j < 3; j++)
-		{
-			bmin[j] = 9999.0;
-			bmax[j] = -9999.0;
-		}
+		// the unweighted pose, not blended to the ref pose by the weightlist
+		pose.Build( panim, j );
 
-		for (j = 0; j < g_panimation[i]->numframes; j++)
+		// include hitboxes as well.
+		for (k = 0; k < g_numbones; k++)
 		{
-			matrix3x4_t bonetransform[MAXSTUDIOBONES];	// bone transformation matrix
-			matrix3x4_t posetransform[MAXSTUDIOBONES];	// bone transformation matrix
-			matrix3x4_t bonematrix;						// local transformation matrix
-			Vector pos;
-
-			for (k = 0; k < g_numbones; k++)
+			FourVectors tmpMin, tmpMax;
+			TransformAABBBatch( pose.BoneToWorld( k ), (*s_pBoneRenderBounds)[k].m_Mins, (*s_pBoneRenderBounds)[k].m_Maxs, tmpMin, tmpMax );
+			for (n = 0; n < 3; n++)
 			{
-// TODO: We're 2 weeks from shipping so this isn't safe enough to change.
-// Just using anglematrix is a bug for certain models because if we don't then 
-// blend to the ref pose based on the weightlist, we may bloat the bbox from animation that doesn't ever get used
-// in this animation. This can be pretty bad if, for example, the guy is walking, but
-// it's an upper-body-only animation and we don't want his root bone movement in the bbox.
-#if 1
-				AngleMatrix( g_panimation[i]->sanim[j][k].rot, g_panimation[i]->sanim[j][k].pos, bonematrix );
-#else
-				Quaternion animQuat, referenceQuat, blendedQuat;
-				AngleQuaternion( g_panimation[i]->sanim[j][k].rot, animQuat );
-				AngleQuaternion( g_bonetable[k].rot, referenceQuat );
-
-				Vector animPos = g_panimation[i]->sanim[j][k].pos;
-				Vector referencePos = g_bonetable[k].pos;
-				Vector blendedPos;
-
-				
-				float flWeight = g_panimation[i]->weight[k];
-				VectorLerp( referencePos, animPos, flWeight, blendedPos );
-				QuaternionSlerp( referenceQuat, animQuat, flWeight, blendedQuat );				
-				
-				QuaternionMatrix( blendedQuat, blendedPos, bonematrix );				
-#endif
-				
-
-				if (g_bonetable[k].parent == -1)
-				{
-					MatrixCopy( bonematrix, bonetransform[k] );
-				}
-				else
-				{
-					ConcatTransforms (bonetransform[g_bonetable[k].parent], bonematrix, bonetransform[k]);
-				}
-
-				MatrixInvert( g_bonetable[k].boneToPose, bonematrix );
-				ConcatTransforms (bonetransform[k], bonematrix, posetransform[k]);
+				bmin[n] = MinSIMD( tmpMin[n], bmin[n] );
+				bmax[n] = MaxSIMD( tmpMax[n], bmax[n] );
 			}
+		}
 
-			// include hitboxes as well.
-			for (k = 0; k < g_numbones; k++)
+		for (k = 0; k < g_nummodelsbeforeLOD; k++)
+		{
+			s_loddata_t *pLodDataSrc = g_model[k]->source->pLodData;
+			if (!pLodDataSrc)
 			{
-				Vector tmpMin, tmpMax;
-				TransformAABB( bonetransform[k], boneRenderBounds[k].m_Mins, boneRenderBounds[k].m_Maxs, tmpMin, tmpMax );
-				if (tmpMin[0] < bmin[0]) bmin[0] = tmpMin[0];
-				if (tmpMin[1] < bmin[1]) bmin[1] = tmpMin[1];
-				if (tmpMin[2] < bmin[2]) bmin[2] = tmpMin[2];
-				if (tmpMax[0] > bmax[0]) bmax[0] = tmpMax[0];
-				if (tmpMax[1] > bmax[1]) bmax[1] = tmpMax[1];
-				if (tmpMax[2] > bmax[2]) bmax[2] = tmpMax[2];
+				// skip blank empty model
+				continue;
 			}
 
-			for (k = 0; k < g_nummodelsbeforeLOD; k++)
+			for (n = 0; n < pLodDataSrc->numvertices; n++)
 			{
-				s_loddata_t *pLodDataSrc = g_model[k]->source->pLodData;
-				if (!pLodDataSrc)
+				const s_vertexinfo_t &vertex = pLodDataSrc->vertex[n];
+				FourVectors pos;
+				pos.DuplicateVector( Vector( 0, 0, 0 ) );
+				for (m = 0; m < vertex.globalBoneweight.numbones; m++)
 				{
-					// skip blank empty model
-					continue;
+					FourVectors tmp;
+					VectorTransformBatch( vertex.position, pose.PoseToWorld( vertex.globalBoneweight.bone[m] ), tmp ); // bug: should use all bones!
+					fltx4 weight = ReplicateX4( vertex.globalBoneweight.weight[m] );
+					pos.x = AddSIMD( pos.x, MulSIMD( tmp.x, weight ) );
+					pos.y = AddSIMD( pos.y, MulSIMD( tmp.y, weight ) );
+					pos.z = AddSIMD( pos.z, MulSIMD( tmp.z, weight ) );
 				}
 
-				for (n = 0; n < pLodDataSrc->numvertices; n++)
-				{
-					Vector tmp;
-					pos = Vector( 0, 0, 0 );
-					for (m = 0; m < pLodDataSrc->vertex[n].globalBoneweight.numbones; m++)
-					{
-						tmp;
-						VectorTransform( pLodDataSrc->vertex[n].position, posetransform[pLodDataSrc->vertex[n].globalBoneweight.bone[m]], tmp ); // bug: should use all bones!
-						VectorMA( pos, pLodDataSrc->vertex[n].globalBoneweight.weight[m], tmp, pos );
-					}
-
-					if (pos[0] < bmin[0]) bmin[0] = pos[0];
-					if (pos[1] < bmin[1]) bmin[1] = pos[1];
-					if (pos[2] < bmin[2]) bmin[2] = pos[2];
-					if (pos[0] > bmax[0]) bmax[0] = pos[0];
-					if (pos[1] > bmax[1]) bmax[1] = pos[1];
-					if (pos[2] > bmax[2]) bmax[2] = pos[2];
-				}
+				bmin.x = MinSIMD( pos.x, bmin.x );
+				bmin.y = MinSIMD( pos.y, bmin.y );
+				bmin.z = MinSIMD( pos.z, bmin.z );
+				bmax.x = MaxSIMD( pos.x, bmax.x );
+				bmax.y = MaxSIMD( pos.y, bmax.y );
+				bmax.z = MaxSIMD( pos.z, bmax.z );
 			}
 		}
+	}
 
-		VectorCopy( bmin, g_panimation[i]->bmin );
-		VectorCopy( bmax, g_panimation[i]->bmax );
+	for (k = 0; k < 3; k++)
+	{
+		panim->bmin[k] = SubFloat( bmin[k], 0 );
+		panim->bmax[k] = SubFloat( bmax[k], 0 );
+		for (n = 1; n < 4; n++)
+		{
+			if (SubFloat( bmin[k], n ) < panim->bmin[k])
+				panim->bmin[k] = SubFloat( bmin[k], n );
+			if (SubFloat( bmax[k], n ) > panim->bmax[k])
+				panim->bmax[k] = SubFloat( bmax[k], n );
+		}
+	}
 
-		/*
-		printf("%s : %.0f %.0f %.0f %.0f %.0f %.0f\n", 
-			g_panimation[i]->name, bmin[0], bmax[0], bmin[1], bmax[1], bmin[2], bmax[2] );
-		*/
+	/*
+	printf("%s : %.0f %.0f %.0f %.0f %.0f %.0f\n", 
+		panim->name, panim->bmin[0], panim->bmax[0], panim->bmin[1], panim->bmax[1], panim->bmin[2], panim->bmax[2] );
+	*/
+}
 
-		// printf("%s  %.2f\n", g_sequence[i].name, g_sequence[i].panim[0]->pos[9][0][0] / g_bonetable[9].pos[0] );
-	}
+
+void CalcSequenceBoundingBoxes()
+{
+	int i;
+	int	j;
+	int	k;
+
+	CUtlVector<CBoneRenderBounds> boneRenderBounds;
+	SetupFullBoneRenderBounds( boneRenderBounds );
+
+	// find bounding box for each g_sequence
+	s_pBoneRenderBounds = &boneRenderBounds;
+	RunThreadsOnIndividual( g_numani, false, CalcAnimationBoundingBoxThread );
+	s_pBoneRenderBounds = NULL;
 
 	for (i = 0; i < g_sequence.Count(); i++)
 	{
@@ -7226,9 +7811,9 @@ void SimplifyModel()
 
 	// have to load the lod sources before remapping bones so that the remap
 	// happens for all LODs.
-	LoadLODSources();
+	Timings_Stage( "LoadLODSources", LoadLODSources );
 
-	RemapBones();
+	Timings_Stage( "RemapBones", RemapBones );
 
 	LinkIKChains();
 
@@ -7255,11 +7840,11 @@ void SimplifyModel()
 	// replacebone "bone2" "bone3"
 	FixupReplacedBones();  
 
-	RemapVerticesToGlobalBones();
+	Timings_Stage( "RemapVerticesToGlobalBones", RemapVerticesToGlobalBones );
 	
 	// remap lods to root, building aggregate final pools
 	// mark bones used by an lod
-	UnifyLODs();
+	Timings_Stage( "UnifyLODs", UnifyLODs );
 	
 	if ( g_bPrintBones )
 	{
@@ -7275,16 +7860,16 @@ void SimplifyModel()
 	}
 	SpewBoneUsageStats();
 
-	RemapAnimations();
+	Timings_Stage( "RemapAnimations", RemapAnimations );
 
-	processAnimations();
+	Timings_Stage( "processAnimations", processAnimations );
 
 	limitBoneRotations();
 
 	limitIKChainLength();
 
-	MakeTransitions();
-	RemapVertexAnimations();
+	Timings_Stage( "MakeTransitions", MakeTransitions );
+	Timings_Stage( "RemapVertexAnimations", RemapVertexAnimations );
 
 	FindAutolayers();
 
@@ -7308,9 +7893,9 @@ void SimplifyModel()
 
 	LockBoneLengths();
 
-	ProcessIKRules();
+	Timings_Stage( "ProcessIKRules", ProcessIKRules );
 
-	CompressIKErrors( );
+	Timings_Stage( "CompressIKErrors", CompressIKErrors );
 
 	CalcPoseParameters();
 
@@ -7318,9 +7903,9 @@ void SimplifyModel()
 
 	SetupHitBoxes();
 
-	CompressAnimations( );
+	Timings_Stage( "CompressAnimations", CompressAnimations );
 
-	CalcSequenceBoundingBoxes();
+	Timings_Stage( "CalcSequenceBoundingBoxes", CalcSequenceBoundingBoxes );
 
 	SetIlluminationPosition();
 }
@@ -25,6 +25,13 @@
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <math.h>
+#include <ctype.h>
+#include <atomic>
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 #include "istudiorender.h"
 #include "filesystem_tools.h"
 
@@ -36,10 +43,15 @@
 #include "studiomdl.h"
 #include "collisionmodel.h"
 #include "optimize.h"
+#include "bonenames.h"
+#include "linereader.h"
+#include "perfstats.h"
+#include "threads.h"
 #include "vstdlib/strtools.h"
 #include "bspflags.h"
 #include "vstdlib/icommandline.h"
 #include "utldict.h"
+#include "tier1/checksum_md5.h"
 
 
 bool g_collapse_bones = false;
@@ -62,6 +74,8 @@ bool g_bOverridePreDefinedBones = true;
 bool g_bXbox = false;
 int g_minLod = 0;
 bool g_bNoWarnings = false;
+float g_flAnimRotTolerance = 0;
+float g_flAnimPosTolerance = 0;
 
 char g_path[1024];
 
@@ -74,10 +88,11 @@ CUtlVector< char >	g_KeyValueText;
 //  Stuff for writing a makefile to build models incrementally.
 //-----------------------------------------------------------------------------
 CUtlVector<CUtlSymbol> m_CreateMakefileDependencies;
+extern bool g_bCompileCache;
 
 void CreateMakefile_AddDependency( const char *pFileName )
 {
-	if( !g_bCreateMakefile )
+	if( !g_bCreateMakefile && !g_bCompileCache )
 	{
 		return;
 	}
@@ -133,11 +148,309 @@ void CreateMakefile_OutputMakefile( void )
 	fclose( fp );
 }
 
+
+//-----------------------------------------------------------------------------
+//  -cache <dir>: skip compiles whose .qc, sources and options haven't changed.
+//
+//  The entry for a compile lives in <dir>/<key>/, where the key hashes the
+//  studiomdl build, the .qc path, the gamedir and the options. Its manifest
+//  holds the hash of every file the last compile read (the makefile
+//  dependencies and the game scripts it loaded), the game files it looked
+//  for and didn't find, and the outputs it wrote, which are copied
+//  alongside. When every dependency still hashes the same and the missing
+//  files are still missing the outputs are copied back into the gamedir
+//  instead of compiling. A compile that reads something the cache can't
+//  follow isn't stored.
+//-----------------------------------------------------------------------------
+bool g_bCompileCache = false;
+char g_szCacheDir[MAX_PATH];
+static char s_CompileCacheEntry[MAX_PATH];
+static CUtlVector<CUtlSymbol> s_CompileCacheInputs;
+static CUtlVector<CUtlSymbol> s_CompileCacheOutputs;
+static const char *s_pCompileCacheUntracked;
+
+// a file outside the sources the output depends on, which might not exist
+void CompileCache_AddInput( const char *pFileName )
+{
+	if ( !g_bCompileCache )
+		return;
+
+	CUtlSymbol sym( pFileName );
+	if ( s_CompileCacheInputs.Find( sym ) < 0 )
+	{
+		s_CompileCacheInputs.AddToTail( sym );
+	}
+}
+
+// the compile read something it can't name the files of
+void CompileCache_Untracked( const char *pWhat )
+{
+	if ( !s_pCompileCacheUntracked )
+	{
+		s_pCompileCacheUntracked = pWhat;
+	}
+}
+
+void CompileCache_AddOutput( const char *pFileName )
+{
+	if ( !g_bCompileCache )
+		return;
+
+	CUtlSymbol sym( pFileName );
+	if ( s_CompileCacheOutputs.Find( sym ) < 0 )
+	{
+		s_CompileCacheOutputs.AddToTail( sym );
+	}
+}
+
+bool CompileCache_HashFile( const char *pFileName, char *pHash, int nHashSize )
+{
+	FILE *fp = fopen( pFileName, "rb" );
+	if ( !fp )
+		return false;
+
+	MD5Context_t ctx;
+	MD5Init( &ctx );
+	unsigned char buf[65536];
+	size_t nRead;
+	while ( ( nRead = fread( buf, 1, sizeof( buf ), fp ) ) > 0 )
+	{
+		MD5Update( &ctx, buf, (unsigned int)nRead );
+	}
+	fclose( fp );
+
+	unsigned char digest[MD5_DIGEST_LENGTH];
+	MD5Final( digest, &ctx );
+	Q_strncpy( pHash, MD5_Print( digest, MD5_DIGEST_LENGTH ), nHashSize );
+	return true;
+}
+
+static bool CompileCache_CopyFile( const char *pSrc, const char *pDest )
+{
+	FILE *fpSrc = fopen( pSrc, "rb" );
+	if ( !fpSrc )
+		return false;
+
+	EnsureFileDirectoryExists( pDest );
+	FILE *fpDest = fopen( pDest, "wb" );
+	if ( !fpDest )
+	{
+		fclose( fpSrc );
+		return false;
+	}
+
+	bool bOk = true;
+	unsigned char buf[65536];
+	size_t nRead;
+	while ( ( nRead = fread( buf, 1, sizeof( buf ), fpSrc ) ) > 0 )
+	{
+		if ( fwrite( buf, 1, nRead, fpDest ) != nRead )
+		{
+			bOk = false;
+			break;
+		}
+	}
+	fclose( fpSrc );
+	if ( fclose( fpDest ) != 0 )
+		bOk = false;
+	return bOk;
+}
+
+static void CompileCache_HashString( MD5Context_t *pCtx, const char *pString )
+{
+	// include the terminator so "ab","c" and "a","bc" differ
+	MD5Update( pCtx, (const unsigned char *)pString, (unsigned int)strlen( pString ) + 1 );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: pick the cache entry for this compile; everything on the command
+//			line except the .qc and the options that don't change the output
+//-----------------------------------------------------------------------------
+static void CompileCache_Init( int argc, char **argv, int qcArgIndex )
+{
+	MD5Context_t ctx;
+	MD5Init( &ctx );
+
+	// a rebuilt studiomdl may write different files for the same input
+	CompileCache_HashString( &ctx, __DATE__ " " __TIME__ );
+	char exeName[MAX_PATH] = "";
+#ifdef _WIN32
+	GetModuleFileNameA( NULL, exeName, sizeof( exeName ) );
+#else
+	ssize_t nLen = readlink( "/proc/self/exe", exeName, sizeof( exeName ) - 1 );
+	exeName[nLen > 0 ? nLen : 0] = '\0';
+#endif
+	char exeHash[64];
+	if ( exeName[0] && CompileCache_HashFile( exeName, exeHash, sizeof( exeHash ) ) )
+	{
+		CompileCache_HashString( &ctx, exeHash );
+	}
+
+	CompileCache_HashString( &ctx, fullpath );
+	CompileCache_HashString( &ctx, gamedir );
+	for ( int i = 1; i < argc; i++ )
+	{
+		if ( i == qcArgIndex )
+			continue;
+		if ( !stricmp( argv[i], "-cache" ) || !stricmp( argv[i], "-jobs" ) )
+		{
+			i++;
+			continue;
+		}
+		if ( !stricmp( argv[i], "-timings" ) || !stricmp( argv[i], "-server" ) )
+			continue;
+		CompileCache_HashString( &ctx, argv[i] );
+	}
+
+	unsigned char digest[MD5_DIGEST_LENGTH];
+	MD5Final( digest, &ctx );
+	Q_snprintf( s_CompileCacheEntry, sizeof( s_CompileCacheEntry ), "%s/%s", g_szCacheDir, MD5_Print( digest, MD5_DIGEST_LENGTH ) );
+	Q_FixSlashes( s_CompileCacheEntry );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: copy the outputs of the last compile back if none of the files it
+//			read have changed, returns false when the model has to be compiled
+//-----------------------------------------------------------------------------
+static bool CompileCache_Restore( void )
+{
+	char manifest[MAX_PATH];
+	Q_snprintf( manifest, sizeof( manifest ), "%s%cmanifest", s_CompileCacheEntry, CORRECT_PATH_SEPARATOR );
+	FILE *fp = fopen( manifest, "r" );
+	if ( !fp )
+		return false;
+
+	// the dependencies all come before the outputs
+	CUtlVector<CUtlSymbol> outputs;
+	bool bHit = true;
+	char line[MAX_PATH + 64];
+	while ( bHit && fgets( line, sizeof( line ), fp ) )
+	{
+		line[strcspn( line, "\r\n" )] = '\0';
+		if ( !strncmp( line, "dep ", 4 ) )
+		{
+			char *pPath = strchr( line + 4, ' ' );
+			if ( !pPath )
+			{
+				bHit = false;
+				break;
+			}
+			*pPath++ = '\0';
+
+			char hash[64];
+			if ( !strcmp( line + 4, "-" ) )
+			{
+				// a game file that wasn't there last time
+				bHit = !CompileCache_HashFile( pPath, hash, sizeof( hash ) );
+			}
+			else
+			{
+				bHit = CompileCache_HashFile( pPath, hash, sizeof( hash ) ) && !stricmp( hash, line + 4 );
+			}
+		}
+		else if ( !strncmp( line, "out ", 4 ) )
+		{
+			outputs.AddToTail( CUtlSymbol( line + 4 ) );
+		}
+	}
+	fclose( fp );
+
+	if ( !bHit || outputs.Count() == 0 )
+		return false;
+
+	for ( int i = 0; i < outputs.Count(); i++ )
+	{
+		char cached[MAX_PATH];
+		Q_snprintf( cached, sizeof( cached ), "%s%c%d_%s", s_CompileCacheEntry, CORRECT_PATH_SEPARATOR, i, V_UnqualifiedFileName( outputs[i].String() ) );
+		if ( !CompileCache_CopyFile( cached, outputs[i].String() ) )
+		{
+			MdlWarning( "compile cache: can't restore \"%s\", compiling\n", outputs[i].String() );
+			return false;
+		}
+		if ( !g_quiet )
+		{
+			printf( "restored %s\n", outputs[i].String() );
+		}
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: save the outputs of a finished compile with the hashes of its inputs
+//-----------------------------------------------------------------------------
+static void CompileCache_Store( void )
+{
+	if ( s_CompileCacheOutputs.Count() == 0 )
+		return;
+
+	if ( s_pCompileCacheUntracked )
+	{
+		MdlWarning( "compile cache: can't follow the files %s reads, not caching\n", s_pCompileCacheUntracked );
+		return;
+	}
+
+	// drop the manifest first so a half written entry is never a hit
+	char manifest[MAX_PATH];
+	Q_snprintf( manifest, sizeof( manifest ), "%s%cmanifest", s_CompileCacheEntry, CORRECT_PATH_SEPARATOR );
+	remove( manifest );
+	EnsureFileDirectoryExists( manifest );
+
+	CUtlVector<char> text;
+	char line[MAX_PATH + 64];
+	for ( int i = 0; i < m_CreateMakefileDependencies.Count(); i++ )
+	{
+		const char *pFileName = m_CreateMakefileDependencies[i].String();
+		char hash[64];
+		if ( !CompileCache_HashFile( pFileName, hash, sizeof( hash ) ) )
+		{
+			MdlWarning( "compile cache: can't read \"%s\", not caching\n", pFileName );
+			return;
+		}
+		Q_snprintf( line, sizeof( line ), "dep %s %s\n", hash, pFileName );
+		text.AddMultipleToTail( strlen( line ), line );
+	}
+
+	for ( int i = 0; i < s_CompileCacheInputs.Count(); i++ )
+	{
+		const char *pFileName = s_CompileCacheInputs[i].String();
+		char hash[64];
+		if ( !CompileCache_HashFile( pFileName, hash, sizeof( hash ) ) )
+		{
+			Q_strncpy( hash, "-", sizeof( hash ) );
+		}
+		Q_snprintf( line, sizeof( line ), "dep %s %s\n", hash, pFileName );
+		text.AddMultipleToTail( strlen( line ), line );
+	}
+
+	for ( int i = 0; i < s_CompileCacheOutputs.Count(); i++ )
+	{
+		const char *pFileName = s_CompileCacheOutputs[i].String();
+		char cached[MAX_PATH];
+		Q_snprintf( cached, sizeof( cached ), "%s%c%d_%s", s_CompileCacheEntry, CORRECT_PATH_SEPARATOR, i, V_UnqualifiedFileName( pFileName ) );
+		if ( !CompileCache_CopyFile( pFileName, cached ) )
+		{
+			MdlWarning( "compile cache: can't save \"%s\", not caching\n", pFileName );
+			return;
+		}
+		Q_snprintf( line, sizeof( line ), "out %s\n", pFileName );
+		text.AddMultipleToTail( strlen( line ), line );
+	}
+
+	FILE *fp = fopen( manifest, "w" );
+	if ( !fp )
+	{
+		MdlWarning( "compile cache: can't write \"%s\"\n", manifest );
+		return;
+	}
+	fwrite( text.Base(), 1, text.Count(), fp );
+	fclose( fp );
+}
+
 //-----------------------------------------------------------------------------
 // 
 //-----------------------------------------------------------------------------
 
-static bool g_bFirstWarning = true;
+static std::atomic<bool> g_bFirstWarning( true );
 
 void TokenError( char const *fmt, ... )
 {
@@ -171,12 +484,12 @@ void MdlError( char const *fmt, ... )
 	va_list		args;
 
 	Assert( 0 );
+	RunThreads_ErrorLock();
 	if (g_quiet)
 	{
-		if (g_bFirstWarning)
+		if (g_bFirstWarning.exchange( false ))
 		{
 			printf("%s :\n", fullpath );
-			g_bFirstWarning = false;
 		}
 		printf("\t");
 	}
@@ -210,33 +523,49 @@ void MdlError( char const *fmt, ... )
 		}
 	}
 
-	exit( -1 );
+	RunThreads_Exit( -1 );
 }
 
 
 void MdlWarning( const char *fmt, ... )
 {
 	va_list args;
-	static char output[1024];
 
 	if (g_bNoWarnings)
 		return;
 
+	Assert( 0 );
+
+	// the whole warning goes out in one printf so warnings from animation
+	// threads don't interleave, with the .qc named before the first one
+	char prefix[sizeof( fullpath ) + 16] = "";
 	if (g_quiet)
 	{
-		if (g_bFirstWarning)
+		if (g_bFirstWarning.exchange( false ))
 		{
-			printf("%s :\n", fullpath );
-			g_bFirstWarning = false;
+			Q_snprintf( prefix, sizeof( prefix ), "%s :\n", fullpath );
 		}
-		printf("\t");
+		Q_strncat( prefix, "\t", sizeof( prefix ), COPY_ALL_CHARACTERS );
 	}
 
-	Assert( 0 );
+	char output[1024];
+	va_start( args, fmt );
+	int nLength = vsnprintf( output, sizeof( output ), fmt, args );
+	va_end( args );
 
-	printf("WARNING: ");
+	if ( nLength < (int)sizeof( output ) )
+	{
+		printf( "%sWARNING: %s", prefix, output );
+		return;
+	}
+
+	// too long for the buffer, format it again into one that fits
+	char *pLong = (char *)malloc( nLength + 1 );
 	va_start( args, fmt );
-	vprintf( fmt, args );
+	vsnprintf( pLong, nLength + 1, fmt, args );
+	va_end( args );
+	printf( "%sWARNING: %s", prefix, pLong );
+	free( pLong );
 }
 
 #if defined(_WIN32) && !defined(_DEBUG)
@@ -321,7 +650,7 @@ void MdlExceptionFilter( unsigned long code )
 =================
 */
 
-int k_memtotal;
+std::atomic<int> k_memtotal;
 void *kalloc( int num, int size )
 {
 	// printf( "calloc( %d, %d )\n", num, size );
@@ -701,16 +1030,21 @@ void SetSkinValues( )
 */
 
 
+static CBoneNameIndex s_XNodeNames;
+
+static const char *XNodeName( int i )
+{
+	return g_xnodename[i+1];
+}
+
 int LookupXNode( char *name )
 {
-	int i;
-	for ( i = 1; i <= g_numxnodes; i++)
+	int i = s_XNodeNames.Find( name, g_numxnodes, XNodeName );
+	if (i != -1)
 	{
-		if (stricmp( name, g_xnodename[i] ) == 0)
-		{
-			return i;
-		}
+		return i + 1;
 	}
+	i = g_numxnodes + 1;
 	g_xnodename[i] = strdup( name );
 	g_numxnodes = i;
 	return i;
@@ -723,7 +1057,7 @@ int LookupXNode( char *name )
 */
 
 char	g_szFilename[1024];
-FILE	*g_fpInput;
+CLineReader g_InputFile;
 char	g_szLine[4096];
 int		g_iLinecount;
 
@@ -779,7 +1113,7 @@ int Grab_Nodes( s_node_t *pnodes )
 		pnodes[index].parent = -1;
 	}
 
-	while (fgets( g_szLine, sizeof( g_szLine ), g_fpInput ) != NULL) 
+	while (g_InputFile.GetLine( g_szLine, sizeof( g_szLine ) )) 
 	{
 		g_iLinecount++;
 		if (sscanf( g_szLine, "%d \"%[^\"]\" %d", &index, name, &parent ) == 3)
@@ -801,6 +1135,7 @@ int Grab_Nodes( s_node_t *pnodes )
 		}
 		else 
 		{
+			SourceCache_RecordNodes( numbones + 1, pnodes );
 			return numbones + 1;
 		}
 	}
@@ -1065,6 +1400,236 @@ void Cmd_Body( )
 ===============
 */
 
+//-----------------------------------------------------------------------------
+// Purpose: start a "time" block of a skeleton, returns the frame relative to
+//			the first one. Shared by the text parser and the source cache.
+//-----------------------------------------------------------------------------
+int Animation_StartFrame( s_source_t *psource, int time )
+{
+	int t = time;
+	if (psource->startframe == -1)
+	{
+		psource->startframe = t;
+	}
+	if (t > psource->endframe)
+	{
+		psource->endframe = t;
+	}
+	t -= psource->startframe;
+
+	if (psource->rawanim[t] == NULL)
+	{
+		psource->rawanim[t] = (s_bone_t *)kalloc( 1, psource->numbones * sizeof( s_bone_t ) );
+
+		// duplicate previous frames keys
+		if (t > 0 && psource->rawanim[t-1])
+		{
+			for (int j = 0; j < psource->numbones; j++)
+			{
+				VectorCopy( psource->rawanim[t-1][j].pos, psource->rawanim[t][j].pos );
+				VectorCopy( psource->rawanim[t-1][j].rot, psource->rawanim[t][j].rot );
+			}
+		}
+	}
+	else
+	{
+		// MdlError( "%s has duplicated frame %d\n", psource->filename, t );
+	}
+	return t;
+}
+
+void Animation_SetKey( s_source_t *psource, int t, int index, Vector pos, const RadianEuler &rot )
+{
+	scale_vertex( pos );
+	VectorCopy( pos, psource->rawanim[t][index].pos );
+	VectorCopy( rot, psource->rawanim[t][index].rot );
+}
+
+void Animation_End( s_source_t *psource )
+{
+	psource->numframes = psource->endframe - psource->startframe + 1;
+
+	for (int t = 0; t < psource->numframes; t++)
+	{
+		if (psource->rawanim[t] == NULL)
+		{
+			MdlError( "%s is missing frame %d\n", psource->filename, t + psource->startframe );
+		}
+	}
+
+	Build_Reference( psource );
+}
+
+//-----------------------------------------------------------------------------
+// Skeleton frames are read ahead in batches and their keys scanned on worker
+// threads, then applied in file order.  A batch only takes "time" blocks
+// whose keys all scan and name a bone of the source; anything else is left
+// to the line by line loop in Grab_Animation, so its errors still come out
+// where they did.
+//-----------------------------------------------------------------------------
+#define MAX_BATCH_KEYS		(1 << 18)	// per batch, bounds the staging memory
+#define BATCH_CHUNK_KEYS	4096		// per worker thread work item
+
+struct s_batchkey_t
+{
+	int			index;
+	Vector		pos;
+	RadianEuler	rot;
+};
+
+struct s_batchframe_t
+{
+	int			time;
+	const char	*pTimeLine;
+	int			linecount;		// of the "time" line
+	const char	*pKeys;
+	const char	*pNext;			// the line after the last key
+	int			numkeys;
+	int			firstkey;		// into s_BatchKeys
+	bool		bValid;
+};
+
+static CUtlVector< s_batchframe_t > s_BatchFrames;
+static CUtlVector< s_batchkey_t > s_BatchKeys;
+static CUtlVector< int > s_BatchFrameChunks;	// first frame of each work item, then the frame count
+static int s_nBatchBones;
+
+static void ParseBatchFramesThread( int iThread, int iChunk )
+{
+	for (int i = s_BatchFrameChunks[iChunk]; i < s_BatchFrameChunks[iChunk+1]; i++)
+	{
+		s_batchframe_t &frame = s_BatchFrames[i];
+		const char *pLine = frame.pKeys;
+		frame.bValid = true;
+		for (int k = 0; k < frame.numkeys; k++)
+		{
+			const char *pLineEnd = CLineReader::FindLineEnd( pLine, frame.pNext );
+			s_batchkey_t &key = s_BatchKeys[frame.firstkey + k];
+			CLineScanner scan( pLine, pLineEnd );
+			if (scan.Scan( key.index, key.pos[0], key.pos[1], key.pos[2], key.rot[0], key.rot[1], key.rot[2] ) != 7
+				|| key.index < 0 || key.index >= s_nBatchBones)
+			{
+				frame.bValid = false;
+				break;
+			}
+			pLine = pLineEnd;
+		}
+	}
+}
+
+// a line that could be a key, which starts with the bone index
+static bool IsBatchKeyLine( const char *pLine, const char *pLineEnd )
+{
+	while (pLine < pLineEnd && ( *pLine == ' ' || ( *pLine >= '\t' && *pLine <= '\r' ) ))
+	{
+		pLine++;
+	}
+	return pLine < pLineEnd && ( ( *pLine >= '0' && *pLine <= '9' ) || *pLine == '-' || *pLine == '+' );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: read the frames that follow in one batch, returns the current frame.
+//			cmd and index are left as the line by line loop would leave them,
+//			which it reuses on blank lines.
+//-----------------------------------------------------------------------------
+static int Grab_AnimationFrames( s_source_t *psource, int t, char *cmd, int &index )
+{
+	s_BatchFrames.RemoveAll();
+	s_BatchFrameChunks.RemoveAll();
+
+	// find the frames, which only needs the line breaks and "time" lines
+	const char *pLine = g_InputFile.Tell();
+	const char *pEnd = g_InputFile.End();
+	int linecount = g_iLinecount;
+	int numkeys = 0;
+	int chunkkeys = 0;
+	while (pLine < pEnd && numkeys < MAX_BATCH_KEYS)
+	{
+		const char *pLineEnd = CLineReader::FindLineEnd( pLine, pEnd );
+		if (IsBatchKeyLine( pLine, pLineEnd ))
+			break;
+		CLineReader::CopyLine( pLine, pLineEnd, g_szLine, sizeof( g_szLine ) );
+		if (sscanf( g_szLine, "%1023s %d", cmd, &index ) != 2 || stricmp( cmd, "time" ) != 0)
+			break;
+
+		s_batchframe_t &frame = s_BatchFrames[s_BatchFrames.AddToTail()];
+		frame.time = index;
+		frame.pTimeLine = pLine;
+		frame.linecount = ++linecount;
+		frame.pKeys = pLineEnd;
+		frame.firstkey = numkeys;
+
+		pLine = pLineEnd;
+		while (pLine < pEnd)
+		{
+			pLineEnd = CLineReader::FindLineEnd( pLine, pEnd );
+			if (!IsBatchKeyLine( pLine, pLineEnd ))
+				break;
+			pLine = pLineEnd;
+			linecount++;
+			numkeys++;
+		}
+		frame.pNext = pLine;
+		frame.numkeys = numkeys - frame.firstkey;
+
+		if (chunkkeys == 0)
+		{
+			s_BatchFrameChunks.AddToTail( s_BatchFrames.Count() - 1 );
+		}
+		chunkkeys += frame.numkeys + 1;
+		if (chunkkeys >= BATCH_CHUNK_KEYS)
+		{
+			chunkkeys = 0;
+		}
+	}
+
+	if (s_BatchFrames.Count() == 0)
+		return t;
+
+	s_BatchFrameChunks.AddToTail( s_BatchFrames.Count() );
+	s_BatchKeys.SetCount( numkeys );
+	s_nBatchBones = psource->numbones;
+	RunThreadsOnIndividual( s_BatchFrameChunks.Count() - 1, false, ParseBatchFramesThread );
+
+	// apply them in order, as the loop below would have
+	const s_batchframe_t *pLast = NULL;
+	for (int i = 0; i < s_BatchFrames.Count(); i++)
+	{
+		const s_batchframe_t &frame = s_BatchFrames[i];
+		if (!frame.bValid || ( psource->startframe != -1 && frame.time < psource->startframe ))
+		{
+			// leave this frame to be read a line at a time
+			g_InputFile.Seek( frame.pTimeLine );
+			g_iLinecount = frame.linecount - 1;
+			break;
+		}
+
+		SourceCache_RecordFrame( frame.time );
+		t = Animation_StartFrame( psource, frame.time );
+		for (int k = 0; k < frame.numkeys; k++)
+		{
+			const s_batchkey_t &key = s_BatchKeys[frame.firstkey + k];
+			SourceCache_RecordKey( key.index, key.pos, key.rot );
+			Animation_SetKey( psource, t, key.index, key.pos, key.rot );
+		}
+
+		g_InputFile.Seek( frame.pNext );
+		g_iLinecount = frame.linecount + frame.numkeys;
+		pLast = &frame;
+	}
+
+	if (pLast)
+	{
+		CLineReader::CopyLine( pLast->pTimeLine, pLast->pKeys, g_szLine, sizeof( g_szLine ) );
+		sscanf( g_szLine, "%1023s %d", cmd, &index );
+		if (pLast->numkeys)
+		{
+			index = s_BatchKeys[pLast->firstkey + pLast->numkeys - 1].index;
+		}
+	}
+	return t;
+}
+
 void Grab_Animation( s_source_t *psource )
 {
 	Vector pos;
@@ -1072,79 +1637,50 @@ void Grab_Animation( s_source_t *psource )
 	char cmd[1024];
 	int index;
 	int	t = -99999999;
-	int size;
 
 	psource->startframe = -1;
+	SourceCache_RecordAnimation();
 
-	size = psource->numbones * sizeof( s_bone_t );
-
-	while (fgets( g_szLine, sizeof( g_szLine ), g_fpInput ) != NULL) 
+	while (1)
 	{
+		t = Grab_AnimationFrames( psource, t, cmd, index );
+		if (!g_InputFile.NextLine())
+			break;
 		g_iLinecount++;
-		if (sscanf( g_szLine, "%d %f %f %f %f %f %f", &index, &pos[0], &pos[1], &pos[2], &rot[0], &rot[1], &rot[2] ) == 7)
+
+		// keys are read straight from the file, the rest of the lines as text
+		CLineScanner scan( g_InputFile );
+		if (scan.Scan( index, pos[0], pos[1], pos[2], rot[0], rot[1], rot[2] ) == 7)
 		{
 			if (psource->startframe < 0)
 			{
+				g_InputFile.CopyLine( g_szLine, sizeof( g_szLine ) );
 				MdlError( "Missing frame start(%d) : %s", g_iLinecount, g_szLine );
 			}
 
-			scale_vertex( pos );
-			VectorCopy( pos, psource->rawanim[t][index].pos );
-			VectorCopy( rot, psource->rawanim[t][index].rot );
+			SourceCache_RecordKey( index, pos, rot );
+			Animation_SetKey( psource, t, index, pos, rot );
 
 			clip_rotations( rot ); // !!!
+			continue;
 		}
-		else if (sscanf( g_szLine, "%1023s %d", cmd, &index ))
+
+		g_InputFile.CopyLine( g_szLine, sizeof( g_szLine ) );
+		if (sscanf( g_szLine, "%1023s %d", cmd, &index ))
 		{
 			if (stricmp( cmd, "time" ) == 0) 
 			{
-				t = index;
-				if (psource->startframe == -1)
-				{
-					psource->startframe = t;
-				}
-				if (t < psource->startframe)
+				if (psource->startframe != -1 && index < psource->startframe)
 				{
 					MdlError( "Frame MdlError(%d) : %s", g_iLinecount, g_szLine );
 				}
-				if (t > psource->endframe)
-				{
-					psource->endframe = t;
-				}
-				t -= psource->startframe;
-
-				if (psource->rawanim[t] == NULL)
-				{
-					psource->rawanim[t] = (s_bone_t *)kalloc( 1, size );
-
-					// duplicate previous frames keys
-					if (t > 0 && psource->rawanim[t-1])
-					{
-						for (int j = 0; j < psource->numbones; j++)
-						{
-							VectorCopy( psource->rawanim[t-1][j].pos, psource->rawanim[t][j].pos );
-							VectorCopy( psource->rawanim[t-1][j].rot, psource->rawanim[t][j].rot );
-						}
-					}
-				}
-				else
-				{
-					// MdlError( "%s has duplicated frame %d\n", psource->filename, t );
-				}
+				SourceCache_RecordFrame( index );
+				t = Animation_StartFrame( psource, index );
 			}
 			else if (stricmp( cmd, "end") == 0) 
 			{
-				psource->numframes = psource->endframe - psource->startframe + 1;
-
-				for (t = 0; t < psource->numframes; t++)
-				{
-					if (psource->rawanim[t] == NULL)
-					{
-						MdlError( "%s is missing frame %d\n", psource->filename, t + psource->startframe );
-					}
-				}
-
-				Build_Reference( psource );
+				SourceCache_RecordAnimationEnd();
+				Animation_End( psource );
 				return;
 			}
 			else
@@ -1613,25 +2149,25 @@ s_source_t *Load_Source( char const *name, const char *ext, bool reverse, bool i
 	{
 		sprintf (g_szFilename, "%s%s.smd", cddir[numdirs], pTempName );
 		strcpyn( g_source[g_numsources]->filename, g_szFilename );
-		result = Load_SMD( g_source[g_numsources] );
+		result = Load_CachedSource( g_source[g_numsources], "SMD" ) || Load_SMD( g_source[g_numsources] );
 	}
 	if ( ( !result && xext[0] == '\0' ) || stricmp( xext, "sma" ) == 0)
 	{
 		sprintf (g_szFilename, "%s%s.sma", cddir[numdirs], pTempName );
 		strcpyn( g_source[g_numsources]->filename, g_szFilename );
-		result = Load_SMD( g_source[g_numsources] );
+		result = Load_CachedSource( g_source[g_numsources], "SMD" ) || Load_SMD( g_source[g_numsources] );
 	}
 	if ( ( !result && xext[0] == '\0' ) || stricmp( xext, "phys" ) == 0)
 	{
 		sprintf (g_szFilename, "%s%s.phys", cddir[numdirs], pTempName );
 		strcpyn( g_source[g_numsources]->filename, g_szFilename );
-		result = Load_SMD( g_source[g_numsources] );
+		result = Load_CachedSource( g_source[g_numsources], "SMD" ) || Load_SMD( g_source[g_numsources] );
 	}
 	if (( !result && xext[0] == '\0' ) || stricmp( xext, "vta" ) == 0)
 	{
 		sprintf (g_szFilename, "%s%s.vta", cddir[numdirs], pTempName );
 		strcpyn( g_source[g_numsources]->filename, g_szFilename );
-		result = Load_VTA( g_source[g_numsources] );
+		result = Load_CachedSource( g_source[g_numsources], "VTA" ) || Load_VTA( g_source[g_numsources] );
 	}
 	if (( !result && xext[0] == '\0' ) || stricmp( xext, "obj" ) == 0)
 	{
@@ -3901,6 +4437,9 @@ void Option_Flexrule( s_model_t *pmodel, char *name )
 	int j = 0;
 	int k = 0;
 
+	// operators don't set d, don't write whatever was on the stack into the .mdl
+	memset( stream, 0, sizeof( stream ) );
+
 	s_flexrule_t *pRule = &g_flexrule[g_numflexrules++];
 
 	if (g_numflexrules > MAXSTUDIOFLEXRULES)
@@ -5983,33 +6522,52 @@ void Grab_Vertexanimation( s_source_t *psource )
 	Vector	normal;
 	int		t = -1;
 	int		count = 0;
-	static s_vertanim_t	tmpvanim[MAXSTUDIOVERTS*4];
+	CUtlVector< s_vertanim_t > tmpvanim;
 
-	while (fgets( g_szLine, sizeof( g_szLine ), g_fpInput ) != NULL) 
+	while (g_InputFile.NextLine()) 
 	{
 		g_iLinecount++;
-		if (sscanf( g_szLine, "%d %f %f %f %f %f %f", &index, &pos[0], &pos[1], &pos[2], &normal[0], &normal[1], &normal[2] ) == 7)
+
+		// vertices are read straight from the file, the rest of the lines as text
+		CLineScanner scan( g_InputFile );
+		if (scan.Scan( index, pos[0], pos[1], pos[2], normal[0], normal[1], normal[2] ) == 7)
 		{
 			if (psource->startframe < 0)
 			{
+				g_InputFile.CopyLine( g_szLine, sizeof( g_szLine ) );
 				MdlError( "Missing frame start(%d) : %s", g_iLinecount, g_szLine );
 			}
 
 			if (t < 0)
 			{
+				g_InputFile.CopyLine( g_szLine, sizeof( g_szLine ) );
 				MdlError( "VTA Frame Sync (%d) : %s", g_iLinecount, g_szLine );
 			}
 
-			tmpvanim[count].vertex = index;
-			VectorCopy( pos, tmpvanim[count].pos );
-			VectorCopy( normal, tmpvanim[count].normal );
-			count++;
-
 			if (index >= psource->numvertices)
 				psource->numvertices = index + 1;
+
+			// past frame 0 only keep the vertices that move off it
+			if (t > 0 && psource->vanim[0] && index >= 0 && index < psource->numvanims[0] && psource->vanim[0][index].vertex == index)
+			{
+				Vector delta, ndelta;
+				VectorSubtract( pos, psource->vanim[0][index].pos, delta );
+				VectorSubtract( normal, psource->vanim[0][index].normal, ndelta );
+				if (!VertexAnimMoves( delta, ndelta ))
+					continue;
+			}
+
+			s_vertanim_t &vanim = tmpvanim[tmpvanim.AddToTail()];
+			memset( &vanim, 0, sizeof( vanim ) );
+			vanim.vertex = index;
+			VectorCopy( pos, vanim.pos );
+			VectorCopy( normal, vanim.normal );
+			count++;
 		}
 		else
 		{
+			g_InputFile.CopyLine( g_szLine, sizeof( g_szLine ) );
+
 			// flush data
 
 			if (count)
@@ -6018,11 +6576,13 @@ void Grab_Vertexanimation( s_source_t *psource )
 
 				psource->vanim[t] = (s_vertanim_t *)kalloc( count, sizeof( s_vertanim_t ) );
 
-				memcpy( psource->vanim[t], tmpvanim, count * sizeof( s_vertanim_t ) );
+				memcpy( psource->vanim[t], tmpvanim.Base(), count * sizeof( s_vertanim_t ) );
+				SourceCache_RecordVertexAnim( t, count, tmpvanim.Base() );
 			}
 			else if (t > 0)
 			{
 				psource->numvanims[t] = 0;
+				SourceCache_RecordVertexAnim( t, 0, NULL );
 			}
 
 			// next command
@@ -6032,6 +6592,7 @@ void Grab_Vertexanimation( s_source_t *psource )
 				{
 					t = index;
 					count = 0;
+					tmpvanim.RemoveAll();
 
 					if (t < psource->startframe)
 					{
@@ -6047,6 +6608,7 @@ void Grab_Vertexanimation( s_source_t *psource )
 				else if (stricmp( cmd, "end") == 0) 
 				{
 					psource->numframes = psource->endframe - psource->startframe + 1;
+					SourceCache_RecordVertexAnimEnd( psource->numvertices );
 					return;
 				}
 				else
@@ -6054,14 +6616,47 @@ void Grab_Vertexanimation( s_source_t *psource )
 					MdlError( "MdlError(%d) : %s", g_iLinecount, g_szLine );
 				}
 
-			}
-			else
+			}
+			else
+			{
+				MdlError( "MdlError(%d) : %s", g_iLinecount, g_szLine );
+			}
+		}
+	}
+	MdlError( "unexpected EOF: %s\n", psource->filename );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: the file OpenGlobalFile would open for src, false if there isn't one
+//-----------------------------------------------------------------------------
+bool FindGlobalFile( char *src, char *pFileName, int nFileNameSize )
+{
+	char	filename[1024];
+
+	strcpy( filename, ExpandPath( src ) );
+
+	int pathLength;
+	if( CmdLib_HasBasePath( filename, pathLength ) )
+	{
+		char tmp[1024];
+		for( int i = 0; i < CmdLib_GetNumBasePaths(); i++ )
+		{
+			strcpy( tmp, CmdLib_GetBasePath( i ) );
+			strcat( tmp, filename + pathLength );
+			if( FileTime( tmp ) != -1 )
 			{
-				MdlError( "MdlError(%d) : %s", g_iLinecount, g_szLine );
+				Q_strncpy( pFileName, tmp, nFileNameSize );
+				return true;
 			}
 		}
+		return false;
 	}
-	MdlError( "unexpected EOF: %s\n", psource->filename );
+
+	if( FileTime( filename ) == -1 )
+		return false;
+
+	Q_strncpy( pFileName, filename, nFileNameSize );
+	return true;
 }
 
 int OpenGlobalFile( char *src )
@@ -6091,13 +6686,14 @@ int OpenGlobalFile( char *src )
 			time1 = FileTime( tmp );
 			if( time1 != -1 )
 			{
-				if ((g_fpInput = fopen(tmp, "r")) == 0) 
+				if (!g_InputFile.Open( tmp )) 
 				{
 					MdlWarning( "reader: could not open file '%s'\n", src );
 					return 0;
 				}
 				else
 				{
+					CreateMakefile_AddDependency( tmp );
 					return 1;
 				}
 			}
@@ -6115,12 +6711,13 @@ int OpenGlobalFile( char *src )
 			CreateMakefile_AddDependency( filename );
 			return 0;
 		}
-		if ((g_fpInput = fopen(filename, "r")) == 0) 
+		if (!g_InputFile.Open( filename )) 
 		{
 			MdlWarning( "reader: could not open file '%s'\n", src );
 			return 0;
 		}
 
+		CreateMakefile_AddDependency( filename );
 		return 1;
 	}
 }
@@ -6138,8 +6735,10 @@ int Load_VTA( s_source_t *psource )
 	if (!g_quiet)
 		printf ("VTA MODEL %s\n", psource->filename);
 
+	SourceCache_BeginRecord();
+
 	g_iLinecount = 0;
-	while (fgets( g_szLine, sizeof( g_szLine ), g_fpInput ) != NULL) 
+	while (g_InputFile.GetLine( g_szLine, sizeof( g_szLine ) )) 
 	{
 		g_iLinecount++;
 		sscanf( g_szLine, "%s %d", cmd, &option );
@@ -6165,9 +6764,12 @@ int Load_VTA( s_source_t *psource )
 		else 
 		{
 			MdlWarning("unknown studio command \"%s\"\n", cmd );
+			SourceCache_Discard();
 		}
 	}
-	fclose( g_fpInput );
+	g_InputFile.Close();
+
+	SourceCache_EndRecord( psource );
 
 	is_v1support = true;
 
@@ -6182,7 +6784,7 @@ void Grab_AxisInterpBones( )
 	s_axisinterpbone_t *pAxis = NULL;
 	s_axisinterpbone_t *pBone = &g_axisinterpbones[g_numaxisinterpbones];
 
-	while (fgets( g_szLine, sizeof( g_szLine ), g_fpInput ) != NULL) 
+	while (g_InputFile.GetLine( g_szLine, sizeof( g_szLine ) )) 
 	{
 		g_iLinecount++;
 		if (IsEnd( g_szLine )) 
@@ -6239,7 +6841,7 @@ bool Grab_AimAtBones( )
 		char	cmd[1024];
 		Vector	vector;
 
-		while ( fgets( g_szLine, sizeof( g_szLine ), g_fpInput ) != NULL) 
+		while ( g_InputFile.GetLine( g_szLine, sizeof( g_szLine ) )) 
 		{
 			g_iLinecount++;
 
@@ -6304,7 +6906,7 @@ void Grab_QuatInterpBones( )
 	s_quatinterpbone_t *pAxis = NULL;
 	s_quatinterpbone_t *pBone = &g_quatinterpbones[g_numquatinterpbones];
 
-	while (fgets( g_szLine, sizeof( g_szLine ), g_fpInput ) != NULL) 
+	while (g_InputFile.GetLine( g_szLine, sizeof( g_szLine ) )) 
 	{
 		g_iLinecount++;
 		if (IsEnd( g_szLine )) 
@@ -6456,7 +7058,7 @@ void Load_ProceduralBones( )
 	}
 	else
 	{
-		while (fgets( g_szLine, sizeof( g_szLine ), g_fpInput ) != NULL) 
+		while (g_InputFile.GetLine( g_szLine, sizeof( g_szLine ) )) 
 		{
 			g_iLinecount++;
 			sscanf( g_szLine, "%s", cmd, &option );
@@ -6473,7 +7075,7 @@ void Load_ProceduralBones( )
 			}
 		}
 	}
-	fclose( g_fpInput );
+	g_InputFile.Close();
 }
 
 
@@ -6846,9 +7448,15 @@ bool HandlePrintSurfaceProps( int &returnValue )
 void UsageAndExit()
 {
 	MdlError( "Bad or missing options\n"
-		"usage: studiomdl [options] <file.qc>\n"
+		"usage: studiomdl [options] <file.qc> [<file.qc>...] [@listfile]\n"
 		"options:\n"
 		"[-a <normal_blend_angle>]\n"
+		"[-animtolerance <degrees> <units>] - let animation frames share a stored value when they're\n"
+		"                 within this angle/distance of it\n"
+		"[-builtinphysics] - build $collisionmodel/$collisionjoints without the game's vphysics\n"
+		"[-cache <dir>] - reuse the outputs of an earlier compile when nothing it read has changed,\n"
+		"                 and keep the parsed .smd/.vta files there; a reused compile doesn't\n"
+		"                 repeat its warnings\n"
 		"[-checklengths]\n"
 		"[-d] - dump glview files\n"
 		"[-definebones]\n"
@@ -6857,6 +7465,7 @@ void UsageAndExit()
 		"[-game <gamedir>]\n"
 		"[-h] - dump hboxes\n"
 		"[-i] - ignore warnings\n"
+		"[-jobs <n>] - models compiled at once for several .qc files or an @listfile (not on Windows)\n"
 		"[-minlod <lod>] - truncate to highest detail <lod>\n"
 		"[-n] - tag bad normals\n"
 		"[-perf]\n"
@@ -6864,7 +7473,10 @@ void UsageAndExit()
 		"[-printgraph]\n"
 		"[-quiet] - operate silently\n"
 		"[-r] - tag reversed\n"
+		"[-server] - compile \"[options] <file.qc>\" lines read from stdin (not on Windows)\n"
 		"[-t <texture>]\n"
+		"[-threads <n>] - number of worker threads (default: one per core)\n"
+		"[-timings] - report the time and memory of each stage, and write <file>.timings.json\n"
 		"[-xbox] - enable xbox processing(default)\n"
 		"[-notxbox] - disable xbox processing\n"
 		"[-nowarnings] - disable warnings\n"
@@ -6880,31 +7492,70 @@ LONG __stdcall VExceptionFilter( struct _EXCEPTION_POINTERS *ExceptionInfo )
 }
 
 #endif // defined(_WIN32) && !defined(_DEBUG)
-/*
-==============
-main
-==============
-*/
 
-int main (int argc, char **argv)
-{
-	int		i;
+//-----------------------------------------------------------------------------
+// Purpose: put the options and the model back to their startup state
+//-----------------------------------------------------------------------------
+static void ClearCompileState( void )
+{
+	g_collapse_bones = false;
+	g_quiet = false;
+	g_badCollide = false;
+	g_IHVTest = false;
+	g_bCheckLengths = false;
+	g_bPrintBones = false;
+	g_bPerf = false;
+	g_bDumpGraph = false;
+	g_bMultistageGraph = false;
+	g_verbose = false;
+	g_bCreateMakefile = false;
+	g_bHasModelName = false;
+	g_bZBrush = false;
+	g_bVerifyOnly = false;
+	g_bUseBoneInBBox = true;
+	g_bLockBoneLengths = false;
+	g_bOverridePreDefinedBones = true;
+	g_bXbox = false;
+	g_minLod = 0;
+	g_bNoWarnings = false;
+	g_bFirstWarning = true;
+	g_flAnimRotTolerance = 0;
+	g_flAnimPosTolerance = 0;
+	g_path[0] = '\0';
+	m_CreateMakefileDependencies.Purge();
+
+	strcpy( s_pDefaultSurfaceProp, "default" );
+	s_JointSurfaceProp.Purge();
+	s_nDefaultContents = CONTENTS_SOLID;
+	s_JointContents.Purge();
+
+	numthreads = -1;
+	g_bBuiltinPhysics = false;
+
+	g_bTimings = false;
+	Timings_Clear();
+
+	g_bCompileCache = false;
+	g_szCacheDir[0] = '\0';
+	s_CompileCacheEntry[0] = '\0';
+	s_CompileCacheInputs.Purge();
+	s_CompileCacheOutputs.Purge();
+	s_pCompileCacheUntracked = NULL;
 
-#if defined(_WIN32) && !defined(_DEBUG)
-	LPTOP_LEVEL_EXCEPTION_FILTER pOldFilter = SetUnhandledExceptionFilter( VExceptionFilter );
-#endif // defined(_WIN32) && !defined(_DEBUG)
+	ClearModel();
+}
 
-	CommandLine()->CreateCmdLine( argc, argv );
+static int RunBatch( int argc, char **argv, const CUtlVector< int > &qcArgs, int nJobs );
 
-	InstallSpewFunction();
-	MathLib_Init( 2.2f, 2.2f, 0.0f, 2.0f, false, false, false, false );
-	
+//-----------------------------------------------------------------------------
+// Purpose: compile the .qc on a studiomdl command line, returns the exit code
+//-----------------------------------------------------------------------------
+static int CompileCommandLine( int argc, char **argv )
+{
+	int		i;
 
-	int returnValue;	
-	if ( HandlePrintSurfaceProps( returnValue ) )
-		return returnValue;
+	ClearCompileState();
 
-	
 	g_currentscale = g_defaultscale = 1.0;
 	g_defaultrotation = RadianEuler( 0, 0, M_PI / 2 );
 
@@ -6935,6 +7586,8 @@ int main (int argc, char **argv)
 	
 	g_bDumpGLViewFiles = false;
 	int qcArgIndex = -1;
+	CUtlVector< int > qcArgs;
+	int nJobs = 1;
 	g_quiet = false;	  
 	for (i = 1; i < argc; i++)
 	{
@@ -6950,6 +7603,7 @@ int main (int argc, char **argv)
 		if ( argv[i][0] != '-' )
 		{
 			qcArgIndex = i;
+			qcArgs.AddToTail( i );
 			continue;
 		}
 
@@ -6988,6 +7642,12 @@ int main (int argc, char **argv)
 				continue;
 			}
 
+			if (!stricmp(argv[i], "-builtinphysics"))
+			{
+				g_bBuiltinPhysics = true;
+				continue;
+			}
+
 			if (!stricmp(argv[i], "-checklengths"))
 			{
 				g_bCheckLengths = true;
@@ -7006,6 +7666,21 @@ int main (int argc, char **argv)
 				continue;
 			}
 
+			if (!stricmp(argv[i], "-timings"))
+			{
+				g_bTimings = true;
+				continue;
+			}
+
+			if (!stricmp(argv[i], "-cache"))
+			{
+				if ( i + 1 >= argc )
+					UsageAndExit();
+				g_bCompileCache = true;
+				Q_strncpy( g_szCacheDir, argv[++i], sizeof( g_szCacheDir ) );
+				continue;
+			}
+
 			if (!stricmp(argv[i], "-printgraph"))
 			{
 				g_bDumpGraph = true;
@@ -7057,6 +7732,40 @@ int main (int argc, char **argv)
 				continue;
 			}
 
+			if (!stricmp(argv[i], "-server"))
+			{
+				continue;
+			}
+
+			if (!stricmp(argv[i], "-jobs"))
+			{
+				if ( i + 1 >= argc )
+					UsageAndExit();
+				nJobs = atoi( argv[++i] );
+				if ( nJobs < 1 )
+					nJobs = 1;
+				continue;
+			}
+
+			if (!stricmp(argv[i], "-animtolerance"))
+			{
+				if ( i + 2 >= argc )
+					UsageAndExit();
+				g_flAnimRotTolerance = DEG2RAD( max( atof( argv[++i] ), 0.0 ) );
+				g_flAnimPosTolerance = max( atof( argv[++i] ), 0.0 );
+				continue;
+			}
+
+			if (!stricmp(argv[i], "-threads"))
+			{
+				if ( i + 1 >= argc )
+					UsageAndExit();
+				numthreads = atoi( argv[++i] );
+				if ( numthreads < 1 )
+					numthreads = 1;
+				continue;
+			}
+
 			if (argv[i][1] && argv[i][2] == '\0')
 			{
 				switch( argv[i][1] )
@@ -7110,6 +7819,12 @@ int main (int argc, char **argv)
 		UsageAndExit();
 	}
 
+	// several .qc files, or @listfile
+	if ( qcArgs.Count() > 1 || argv[qcArgIndex][0] == '@' )
+	{
+		return RunBatch( argc, argv, qcArgs, nJobs );
+	}
+
 	strcpy( g_path, argv[qcArgIndex] );
 
 	CmdLib_InitFileSystem( g_path );
@@ -7149,6 +7864,24 @@ int main (int argc, char **argv)
 	strcpy( fullpath, ExpandPath( fullpath ) );
 	strcpy( fullpath, ExpandArg( fullpath ) );
 	CreateMakefile_AddDependency( fullpath );
+
+	// the makefile and -verify don't write the model
+	if ( g_bCreateMakefile || g_bVerifyOnly )
+	{
+		g_bCompileCache = false;
+	}
+	if ( g_bCompileCache )
+	{
+		CompileCache_Init( argc, argv, qcArgIndex );
+		if ( CompileCache_Restore() )
+		{
+			if (!g_quiet)
+			{
+				printf("\nCompleted \"%s\" (cached)\n", g_path);
+			}
+			return 0;
+		}
+	}
 	
 	// default to having one entry in the LOD list that doesn't do anything so
 	// that we don't have to do any special cases for the first LOD.
@@ -7159,27 +7892,31 @@ int main (int argc, char **argv)
 	//
 	// parse it
 	//
-	ClearModel();
 	Q_StripExtension( argv[qcArgIndex], outname, sizeof( outname ) );
 
 //	strcpy( g_pPlatformName, "" );
 	
-	ParseScript();
+	Timings_Stage( "ParseScript", ParseScript );
 	
 	if ( !g_bCreateMakefile )
 	{
 		SetSkinValues();
 
-		SimplifyModel();
+		Timings_Stage( "SimplifyModel", SimplifyModel );
 
 		ConsistencyCheckSurfaceProp();
 		ConsistencyCheckContents();
 
-		CollisionModel_Build();
+		Timings_Stage( "CollisionModel_Build", CollisionModel_Build );
 
 		// ValidateSharedAnimationGroups();
 
-		WriteModelFiles();
+		Timings_Stage( "WriteModelFiles", WriteModelFiles );
+
+		if ( g_bCompileCache )
+		{
+			CompileCache_Store();
+		}
 	}
 
 	if ( g_bCreateMakefile )
@@ -7187,6 +7924,14 @@ int main (int argc, char **argv)
 		CreateMakefile_OutputMakefile();
 	}
 
+	if ( g_bTimings )
+	{
+		char traceFile[MAX_PATH];
+		Q_StripExtension( fullpath, traceFile, sizeof( traceFile ) );
+		Q_strncat( traceFile, ".timings.json", sizeof( traceFile ), COPY_ALL_CHARACTERS );
+		Timings_Report( traceFile );
+	}
+
 	if (!g_quiet)
 	{
 		printf("\nCompleted \"%s\"\n", g_path);
@@ -7195,7 +7940,340 @@ int main (int argc, char **argv)
 	return 0;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: split a -server request line into arguments, "quotes" group spaces
+//-----------------------------------------------------------------------------
+static void TokenizeServerLine( char *pLine, CUtlVector< char * > &args )
+{
+	char *p = pLine;
+	while ( *p )
+	{
+		while ( *p && isspace( (unsigned char)*p ) )
+			p++;
+		if ( !*p )
+			break;
+
+		char *pArg = p;
+		char *pOut = p;
+		bool bQuoted = false;
+		while ( *p && ( bQuoted || !isspace( (unsigned char)*p ) ) )
+		{
+			if ( *p == '"' )
+			{
+				bQuoted = !bQuoted;
+				p++;
+				continue;
+			}
+			*pOut++ = *p++;
+		}
+		if ( *p )
+			p++;
+		*pOut = '\0';
+		args.AddToTail( pArg );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: a job's command line is the shared options followed by its own,
+//			its own -game replaces the shared one since the file system only
+//			looks at the first
+//-----------------------------------------------------------------------------
+static void BuildJobArgs( const CUtlVector< char * > &options, const CUtlVector< char * > &jobArgs, CUtlVector< char * > &args )
+{
+	bool bJobGame = false;
+	for ( int i = 0; i < jobArgs.Count(); i++ )
+	{
+		if ( !stricmp( jobArgs[i], "-game" ) )
+			bJobGame = true;
+	}
+
+	for ( int i = 0; i < options.Count(); i++ )
+	{
+		if ( bJobGame && !stricmp( options[i], "-game" ) )
+		{
+			i++;
+			continue;
+		}
+		args.AddToTail( options[i] );
+	}
+	args.AddMultipleToTail( jobArgs.Count(), jobArgs.Base() );
+}
+
+#ifndef _WIN32
+//-----------------------------------------------------------------------------
+// Purpose: compile a job's command line in a forked copy of this process,
+//			sending its output to pLogFile when there is one
+//-----------------------------------------------------------------------------
+static pid_t ForkCompile( CUtlVector< char * > &args, const char *pLogFile )
+{
+	fflush( stdout );
+	fflush( stderr );
+
+	pid_t pid = fork();
+	if ( pid == 0 )
+	{
+		if ( pLogFile )
+		{
+			int fd = open( pLogFile, O_WRONLY | O_CREAT | O_TRUNC, 0666 );
+			if ( fd >= 0 )
+			{
+				dup2( fd, STDOUT_FILENO );
+				dup2( fd, STDERR_FILENO );
+				close( fd );
+			}
+		}
+
+		CommandLine()->CreateCmdLine( args.Count(), args.Base() );
+		exit( CompileCommandLine( args.Count(), args.Base() ) );
+	}
+	return pid;
+}
+
+static int JobExitCode( int status )
+{
+	if ( WIFEXITED( status ) )
+		return (signed char)WEXITSTATUS( status );
+	return 128 + WTERMSIG( status );
+}
+
+struct s_batchjob_t
+{
+	CUtlVector< char * > args;
+	char logfile[MAX_PATH];
+	int result;
+	double seconds;
+	pid_t pid;
+};
+#endif
+
+//-----------------------------------------------------------------------------
+// Purpose: compile several models, each .qc on the command line and each
+//			"[options] <file.qc>" line of an @listfile is a job.  Up to nJobs
+//			run at once, each writing its output to <file>.log, and a summary
+//			is printed at the end.
+//
+//			Each job runs in a forked copy of this process so an MdlError()
+//			only fails that one job.  Without fork() the first error would end
+//			the whole batch, so Windows compiles one .qc per run.
+//-----------------------------------------------------------------------------
+static int RunBatch( int argc, char **argv, const CUtlVector< int > &qcArgs, int nJobs )
+{
+#ifdef _WIN32
+	MdlError( "compiling several .qc files or an @listfile isn't supported on Windows, run studiomdl once per model\n" );
+	return 1;
+#else
+	// options shared by every job
+	CUtlVector< char * > options;
+	options.AddToTail( argv[0] );
+	for ( int i = 1; i < argc; i++ )
+	{
+		if ( qcArgs.Find( i ) != -1 )
+			continue;
+		if ( !stricmp( argv[i], "-jobs" ) )
+		{
+			i++;
+			continue;
+		}
+		options.AddToTail( argv[i] );
+	}
+
+	CUtlVector< s_batchjob_t > jobs;
+	for ( int i = 0; i < qcArgs.Count(); i++ )
+	{
+		char *pArg = argv[qcArgs[i]];
+		if ( pArg[0] != '@' )
+		{
+			int j = jobs.AddToTail();
+			jobs[j].args.AddMultipleToTail( options.Count(), options.Base() );
+			jobs[j].args.AddToTail( pArg );
+			continue;
+		}
+
+		FILE *fp = fopen( pArg + 1, "r" );
+		if ( !fp )
+		{
+			MdlError( "Can't open list file \"%s\"\n", pArg + 1 );
+		}
+
+		char line[4096];
+		while ( fgets( line, sizeof( line ), fp ) )
+		{
+			CUtlVector< char * > lineArgs;
+			TokenizeServerLine( strdup( line ), lineArgs );
+			if ( lineArgs.Count() == 0 || !strncmp( lineArgs[0], "//", 2 ) )
+				continue;
+
+			int j = jobs.AddToTail();
+			BuildJobArgs( options, lineArgs, jobs[j].args );
+		}
+		fclose( fp );
+	}
+
+	for ( int i = 0; i < jobs.Count(); i++ )
+	{
+		s_batchjob_t &job = jobs[i];
+		Q_StripExtension( job.args[job.args.Count() - 1], job.logfile, sizeof( job.logfile ) );
+		Q_strncat( job.logfile, ".log", sizeof( job.logfile ), COPY_ALL_CHARACTERS );
+		job.result = -1;
+		job.seconds = 0;
+	}
+
+	int nNextJob = 0;
+	int nRunning = 0;
+	while ( nNextJob < jobs.Count() || nRunning > 0 )
+	{
+		if ( nNextJob < jobs.Count() && nRunning < nJobs )
+		{
+			s_batchjob_t &job = jobs[nNextJob++];
+			job.seconds = Plat_FloatTime();
+			job.pid = ForkCompile( job.args, job.logfile );
+			if ( job.pid < 0 )
+			{
+				job.seconds = 0;
+				continue;
+			}
+			nRunning++;
+			continue;
+		}
+
+		int status;
+		pid_t pid = wait( &status );
+		if ( pid < 0 )
+			break;
+
+		for ( int i = 0; i < nNextJob; i++ )
+		{
+			s_batchjob_t &job = jobs[i];
+			if ( job.pid != pid )
+				continue;
+
+			job.result = JobExitCode( status );
+			job.seconds = Plat_FloatTime() - job.seconds;
+			nRunning--;
+
+			printf( "%s \"%s\"\n", job.result ? "FAILED" : "Completed", job.args[job.args.Count() - 1] );
+			fflush( stdout );
+			break;
+		}
+	}
+
+	int nFailed = 0;
+	printf( "\n%-8s %8s  %s\n", "result", "seconds", "model, log" );
+	for ( int i = 0; i < jobs.Count(); i++ )
+	{
+		const s_batchjob_t &job = jobs[i];
+		if ( job.result != 0 )
+		{
+			nFailed++;
+		}
+		printf( "%-8s %8.2f  %s %s\n", job.result ? "FAILED" : "ok", job.seconds, job.args[job.args.Count() - 1], job.logfile );
+	}
+	printf( "%d of %d models failed\n", nFailed, jobs.Count() );
+
+	return nFailed ? 1 : 0;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: -server, compile a model for each "[options] <file.qc>" line read
+//			from stdin without paying for process startup every time.  The
+//			studiomdl command line options apply to every job, the options on
+//			the line follow them.  "studiomdl-server: <exit code> <file.qc>"
+//			is printed as each job finishes.
+//
+//			Each job runs in a forked copy of the server, so an MdlError() or a
+//			crash only takes down that one job.  The file system is set up in
+//			the server first, so the game dir found for a source dir carries
+//			over to later jobs.  Without fork() there's no way to get back from
+//			an MdlError() on a worker thread, so Windows has no -server.
+//-----------------------------------------------------------------------------
+static int RunServer( int argc, char **argv )
+{
+#ifdef _WIN32
+	MdlError( "-server isn't supported on Windows, run studiomdl once per model\n" );
+	return 1;
+#else
+	CollisionModel_Preload();
+
+	// a forked job exiting with unread stdin buffered would seek the shared
+	// descriptor back to that point
+	setvbuf( stdin, NULL, _IONBF, 0 );
+
+	CUtlVector< char * > options;
+	options.AddToTail( argv[0] );
+	for ( int i = 1; i < argc; i++ )
+	{
+		if ( stricmp( argv[i], "-server" ) )
+			options.AddToTail( argv[i] );
+	}
+
+	int nFailed = 0;
+	char line[4096];
+	while ( fgets( line, sizeof( line ), stdin ) )
+	{
+		CUtlVector< char * > lineArgs;
+		TokenizeServerLine( line, lineArgs );
+		if ( lineArgs.Count() == 0 )
+			continue;
+
+		CUtlVector< char * > args;
+		BuildJobArgs( options, lineArgs, args );
+
+		const char *pQCFile = args[args.Count() - 1];
+
+		CommandLine()->CreateCmdLine( args.Count(), args.Base() );
+		CmdLib_InitFileSystem( pQCFile );
+
+		int result;
+		pid_t pid = ForkCompile( args, NULL );
+
+		int status = 0;
+		if ( pid < 0 || waitpid( pid, &status, 0 ) != pid )
+		{
+			result = -1;
+		}
+		else
+		{
+			result = JobExitCode( status );
+		}
+
+		if ( result != 0 )
+		{
+			nFailed++;
+		}
+
+		printf( "studiomdl-server: %d %s\n", result, pQCFile );
+		fflush( stdout );
+	}
+
+	return nFailed ? 1 : 0;
+#endif
+}
+
+/*
+==============
+main
+==============
+*/
+
+int main (int argc, char **argv)
+{
+#if defined(_WIN32) && !defined(_DEBUG)
+	LPTOP_LEVEL_EXCEPTION_FILTER pOldFilter = SetUnhandledExceptionFilter( VExceptionFilter );
+#endif // defined(_WIN32) && !defined(_DEBUG)
+
+	CommandLine()->CreateCmdLine( argc, argv );
 
+	InstallSpewFunction();
+	MathLib_Init( 2.2f, 2.2f, 0.0f, 2.0f, false, false, false, false );
+	
 
+	int returnValue;	
+	if ( HandlePrintSurfaceProps( returnValue ) )
+		return returnValue;
 
+	if ( CommandLine()->FindParm( "-server" ) )
+		return RunServer( argc, argv );
 
+	return CompileCommandLine( argc, argv );
+}
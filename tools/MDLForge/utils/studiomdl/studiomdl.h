@@ -96,6 +96,9 @@ const char *KeyValueText( CUtlVector< char > *pKeyValue );
 extern vec_t Q_rint (vec_t in);
 
 extern void WriteModelFiles(void);
+extern void AddOutputFile( const char *pFileName, void *pData, int length );
+extern vertexFileHeader_t *CopyVertexFileHeader( void );
+extern void SetThreadVertexFileHeader( vertexFileHeader_t *pVertexHdr );
 void *kalloc( int num, int size );
 
 struct s_trianglevert_t
@@ -187,6 +190,7 @@ struct s_renamebone_t
 };
 EXTERN s_renamebone_t g_renamedbone[MAXSTUDIOSRCBONES];
 const char *RenameBone( const char *pName ); // returns new name if available, else return pName.
+void InvalidateGlobalBoneNames(); // call after moving, removing or renaming g_bonetable entries
 
 EXTERN int g_numimportbones;
 struct s_importbone_t
@@ -495,6 +499,8 @@ struct s_ikrule_t
 
 
 struct s_source_t;
+class CBoneNameIndex;
+class CLineReader;
 EXTERN	int g_numani;
 struct s_animation_t
 {
@@ -819,11 +825,16 @@ struct s_source_t
 	int				**vanim_map;		// local vertices to target vertices mapping list
 	int				*vanim_flag;		// local vert does animate
 
+	// frame 0 has every vertex, in order.  Later frames only need the
+	// vertices that move off frame 0, the rest are taken as frame 0's.
 	int				numvanims[MAXSTUDIOANIMFRAMES];
 	s_vertanim_t	*vanim[MAXSTUDIOANIMFRAMES];	// [frame][vertex]
 
 	// processed aggregate lod data
 	s_loddata_t		*pLodData;
+
+	// hashed localBone names, built by FindLocalBoneNamed()
+	mutable CBoneNameIndex *pBoneNames;
 };
 
 
@@ -1124,6 +1135,7 @@ EXTERN CUtlVector< s_bonesaveframe_t > g_bonesaveframe;
 EXTERN	int is_v1support;
 
 int OpenGlobalFile( char *src );
+bool FindGlobalFile( char *src, char *pFileName, int nFileNameSize );
 s_source_t *Load_Source( char const *filename, const char *ext, bool reverse = false, bool isActiveModel = false );
 extern int Load_VRM( s_source_t *psource );
 extern int Load_SMD( s_source_t *psource );
@@ -1133,6 +1145,24 @@ extern int AppendVTAtoOBJ( s_source_t *psource, char *filename, int frame );
 extern void Build_Reference( s_source_t *psource);
 extern int Grab_Nodes( s_node_t *pnodes );
 extern void Grab_Animation( s_source_t *psource );
+extern int Animation_StartFrame( s_source_t *psource, int time );
+extern void Animation_SetKey( s_source_t *psource, int t, int index, Vector pos, const RadianEuler &rot );
+extern void Animation_End( s_source_t *psource );
+
+// parsed .smd/.vta cache under -cache <dir>, see v1support.cpp
+extern char g_szCacheDir[MAX_PATH];
+extern bool CompileCache_HashFile( const char *pFileName, char *pHash, int nHashSize );
+extern int Load_CachedSource( s_source_t *psource, const char *pKind );
+extern void SourceCache_BeginRecord( void );
+extern void SourceCache_EndRecord( s_source_t *psource );
+extern void SourceCache_Discard( void );
+extern void SourceCache_RecordNodes( int numbones, const s_node_t *pnodes );
+extern void SourceCache_RecordAnimation( void );
+extern void SourceCache_RecordFrame( int time );
+extern void SourceCache_RecordKey( int index, const Vector &pos, const RadianEuler &rot );
+extern void SourceCache_RecordAnimationEnd( void );
+extern void SourceCache_RecordVertexAnim( int t, int count, const s_vertanim_t *pvanim );
+extern void SourceCache_RecordVertexAnimEnd( int numvertices );
 
 extern int lookup_texture( char *texturename, int maxlen );
 extern int use_texture_as_material( int textureindex );
@@ -1193,7 +1223,7 @@ void MarkParentBoneLODs( void );
 */
 
 extern char	g_szFilename[1024];
-extern FILE	*g_fpInput;
+extern CLineReader g_InputFile;
 extern char	g_szLine[4096];
 extern int	g_iLinecount;
 
@@ -1232,6 +1262,7 @@ EXTERN	int numvlist;
 
 int SortAndBalanceBones( int iCount, int iMaxCount, int bones[], float weights[] );
 void Grab_Vertexanimation( s_source_t *psource );
+bool VertexAnimMoves( const Vector &delta, const Vector &ndelta );
 extern void BuildIndividualMeshes( s_source_t *psource );
 
 //-----------------------------------------------------------------------------
@@ -1335,6 +1366,8 @@ extern bool g_bLockBoneLengths;
 extern bool g_bOverridePreDefinedBones;
 extern bool g_bXbox;
 extern int g_minLod;
+extern float g_flAnimRotTolerance;
+extern float g_flAnimPosTolerance;
 
 EXTERN int g_numcollapse;
 EXTERN char *g_collapse[MAXSTUDIOSRCBONES];
@@ -1348,6 +1381,10 @@ extern void MdlError( char const *pMsg, ... );
 extern void MdlWarning( char const *pMsg, ... );
 
 extern void CreateMakefile_AddDependency( const char *pFileName );
+extern void CompileCache_AddInput( const char *pFileName );
+extern void CompileCache_Untracked( const char *pWhat );
+extern void CompileCache_AddOutput( const char *pFileName );
+extern void EnsureFileDirectoryExists( const char *pFilename );
 
 extern bool ComparePath( const char *a, const char *b );
 
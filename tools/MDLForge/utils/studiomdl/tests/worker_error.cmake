@@ -0,0 +1,50 @@
+# An error raised while the animations are processed on worker threads must
+# end the compile with the same status as a single threaded run, not abort it.
+#
+# cmake -DSTUDIOMDL=<path> -DWORK_DIR=<dir> -P worker_error.cmake
+
+if(NOT STUDIOMDL OR NOT WORK_DIR)
+    message(FATAL_ERROR "STUDIOMDL and WORK_DIR must be set")
+endif()
+
+file(REMOVE_RECURSE "${WORK_DIR}")
+file(MAKE_DIRECTORY "${WORK_DIR}/src" "${WORK_DIR}/game")
+
+set(nodes "nodes\n0 \"root\" -1\n1 \"tip\" 0\nend\n")
+
+file(WRITE "${WORK_DIR}/src/ref.smd"
+    "version 1\n${nodes}"
+    "skeleton\ntime 0\n0 0 0 0 0 0 0\n1 0 0 8 0 0 0\nend\n"
+    "triangles\nmat0.bmp\n"
+    "0 0 0 0 0 0 1 0 0\n"
+    "1 4 0 8 0 0 1 1 0\n"
+    "0 4 0 0 0 0 1 1 1\n"
+    "end\n")
+
+file(WRITE "${WORK_DIR}/src/anim.smd"
+    "version 1\n${nodes}"
+    "skeleton\n"
+    "time 0\n0 0 0 0 0 0 0\n1 0 0 8 0 0 0\n"
+    "time 1\n0 0 0 0 0 0 1\n1 0 0 8 0 0 0\n"
+    "end\n")
+
+file(WRITE "${WORK_DIR}/src/worker_error.qc"
+    "$modelname \"test/worker_error.mdl\"\n"
+    "$body b \"ref.smd\"\n"
+    "$sequence idle \"anim.smd\"\n"
+    "$sequence walk \"anim.smd\" counterrotate \"nosuchbone\"\n")
+
+execute_process(
+    COMMAND "${STUDIOMDL}" -game "${WORK_DIR}/game" -threads 4 worker_error.qc
+    WORKING_DIRECTORY "${WORK_DIR}/src"
+    RESULT_VARIABLE result
+    OUTPUT_VARIABLE output
+    ERROR_VARIABLE output
+)
+
+if(NOT result STREQUAL "1")
+    message(FATAL_ERROR "studiomdl exited with '${result}', expected 1\n${output}")
+endif()
+if(NOT output MATCHES "unable to find bone nosuchbone to counterrotate")
+    message(FATAL_ERROR "studiomdl didn't report the bad bone\n${output}")
+endif()
@@ -7,9 +7,12 @@
 #include "vstdlib/ikeyvaluessystem.h"
 #include "vstdlib/random.h"
 #include "icvar.h"
+#include "cmdlib.h"
+#include "threads.h"
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <chrono>
 #include <unordered_map>
 #include <string>
 #include <vector>
@@ -30,6 +33,12 @@ void Plat_DebugString( const char *pMsg )
 		fputs( pMsg, stderr );
 }
 
+double Plat_FloatTime()
+{
+	static const std::chrono::steady_clock::time_point s_start = std::chrono::steady_clock::now();
+	return std::chrono::duration<double>( std::chrono::steady_clock::now() - s_start ).count();
+}
+
 bool Is64BitOS()
 {
 #if defined( PLATFORM_64BITS )
@@ -212,10 +221,11 @@ void InstallSpewFunction()
 
 void Error( PRINTF_FORMAT_STRING const char *pMsg, ... )
 {
+    RunThreads_ErrorLock();
     va_list args; va_start( args, pMsg );
     vfprintf( stderr, pMsg, args );
     va_end( args );
-    exit( 1 );
+    RunThreads_Exit( 1 );
 }
 
 void Msg( PRINTF_FORMAT_STRING const tchar *pMsg, ... )
@@ -10,6 +10,9 @@
 #include <sys/stat.h>
 #include <math.h>
 #include <float.h>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
 
 #include "cmdlib.h"
 #include "scriplib.h"
@@ -38,6 +41,20 @@ static int FindVertexInDictionaryExact( CVertexDictionary &vertexDict, int nStar
 static void BuildBoneLODMapping( CUtlVector<int> &boneMap, int lodID );
 
 
+//-----------------------------------------------------------------------------
+// Tolerances for all fields of the vertex
+//-----------------------------------------------------------------------------
+#define POSITION_EPSILON	0.05f
+#define TEXCOORD_EPSILON	0.1f
+#define NORMAL_EPSILON		60.0f	// in degrees
+#define TANGENT_EPSILON		60.0f	// in degrees
+#define BONEWEIGHT_EPSILON	0.5f
+
+// Cells of the dictionary's position grid are a hair larger than the position
+// tolerance, so rounding in the distance test can't put a match two cells away
+#define POSITION_GRID_SIZE	( POSITION_EPSILON * 1.001f )
+
+
 //-----------------------------------------------------------------------------
 // A vertex format
 //-----------------------------------------------------------------------------
@@ -80,11 +97,22 @@ public:
 
 	void SetRootVertexRange( int start, int end );
 
+	// Finds the vertices in [nStartVert, nEndVert) that can be within POSITION_EPSILON
+	// of a position, in index order
+	void FindVerticesNear( const Vector &position, int nStartVert, int nEndVert, CUtlVector<int> &candidates ) const;
+
 private:
+	static int PositionCell( float flCoord );
+	static long long PositionCellKey( int x, int y, int z );
+	void AddToPositionGrid( int nVertID );
+
 	CUtlVector<VertexInfo_t>	m_Verts;
 	int							m_nPrevLODCount;
 	int							m_nRootLODStart;
 	int							m_nRootLODEnd;
+
+	// grid cell -> vertices in it, in index order
+	std::unordered_map< long long, std::vector<int> >	m_PositionGrid;
 };
 
 
@@ -158,6 +186,7 @@ int CVertexDictionary::AddVertex( const VertexInfo_t &srcVertex )
 	ValidateBoneWeight( vertex.m_BoneWeight );
 	SortBoneWeightByIndex( vertex.m_BoneWeight );
 	ValidateBoneWeight( vertex.m_BoneWeight );
+	AddToPositionGrid( nDstVertID );
 
 	return nDstVertID;
 }
@@ -181,6 +210,7 @@ int CVertexDictionary::AddVertexFromSource( const s_source_t *pSrc, int nVertexI
 	ValidateBoneWeight( vertex.m_BoneWeight );
 	SortBoneWeightByIndex( vertex.m_BoneWeight );
 	ValidateBoneWeight( vertex.m_BoneWeight );
+	AddToPositionGrid( nDstVertID );
 
 	return nDstVertID;
 }
@@ -195,6 +225,71 @@ int CVertexDictionary::VertexCount() const
 }
 
 
+//-----------------------------------------------------------------------------
+// Position grid
+//-----------------------------------------------------------------------------
+int CVertexDictionary::PositionCell( float flCoord )
+{
+	double flCell = floor( (double)flCoord / POSITION_GRID_SIZE );
+	return (int)clamp( flCell, -1.0e9, 1.0e9 );
+}
+
+long long CVertexDictionary::PositionCellKey( int x, int y, int z )
+{
+	// far apart cells can share a key; that only adds candidates
+	return ( (long long)( x & 0x1FFFFF ) << 42 ) | ( (long long)( y & 0x1FFFFF ) << 21 ) | (long long)( z & 0x1FFFFF );
+}
+
+void CVertexDictionary::AddToPositionGrid( int nVertID )
+{
+	const Vector &position = m_Verts[nVertID].m_Position;
+	long long key = PositionCellKey( PositionCell( position.x ), PositionCell( position.y ), PositionCell( position.z ) );
+	m_PositionGrid[key].push_back( nVertID );
+}
+
+void CVertexDictionary::FindVerticesNear( const Vector &position, int nStartVert, int nEndVert, CUtlVector<int> &candidates ) const
+{
+	candidates.RemoveAll();
+
+	int cx = PositionCell( position.x );
+	int cy = PositionCell( position.y );
+	int cz = PositionCell( position.z );
+	long long keys[27];
+	int nKeys = 0;
+	for ( int x = cx - 1; x <= cx + 1; x++ )
+	{
+		for ( int y = cy - 1; y <= cy + 1; y++ )
+		{
+			for ( int z = cz - 1; z <= cz + 1; z++ )
+			{
+				long long key = PositionCellKey( x, y, z );
+				int k;
+				for ( k = 0; k < nKeys; k++ )
+				{
+					if ( keys[k] == key )
+						break;
+				}
+				if ( k < nKeys )
+					continue;
+				keys[nKeys++] = key;
+
+				std::unordered_map< long long, std::vector<int> >::const_iterator cell = m_PositionGrid.find( key );
+				if ( cell == m_PositionGrid.end() )
+					continue;
+
+				const std::vector<int> &verts = cell->second;
+				for ( std::vector<int>::const_iterator it = std::lower_bound( verts.begin(), verts.end(), nStartVert ); it != verts.end() && *it < nEndVert; ++it )
+				{
+					candidates.AddToTail( *it );
+				}
+			}
+		}
+	}
+
+	std::sort( candidates.Base(), candidates.Base() + candidates.Count() );
+}
+
+
 s_source_t* GetModelLODSource( const char *pModelName, 
 								const LodScriptData_t& scriptLOD, bool* pFound )
 {
@@ -229,15 +324,6 @@ s_source_t* GetModelLODSource( const char *pModelName,
 }
 
 
-//-----------------------------------------------------------------------------
-// Tolerances for all fields of the vertex
-//-----------------------------------------------------------------------------
-#define POSITION_EPSILON	0.05f
-#define TEXCOORD_EPSILON	0.1f
-#define NORMAL_EPSILON		60.0f	// in degrees
-#define TANGENT_EPSILON		60.0f	// in degrees
-#define BONEWEIGHT_EPSILON	0.5f
-
 #define UNMATCHED_BONE_WEIGHT 1.0f
 
 //-----------------------------------------------------------------------------
@@ -604,8 +690,24 @@ static int FindVertexWithinVertexDictionary( const VertexInfo_t &find,
 		flTangentSError    = 0;
 	}
 
-	for ( int nVertexIndex = nStartVert; nVertexIndex < nEndVert; ++nVertexIndex )
+	// only the vertices near the position can pass the position check
+	CUtlVector<int> candidates;
+	if ( !(fIgnore & IGNORE_POSITION) )
+	{
+		vertexDict.FindVerticesNear( find.m_Position, nStartVert, nEndVert, candidates );
+	}
+	else
+	{
+		for ( int nVertexIndex = nStartVert; nVertexIndex < nEndVert; ++nVertexIndex )
+		{
+			candidates.AddToTail( nVertexIndex );
+		}
+	}
+
+	for ( int nCandidate = 0; nCandidate < candidates.Count(); ++nCandidate )
 	{
+		int nVertexIndex = candidates[nCandidate];
+
 		// see if the position is reasonable
 		if ( !(fIgnore & IGNORE_POSITION) && !ComparePositionFuzzy( find.m_Position, vertexDict.Vertex(nVertexIndex).m_Position, flPositionError ) )
 			continue;
@@ -672,10 +774,114 @@ static int FindVertexWithinVertexDictionary( const VertexInfo_t &find,
 }
 
 
+//-----------------------------------------------------------------------------
+// Nearest position lookup over all of a source's vertices (a k-d tree kept as
+// a list of vertex indices; the median of each range splits it)
+//-----------------------------------------------------------------------------
+class CSourcePositionTree
+{
+public:
+	CSourcePositionTree() : m_pSrc( NULL ) {}
+
+	void Build( const s_source_t *pSrc );
+
+	// Finds every vertex tied for the least ComparePositionFuzzy error, in index order
+	void FindNearest( const Vector &position, CUtlVector<int> &nearest ) const;
+
+private:
+	void BuildRange( int nStart, int nEnd, int nAxis );
+	void SearchRange( int nStart, int nEnd, int nAxis, const Vector &position, float &flMinError, CUtlVector<int> &nearest ) const;
+
+	const s_source_t	*m_pSrc;
+	CUtlVector<int>		m_Verts;
+};
+
+void CSourcePositionTree::Build( const s_source_t *pSrc )
+{
+	m_pSrc = pSrc;
+	m_Verts.RemoveAll();
+	for ( int i = 0; i < pSrc->numvertices; i++ )
+	{
+		m_Verts.AddToTail( i );
+	}
+	BuildRange( 0, m_Verts.Count(), 0 );
+}
+
+void CSourcePositionTree::BuildRange( int nStart, int nEnd, int nAxis )
+{
+	if ( nEnd - nStart < 2 )
+		return;
+
+	const s_vertexinfo_t *pVerts = m_pSrc->vertex;
+	int nMid = ( nStart + nEnd ) / 2;
+	std::nth_element( m_Verts.Base() + nStart, m_Verts.Base() + nMid, m_Verts.Base() + nEnd,
+		[pVerts, nAxis]( int a, int b ) { return pVerts[a].position[nAxis] < pVerts[b].position[nAxis]; } );
+
+	BuildRange( nStart, nMid, ( nAxis + 1 ) % 3 );
+	BuildRange( nMid + 1, nEnd, ( nAxis + 1 ) % 3 );
+}
+
+void CSourcePositionTree::SearchRange( int nStart, int nEnd, int nAxis, const Vector &position, float &flMinError, CUtlVector<int> &nearest ) const
+{
+	if ( nStart >= nEnd )
+		return;
+
+	int nMid = ( nStart + nEnd ) / 2;
+	int nVert = m_Verts[nMid];
+	const Vector &split = m_pSrc->vertex[nVert].position;
+
+	float flError;
+	ComparePositionFuzzy( position, split, flError );
+	if ( flError < flMinError )
+	{
+		flMinError = flError;
+		nearest.RemoveAll();
+	}
+	if ( flError == flMinError )
+	{
+		nearest.AddToTail( nVert );
+	}
+
+	float flDelta = position[nAxis] - split[nAxis];
+	int nNextAxis = ( nAxis + 1 ) % 3;
+	if ( flDelta < 0 )
+	{
+		SearchRange( nStart, nMid, nNextAxis, position, flMinError, nearest );
+	}
+	else
+	{
+		SearchRange( nMid + 1, nEnd, nNextAxis, position, flMinError, nearest );
+	}
+
+	// the other side can only hold a tie or better if the splitting plane is that
+	// close; the slack covers rounding in the distance test
+	if ( flDelta * flDelta <= flMinError * 1.0001f + 1e-6f )
+	{
+		if ( flDelta < 0 )
+		{
+			SearchRange( nMid + 1, nEnd, nNextAxis, position, flMinError, nearest );
+		}
+		else
+		{
+			SearchRange( nStart, nMid, nNextAxis, position, flMinError, nearest );
+		}
+	}
+}
+
+void CSourcePositionTree::FindNearest( const Vector &position, CUtlVector<int> &nearest ) const
+{
+	nearest.RemoveAll();
+	float flMinError = FLT_MAX;
+	SearchRange( 0, m_Verts.Count(), 0, position, flMinError, nearest );
+	std::sort( nearest.Base(), nearest.Base() + nearest.Count() );
+}
+
+
 //-----------------------------------------------------------------------------
 // Use position, normal, and texcoord checks across the entire model to find a boneweight
 //-----------------------------------------------------------------------------
-static void FindBoneWeightWithinModel( const VertexInfo_t &searchVertex, const s_source_t *pSrc, s_boneweight_t &boneWeight, int fIgnore )
+static void FindBoneWeightWithinModel( const VertexInfo_t &searchVertex, const s_source_t *pSrc, 
+	const CSourcePositionTree &srcPositions, s_boneweight_t &boneWeight, int fIgnore )
 {
 	int		nBestIndex = -1;
 	float	flPositionError;
@@ -706,8 +912,14 @@ static void FindBoneWeightWithinModel( const VertexInfo_t &searchVertex, const s
 		flTangentSError    = 0;
 	}
 
-	for ( int i = 0; i < pSrc->numvertices; i++ )
+	// the best vertex is always one of those closest in position
+	CUtlVector<int> nearest;
+	srcPositions.FindNearest( searchVertex.m_Position, nearest );
+
+	for ( int nCandidate = 0; nCandidate < nearest.Count(); nCandidate++ )
 	{
+		int i = nearest[nCandidate];
+
 		// Compute error metrics
 		ComparePositionFuzzy( searchVertex.m_Position, pSrc->vertex[i].position, flPositionError );
 
@@ -876,7 +1088,7 @@ static void CollapseBoneWeights( s_boneweight_t &boneWeight )
 // Find a matching vertex within the root lod 
 //-----------------------------------------------------------------------------
 static void CalculateBoneWeightFromRootLod( const VertexInfo_t &searchVertex, CVertexDictionary &vertexDict, 
-	const s_source_t *pRootLODSrc, VertexInfo_t &idealVertex )
+	const s_source_t *pRootLODSrc, const CSourcePositionTree &rootPositions, VertexInfo_t &idealVertex )
 {
 	idealVertex = searchVertex;
 
@@ -905,7 +1117,7 @@ static void CalculateBoneWeightFromRootLod( const VertexInfo_t &searchVertex, CV
 
 	// In this case, we didn't find anything within the tolerance, so we need to
 	// do a *positional check only* to give us a bone weight to assign to this vertex.
-	FindBoneWeightWithinModel( searchVertex, pRootLODSrc, idealVertex.m_BoneWeight, IGNORE_BONEWEIGHT|IGNORE_TANGENTS );
+	FindBoneWeightWithinModel( searchVertex, pRootLODSrc, rootPositions, idealVertex.m_BoneWeight, IGNORE_BONEWEIGHT|IGNORE_TANGENTS );
 }
 
 //-----------------------------------------------------------------------------
@@ -1015,8 +1227,11 @@ static bool AreBoneWeightsEqual( const s_boneweight_t &b1, const s_boneweight_t
 //-----------------------------------------------------------------------------
 static int FindVertexInDictionaryExact( CVertexDictionary &vertexDict, int nStartVert, int nEndVert, const VertexInfo_t &vertex )
 {
-	for ( int nVertID = nStartVert; nVertID < nEndVert; ++nVertID )
+	CUtlVector<int> candidates;
+	vertexDict.FindVerticesNear( vertex.m_Position, nStartVert, nEndVert, candidates );
+	for ( int nCandidate = 0; nCandidate < candidates.Count(); ++nCandidate )
 	{
+		int nVertID = candidates[nCandidate];
 		if ( vertexDict.Vertex( nVertID ).m_Position != vertex.m_Position )
 			continue;
 
@@ -1118,8 +1333,8 @@ static void PrintSBoneWeight( s_boneweight_t *pBoneWeight, const s_source_t *pSr
 // vertex dictionary, and use them if you find them, or add new vertices to the 
 // vertex dictionary if not and use those new vertices.
 //-----------------------------------------------------------------------------
-static void CreateLODVertsInDictionary( int nLodID, const s_source_t *pRootLODSrc, s_source_t *pCurrentLODSrc, 
-	const s_mesh_t *pCurrLODMesh, s_mesh_t *pVertexDictMesh, CVertexDictionary &vertexDict, int *pMeshVertIndexMap )
+static void CreateLODVertsInDictionary( int nLodID, const s_source_t *pRootLODSrc, const CSourcePositionTree &rootPositions, 
+	s_source_t *pCurrentLODSrc, const s_mesh_t *pCurrLODMesh, s_mesh_t *pVertexDictMesh, CVertexDictionary &vertexDict, int *pMeshVertIndexMap )
 {
 	// this function is specific to lods and not the root
 	Assert( nLodID );
@@ -1152,7 +1367,7 @@ static void CreateLODVertsInDictionary( int nLodID, const s_source_t *pRootLODSr
 		// the root lod contains no bone remappings
 		// this ensures we get a vertex with its matched proper boneweight assignment
 		VertexInfo_t idealVertex;
-		CalculateBoneWeightFromRootLod( vertex, vertexDict, pRootLODSrc, idealVertex );
+		CalculateBoneWeightFromRootLod( vertex, vertexDict, pRootLODSrc, rootPositions, idealVertex );
 
 		// try again to match the candidate vertex
 		// determine the ideal vertex with desired remapped boneweight
@@ -1361,7 +1576,13 @@ static void UnifyModelLODs( s_model_t *pSrcModel )
 	CVertexDictionary vertexDictionary;
 	CUtlVector<s_face_t> faces;
 	CUtlVector<s_mesh_t> meshes;
+	CSourcePositionTree rootPositions;
 	
+	if ( lods[0] )
+	{
+		rootPositions.Build( lods[0] );
+	}
+
 	meshes.AddMultipleToTail( MAXSTUDIOSKINS );
 	Assert( meshes.Count() == MAXSTUDIOSKINS );
 	memset( meshes.Base(), 0, meshes.Count() * sizeof( s_mesh_t ) );
@@ -1413,7 +1634,7 @@ static void UnifyModelLODs( s_model_t *pSrcModel )
 			if ( !pCurrLODMesh )
 				continue;
 
-			CreateLODVertsInDictionary( nLodID, lods[0], pCurrLOD, pCurrLODMesh, pVertexDictMesh, vertexDictionary, pMeshVertIndexMaps[nLodID]);
+			CreateLODVertsInDictionary( nLodID, lods[0], rootPositions, pCurrLOD, pCurrLODMesh, pVertexDictMesh, vertexDictionary, pMeshVertIndexMaps[nLodID]);
 		}
 	}
 
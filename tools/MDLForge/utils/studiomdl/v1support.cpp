@@ -21,19 +21,73 @@
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <math.h>
+#include <filesystem>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
 
 #include "cmdlib.h"
 #include "scriplib.h"
 #include "mathlib.h"
 #include "studio.h"
 #include "studiomdl.h"
+#include "tier1/checksum_md5.h"
+#include "linereader.h"
+#include "threads.h"
 
 
+//-----------------------------------------------------------------------------
+// Vertex unification hash.  Each bucket chains the v_listdata entries whose
+// material, position and texcoord hash alike, in ascending index order, so
+// lookup_index only runs the normal_blend test against exact matches and
+// still returns the same (lowest) index the old linear scan did.
+//-----------------------------------------------------------------------------
+#define VLIST_HASH_SIZE		( MAXSTUDIOVERTS * 2 )	// must be a power of two
+
+static int s_vlistHashHead[VLIST_HASH_SIZE];
+static int s_vlistHashTail[VLIST_HASH_SIZE];
+static int s_vlistHashNext[MAXSTUDIOVERTS];
+
+static void ClearVertexUnifyHash( void )
+{
+	memset( s_vlistHashHead, 0xFF, sizeof( s_vlistHashHead ) );
+	memset( s_vlistHashTail, 0xFF, sizeof( s_vlistHashTail ) );
+}
+
+static inline unsigned int HashFloatBits( unsigned int hash, float f )
+{
+	// +0 and -0 compare equal, so they must land in the same bucket
+	unsigned int bits = 0;
+	if ( f != 0.0f )
+	{
+		memcpy( &bits, &f, sizeof( bits ) );
+	}
+	hash ^= bits + 0x9e3779b9 + ( hash << 6 ) + ( hash >> 2 );
+	return hash;
+}
+
+static int VertexUnifyHash( int material, const Vector& vertex, const Vector2D& texcoord )
+{
+	unsigned int hash = (unsigned int)material * 0x85ebca6b;
+	hash = HashFloatBits( hash, vertex[0] );
+	hash = HashFloatBits( hash, vertex[1] );
+	hash = HashFloatBits( hash, vertex[2] );
+	hash = HashFloatBits( hash, texcoord[0] );
+	hash = HashFloatBits( hash, texcoord[1] );
+	hash ^= hash >> 16;
+	hash *= 0x7feb352d;
+	hash ^= hash >> 15;
+	return (int)( hash & ( VLIST_HASH_SIZE - 1 ) );
+}
+
 int lookup_index( s_source_t *psource, int material, Vector& vertex, Vector& normal, Vector2D texcoord )
 {
 	int i;
+	int bucket = VertexUnifyHash( material, vertex, texcoord );
 
-	for (i = 0; i < numvlist; i++) 
+	for (i = s_vlistHashHead[bucket]; i >= 0; i = s_vlistHashNext[i]) 
 	{
 		if (v_listdata[i].m == material
 			&& DotProduct( g_normal[i], normal ) > normal_blend
@@ -45,6 +99,8 @@ int lookup_index( s_source_t *psource, int material, Vector& vertex, Vector& nor
 			return i;
 		}
 	}
+
+	i = numvlist;
 	if (i >= MAXSTUDIOVERTS) {
 		MdlError( "too many indices in source: \"%s\"\n", psource->filename);
 	}
@@ -61,232 +117,481 @@ int lookup_index( s_source_t *psource, int material, Vector& vertex, Vector& nor
 	v_listdata[i].firstref = numvlist;
 	v_listdata[i].lastref = numvlist;
 
+	s_vlistHashNext[i] = -1;
+	if (s_vlistHashTail[bucket] >= 0)
+	{
+		s_vlistHashNext[s_vlistHashTail[bucket]] = i;
+	}
+	else
+	{
+		s_vlistHashHead[bucket] = i;
+	}
+	s_vlistHashTail[bucket] = i;
+
 	numvlist = i + 1;
 	return i;
 }
 
 
-void ParseFaceData( s_source_t *psource, int material, s_face_t *pFace )
+//-----------------------------------------------------------------------------
+// A vertex line of a triangle as it is in the file, before the scale and
+// weight processing
+//-----------------------------------------------------------------------------
+struct s_smdvertex_t
 {
-	int index[3];
-	int i, j;
-	Vector p;
-	Vector normal;
-	Vector2D t;
-	int		iCount, bones[MAXSTUDIOSRCBONES];
-	float   weights[MAXSTUDIOSRCBONES];
-	int bone;
-
-	for (j = 0; j < 3; j++) 
+	int			bone;
+	Vector		pos;
+	Vector		normal;
+	Vector2D	texcoord;
+	int			numweights;		// 0 when the vertex only names its parent bone
+	int			bones[MAXSTUDIOSRCBONES];
+	float		weights[MAXSTUDIOSRCBONES];
+};
+
+static void SourceCache_RecordTriangles( void );
+static void SourceCache_RecordTriangle( const char *pTextureName, const s_smdvertex_t *pVerts );
+static void SourceCache_RecordTrianglesEnd( void );
+
+//-----------------------------------------------------------------------------
+// Purpose: scan a vertex line, returns how many of its values up to the fourth
+//			weight were read.  iCount is the weight count the line gives and
+//			nWeights how many weights it actually has, up to what v holds.
+//-----------------------------------------------------------------------------
+template< class T >
+static int ScanFaceVertex( CLineScanner &scan, T &v, int &iCount, int &nWeights )
+{
+	iCount = 0;
+	int i = scan.Scan( v.bone, 
+		v.pos[0], v.pos[1], v.pos[2], 
+		v.normal[0], v.normal[1], v.normal[2], 
+		v.texcoord[0], v.texcoord[1],
+		iCount,
+		v.bones[0], v.weights[0], v.bones[1], v.weights[1], v.bones[2], v.weights[2], v.bones[3], v.weights[3] );
+
+	nWeights = (i > 10) ? (i - 10) / 2 : 0;
+	if (i < 9) 
+		return i;
+
+	// continue parsing more bones, the weights read as doubles like atof() did
+	if (iCount > 4)
 	{
-		memset( g_szLine, 0, sizeof( g_szLine ) );
-
-		if (fgets( g_szLine, sizeof( g_szLine ), g_fpInput ) == NULL) 
+		int k;
+		for (k = 4; k < iCount && k < (int)ARRAYSIZE( v.bones ); k++)
 		{
-			MdlError("%s: error on g_szLine %d: %s", g_szFilename, g_iLinecount, g_szLine );
+			double weight;
+			if (!scan.Read( v.bones[k] ) || !scan.Read( weight ))
+				break;
+			v.weights[k] = weight;
+			nWeights++;
 		}
+	}
 
-		iCount = 0;
+	v.numweights = (i == 9) ? 0 : iCount;
+	return i;
+}
 
-		g_iLinecount++;
-		i = sscanf( g_szLine, "%d %f %f %f %f %f %f %f %f %d %d %f %d %f %d %f %d %f",
-			&bone, 
-			&p[0], &p[1], &p[2], 
-			&normal[0], &normal[1], &normal[2], 
-			&t[0], &t[1],
-			&iCount,
-			&bones[0], &weights[0], &bones[1], &weights[1], &bones[2], &weights[2], &bones[3], &weights[3] );
-			
-		if (i < 9) 
-			continue;
+//-----------------------------------------------------------------------------
+// Purpose: read the next vertex line, false if it doesn't have one
+//-----------------------------------------------------------------------------
+static bool ParseFaceVertex( s_source_t *psource, s_smdvertex_t &v )
+{
+	int iCount;
+	int nWeights;
 
-		if (bone < 0 || bone >= psource->numbones) 
-		{
-			MdlError("bogus bone index\n%d %s :\n%s", g_iLinecount, g_szFilename, g_szLine );
-		}
+	if (!g_InputFile.NextLine()) 
+	{
+		MdlError("%s: error on g_szLine %d: ", g_szFilename, g_iLinecount );
+	}
 
-		//Scale face pos
-		scale_vertex( p );
-		
-		// continue parsing more bones.
-		// FIXME: don't we have a built in parser that'll do this?
-		if (iCount > 4)
-		{
-			int k;
-			int ctr = 0;
-			char *token;
-			for (k = 0; k < 18; k++)
-			{
-				while (g_szLine[ctr] == ' ')
-				{
-					ctr++;
-				}
-				token = strtok( &g_szLine[ctr], " " );
-				ctr += strlen( token ) + 1;
-			}
-			for (k = 4; k < iCount && k < MAXSTUDIOSRCBONES; k++)
-			{
-				while (g_szLine[ctr] == ' ')
-				{
-					ctr++;
-				}
-				token = strtok( &g_szLine[ctr], " " );
-				ctr += strlen( token ) + 1;
+	g_iLinecount++;
+	CLineScanner scan( g_InputFile );
+	if (ScanFaceVertex( scan, v, iCount, nWeights ) < 9) 
+		return false;
 
-				bones[k] = atoi(token);
+	if (v.bone < 0 || v.bone >= psource->numbones) 
+	{
+		g_InputFile.CopyLine( g_szLine, sizeof( g_szLine ) );
+		MdlError("bogus bone index\n%d %s :\n%s", g_iLinecount, g_szFilename, g_szLine );
+	}
+	return true;
+}
 
-				token = strtok( &g_szLine[ctr], " " );
-				ctr += strlen( token ) + 1;
-			
-				weights[k] = atof(token);
-			}
-			// printf("%d ", iCount );
+static int AddFaceVertex( s_source_t *psource, int material, const s_smdvertex_t &v )
+{
+	Vector p = v.pos;
+	Vector normal = v.normal;
+	Vector2D t = v.texcoord;
 
-			//printf("\n");
-			//exit(1);
-		}
+	//Scale face pos
+	scale_vertex( p );
 
-		// adjust_vertex( p );
-		// scale_vertex( p );
+	// adjust_vertex( p );
+	// scale_vertex( p );
 
-		// move vertex position to object space.
-		// VectorSubtract( p, psource->bonefixup[bone].worldorg, tmp );
-		// VectorTransform(tmp, psource->bonefixup[bone].im, p );
+	// move vertex position to object space.
+	// VectorSubtract( p, psource->bonefixup[bone].worldorg, tmp );
+	// VectorTransform(tmp, psource->bonefixup[bone].im, p );
 
-		// move normal to object space.
-		// VectorCopy( normal, tmp );
-		// VectorTransform(tmp, psource->bonefixup[bone].im, normal );
-		// VectorNormalize( normal );
+	// move normal to object space.
+	// VectorCopy( normal, tmp );
+	// VectorTransform(tmp, psource->bonefixup[bone].im, normal );
+	// VectorNormalize( normal );
 
-		// invert v
-		t[1] = 1.0 - t[1];
+	// invert v
+	t[1] = 1.0 - t[1];
+
+	int index = lookup_index( psource, material, p, normal, t );
+
+	if (v.numweights == 0)
+	{
+		g_bone[index].numbones = 1;
+		g_bone[index].bone[0] = v.bone;
+		g_bone[index].weight[0] = 1.0;
+	}
+	else
+	{
+		int		bones[MAXSTUDIOSRCBONES];
+		float   weights[MAXSTUDIOSRCBONES];
+		int		i;
 
-		index[j] = lookup_index( psource, material, p, normal, t );
+		int iCount = min( v.numweights, MAXSTUDIOSRCBONES );
+		memcpy( bones, v.bones, iCount * sizeof( int ) );
+		memcpy( weights, v.weights, iCount * sizeof( float ) );
 
-		if (i == 9 || iCount == 0)
+		iCount = SortAndBalanceBones( v.numweights, MAXSTUDIOBONEWEIGHTS, bones, weights );
+
+		g_bone[index].numbones = iCount;
+		for (i = 0; i < iCount; i++)
 		{
-			g_bone[index[j]].numbones = 1;
-			g_bone[index[j]].bone[0] = bone;
-			g_bone[index[j]].weight[0] = 1.0;
+			g_bone[index].bone[i] = bones[i];
+			g_bone[index].weight[i] = weights[i];
 		}
-		else
-		{
-			iCount = SortAndBalanceBones( iCount, MAXSTUDIOBONEWEIGHTS, bones, weights );
+	}
+	return index;
+}
 
-			g_bone[index[j]].numbones = iCount;
-			for (i = 0; i < iCount; i++)
-			{
-				g_bone[index[j]].bone[i] = bones[i];
-				g_bone[index[j]].weight[i] = weights[i];
-			}
+//-----------------------------------------------------------------------------
+// Purpose: apply the .qc texture renames, false for faces that are skipped
+//-----------------------------------------------------------------------------
+static bool RenameTriangleTexture( char *texturename )
+{
+	int i;
+
+	// funky texture overrides
+	for (i = 0; i < numrep; i++)  
+	{
+		if (sourcetexture[i][0] == '\0') 
+		{
+			strcpy( texturename, defaulttexture[i] );
+			break;
+		}
+		if (stricmp( texturename, sourcetexture[i]) == 0) 
+		{
+			strcpy( texturename, defaulttexture[i] );
+			break;
 		}
 	}
 
-	// pFace->material = material; // BUG
-	pFace->a		= index[0];
-	pFace->b		= index[1];
-	pFace->c		= index[2];
-	Assert( ((pFace->a & 0xF0000000) == 0) && ((pFace->b & 0xF0000000) == 0) && 
-		((pFace->c & 0xF0000000) == 0) );
+	if (texturename[0] == '\0')
+	{
+		// weird source problem, skip them
+		return false;
+	}
 
-	if (flip_triangles)
+	if (stricmp( texturename, "null.bmp") == 0 || stricmp( texturename, "null.tga") == 0)
 	{
-		j = pFace->b;  pFace->b  = pFace->c;  pFace->c  = j;
+		// skip all faces with the null texture on them.
+		return false;
 	}
+	return true;
 }
 
-void Grab_Triangles( s_source_t *psource )
+static void AddTriangle( s_source_t *psource, char *texturename, const s_smdvertex_t *pVerts, const bool *pValid )
 {
-	int		i;
-	int		tcount = 0;	
-	Vector	vmin, vmax;
+	int texture = lookup_texture( texturename, 64 );
+	psource->texmap[texture] = texture;	// hack, make it 1:1
+	int material = use_texture_as_material( texture );
+
+	int index[3];
+	int j;
+	for (j = 0; j < 3; j++)
+	{
+		if (pValid[j])
+		{
+			index[j] = AddFaceVertex( psource, material, pVerts[j] );
+		}
+	}
+
+	s_face_t f;
+	// f.material = material; // BUG
+	f.a		= index[0];
+	f.b		= index[1];
+	f.c		= index[2];
+	Assert( ((f.a & 0xF0000000) == 0) && ((f.b & 0xF0000000) == 0) && 
+		((f.c & 0xF0000000) == 0) );
+
+	if (flip_triangles)
+	{
+		j = f.b;  f.b  = f.c;  f.c  = j;
+	}
 
-	vmin[0] = vmin[1] = vmin[2] = 99999;
-	vmax[0] = vmax[1] = vmax[2] = -99999;
+	g_src_uface[g_numfaces] = f;
+	g_face[g_numfaces].material = material;
+	g_numfaces++;
+}
 
+static void StartTriangles( void )
+{
 	g_numfaces = 0;
 	numvlist = 0;
- 
-	//
-	// load the base triangles
-	//
-	int texture;
-	int material;
+	ClearVertexUnifyHash();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: the texture name on a triangle's first line, less trailing smag
+//-----------------------------------------------------------------------------
+static void GetTriangleTextureName( const char *pLine, char *texturename )
+{
+	int i;
+
+	strncpy( texturename, pLine, 63 );
+	for (i = strlen( texturename ) - 1; i >= 0 && ! isgraph( texturename[i] ); i--)
+	{
+	}
+	texturename[i + 1] = '\0';
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: read one triangle, or the line in place of one.  false at the end.
+//-----------------------------------------------------------------------------
+static bool Grab_Triangle( s_source_t *psource )
+{
+	int		i;
 	char texturename[64];
+	char sourcename[64];
 
-	while (1) 
+	if (!g_InputFile.GetLine( g_szLine, sizeof( g_szLine ) )) 
+		return false;
+
+	g_iLinecount++;
+
+	// check for end
+	if (IsEnd( g_szLine )) 
+		return false;
+
+	// Look for extra junk that we may want to avoid...
+	int nLineLength = strlen( g_szLine );
+	if (nLineLength >= 64)
 	{
-		if (fgets( g_szLine, sizeof( g_szLine ), g_fpInput ) == NULL) 
-			break;
+		MdlWarning("Unexpected data at line %d, (need a texture name) ignoring...\n", g_iLinecount );
+		SourceCache_Discard();
+		return true;
+	}
 
-		g_iLinecount++;
+	GetTriangleTextureName( g_szLine, texturename );
+	strcpy( sourcename, texturename );
 
-		// check for end
-		if (IsEnd( g_szLine )) 
-			break;
+	if (!RenameTriangleTexture( texturename ))
+	{
+		// the cache only has the faces that were read
+		SourceCache_Discard();
+		g_InputFile.NextLine();
+		g_InputFile.NextLine();
+		g_InputFile.NextLine();
+		g_iLinecount += 3;
+		return true;
+	}
 
-		// Look for extra junk that we may want to avoid...
-		int nLineLength = strlen( g_szLine );
-		if (nLineLength >= 64)
-		{
-			MdlWarning("Unexpected data at line %d, (need a texture name) ignoring...\n", g_iLinecount );
-			continue;
-		}
+	s_smdvertex_t verts[3];
+	bool valid[3];
+	for (i = 0; i < 3; i++)
+	{
+		valid[i] = ParseFaceVertex( psource, verts[i] );
+	}
 
-		// strip off trailing smag
-		strncpy( texturename, g_szLine, 63 );
-		for (i = strlen( texturename ) - 1; i >= 0 && ! isgraph( texturename[i] ); i--)
-		{
-		}
-		texturename[i + 1] = '\0';
+	if (valid[0] && valid[1] && valid[2])
+	{
+		SourceCache_RecordTriangle( sourcename, verts );
+	}
+	else
+	{
+		SourceCache_Discard();
+	}
 
-		// funky texture overrides
-		for (i = 0; i < numrep; i++)  
+	AddTriangle( psource, texturename, verts, valid );
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Triangles are read ahead in batches and their vertex lines scanned on
+// worker threads, then added in file order.  A triangle whose vertices
+// don't all scan cleanly, or that has more weights than a batch vertex
+// holds, is re-read by Grab_Triangle() in its place, so its errors and
+// quirks come out as before.
+//-----------------------------------------------------------------------------
+#define MAX_BATCH_TRIANGLES		16384	// per batch, bounds the staging memory
+#define BATCH_CHUNK_TRIANGLES	512		// per worker thread work item
+#define MAXBATCHWEIGHTS			16
+
+struct s_batchvertex_t
+{
+	int			bone;
+	Vector		pos;
+	Vector		normal;
+	Vector2D	texcoord;
+	int			numweights;
+	int			bones[MAXBATCHWEIGHTS];
+	float		weights[MAXBATCHWEIGHTS];
+};
+
+struct s_batchtriangle_t
+{
+	const char		*pLine;		// the texture name
+	const char		*pVerts;
+	const char		*pNext;
+	int				linecount;	// of the texture name
+	bool			bValid;
+	s_batchvertex_t	verts[3];
+};
+
+static CUtlVector< s_batchtriangle_t > s_BatchTriangles;
+static int s_nBatchBones;
+
+static void ParseBatchTrianglesThread( int iThread, int iChunk )
+{
+	int nLast = min( ( iChunk + 1 ) * BATCH_CHUNK_TRIANGLES, s_BatchTriangles.Count() );
+	for (int i = iChunk * BATCH_CHUNK_TRIANGLES; i < nLast; i++)
+	{
+		s_batchtriangle_t &tri = s_BatchTriangles[i];
+		const char *pLine = tri.pVerts;
+		tri.bValid = true;
+		for (int j = 0; j < 3 && tri.bValid; j++)
 		{
-			if (sourcetexture[i][0] == '\0') 
+			const char *pLineEnd = CLineReader::FindLineEnd( pLine, tri.pNext );
+			s_batchvertex_t &v = tri.verts[j];
+			CLineScanner scan( pLine, pLineEnd );
+			int iCount, nWeights;
+			int n = ScanFaceVertex( scan, v, iCount, nWeights );
+			if (n < 9 || v.bone < 0 || v.bone >= s_nBatchBones)
 			{
-				strcpy( texturename, defaulttexture[i] );
-				break;
+				tri.bValid = false;
 			}
-			if (stricmp( texturename, sourcetexture[i]) == 0) 
+			else if (n > 9 && ( iCount < 0 || iCount > MAXBATCHWEIGHTS || nWeights < iCount ))
 			{
-				strcpy( texturename, defaulttexture[i] );
-				break;
+				// weights that are missing or don't fit
+				tri.bValid = false;
 			}
+			pLine = pLineEnd;
 		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: read the triangles that follow in one batch
+//-----------------------------------------------------------------------------
+static void Grab_TriangleBatch( s_source_t *psource )
+{
+	s_BatchTriangles.RemoveAll();
 
-		if (texturename[0] == '\0')
+	// find the triangles, four lines each up to the end or anything odd
+	const char *pLine = g_InputFile.Tell();
+	const char *pEnd = g_InputFile.End();
+	int linecount = g_iLinecount;
+	while (pLine < pEnd && s_BatchTriangles.Count() < MAX_BATCH_TRIANGLES)
+	{
+		const char *pVerts = CLineReader::FindLineEnd( pLine, pEnd );
+		CLineReader::CopyLine( pLine, pVerts, g_szLine, sizeof( g_szLine ) );
+		if (IsEnd( g_szLine ) || strlen( g_szLine ) >= 63)
+			break;
+
+		const char *pNext = pVerts;
+		int j;
+		for (j = 0; j < 3 && pNext < pEnd; j++)
 		{
-			// weird source problem, skip them
-			fgets( g_szLine, sizeof( g_szLine ), g_fpInput );
-			fgets( g_szLine, sizeof( g_szLine ), g_fpInput );
-			fgets( g_szLine, sizeof( g_szLine ), g_fpInput );
-			g_iLinecount += 3;
+			pNext = CLineReader::FindLineEnd( pNext, pEnd );
+		}
+		if (j < 3)
+			break;
+
+		s_batchtriangle_t &tri = s_BatchTriangles[s_BatchTriangles.AddToTail()];
+		tri.pLine = pLine;
+		tri.pVerts = pVerts;
+		tri.pNext = pNext;
+		tri.linecount = linecount + 1;
+		pLine = pNext;
+		linecount += 4;
+	}
+
+	if (s_BatchTriangles.Count() == 0)
+		return;
+
+	s_nBatchBones = psource->numbones;
+	RunThreadsOnIndividual( ( s_BatchTriangles.Count() + BATCH_CHUNK_TRIANGLES - 1 ) / BATCH_CHUNK_TRIANGLES, false, ParseBatchTrianglesThread );
+
+	// add them in order, as Grab_Triangle() would have
+	char texturename[64];
+	char sourcename[64];
+	s_smdvertex_t verts[3];
+	static const bool valid[3] = { true, true, true };
+	for (int i = 0; i < s_BatchTriangles.Count(); i++)
+	{
+		const s_batchtriangle_t &tri = s_BatchTriangles[i];
+		if (!tri.bValid)
+		{
+			g_InputFile.Seek( tri.pLine );
+			g_iLinecount = tri.linecount - 1;
+			Grab_Triangle( psource );
 			continue;
 		}
 
-		if (stricmp( texturename, "null.bmp") == 0 || stricmp( texturename, "null.tga") == 0)
+		CLineReader::CopyLine( tri.pLine, tri.pVerts, g_szLine, sizeof( g_szLine ) );
+		GetTriangleTextureName( g_szLine, texturename );
+		strcpy( sourcename, texturename );
+		g_iLinecount = tri.linecount + 3;
+		g_InputFile.Seek( tri.pNext );
+
+		if (!RenameTriangleTexture( texturename ))
 		{
-			// skip all faces with the null texture on them.
-			fgets( g_szLine, sizeof( g_szLine ), g_fpInput );
-			fgets( g_szLine, sizeof( g_szLine ), g_fpInput );
-			fgets( g_szLine, sizeof( g_szLine ), g_fpInput );
-			g_iLinecount += 3;
+			SourceCache_Discard();
 			continue;
 		}
 
-		texture = lookup_texture( texturename, sizeof( texturename ) );
-		psource->texmap[texture] = texture;	// hack, make it 1:1
-		material = use_texture_as_material( texture );
+		for (int j = 0; j < 3; j++)
+		{
+			const s_batchvertex_t &src = tri.verts[j];
+			s_smdvertex_t &v = verts[j];
+			v.bone = src.bone;
+			v.pos = src.pos;
+			v.normal = src.normal;
+			v.texcoord = src.texcoord;
+			v.numweights = src.numweights;
+			memcpy( v.bones, src.bones, src.numweights * sizeof( int ) );
+			memcpy( v.weights, src.weights, src.numweights * sizeof( float ) );
+		}
+
+		SourceCache_RecordTriangle( sourcename, verts );
+		AddTriangle( psource, texturename, verts, valid );
+	}
+}
+
+void Grab_Triangles( s_source_t *psource )
+{
+	StartTriangles();
+	SourceCache_RecordTriangles();
+ 
+	//
+	// load the base triangles
+	//
+	while (1) 
+	{
+		// runs of ordinary triangles go through the worker threads
+		Grab_TriangleBatch( psource );
 
-		s_face_t f;
-		ParseFaceData( psource, material, &f );
-	
-		g_src_uface[g_numfaces] = f;
-		g_face[g_numfaces].material = material;
-		g_numfaces++;
+		if (!Grab_Triangle( psource ))
+			break;
 	}
 
+	SourceCache_RecordTrianglesEnd();
 	BuildIndividualMeshes( psource );
 }
 
@@ -304,9 +609,11 @@ int Load_SMD ( s_source_t *psource )
 		printf ("SMD MODEL %s\n", psource->filename);
 	}
 
+	SourceCache_BeginRecord();
+
 	g_iLinecount = 0;
 
-	while (fgets( g_szLine, sizeof( g_szLine ), g_fpInput ) != NULL) 
+	while (g_InputFile.GetLine( g_szLine, sizeof( g_szLine ) )) 
 	{
 		g_iLinecount++;
 		int numRead = sscanf( g_szLine, "%s %d", cmd, &option );
@@ -345,9 +652,474 @@ int Load_SMD ( s_source_t *psource )
 		else 
 		{
 			MdlWarning("unknown studio command \"%s\"\n", cmd );
+			SourceCache_Discard();
+		}
+	}
+	g_InputFile.Close();
+
+	SourceCache_EndRecord( psource );
+
+	is_v1support = true;
+
+	return 1;
+}
+
+
+//-----------------------------------------------------------------------------
+// Parsed source cache.
+//
+// Reading the text is most of the cost of loading an .smd or .vta, and the
+// same animations are loaded by one .qc after another. With -cache <dir>,
+// Load_SMD and Load_VTA record what they read into
+// <dir>/sources/<hash of the path>.src. The values are stored before the
+// .qc's scale, texture renames and vertex welding are applied.
+// Load_CachedSource() maps that file and replays the records through the
+// same code the text parser uses. It does so while the source's size and time
+// stamp, or failing those its MD5, are the ones recorded.
+//
+// Files that warn or have lines the parser skips are always read as text.
+//-----------------------------------------------------------------------------
+#define SOURCECACHE_ID			(('C'<<24)+('S'<<16)+('D'<<8)+'M')
+#define SOURCECACHE_VERSION		2
+
+enum
+{
+	SOURCECACHE_NODES = 1,			// int numbones, s_node_t[numbones]
+	SOURCECACHE_ANIMATION,
+	SOURCECACHE_FRAME,				// int time
+	SOURCECACHE_KEY,				// int bone, Vector pos, RadianEuler rot
+	SOURCECACHE_ANIMATION_END,
+	SOURCECACHE_TRIANGLES,
+	SOURCECACHE_TRIANGLE,			// char texture[64], 3 x s_smdvertex_t with numweights bones and weights
+	SOURCECACHE_TRIANGLES_END,
+	SOURCECACHE_VERTEXANIM,			// int frame, int count, s_vertanim_t[count] as Grab_Vertexanimation keeps them
+	SOURCECACHE_VERTEXANIM_END,		// int numvertices
+};
+
+struct s_sourcecacheheader_t
+{
+	int		id;
+	int		version;
+	int		layout;			// sizes of the structs written as is
+	int		size;			// of the records after the header
+	int64	filesize;
+	int64	filetime;
+	char	md5[40];
+};
+
+static const int s_nSourceCacheLayout = sizeof( s_node_t ) + ( sizeof( s_vertanim_t ) << 8 ) + ( MAXSTUDIOSRCBONES << 16 );
+
+static bool s_bSourceCacheRecording = false;
+static CUtlVector< unsigned char > s_SourceCacheRecord;
+
+static void SourceCache_Put( const void *pData, int nSize )
+{
+	s_SourceCacheRecord.AddMultipleToTail( nSize, (const unsigned char *)pData );
+}
+
+static void SourceCache_PutInt( int n )
+{
+	SourceCache_Put( &n, sizeof( n ) );
+}
+
+static void SourceCache_FileName( const char *pSourceFile, char *pCacheFile, int nCacheFileSize )
+{
+	MD5Context_t ctx;
+	unsigned char digest[MD5_DIGEST_LENGTH];
+	MD5Init( &ctx );
+	MD5Update( &ctx, (const unsigned char *)pSourceFile, strlen( pSourceFile ) );
+	MD5Final( digest, &ctx );
+	Q_snprintf( pCacheFile, nCacheFileSize, "%s/sources/%s.src", g_szCacheDir, MD5_Print( digest, MD5_DIGEST_LENGTH ) );
+	Q_FixSlashes( pCacheFile );
+}
+
+static bool SourceCache_Stat( const char *pFileName, int64 &size, int64 &time )
+{
+	struct stat st;
+	if ( stat( pFileName, &st ) != 0 )
+		return false;
+	size = st.st_size;
+	time = st.st_mtime;
+	return true;
+}
+
+void SourceCache_BeginRecord( void )
+{
+	s_bSourceCacheRecording = g_szCacheDir[0] != '\0' && !g_bCreateMakefile;
+	s_SourceCacheRecord.RemoveAll();
+}
+
+void SourceCache_Discard( void )
+{
+	s_bSourceCacheRecording = false;
+}
+
+void SourceCache_RecordNodes( int numbones, const s_node_t *pnodes )
+{
+	if ( !s_bSourceCacheRecording )
+		return;
+	SourceCache_PutInt( SOURCECACHE_NODES );
+	SourceCache_PutInt( numbones );
+	SourceCache_Put( pnodes, numbones * sizeof( s_node_t ) );
+}
+
+void SourceCache_RecordAnimation( void )
+{
+	if ( !s_bSourceCacheRecording )
+		return;
+	SourceCache_PutInt( SOURCECACHE_ANIMATION );
+}
+
+void SourceCache_RecordFrame( int time )
+{
+	if ( !s_bSourceCacheRecording )
+		return;
+	SourceCache_PutInt( SOURCECACHE_FRAME );
+	SourceCache_PutInt( time );
+}
+
+void SourceCache_RecordKey( int index, const Vector &pos, const RadianEuler &rot )
+{
+	if ( !s_bSourceCacheRecording )
+		return;
+	SourceCache_PutInt( SOURCECACHE_KEY );
+	SourceCache_PutInt( index );
+	SourceCache_Put( &pos, sizeof( pos ) );
+	SourceCache_Put( &rot, sizeof( rot ) );
+}
+
+void SourceCache_RecordAnimationEnd( void )
+{
+	if ( !s_bSourceCacheRecording )
+		return;
+	SourceCache_PutInt( SOURCECACHE_ANIMATION_END );
+}
+
+static void SourceCache_RecordTriangles( void )
+{
+	if ( !s_bSourceCacheRecording )
+		return;
+	SourceCache_PutInt( SOURCECACHE_TRIANGLES );
+}
+
+static void SourceCache_RecordTriangle( const char *pTextureName, const s_smdvertex_t *pVerts )
+{
+	if ( !s_bSourceCacheRecording )
+		return;
+	char texturename[64];
+	Q_strncpy( texturename, pTextureName, sizeof( texturename ) );
+	SourceCache_PutInt( SOURCECACHE_TRIANGLE );
+	SourceCache_Put( texturename, sizeof( texturename ) );
+	for ( int i = 0; i < 3; i++ )
+	{
+		const s_smdvertex_t &v = pVerts[i];
+		SourceCache_PutInt( v.bone );
+		SourceCache_Put( &v.pos, sizeof( v.pos ) );
+		SourceCache_Put( &v.normal, sizeof( v.normal ) );
+		SourceCache_Put( &v.texcoord, sizeof( v.texcoord ) );
+		SourceCache_PutInt( v.numweights );
+		int nStored = min( v.numweights, MAXSTUDIOSRCBONES );
+		SourceCache_Put( v.bones, nStored * sizeof( int ) );
+		SourceCache_Put( v.weights, nStored * sizeof( float ) );
+	}
+}
+
+static void SourceCache_RecordTrianglesEnd( void )
+{
+	if ( !s_bSourceCacheRecording )
+		return;
+	SourceCache_PutInt( SOURCECACHE_TRIANGLES_END );
+}
+
+void SourceCache_RecordVertexAnim( int t, int count, const s_vertanim_t *pvanim )
+{
+	if ( !s_bSourceCacheRecording )
+		return;
+	SourceCache_PutInt( SOURCECACHE_VERTEXANIM );
+	SourceCache_PutInt( t );
+	SourceCache_PutInt( count );
+	SourceCache_Put( pvanim, count * sizeof( s_vertanim_t ) );
+}
+
+void SourceCache_RecordVertexAnimEnd( int numvertices )
+{
+	if ( !s_bSourceCacheRecording )
+		return;
+	SourceCache_PutInt( SOURCECACHE_VERTEXANIM_END );
+	SourceCache_PutInt( numvertices );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: write out what was recorded while psource was parsed
+//-----------------------------------------------------------------------------
+void SourceCache_EndRecord( s_source_t *psource )
+{
+	if ( !s_bSourceCacheRecording )
+		return;
+	s_bSourceCacheRecording = false;
+
+	char filename[1024];
+	s_sourcecacheheader_t header;
+	memset( &header, 0, sizeof( header ) );
+	if ( !FindGlobalFile( psource->filename, filename, sizeof( filename ) ) ||
+		!SourceCache_Stat( filename, header.filesize, header.filetime ) ||
+		!CompileCache_HashFile( filename, header.md5, sizeof( header.md5 ) ) )
+	{
+		return;
+	}
+	header.id = SOURCECACHE_ID;
+	header.version = SOURCECACHE_VERSION;
+	header.layout = s_nSourceCacheLayout;
+	header.size = s_SourceCacheRecord.Count();
+
+	// other compiles may be reading the old file, write a new one and swap it in
+	char cachefile[MAX_PATH];
+	char tmpfile[MAX_PATH];
+	SourceCache_FileName( filename, cachefile, sizeof( cachefile ) );
+#ifdef _WIN32
+	Q_snprintf( tmpfile, sizeof( tmpfile ), "%s.%lu", cachefile, GetCurrentProcessId() );
+#else
+	Q_snprintf( tmpfile, sizeof( tmpfile ), "%s.%d", cachefile, (int)getpid() );
+#endif
+	EnsureFileDirectoryExists( cachefile );
+
+	FILE *fp = fopen( tmpfile, "wb" );
+	if ( !fp )
+		return;
+	bool bOk = fwrite( &header, sizeof( header ), 1, fp ) == 1 &&
+		fwrite( s_SourceCacheRecord.Base(), 1, header.size, fp ) == (size_t)header.size;
+	if ( fclose( fp ) != 0 )
+		bOk = false;
+
+	std::error_code ec;
+	if ( bOk )
+	{
+		std::filesystem::rename( tmpfile, cachefile, ec );
+	}
+	if ( !bOk || ec )
+	{
+		std::filesystem::remove( tmpfile, ec );
+	}
+	s_SourceCacheRecord.Purge();
+}
+
+struct s_sourcecachereader_t
+{
+	const unsigned char	*p;
+	const unsigned char	*end;
+	const char			*pFileName;
+
+	const void *Get( int nSize )
+	{
+		if ( nSize < 0 || end - p < nSize )
+		{
+			MdlError( "%s: source cache is corrupt, delete it\n", pFileName );
+		}
+		const void *pData = p;
+		p += nSize;
+		return pData;
+	}
+
+	int GetInt( void )
+	{
+		int n;
+		memcpy( &n, Get( sizeof( n ) ), sizeof( n ) );
+		return n;
+	}
+
+	template< class T > void GetValue( T &value )
+	{
+		memcpy( &value, Get( sizeof( value ) ), sizeof( value ) );
+	}
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: load psource from the source cache, 0 when it isn't in the cache
+//			and has to be read from the text
+//-----------------------------------------------------------------------------
+int Load_CachedSource( s_source_t *psource, const char *pKind )
+{
+	if ( !g_szCacheDir[0] || g_bCreateMakefile )
+		return 0;
+
+	char filename[1024];
+	int64 filesize, filetime;
+	if ( !FindGlobalFile( psource->filename, filename, sizeof( filename ) ) ||
+		!SourceCache_Stat( filename, filesize, filetime ) )
+	{
+		return 0;
+	}
+
+	char cachefile[MAX_PATH];
+	SourceCache_FileName( filename, cachefile, sizeof( cachefile ) );
+
+	s_mappedfile_t map;
+	if ( !MapFile( cachefile, map ) )
+		return 0;
+
+	s_sourcecacheheader_t header;
+	if ( map.size < (int64)sizeof( header ) )
+	{
+		UnmapFile( map );
+		return 0;
+	}
+	memcpy( &header, map.pBase, sizeof( header ) );
+	if ( header.id != SOURCECACHE_ID || header.version != SOURCECACHE_VERSION || 
+		header.layout != s_nSourceCacheLayout || header.size != map.size - (int64)sizeof( header ) )
+	{
+		UnmapFile( map );
+		return 0;
+	}
+
+	// touched but not changed, e.g. a fresh checkout
+	bool bRetimed = false;
+	if ( header.filesize != filesize || header.filetime != filetime )
+	{
+		char md5[40];
+		if ( header.filesize != filesize || 
+			!CompileCache_HashFile( filename, md5, sizeof( md5 ) ) || 
+			stricmp( md5, header.md5 ) )
+		{
+			UnmapFile( map );
+			return 0;
+		}
+		header.filetime = filetime;
+		bRetimed = true;
+	}
+
+	if ( !g_quiet )
+	{
+		printf ("%s MODEL %s\n", pKind, psource->filename);
+	}
+	CreateMakefile_AddDependency( filename );
+
+	s_sourcecachereader_t reader;
+	reader.p = map.pBase + sizeof( header );
+	reader.end = reader.p + header.size;
+	reader.pFileName = cachefile;
+
+	int t = 0;
+	while ( reader.p < reader.end )
+	{
+		switch ( reader.GetInt() )
+		{
+		case SOURCECACHE_NODES:
+			{
+				int numbones = reader.GetInt();
+				if ( numbones < 0 || numbones > MAXSTUDIOSRCBONES )
+				{
+					MdlError( "%s: source cache is corrupt, delete it\n", cachefile );
+				}
+				for ( int i = 0; i < MAXSTUDIOSRCBONES; i++ )
+				{
+					psource->localBone[i].parent = -1;
+				}
+				memcpy( psource->localBone, reader.Get( numbones * sizeof( s_node_t ) ), numbones * sizeof( s_node_t ) );
+				psource->numbones = numbones;
+			}
+			break;
+
+		case SOURCECACHE_ANIMATION:
+			psource->startframe = -1;
+			break;
+
+		case SOURCECACHE_FRAME:
+			t = Animation_StartFrame( psource, reader.GetInt() );
+			break;
+
+		case SOURCECACHE_KEY:
+			{
+				int index = reader.GetInt();
+				Vector pos;
+				RadianEuler rot;
+				reader.GetValue( pos );
+				reader.GetValue( rot );
+				Animation_SetKey( psource, t, index, pos, rot );
+			}
+			break;
+
+		case SOURCECACHE_ANIMATION_END:
+			Animation_End( psource );
+			break;
+
+		case SOURCECACHE_TRIANGLES:
+			StartTriangles();
+			break;
+
+		case SOURCECACHE_TRIANGLE:
+			{
+				char texturename[64];
+				memcpy( texturename, reader.Get( sizeof( texturename ) ), sizeof( texturename ) );
+				texturename[sizeof( texturename ) - 1] = '\0';
+
+				s_smdvertex_t verts[3];
+				for ( int i = 0; i < 3; i++ )
+				{
+					s_smdvertex_t &v = verts[i];
+					v.bone = reader.GetInt();
+					reader.GetValue( v.pos );
+					reader.GetValue( v.normal );
+					reader.GetValue( v.texcoord );
+					v.numweights = reader.GetInt();
+					int nStored = min( v.numweights, MAXSTUDIOSRCBONES );
+					if ( nStored < 0 )
+					{
+						MdlError( "%s: source cache is corrupt, delete it\n", cachefile );
+					}
+					memcpy( v.bones, reader.Get( nStored * sizeof( int ) ), nStored * sizeof( int ) );
+					memcpy( v.weights, reader.Get( nStored * sizeof( float ) ), nStored * sizeof( float ) );
+				}
+
+				static const bool valid[3] = { true, true, true };
+				if ( RenameTriangleTexture( texturename ) )
+				{
+					AddTriangle( psource, texturename, verts, valid );
+				}
+			}
+			break;
+
+		case SOURCECACHE_TRIANGLES_END:
+			BuildIndividualMeshes( psource );
+			break;
+
+		case SOURCECACHE_VERTEXANIM:
+			{
+				int frame = reader.GetInt();
+				int count = reader.GetInt();
+				if ( frame < 0 || frame >= MAXSTUDIOANIMFRAMES || count < 0 )
+				{
+					MdlError( "%s: source cache is corrupt, delete it\n", cachefile );
+				}
+				psource->numvanims[frame] = count;
+				if ( count )
+				{
+					psource->vanim[frame] = (s_vertanim_t *)kalloc( count, sizeof( s_vertanim_t ) );
+					memcpy( psource->vanim[frame], reader.Get( count * sizeof( s_vertanim_t ) ), count * sizeof( s_vertanim_t ) );
+				}
+			}
+			break;
+
+		case SOURCECACHE_VERTEXANIM_END:
+			psource->numvertices = reader.GetInt();
+			psource->numframes = psource->endframe - psource->startframe + 1;
+			break;
+
+		default:
+			MdlError( "%s: source cache is corrupt, delete it\n", cachefile );
+		}
+	}
+
+	UnmapFile( map );
+
+	if ( bRetimed )
+	{
+		FILE *fp = fopen( cachefile, "r+b" );
+		if ( fp )
+		{
+			fwrite( &header, sizeof( header ), 1, fp );
+			fclose( fp );
 		}
 	}
-	fclose( g_fpInput );
 
 	is_v1support = true;
 
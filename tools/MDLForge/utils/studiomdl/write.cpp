@@ -1305,6 +1305,77 @@ static void WriteTextures( studiohdr_t *phdr )
 	ALIGN4( pData );
 }
 
+//-----------------------------------------------------------------------------
+// Output files
+//
+// The .vvd and .vtx images stay in memory until the sorted lod fixup and root
+// lod clamp have run on them, then each is written to disk once.
+//-----------------------------------------------------------------------------
+
+struct s_outputfile_t
+{
+	char	fileName[MAX_PATH];
+	void	*pData;				// malloc'd, owned by the list
+	int		length;
+};
+
+static CUtlVector< s_outputfile_t > g_outputfiles;
+
+static s_outputfile_t *FindOutputFile( const char *pFileName )
+{
+	for (int i = 0; i < g_outputfiles.Count(); i++)
+	{
+		if (!Q_stricmp( g_outputfiles[i].fileName, pFileName ))
+			return &g_outputfiles[i];
+	}
+	return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Hands a finished file image to the output list, replacing any earlier
+// image of the same file.  pData must come from malloc.
+//-----------------------------------------------------------------------------
+void AddOutputFile( const char *pFileName, void *pData, int length )
+{
+	s_outputfile_t *pFile = FindOutputFile( pFileName );
+	if (!pFile)
+	{
+		pFile = &g_outputfiles[ g_outputfiles.AddToTail() ];
+		Q_strncpy( pFile->fileName, pFileName, sizeof( pFile->fileName ) );
+	}
+	else
+	{
+		free( pFile->pData );
+	}
+	pFile->pData  = pData;
+	pFile->length = length;
+}
+
+static void *GetOutputFile( const char *pFileName, int *pLength )
+{
+	s_outputfile_t *pFile = FindOutputFile( pFileName );
+	if (!pFile)
+	{
+		MdlError( "Missing output file '%s'\n", pFileName );
+	}
+	if (pLength)
+	{
+		*pLength = pFile->length;
+	}
+	return pFile->pData;
+}
+
+static void WriteOutputFiles( void )
+{
+	for (int i = 0; i < g_outputfiles.Count(); i++)
+	{
+		SaveFile( g_outputfiles[i].fileName, g_outputfiles[i].pData, g_outputfiles[i].length );
+		CompileCache_AddOutput( g_outputfiles[i].fileName );
+		free( g_outputfiles[i].pData );
+	}
+	g_outputfiles.Purge();
+}
+
 //-----------------------------------------------------------------------------
 // Write the processed vertices
 //-----------------------------------------------------------------------------
@@ -1441,7 +1512,9 @@ static void WriteVertices( studiohdr_t *phdr )
 	}
 
 	// fileHeader->length = pData - pStart;
-	SaveFile( fileName, pStart, pData - pStart );
+	void *pFileData = malloc( pData - pStart );
+	memcpy( pFileData, pStart, pData - pStart );
+	AddOutputFile( fileName, pFileData, pData - pStart );
 }
 
 static void WriteModel( studiohdr_t *phdr )
@@ -1896,6 +1969,9 @@ void LoadMaterials( studiohdr_t *phdr )
         }
 	int					i, j;
 
+	// which .vmt files it opens is up to the material system
+	CompileCache_Untracked( "the material system" );
+
 	// get index of each material
 	if( phdr->textureindex != 0 )
 	{
@@ -1995,9 +2071,18 @@ void EnsureFileDirectoryExists( const char *pFilename )
 }
 
 
+static void WriteMDLFile( const char *pFileName, studiohdr_t *phdr )
+{
+	FileHandle_t modelouthandle = SafeOpenWrite( (char *)pFileName );
+	SafeWrite( modelouthandle, phdr, phdr->length );
+	g_pFileSystem->Close( modelouthandle );
+	CompileCache_AddOutput( pFileName );
+}
+
+static void FreeVertexFileHeader( void );
+
 void WriteModelFiles(void)
 {
-	FileHandle_t modelouthandle = 0;
 	FileHandle_t blockouthandle = 0;
 	int			total = 0;
 	int			i;
@@ -2005,6 +2090,16 @@ void WriteModelFiles(void)
 	studiohdr_t *phdr;
 	studiohdr_t *pblockhdr;
 
+	// studiomdl -server writes many models from one process
+	FreeVertexFileHeader();
+	totalframes = 0;
+	totalseconds = 0;
+	rawanimbytes = 0;
+	animboneframes = 0;
+	memset( numAxis, 0, sizeof( numAxis ) );
+	memset( numPos, 0, sizeof( numPos ) );
+	useRaw = 0;
+
 	pStart = (byte *)kalloc( 1, FILEBUFFER );
 
 	pBlockData = NULL;
@@ -2028,7 +2123,10 @@ void WriteModelFiles(void)
 		EnsureFileDirectoryExists( filename );
 
 		if (!g_bVerifyOnly)
+		{
 			blockouthandle = SafeOpenWrite( filename );
+			CompileCache_AddOutput( filename );
+		}
 
 		pBlockStart = (byte *)kalloc( 1, FILEBUFFER );
 		pBlockData = pBlockStart;
@@ -2073,9 +2171,6 @@ void WriteModelFiles(void)
 		printf ("writing %s:\n", filename);
 	}
 
-	if (!g_bVerifyOnly)
-		modelouthandle = SafeOpenWrite (filename);
-
 	phdr->eyeposition = eyeposition;
 	phdr->illumposition = illumposition;
 
@@ -2117,7 +2212,9 @@ void WriteModelFiles(void)
 	}
 	total = pData - pStart;
 
+	Timings_Begin( "WriteAnimations" );
 	pData = WriteAnimations( pData, pStart, 0, phdr, NULL );
+	Timings_End();
 	if( !g_quiet )
 	{
 			printf("animations %7td bytes (%d anims) (%d frames) [%d:%02d]\n", pData - pStart - total, g_numani, totalframes, (int)totalseconds / 60, (int)totalseconds % 60 );
@@ -2191,10 +2288,6 @@ void WriteModelFiles(void)
 	InitMaterialSystem( materialDir );
 	LoadMaterials( phdr );
 
-	SafeWrite( modelouthandle, pStart, phdr->length );
-
-	g_pFileSystem->Close(modelouthandle);
-
 	if (pBlockStart)
 	{
 		pblockhdr->length = pBlockData - pBlockStart;
@@ -2212,12 +2305,17 @@ void WriteModelFiles(void)
 	}
 
 	if (phdr->numbodyparts == 0)
+	{
+		WriteMDLFile( filename, phdr );
 		return;
+	}
 
 	// vertices have become an external peer data store
 	// write now prior to impending vertex access from any further code
 	// vertex accessors hide shifting vertex data
+	Timings_Begin( "WriteVertices" );
 	WriteVertices( phdr );
+	Timings_End();
 
 #ifdef _DEBUG
 	int bodyPartID;
@@ -2239,20 +2337,31 @@ void WriteModelFiles(void)
 	}
 #endif
 
+	Timings_Begin( "WriteOptimizedFiles" );
 	OptimizedModel::WriteOptimizedFiles( phdr, g_bodypart );
+	Timings_End();
 
-	// now have external finalized vtx (windings) and vvd (vertexes)
-	// re-open files, sort vertexes, perform fixups, and rewrite
+	// now have finalized vtx (windings) and vvd (vertexes) in memory
+	// sort vertexes, perform fixups, then write everything out once
 	// purposely isolated as a post process for stability
+	Timings_Begin( "FixupToSortedLODVertexes" );
 	if (!FixupToSortedLODVertexes( phdr ))
 	{
 		MdlError("Aborted vertex sort fixup on '%s':\n", filename);
 	}
+	Timings_End();
 
+	Timings_Begin( "Clamp_RootLOD" );
 	if (!Clamp_RootLOD( phdr ))
 	{
 		MdlError("Aborted root lod shift '%s':\n", filename);
 	}
+	Timings_End();
+
+	Timings_Begin( "WriteOutputFiles" );
+	WriteMDLFile( filename, phdr );
+	WriteOutputFiles();
+	Timings_End();
 
 	if ( g_bPerf )
 	{
@@ -2260,18 +2369,23 @@ void WriteModelFiles(void)
 	}
 }
 
-const mstudio_modelvertexdata_t *mstudiomodel_t::GetVertexData()
+// persists for the model being written, see FreeVertexFileHeader()
+static vertexFileHeader_t	*s_pVertexHdr;
+static int					s_nVertexHdrSize;
+
+// lets a worker thread read its own copy of the vertex file
+static thread_local vertexFileHeader_t *s_pThreadVertexHdr;
+
+static vertexFileHeader_t *LoadVertexFileHeader( void )
 {
-	static vertexFileHeader_t	*pVertexHdr;
 	char						filename[260];
 
-	if (pVertexHdr)
+	if (s_pVertexHdr)
 	{
-		// studiomdl is a single model process, can simply persist data in static
-		goto hasData;
+		return s_pVertexHdr;
 	}
 
-	// load and persist the vertex file
+	// persist the vertex file
 	strcpy( filename, gamedir );
 //	if( *g_pPlatformName )
 //	{
@@ -2284,21 +2398,56 @@ const mstudio_modelvertexdata_t *mstudiomodel_t::GetVertexData()
 	Q_StripExtension( filename, filename, sizeof( filename ) );
 	strcat( filename, ".vvd" );
 
-	LoadFile(filename, (void**)&pVertexHdr);
+	// private copy, the optimizer edits bone weights in place
+	void *pFileData = GetOutputFile( filename, &s_nVertexHdrSize );
+	s_pVertexHdr = (vertexFileHeader_t *)malloc( s_nVertexHdrSize );
+	memcpy( s_pVertexHdr, pFileData, s_nVertexHdrSize );
 
 	// check id
-	if (pVertexHdr->id != MODEL_VERTEX_FILE_ID)
+	if (s_pVertexHdr->id != MODEL_VERTEX_FILE_ID)
 	{
-		MdlError("Error Vertex File: '%s' (id %d should be %d)\n", filename, pVertexHdr->id, MODEL_VERTEX_FILE_ID);
+		MdlError("Error Vertex File: '%s' (id %d should be %d)\n", filename, s_pVertexHdr->id, MODEL_VERTEX_FILE_ID);
 	}
 
 	// check version
-	if (pVertexHdr->version != MODEL_VERTEX_FILE_VERSION)
+	if (s_pVertexHdr->version != MODEL_VERTEX_FILE_VERSION)
 	{
-		MdlError("Error Vertex File: '%s' (version %d should be %d)\n", filename, pVertexHdr->version, MODEL_VERTEX_FILE_VERSION);
+		MdlError("Error Vertex File: '%s' (version %d should be %d)\n", filename, s_pVertexHdr->version, MODEL_VERTEX_FILE_VERSION);
 	}
 
-hasData:
+	return s_pVertexHdr;
+}
+
+static void FreeVertexFileHeader( void )
+{
+	free( s_pVertexHdr );
+	s_pVertexHdr = NULL;
+	s_nVertexHdrSize = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Returns a private copy of the vertex file; free it with free()
+//-----------------------------------------------------------------------------
+vertexFileHeader_t *CopyVertexFileHeader( void )
+{
+	vertexFileHeader_t *pVertexHdr = LoadVertexFileHeader();
+	vertexFileHeader_t *pCopy = (vertexFileHeader_t *)malloc( s_nVertexHdrSize );
+	memcpy( pCopy, pVertexHdr, s_nVertexHdrSize );
+	return pCopy;
+}
+
+//-----------------------------------------------------------------------------
+// Points GetVertexData on the calling thread at pVertexHdr, NULL to restore
+//-----------------------------------------------------------------------------
+void SetThreadVertexFileHeader( vertexFileHeader_t *pVertexHdr )
+{
+	s_pThreadVertexHdr = pVertexHdr;
+}
+
+const mstudio_modelvertexdata_t *mstudiomodel_t::GetVertexData()
+{
+	vertexFileHeader_t *pVertexHdr = s_pThreadVertexHdr ? s_pThreadVertexHdr : LoadVertexFileHeader();
+
 	vertexdata.pVertexData  = (byte *)pVertexHdr + pVertexHdr->vertexDataStart;
 	vertexdata.pTangentData = (byte *)pVertexHdr + pVertexHdr->tangentDataStart;
 
@@ -2745,7 +2894,7 @@ bool FixupVVDFile(const char *fileName,  const studiohdr_t *pStudioHdr, const vo
 
 	pVtxHdr = (OptimizedModel::FileHeader_t*)pVtxBuff; 
 
-	LoadFile((char*)fileName, &pVvdBuff);
+	pVvdBuff = GetOutputFile( fileName, NULL );
 
 	pFileHdr_old = (vertexFileHeader_t*)pVvdBuff;
 	if (pFileHdr_old->numLODs != 1)
@@ -2934,7 +3083,9 @@ bool FixupVVDFile(const char *fileName,  const studiohdr_t *pStudioHdr, const vo
 	}
 
 	// pFileHdr_new->length =  pData_new-pStart_new;
-	SaveFile((char*)fileName, pStart_new, pData_new-pStart_new);
+	void *pFileData = malloc(pData_new-pStart_new);
+	memcpy(pFileData, pStart_new, pData_new-pStart_new);
+	AddOutputFile(fileName, pFileData, pData_new-pStart_new);
 
 	free(pStart_base);
 	free(pFlatVertexes);
@@ -2968,7 +3119,7 @@ bool FixupVTXFile(const char *fileName, const studiohdr_t *pStudioHdr, const ver
 	int									newMeshVertID;
 	void								*pVtxBuff;
 
-	VtxLen  = LoadFile((char*)fileName, &pVtxBuff);
+	pVtxBuff = GetOutputFile( fileName, &VtxLen );
 	pVtxHdr = (OptimizedModel::FileHeader_t*)pVtxBuff; 
 
 	// iterate all lod's windings
@@ -3024,11 +3175,7 @@ bool FixupVTXFile(const char *fileName, const studiohdr_t *pStudioHdr, const ver
 		}
 	}
 
-	// pVtxHdr->length = VtxLen;
-	SaveFile((char*)fileName, pVtxBuff, VtxLen);
-
-	free(pVtxBuff);
-
+	// remapped in place
 	return true;
 }
 
@@ -3120,8 +3267,6 @@ bool FixupMDLFile(const char *fileName, studiohdr_t *pStudioHdr, const void *pVt
 		}
 	}
 
-	SaveFile((char*)fileName, (void*)pStudioHdr, pStudioHdr->length);
-
 	// success
 	return true;
 }
@@ -3169,7 +3314,7 @@ bool FixupToSortedLODVertexes(studiohdr_t *pStudioHdr)
 		// must use the target we are building for
 		strcat( tmpFileName, ".xbox.vtx" );
 	}
-	VtxLen = LoadFile( tmpFileName, &pVtxBuff );
+	pVtxBuff = GetOutputFile( tmpFileName, &VtxLen );
 
 	// build the sorted vertex tables
 	if (!BuildSortedVertexList(pStudioHdr, pVtxBuff, &pVertexPools, &numVertexPools, &pVertexList, &numVertexes))
@@ -3218,7 +3363,6 @@ bool FixupToSortedLODVertexes(studiohdr_t *pStudioHdr)
 	}
 	if (numVertexPools)
 		free(pVertexPools);
-	free(pVtxBuff);
 
 	// success
 	return true;
@@ -3272,13 +3416,8 @@ unsigned short IsUShort( int val )
 }
 
 
-bool Clamp_MDL_LODS( const char *fileName, int rootLOD )
+bool Clamp_MDL_LODS( studiohdr_t *pStudioHdr, int rootLOD )
 {
-	studiohdr_t *pStudioHdr;
-	int			len;
-
-	len  = LoadFile((char*)fileName, (void **)&pStudioHdr);
-
 	Studio_SetRootLOD( pStudioHdr, rootLOD );
 
 #if 0
@@ -3305,8 +3444,6 @@ bool Clamp_MDL_LODS( const char *fileName, int rootLOD )
 	}
 #endif
 
-	SaveFile( (char *)fileName, pStudioHdr, len );
-
 	return true;
 }
 
@@ -3318,7 +3455,7 @@ bool Clamp_VVD_LODS( const char *fileName, int rootLOD )
 	vertexFileHeader_t *pTempVvdHdr;
 	int			len;
 
-	len  = LoadFile((char*)fileName, (void **)&pTempVvdHdr);
+	pTempVvdHdr = (vertexFileHeader_t *)GetOutputFile( fileName, &len );
 
 	int newLength = Studio_VertexDataSize( pTempVvdHdr, rootLOD, true );
 
@@ -3337,7 +3474,7 @@ bool Clamp_VVD_LODS( const char *fileName, int rootLOD )
 
 	// pNewVvdHdr->length = newLength;
 
-	SaveFile( (char *)fileName, pNewVvdHdr, newLength );
+	AddOutputFile( fileName, pNewVvdHdr, newLength );
 
 	return true;
 }
@@ -3352,7 +3489,7 @@ bool Clamp_VTX_LODS( const char *fileName, int rootLOD, studiohdr_t *pStudioHdr
 	OptimizedModel::FileHeader_t *pVtxHdr;
 	int			len;
 
-	len  = LoadFile((char*)fileName, (void **)&pVtxHdr);
+	pVtxHdr = (OptimizedModel::FileHeader_t *)GetOutputFile( fileName, &len );
 
 	OptimizedModel::FileHeader_t *pNewVtxHdr = (OptimizedModel::FileHeader_t *)calloc( FILEBUFFER, 1 );
 
@@ -3566,9 +3703,7 @@ bool Clamp_VTX_LODS( const char *fileName, int rootLOD, studiohdr_t *pStudioHdr
 		printf ("writing %s:\n", fileName);
 		printf( "everything (%d bytes)\n", newLen );
 	}
-	SaveFile( (char *)fileName, pNewVtxHdr, newLen );
-
-	free( pNewVtxHdr );
+	AddOutputFile( fileName, realloc( pNewVtxHdr, newLen ), newLen );
 
 	return true;
 }
@@ -3601,10 +3736,6 @@ bool Clamp_RootLOD( studiohdr_t *phdr )
 	Q_StripExtension( filename, filename, sizeof( filename ) );
 
 	// shift the files so that g_minLod is the root LOD
-	strcpy( tmpFileName, filename );
-	strcat( tmpFileName, ".mdl" );
-	Clamp_MDL_LODS( tmpFileName, rootLOD );
-
 	strcpy( tmpFileName, filename );
 	strcat( tmpFileName, ".vvd" );
 	Clamp_VVD_LODS( tmpFileName, rootLOD );
@@ -3617,6 +3748,9 @@ bool Clamp_RootLOD( studiohdr_t *phdr )
 		Clamp_VTX_LODS( tmpFileName, rootLOD, phdr );
 	}
 
+	// the mdl is clamped in place, after the vtx clamp is done reading its lods
+	Clamp_MDL_LODS( phdr, rootLOD );
+
 	return true;
 }
 